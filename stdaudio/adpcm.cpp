@@ -0,0 +1,305 @@
+#include "adpcm.h"
+#include "simd.h"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// The predictor and step are tracked in 16-bit sample units.  Each code moves the predictor by (2m + 1) / 8 of the
+// step, with m the low three bits and the top bit the sign, then scales the step by 230/256 for small codes up to
+// 613/256 for the largest.  The factor is max(230, 102m - 101), which needs no table, so the SSE decoder can
+// adapt four units at once without gathers.  Everything is float, and the encoder runs the same operations in the
+// same order, so it always knows exactly what the decoder will produce.
+static const float adpcm_min_step = 127.0f;
+static const float adpcm_max_step = 24576.0f;
+
+static void AdpcmStep(float& predictor, float& step, unsigned int code)
+{
+	float m = static_cast<float>(code & 7);
+	float diff = (m + m + 1.0f) * step * 0.125f;
+	if (code & 8)
+		diff = -diff;
+	predictor = std::min(std::max(predictor + diff, -32768.0f), 32767.0f);
+	float factor = std::max(230.0f, m * 102.0f - 101.0f);
+	step = std::min(std::max(step * factor * (1.0f / 256.0f), adpcm_min_step), adpcm_max_step);
+}
+
+static int16_t ReadInt16(const std::byte* data)
+{
+	int16_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static uint16_t ReadUInt16(const std::byte* data)
+{
+	uint16_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static uint32_t ReadUInt32(const std::byte* data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+#if STDAUDIO_SSE2
+// Decodes four units side by side.  output holds a row of four lanes per frame, one extra row absorbing the
+// padding code at the end of each unit.
+static void DecodeUnits4(const std::byte* const units[4], float (*output)[4])
+{
+	__m128 predictor = _mm_cvtepi32_ps(_mm_setr_epi32(ReadInt16(units[0]), ReadInt16(units[1]), ReadInt16(units[2]), ReadInt16(units[3])));
+	__m128 step = _mm_cvtepi32_ps(_mm_setr_epi32(ReadUInt16(units[0] + 2), ReadUInt16(units[1] + 2), ReadUInt16(units[2] + 2), ReadUInt16(units[3] + 2)));
+	const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 eighth = _mm_set1_ps(0.125f);
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	const __m128 min_sample = _mm_set1_ps(-32768.0f);
+	const __m128 max_sample = _mm_set1_ps(32767.0f);
+	const __m128 factor_floor = _mm_set1_ps(230.0f);
+	const __m128 factor_slope = _mm_set1_ps(102.0f);
+	const __m128 factor_offset = _mm_set1_ps(101.0f);
+	const __m128 step_scale = _mm_set1_ps(1.0f / 256.0f);
+	const __m128 min_step = _mm_set1_ps(adpcm_min_step);
+	const __m128 max_step = _mm_set1_ps(adpcm_max_step);
+	const __m128i magnitude_mask = _mm_set1_epi32(7);
+	const __m128i sign_bit = _mm_set1_epi32(8);
+
+	_mm_storeu_ps(output[0], _mm_mul_ps(predictor, scale));
+	for (size_t word = 0; word < std::experimental::audio::adpcm_block_frames / 8; word++)
+	{
+		const size_t offset = 4 + word * 4;
+		__m128i codes = _mm_setr_epi32(ReadUInt32(units[0] + offset), ReadUInt32(units[1] + offset), ReadUInt32(units[2] + offset), ReadUInt32(units[3] + offset));
+		for (int nibble = 0; nibble < 8; nibble++)
+		{
+			__m128i code = _mm_srl_epi32(codes, _mm_cvtsi32_si128(nibble * 4));
+			__m128 m = _mm_cvtepi32_ps(_mm_and_si128(code, magnitude_mask));
+			__m128 negative = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(code, sign_bit), sign_bit));
+
+			__m128 diff = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_add_ps(m, m), one), step), eighth);
+			diff = _mm_xor_ps(diff, _mm_and_ps(negative, sign));
+			predictor = _mm_min_ps(_mm_max_ps(_mm_add_ps(predictor, diff), min_sample), max_sample);
+
+			__m128 factor = _mm_max_ps(factor_floor, _mm_sub_ps(_mm_mul_ps(m, factor_slope), factor_offset));
+			step = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_mul_ps(step, factor), step_scale), min_step), max_step);
+
+			_mm_storeu_ps(output[1 + word * 8 + nibble], _mm_mul_ps(predictor, scale));
+		}
+	}
+}
+#else
+// Decodes one unit into output[frame * stride].
+static void DecodeUnit(const std::byte* unit, float* output, size_t stride)
+{
+	float predictor = ReadInt16(unit);
+	float step = ReadUInt16(unit + 2);
+	const std::byte* codes = unit + 4;
+	output[0] = predictor / 32768.0f;
+	for (size_t i = 1; i < std::experimental::audio::adpcm_block_frames; i++)
+	{
+		unsigned int code = (static_cast<unsigned int>(codes[(i - 1) / 2]) >> (((i - 1) & 1) * 4)) & 15;
+		AdpcmStep(predictor, step, code);
+		output[i * stride] = predictor / 32768.0f;
+	}
+}
+#endif
+
+size_t std::experimental::audio::adpcm_block_size(unsigned int num_channels)
+{
+	return adpcm_unit_size * num_channels;
+}
+
+size_t std::experimental::audio::adpcm_encoded_size(size_t num_frames, unsigned int num_channels)
+{
+	size_t num_blocks = (num_frames + adpcm_block_frames - 1) / adpcm_block_frames;
+	return sizeof(adpcm_header) + num_blocks * adpcm_block_size(num_channels);
+}
+
+size_t std::experimental::audio::adpcm_num_frames(const memory_buffer& data, unsigned int num_channels)
+{
+	if (data.data == nullptr || data.size < sizeof(adpcm_header) || num_channels == 0)
+		return 0;
+
+	adpcm_header header;
+	memcpy(&header, data.data, sizeof(header));
+	if (memcmp(header.magic, adpcm_magic, sizeof(adpcm_magic)) != 0 || data.size < adpcm_encoded_size(header.num_frames, num_channels))
+		return 0;
+	return header.num_frames;
+}
+
+void std::experimental::audio::adpcm_encode(const float* input, size_t num_frames, unsigned int num_channels, std::byte* output)
+{
+	if (num_frames > std::numeric_limits<uint32_t>::max())
+		throw std::invalid_argument("ADPCM data is limited to 2^32 frames");
+
+	adpcm_header header = {};
+	memcpy(header.magic, adpcm_magic, sizeof(adpcm_magic));
+	header.num_frames = static_cast<uint32_t>(num_frames);
+	memcpy(output, &header, sizeof(header));
+
+	// Each channel's step carries over from one block to the next, rounded to what the header can hold.
+	std::vector<float> steps(num_channels, adpcm_min_step);
+	std::byte* unit = output + sizeof(header);
+	for (size_t block_start = 0; block_start < num_frames; block_start += adpcm_block_frames)
+	{
+		const size_t block_length = std::min(adpcm_block_frames, num_frames - block_start);
+		for (unsigned int channel = 0; channel < num_channels; channel++, unit += adpcm_unit_size)
+		{
+			// Frames past the end encode silence.
+			float target[adpcm_block_frames] = {};
+			for (size_t i = 0; i < block_length; i++)
+				target[i] = input[(block_start + i) * num_channels + channel] * 32768.0f;
+
+			int16_t first = static_cast<int16_t>(std::lrint(std::min(std::max(target[0], -32768.0f), 32767.0f)));
+			uint16_t first_step = static_cast<uint16_t>(std::lrint(std::min(std::max(steps[channel], adpcm_min_step), adpcm_max_step)));
+			memcpy(unit, &first, sizeof(first));
+			memcpy(unit + 2, &first_step, sizeof(first_step));
+			memset(unit + 4, 0, adpcm_block_frames / 2);
+
+			// Picks whichever code lands closest.  The search is only 16 steps, and encoding is an offline job.
+			float predictor = first;
+			float step = first_step;
+			for (size_t i = 1; i < adpcm_block_frames; i++)
+			{
+				unsigned int best_code = 0;
+				float best_error = std::numeric_limits<float>::infinity();
+				for (unsigned int code = 0; code < 16; code++)
+				{
+					float candidate = predictor;
+					float candidate_step = step;
+					AdpcmStep(candidate, candidate_step, code);
+					float error = std::abs(candidate - target[i]);
+					if (error < best_error)
+					{
+						best_error = error;
+						best_code = code;
+					}
+				}
+				AdpcmStep(predictor, step, best_code);
+				unit[4 + (i - 1) / 2] |= static_cast<std::byte>(best_code << (((i - 1) & 1) * 4));
+			}
+			steps[channel] = step;
+		}
+	}
+}
+
+void std::experimental::audio::adpcm_decode(const std::byte* blocks, size_t num_blocks, unsigned int num_channels, float* output)
+{
+	// Units are numbered block by block, so unit u is channel u % num_channels of block u / num_channels.
+	const size_t num_units = num_blocks * num_channels;
+#if STDAUDIO_SSE2
+	// A short final group repeats its last unit in the spare lanes rather than falling back to scalar code, since
+	// a single mono or stereo block is the common case when streaming.
+	float lanes[adpcm_block_frames + 1][4];
+	for (size_t u = 0; u < num_units; u += 4)
+	{
+		const std::byte* units[4];
+		for (size_t lane = 0; lane < 4; lane++)
+			units[lane] = blocks + std::min(u + lane, num_units - 1) * adpcm_unit_size;
+		DecodeUnits4(units, lanes);
+
+		for (size_t lane = 0; lane < 4 && u + lane < num_units; lane++)
+		{
+			size_t block = (u + lane) / num_channels;
+			size_t channel = (u + lane) % num_channels;
+			float* destination = output + block * adpcm_block_frames * num_channels + channel;
+			for (size_t i = 0; i < adpcm_block_frames; i++)
+				destination[i * num_channels] = lanes[i][lane];
+		}
+	}
+#else
+	for (size_t u = 0; u < num_units; u++)
+	{
+		size_t block = u / num_channels;
+		size_t channel = u % num_channels;
+		DecodeUnit(blocks + u * adpcm_unit_size, output + block * adpcm_block_frames * num_channels + channel, num_channels);
+	}
+#endif
+}
+
+std::experimental::audio::adpcm_decoder::adpcm_decoder(const memory_buffer_data& data) :
+	m_blocks(data.data.data + sizeof(adpcm_header)),
+	m_length(adpcm_num_frames(data.data, data.description.num_channels)),
+	m_num_channels(data.description.num_channels),
+	m_current_block(std::numeric_limits<size_t>::max()),
+	m_block((adpcm_block_frames + 1) * data.description.num_channels)
+{
+	if (data.description.format != memory_buffer_format::adpcm || m_length == 0)
+		throw std::invalid_argument("Not valid ADPCM data");
+}
+
+unsigned int std::experimental::audio::adpcm_decoder::get_num_channels() const
+{
+	return m_num_channels;
+}
+
+size_t std::experimental::audio::adpcm_decoder::get_length() const
+{
+	return m_length;
+}
+
+size_t std::experimental::audio::adpcm_decoder::get_position() const
+{
+	return m_position;
+}
+
+void std::experimental::audio::adpcm_decoder::seek(size_t frame)
+{
+	m_position = std::min(frame, m_length);
+}
+
+size_t std::experimental::audio::adpcm_decoder::read(float* output, size_t num_frames)
+{
+	size_t count = std::min(num_frames, m_length - m_position);
+	size_t done = 0;
+	while (done < count)
+	{
+		size_t block = m_position / adpcm_block_frames;
+		size_t offset = m_position % adpcm_block_frames;
+		size_t length = std::min(count - done, adpcm_block_frames - offset);
+		size_t whole_blocks = (count - done) / adpcm_block_frames;
+		if (offset == 0 && whole_blocks > 0 && block != m_current_block)
+		{
+			// Runs of whole blocks skip the cache and decode together, which keeps all four SSE lanes busy.
+			length = whole_blocks * adpcm_block_frames;
+			adpcm_decode(m_blocks + block * adpcm_block_size(m_num_channels), whole_blocks, m_num_channels, output + done * m_num_channels);
+		}
+		else
+		{
+			decode_block(block);
+			std::copy_n(m_block.data() + offset * m_num_channels, length * m_num_channels, output + done * m_num_channels);
+		}
+		done += length;
+		m_position += length;
+	}
+	return count;
+}
+
+const float* std::experimental::audio::adpcm_decoder::get_frames(size_t frame)
+{
+	decode_block(frame / adpcm_block_frames);
+	return m_block.data() + (frame % adpcm_block_frames) * m_num_channels;
+}
+
+void std::experimental::audio::adpcm_decoder::decode_block(size_t block)
+{
+	if (block == m_current_block)
+		return;
+
+	adpcm_decode(m_blocks + block * adpcm_block_size(m_num_channels), 1, m_num_channels, m_block.data());
+
+	// The next block's first frame is stored as is, so it comes straight from the unit headers.
+	float* next = m_block.data() + adpcm_block_frames * m_num_channels;
+	if ((block + 1) * adpcm_block_frames < m_length)
+	{
+		const std::byte* units = m_blocks + (block + 1) * adpcm_block_size(m_num_channels);
+		for (unsigned int channel = 0; channel < m_num_channels; channel++)
+			next[channel] = ReadInt16(units + channel * adpcm_unit_size) / 32768.0f;
+	}
+	else
+	{
+		std::fill_n(next, m_num_channels, 0.0f);
+	}
+	m_current_block = block;
+}
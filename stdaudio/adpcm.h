@@ -0,0 +1,71 @@
+#pragma once
+
+#include "audio.h"
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			// Layout of memory_buffer_format::adpcm data: an adpcm_header, then blocks of adpcm_block_frames frames.
+			// A block holds one unit per channel, and each unit is a 16-bit first sample, a 16-bit starting step and
+			// a 4-bit code for each of the remaining samples.  Units decode independently, so the decoder runs four
+			// of them at once in SSE lanes, and seeking only has to decode from the start of a block.
+			constexpr char adpcm_magic[4] = { 'S', 'A', 'D', 'P' };
+			constexpr size_t adpcm_block_frames = 256;
+			constexpr size_t adpcm_unit_size = 4 + adpcm_block_frames / 2;
+
+			struct adpcm_header
+			{
+				char magic[4];
+				uint32_t num_frames;
+				uint32_t reserved[2];
+			};
+
+			static_assert(sizeof(adpcm_header) == 16, "adpcm_header must match the data layout");
+
+			size_t adpcm_block_size(unsigned int num_channels);
+			size_t adpcm_encoded_size(size_t num_frames, unsigned int num_channels);
+
+			// Frame count from the header, or 0 if data isn't valid adpcm data for num_channels.
+			size_t adpcm_num_frames(const memory_buffer& data, unsigned int num_channels);
+
+			// Encodes num_frames interleaved frames into output, which holds adpcm_encoded_size bytes.
+			void adpcm_encode(const float* input, size_t num_frames, unsigned int num_channels, std::byte* output);
+
+			// Decodes whole blocks, starting just past the header, into num_blocks * adpcm_block_frames interleaved
+			// frames.
+			void adpcm_decode(const std::byte* blocks, size_t num_blocks, unsigned int num_channels, float* output);
+
+			// Sequential and random access to adpcm data that stays compressed in memory.  One block is decoded at a
+			// time, along with the first frame of the next one so that interpolation can always read a pair.
+			class adpcm_decoder
+			{
+			public:
+				explicit adpcm_decoder(const memory_buffer_data& data);
+
+				unsigned int get_num_channels() const;
+				size_t get_length() const;
+				size_t get_position() const;
+				void seek(size_t frame);
+
+				// Reads up to num_frames interleaved frames from the current position and returns the count read.
+				size_t read(float* output, size_t num_frames);
+
+				// Points at frame, followed by frame + 1 when that is within get_length().
+				const float* get_frames(size_t frame);
+
+			private:
+				void decode_block(size_t block);
+
+				const std::byte* m_blocks;
+				size_t m_length;
+				unsigned int m_num_channels;
+				size_t m_position = 0;
+				size_t m_current_block;
+				std::vector<float> m_block;
+			};
+		}
+	}
+}
@@ -1,173 +1,781 @@
 #include "audio.h"
+#include "level_meter.h"
+#include "ducking.h"
+#include "backend.h"
+#include "loopback.h"
+#include "realtime_check.h"
+#include "memory_tracking.h"
+#include "sample_format.h"
+#include "resampler.h"
+#include "channel_mix.h"
+#include "adpcm.h"
+#if STDAUDIO_FMOD
 #include "fmod/fmod.hpp"
-#include "fmod/fmod_errors.h"
+#endif
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <chrono>
+#include <iterator>
+#include <stdexcept>
 
-std::experimental::audio::device::device()
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <climits>
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#include <cerrno>
+#endif
+
+// Parks the worker threads.  Posting never blocks or takes a lock, so the mixer can wake a worker.
+class worker_semaphore
+{
+public:
+	worker_semaphore()
+	{
+#ifdef _WIN32
+		m_handle = CreateSemaphore(nullptr, 0, LONG_MAX, nullptr);
+#elif defined(__APPLE__)
+		m_handle = dispatch_semaphore_create(0);
+#else
+		sem_init(&m_handle, 0, 0);
+#endif
+	}
+
+	~worker_semaphore()
+	{
+#ifdef _WIN32
+		CloseHandle(m_handle);
+#elif defined(__APPLE__)
+		dispatch_release(m_handle);
+#else
+		sem_destroy(&m_handle);
+#endif
+	}
+
+	worker_semaphore(const worker_semaphore&) = delete;
+	worker_semaphore& operator=(const worker_semaphore&) = delete;
+
+	void post()
+	{
+#ifdef _WIN32
+		ReleaseSemaphore(m_handle, 1, nullptr);
+#elif defined(__APPLE__)
+		dispatch_semaphore_signal(m_handle);
+#else
+		sem_post(&m_handle);
+#endif
+	}
+
+	void wait()
+	{
+#ifdef _WIN32
+		WaitForSingleObject(m_handle, INFINITE);
+#elif defined(__APPLE__)
+		dispatch_semaphore_wait(m_handle, DISPATCH_TIME_FOREVER);
+#else
+		while (sem_wait(&m_handle) != 0 && errno == EINTR)
+		{
+		}
+#endif
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE m_handle;
+#elif defined(__APPLE__)
+	dispatch_semaphore_t m_handle;
+#else
+	sem_t m_handle;
+#endif
+};
+
+// Small pool of high priority threads that run effect_instance jobs queued from the mixer thread.  The mixer is the
+// only producer, so the queue is a single-producer, multi-consumer ring that never blocks the mixer.
+class std::experimental::audio::worker_pool
 {
-	FMOD_RESULT result = FMOD::System_Create(&m_system);
-	if (result != FMOD_OK)
-		throw std::exception(FMOD_ErrorString(result));
+public:
+	explicit worker_pool(unsigned int num_threads)
+	{
+		for (unsigned int i = 0; i < num_threads; i++)
+		{
+			m_threads.emplace_back([this] { worker_thread(); });
+#ifdef _WIN32
+			SetThreadPriority(m_threads.back().native_handle(), THREAD_PRIORITY_TIME_CRITICAL);
+#endif
+		}
+	}
+
+	~worker_pool()
+	{
+		m_quit.store(true);
+		for (size_t i = 0; i < m_threads.size(); i++)
+			m_wake.post();
+		for (auto& thread : m_threads)
+			thread.join();
+	}
+
+	bool submit(effect_instance* job)
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head - m_tail.load(std::memory_order_acquire) >= queue_size)
+			return false;
+
+		m_queue[head % queue_size].store(job, std::memory_order_relaxed);
+		m_head.store(head + 1, std::memory_order_seq_cst);
+
+		// Only parked workers need waking.  A post that races with a worker that found the job on its own is
+		// harmless: the worker's next wait returns straight away and it parks again.
+		if (m_parked.load(std::memory_order_seq_cst) > 0)
+			m_wake.post();
+		return true;
+	}
+
+private:
+	effect_instance* pop()
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		while (tail != m_head.load(std::memory_order_acquire))
+		{
+			// Read the slot before claiming it; the producer can't reuse it until the tail has moved past.
+			effect_instance* job = m_queue[tail % queue_size].load(std::memory_order_relaxed);
+			if (m_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel))
+				return job;
+		}
+		return nullptr;
+	}
+
+	void worker_thread()
+	{
+		int idle_spins = 0;
+		for (;;)
+		{
+			if (effect_instance* job = pop())
+			{
+				job->run_job();
+				idle_spins = 0;
+				continue;
+			}
 
-	result = m_system->init(128, FMOD_INIT_NORMAL, nullptr);
-	if (result != FMOD_OK)
-		throw std::exception(FMOD_ErrorString(result));
+			// Queued jobs are always drained before exiting so that no effect_instance is left waiting on one.
+			if (m_quit.load())
+				return;
+
+			if (++idle_spins < 1000)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			// Park until the mixer queues a job.  The count goes up before the queue is checked again, so a job
+			// submitted in between either is seen here or sees this worker parked and posts.
+			m_parked.fetch_add(1, std::memory_order_seq_cst);
+			if (!m_quit.load() && m_tail.load(std::memory_order_seq_cst) == m_head.load(std::memory_order_seq_cst))
+				m_wake.wait();
+			m_parked.fetch_sub(1, std::memory_order_relaxed);
+			idle_spins = 0;
+		}
+	}
+
+	static constexpr size_t queue_size = 256;
+	std::atomic<effect_instance*> m_queue[queue_size] = {};
+	std::atomic<size_t> m_head{ 0 };
+	std::atomic<size_t> m_tail{ 0 };
+	std::atomic<bool> m_quit{ false };
+	std::atomic<int> m_parked{ 0 };
+	worker_semaphore m_wake;
+	std::vector<std::thread> m_threads;
+};
+
+std::experimental::audio::device::device() :
+	device(device_settings{})
+{
+}
+
+std::experimental::audio::device::device(const device_settings& settings)
+{
+	for (std::pmr::memory_resource* upstream : { settings.memory.backend, settings.memory.voices, settings.memory.effects, settings.memory.buffers })
+		m_memory.push_back(std::make_unique<tracking_resource>(upstream));
+
+	std::pmr::memory_resource* backend_resource = get_memory_resource(memory_category::backend);
+	switch (settings.backend)
+	{
+	case device_backend::fmod:
+#if STDAUDIO_FMOD
+		m_backend = create_fmod_backend(settings, backend_resource);
+		break;
+#else
+		throw std::runtime_error("This build has no FMOD backend");
+#endif
+	case device_backend::software:
+		m_backend = create_software_backend(settings, backend_resource);
+		break;
+	default:
+		throw std::invalid_argument("Unknown device backend");
+	}
 }
 
 std::experimental::audio::device::~device()
 {
-	m_system->release();
+	m_backend.reset();
+	m_worker_pool.reset();
+}
+
+auto std::experimental::audio::device::get_worker_pool() -> worker_pool*
+{
+	if (!m_worker_pool)
+	{
+		unsigned int num_threads = std::thread::hardware_concurrency();
+		num_threads = std::min(4u, num_threads > 1 ? num_threads - 1 : 1u);
+		m_worker_pool = std::make_unique<worker_pool>(num_threads);
+	}
+	return m_worker_pool.get();
 }
 
 int std::experimental::audio::device::num_drivers() const
 {
-	int num_drivers = 0;
-	m_system->getNumDrivers(&num_drivers);
-	return num_drivers;
+	return m_backend->num_drivers();
 }
 
 auto std::experimental::audio::device::get_driver(int index) const -> driver_info
 {
-	FMOD_GUID fmod_guid;
-	char name[512];
-	FMOD_RESULT result = m_system->getDriverInfo(index, name, 512, &fmod_guid, nullptr, nullptr, nullptr);
-	if (result != FMOD_OK)
-		throw std::exception(FMOD_ErrorString(result));
+	return m_backend->get_driver(index);
+}
+
+void std::experimental::audio::device::set_driver(int index)
+{
+	m_backend->set_driver(index);
+}
+
+static void SynthReadCallback(void* userdata, float* output, size_t length_frames)
+{
+	std::experimental::audio::realtime_scope scope(nullptr, length_frames);
+	static_cast<std::experimental::audio::synth*>(userdata)->render(output, length_frames);
+}
+
+auto std::experimental::audio::device::play_sound(const std::shared_ptr<source>& sound, bool paused) -> std::unique_ptr<voice>
+{
+	backend_sound* sound_handle = nullptr;
+	synth* generator = dynamic_cast<synth*>(sound.get());
+	if (auto file = dynamic_cast<const stream*>(sound.get()))
+	{
+		sound_handle = m_backend->create_stream(file->get_path(), file->get_subsound());
+	}
+	else if (generator != nullptr)
+	{
+		// Two voices would render the one synth from two places at once, so only the first to claim it plays.
+		bool expected = false;
+		if (!generator->m_playing.compare_exchange_strong(expected, true))
+			throw std::runtime_error("The synth is already playing on another voice");
+
+		generator_callbacks callbacks;
+		callbacks.read = SynthReadCallback;
+		callbacks.userdata = generator;
+		callbacks.num_channels = generator->get_num_channels();
+		callbacks.frequency = generator->get_frequency();
+		try
+		{
+			sound_handle = m_backend->create_generator(callbacks);
+		}
+		catch (...)
+		{
+			generator->m_playing.store(false);
+			throw;
+		}
+	}
+	else
+	{
+		auto audio_data = sound->get_audio_data();
+		if (audio_data.data.data == nullptr)
+			return nullptr;
+		sound_handle = m_backend->create_sound(audio_data);
+	}
+
+	// Until the voice owns them, the channel, the sound and the synth's claim are released here if anything fails.
+	backend_channel* channel = nullptr;
+	try
+	{
+		channel = m_backend->play(sound_handle, paused);
+		std::pmr::memory_resource* resource = get_memory_resource(memory_category::voices);
+		std::unique_ptr<voice> return_value(new (resource) voice(this, channel, sound_handle, sound, voice::constructor_tag{}));
+		return_value->m_sequence = ++m_voice_sequence;
+		return return_value;
+	}
+	catch (...)
+	{
+		if (channel != nullptr)
+			m_backend->release(channel);
+		m_backend->release(sound_handle);
+		if (generator != nullptr)
+			generator->m_playing.store(false);
+		throw;
+	}
+}
+
+auto std::experimental::audio::device::play_sound(const std::shared_ptr<source>& sound, const loop_settings& loop, bool paused) -> std::unique_ptr<voice>
+{
+	std::optional<loop_region> region = loop.region;
+	if (!region)
+	{
+		if (auto b = dynamic_cast<const buffer*>(sound.get()))
+			region = b->get_loop_points();
+	}
+	if (region && region->start_frame >= region->end_frame)
+		throw std::invalid_argument("The loop region is empty");
 
-	name[511] = '\0';
+	// Start paused so that the loop is in place before the mixer reads anything.
+	auto return_value = play_sound(sound, true);
+	if (!return_value)
+		return nullptr;
+	m_backend->set_loop(return_value->m_channel, loop.count, region ? region->start_frame : 0, region ? region->end_frame : 0);
+	if (!paused)
+		return_value->resume();
+	return return_value;
+}
 
-	driver_info info;
-	info.name.assign(name);
-	info.guid = *reinterpret_cast<guid*>(&fmod_guid);
+void std::experimental::audio::device::update()
+{
+	m_backend->update();
 
-	return info;
+	// Voices that finished since the last update don't count any more, which may leave room for stolen ones.
+	for (submix* s : m_voice_limited)
+		s->enforce_voice_limit();
 }
 
-void std::experimental::audio::device::set_driver(int index)
+auto std::experimental::audio::device::create_return_submix(const std::string& name) -> std::unique_ptr<submix>
+{
+	if (m_returns.find(name) != m_returns.end())
+		throw std::invalid_argument("A return submix with that name already exists");
+
+	auto return_value = create_submix();
+	return_value->make_return(name);
+	m_returns[name] = return_value.get();
+	return return_value;
+}
+
+auto std::experimental::audio::device::find_return(const std::string& name) const -> submix*
 {
-	FMOD_RESULT result = m_system->setDriver(index);
-	if (result != FMOD_OK)
-		throw std::exception(FMOD_ErrorString(result));
+	auto it = m_returns.find(name);
+	return it != m_returns.end() ? it->second : nullptr;
 }
 
-static FMOD_SOUND_FORMAT ConvertSoundFormat(std::experimental::audio::memory_buffer_format format)
+static void AccumulateProfile(std::experimental::audio::profile_node& node, const std::experimental::audio::profile_counters& counters)
 {
-	switch (format)
+	node.counters.call_count += counters.call_count;
+	node.counters.total_time += counters.total_time;
+	node.counters.worst_block_time = std::max(node.counters.worst_block_time, counters.worst_block_time);
+	node.counters.missed_deadlines += counters.missed_deadlines;
+}
+
+auto std::experimental::audio::device::get_profile() const -> device_profile
+{
+	device_profile profile;
+	m_backend->get_cpu_usage(profile.dsp_cpu_usage, profile.total_cpu_usage);
+	profile.block_length = m_backend->get_block_length();
+	profile.sample_rate = m_backend->get_sample_rate();
+	profile.nodes = profile_children(m_backend->get_master_group());
+	return profile;
+}
+
+auto std::experimental::audio::device::profile_children(backend_group* group) const -> std::vector<profile_node>
+{
+	std::vector<profile_node> nodes;
+
+	size_t num_groups = m_backend->get_num_groups(group);
+	for (size_t i = 0; i < num_groups; i++)
 	{
-	case std::experimental::audio::memory_buffer_format::pcm8:
-		return FMOD_SOUND_FORMAT_PCM8;
-	case std::experimental::audio::memory_buffer_format::pcm16:
-		return FMOD_SOUND_FORMAT_PCM16;
-	case std::experimental::audio::memory_buffer_format::pcm24:
-		return FMOD_SOUND_FORMAT_PCM24;
-	case std::experimental::audio::memory_buffer_format::pcm32:
-		return FMOD_SOUND_FORMAT_PCM32;
-	case std::experimental::audio::memory_buffer_format::pcmfloat:
-		return FMOD_SOUND_FORMAT_PCMFLOAT;
-	default:
-		break;
+		backend_group* child = m_backend->get_group(group, i);
+		void* user_data = m_backend->get_user_data(child);
+		auto children = profile_children(child);
+		if (user_data == nullptr)
+		{
+			// Not one of ours; splice its contents in so nothing routed through it goes missing.
+			std::move(children.begin(), children.end(), std::back_inserter(nodes));
+			continue;
+		}
+
+		auto* mix = static_cast<const submix*>(user_data);
+		profile_node node;
+		node.object = mix;
+		for (auto& instance : mix->m_effects)
+		{
+			profile_node effect_node;
+			effect_node.object = instance.get();
+			effect_node.counters = instance->get_profile();
+			effect_node.latency_samples = mix->m_parallel ? m_backend->get_block_length() : 0;
+			AccumulateProfile(node, effect_node.counters);
+			node.latency_samples += effect_node.latency_samples;
+			node.children.push_back(std::move(effect_node));
+		}
+		size_t input_latency = 0;
+		for (auto& child_node : children)
+		{
+			AccumulateProfile(node, child_node.counters);
+			input_latency = std::max(input_latency, child_node.latency_samples);
+			node.children.push_back(std::move(child_node));
+		}
+		node.latency_samples += input_latency;
+		nodes.push_back(std::move(node));
+	}
+
+	size_t num_channels = m_backend->get_num_channels(group);
+	for (size_t i = 0; i < num_channels; i++)
+	{
+		void* user_data = m_backend->get_user_data(m_backend->get_channel(group, i));
+		if (user_data == nullptr)
+			continue;
+
+		auto* v = static_cast<const voice*>(user_data);
+		profile_node node;
+		node.object = v;
+		for (auto& instance : v->m_effects)
+		{
+			profile_node effect_node;
+			effect_node.object = instance.get();
+			effect_node.counters = instance->get_profile();
+			AccumulateProfile(node, effect_node.counters);
+			node.children.push_back(std::move(effect_node));
+		}
+		nodes.push_back(std::move(node));
 	}
-	return FMOD_SOUND_FORMAT_NONE;
+
+	return nodes;
 }
 
-auto std::experimental::audio::device::play_sound(const std::shared_ptr<source>& sound, bool paused) -> std::unique_ptr<voice>
+void std::experimental::audio::device::reset_profile()
 {
-	auto audio_data = sound->get_audio_data();
-	if (audio_data.data.data == nullptr)
-		return nullptr;
+	reset_profile(m_backend->get_master_group());
+}
 
-	FMOD_RESULT result;
-	FMOD::Sound* fmod_sound = nullptr;
-	FMOD_CREATESOUNDEXINFO ex_info = { 0 };
-	ex_info.cbsize = sizeof(FMOD_CREATESOUNDEXINFO);
-	ex_info.format = ConvertSoundFormat(audio_data.description.format);
-	ex_info.defaultfrequency = audio_data.description.frequency;
-	ex_info.numchannels = audio_data.description.num_channels;
-	ex_info.length = static_cast<unsigned int>(audio_data.data.size);
-	result = m_system->createSound(
-		reinterpret_cast<const char*>(audio_data.data.data),
-		FMOD_OPENMEMORY_POINT | FMOD_LOOP_NORMAL | FMOD_2D | FMOD_OPENRAW,
-		&ex_info,
-		&fmod_sound);
+void std::experimental::audio::device::reset_profile(backend_group* group)
+{
+	size_t num_groups = m_backend->get_num_groups(group);
+	for (size_t i = 0; i < num_groups; i++)
+	{
+		backend_group* child = m_backend->get_group(group, i);
+		void* user_data = m_backend->get_user_data(child);
+		if (user_data != nullptr)
+		{
+			for (auto& instance : static_cast<submix*>(user_data)->m_effects)
+				instance->reset_profile();
+		}
+		reset_profile(child);
+	}
 
-	fmod_sound->setLoopCount(0);
+	size_t num_channels = m_backend->get_num_channels(group);
+	for (size_t i = 0; i < num_channels; i++)
+	{
+		void* user_data = m_backend->get_user_data(m_backend->get_channel(group, i));
+		if (user_data != nullptr)
+		{
+			for (auto& instance : static_cast<voice*>(user_data)->m_effects)
+				instance->reset_profile();
+		}
+	}
+}
 
-	FMOD::Channel* fmod_channel = nullptr;
-	result = m_system->playSound(fmod_sound, nullptr, paused, &fmod_channel);
-	if (result != FMOD_OK)
-		throw std::exception(FMOD_ErrorString(result));
+auto std::experimental::audio::device::get_loopback() const -> loopback_buffer*
+{
+	loopback_buffer* loopback = m_backend->get_loopback();
+	if (loopback == nullptr)
+		throw std::runtime_error("The device has no loopback output");
+	return loopback;
+}
 
-	return make_unique<voice>(this, fmod_channel, fmod_sound, sound, voice::constructor_tag{});
+size_t std::experimental::audio::device::read_output(float* buffer, size_t num_frames)
+{
+	return get_loopback()->read(buffer, num_frames);
+}
+
+void std::experimental::audio::device::mix_output(size_t num_frames)
+{
+	get_loopback();
+	m_backend->mix_loopback(num_frames);
+}
+
+auto std::experimental::audio::device::get_output_stats() const -> loopback_stats
+{
+	return get_loopback()->get_stats();
+}
+
+int std::experimental::audio::device::get_sample_rate() const
+{
+	return m_backend->get_sample_rate();
+}
+
+void std::experimental::audio::device::set_realtime_checks(bool enabled, float budget)
+{
+	if (enabled)
+		realtime_checks::enable(m_backend->get_sample_rate(), budget);
+	else
+		realtime_checks::disable();
+}
+
+auto std::experimental::audio::device::take_realtime_violations() -> std::vector<realtime_violation>
+{
+	return realtime_checks::take_violations();
+}
+
+auto std::experimental::audio::device::get_memory_resource(memory_category category) const -> std::pmr::memory_resource*
+{
+	return m_memory[static_cast<size_t>(category)].get();
+}
+
+auto std::experimental::audio::device::get_memory_stats(memory_category category) const -> memory_stats
+{
+	memory_stats stats;
+	if (category == memory_category::backend && m_backend->get_memory_stats(stats))
+		return stats;
+	return m_memory[static_cast<size_t>(category)]->get_stats();
 }
 
 auto std::experimental::audio::device::create_submix() -> std::unique_ptr<submix>
 {
-	FMOD::ChannelGroup* fmod_channelgroup = nullptr;
-	m_system->createChannelGroup(nullptr, &fmod_channelgroup);
-	return std::make_unique<submix>(this, fmod_channelgroup, submix::constructor_tag{});
+	return std::make_unique<submix>(this, m_backend->create_group(), submix::constructor_tag{});
+}
+
+using SendList = std::vector<std::pair<const std::experimental::audio::submix*, std::experimental::audio::backend_dsp*>>;
+using SenderList = std::vector<std::pair<std::experimental::audio::backend_node*, SendList*>>;
+
+static float GetSend(const std::experimental::audio::backend& backend, const SendList& sends, const std::experimental::audio::submix& bus)
+{
+	for (auto& send : sends)
+	{
+		if (send.first == &bus)
+			return backend.get_send_level(send.second);
+	}
+	return 0.0f;
+}
+
+// Returns true if the send is new, in which case the caller registers it with the return.
+static bool SetSend(
+	std::experimental::audio::backend& backend,
+	std::experimental::audio::backend_node* node,
+	SendList& sends,
+	const std::experimental::audio::submix& bus,
+	int return_id,
+	float level)
+{
+	if (return_id < 0)
+		throw std::invalid_argument("Sends must target a return submix");
+
+	for (auto& send : sends)
+	{
+		if (send.first == &bus)
+		{
+			backend.set_send_level(send.second, level);
+			return false;
+		}
+	}
+
+	// Sends sit at the head of the chain so they pick up the signal after the fader and any effects.
+	auto* dsp = backend.create_send(return_id, level);
+	backend.add_dsp(node, dsp, std::experimental::audio::dsp_position::head);
+	sends.emplace_back(&bus, dsp);
+	return true;
+}
+
+static void RemoveSend(std::experimental::audio::backend& backend, std::experimental::audio::backend_node* node, SendList& sends, const std::experimental::audio::submix& bus)
+{
+	for (auto it = sends.begin(); it != sends.end(); ++it)
+	{
+		if (it->first == &bus)
+		{
+			backend.remove_dsp(node, it->second);
+			backend.release(it->second);
+			sends.erase(it);
+			return;
+		}
+	}
+}
+
+static void RemoveSender(SenderList& senders, const SendList* sends)
+{
+	senders.erase(std::remove_if(senders.begin(), senders.end(), [sends](const auto& sender) { return sender.second == sends; }), senders.end());
+}
+
+static void ReleaseSends(std::experimental::audio::backend& backend, std::experimental::audio::backend_node* node, SendList& sends)
+{
+	for (auto& send : sends)
+	{
+		backend.remove_dsp(node, send.second);
+		backend.release(send.second);
+	}
+	sends.clear();
+}
+
+// Effects are added at the head, so afterwards the sends and then the meter go back in front of them.  That way both
+// see the signal after every effect, whatever order things were set up in.
+static void MoveTapsToHead(std::experimental::audio::backend& backend, std::experimental::audio::backend_node* node, const SendList& sends, std::experimental::audio::backend_dsp* meter_dsp)
+{
+	for (auto& send : sends)
+		backend.move_dsp_to_head(node, send.second);
+	if (meter_dsp != nullptr)
+		backend.move_dsp_to_head(node, meter_dsp);
+}
+
+static void MeterReadCallback(void* userdata, float* buffer_in, float* buffer_out, size_t length_samples, int num_channels)
+{
+	std::experimental::audio::realtime_scope scope(nullptr, length_samples);
+	std::copy(buffer_in, buffer_in + length_samples * num_channels, buffer_out);
+	static_cast<std::experimental::audio::level_meter*>(userdata)->process(buffer_in, length_samples, num_channels);
+}
+
+static std::experimental::audio::dsp_result MeterShouldProcessCallback(void* userdata, bool inputs_idle, size_t length_samples, int num_channels)
+{
+	if (!inputs_idle)
+		return std::experimental::audio::dsp_result::process;
+
+	// Keep the meter decaying while the chain is idle without paying for a pass over silence.
+	static_cast<std::experimental::audio::level_meter*>(userdata)->process_silence(length_samples, num_channels);
+	return std::experimental::audio::dsp_result::silence;
+}
+
+static std::experimental::audio::backend_dsp* CreateCustomDSP(
+	std::experimental::audio::backend& backend,
+	decltype(std::experimental::audio::dsp_callbacks::read) read,
+	decltype(std::experimental::audio::dsp_callbacks::should_process) should_process,
+	void* userdata)
+{
+	std::experimental::audio::dsp_callbacks callbacks;
+	callbacks.read = read;
+	callbacks.should_process = should_process;
+	callbacks.userdata = userdata;
+	return backend.create_dsp(callbacks);
+}
+
+static void SetMetering(
+	std::experimental::audio::backend& backend,
+	std::experimental::audio::backend_node* node,
+	std::unique_ptr<std::experimental::audio::level_meter>& meter,
+	std::experimental::audio::backend_dsp*& meter_dsp,
+	bool enabled)
+{
+	if (enabled == (meter != nullptr))
+		return;
+
+	if (!enabled)
+	{
+		backend.remove_dsp(node, meter_dsp);
+		backend.release(meter_dsp);
+		meter_dsp = nullptr;
+		meter.reset();
+		return;
+	}
+
+	auto new_meter = std::make_unique<std::experimental::audio::level_meter>(backend.get_sample_rate());
+	meter_dsp = CreateCustomDSP(backend, MeterReadCallback, MeterShouldProcessCallback, new_meter.get());
+	meter = std::move(new_meter);
+
+	// The meter stays at the head of the chain so that it sees the signal after every effect.
+	backend.add_dsp(node, meter_dsp, std::experimental::audio::dsp_position::head);
+}
+
+static std::experimental::audio::meter_levels GetLevels(const std::unique_ptr<std::experimental::audio::level_meter>& meter)
+{
+	return meter ? meter->get_levels() : std::experimental::audio::meter_levels{ 0.0f, 0.0f, 0.0f, -std::numeric_limits<float>::infinity() };
 }
 
 std::experimental::audio::voice::voice(
 	device* dev,
-	FMOD::Channel* channel,
-	FMOD::Sound* fmod_sound,
+	backend_channel* channel,
+	backend_sound* sound_handle,
 	const std::shared_ptr<source>& sound,
 	constructor_tag) :
 	m_device(dev),
 	m_channel(channel),
-	m_sound(fmod_sound),
+	m_sound(sound_handle),
 	m_source(sound)
 {
+	m_device->m_backend->set_user_data(m_channel, this);
+}
+
+void* std::experimental::audio::voice::operator new(size_t size, std::pmr::memory_resource* resource)
+{
+	return allocate_object(resource, size);
+}
+
+void std::experimental::audio::voice::operator delete(void* p, std::pmr::memory_resource*)
+{
+	deallocate_object(p);
+}
+
+void std::experimental::audio::voice::operator delete(void* p)
+{
+	deallocate_object(p);
 }
 
 std::experimental::audio::voice::~voice()
 {
-	m_channel->stop();
-	m_sound->release();
+	if (m_submix != nullptr)
+		m_submix->detach_voice(this);
+	for (auto& send : m_sends)
+		RemoveSender(send.first->m_senders, &m_sends);
+	ReleaseSends(*m_device->m_backend, m_channel, m_sends);
+	SetMetering(*m_device->m_backend, m_channel, m_meter, m_meter_dsp, false);
+	m_device->m_backend->release(m_channel);
+	m_device->m_backend->release(m_sound);
+
+	// Released channels are never read again, so the synth is free for another voice.
+	if (auto generator = dynamic_cast<synth*>(m_source.get()))
+		generator->m_playing.store(false);
 }
 
 void std::experimental::audio::voice::stop()
 {
-	m_channel->stop();
+	m_device->m_backend->stop(m_channel);
+	if (m_submix != nullptr)
+		m_submix->enforce_voice_limit();
 }
 
 void std::experimental::audio::voice::pause()
 {
-	m_channel->setPaused(true);
+	m_device->m_backend->set_paused(m_channel, true);
 }
 
 void std::experimental::audio::voice::resume()
 {
-	m_channel->setPaused(false);
+	m_device->m_backend->set_paused(m_channel, false);
+}
+
+int std::experimental::audio::voice::get_loop_count() const
+{
+	return m_device->m_backend->get_loop_count(m_channel);
+}
+
+void std::experimental::audio::voice::set_loop_count(int count)
+{
+	m_device->m_backend->set_loop_count(m_channel, count);
 }
 
 void std::experimental::audio::voice::set_volume(float volume)
 {
-	m_channel->setVolume(volume);
+	m_device->m_backend->set_volume(m_channel, volume);
 }
 
 void std::experimental::audio::voice::set_pitch(float pitch)
 {
-	m_channel->setPitch(pitch);
+	m_device->m_backend->set_pitch(m_channel, pitch);
 }
 
 void std::experimental::audio::voice::set_pan(float pan_value)
 {
 	pan = pan_value;
-	m_channel->setPan(pan);
+	m_device->m_backend->set_pan(m_channel, pan);
 }
 
 float std::experimental::audio::voice::get_volume() const
 {
-	float volume = 0.0f;
-	m_channel->getVolume(&volume);
-	return volume;
+	return m_device->m_backend->get_volume(m_channel);
 }
 
 float std::experimental::audio::voice::get_pitch() const
 {
-	float pitch = 0.0f;
-	m_channel->getPitch(&pitch);
-	return pitch;
+	return m_device->m_backend->get_pitch(m_channel);
 }
 
 float std::experimental::audio::voice::get_pan() const
@@ -175,28 +783,86 @@ float std::experimental::audio::voice::get_pan() const
 	return pan;
 }
 
+int std::experimental::audio::voice::get_priority() const
+{
+	return m_device->m_backend->get_priority(m_channel);
+}
+
+void std::experimental::audio::voice::set_priority(int priority)
+{
+	m_device->m_backend->set_priority(m_channel, priority);
+}
+
+bool std::experimental::audio::voice::is_virtual() const
+{
+	return m_device->m_backend->is_virtual(m_channel) || m_stolen;
+}
+
 bool std::experimental::audio::voice::is_playing() const
 {
-	bool playing = false;
-	m_channel->isPlaying(&playing);
-	return playing;
+	return m_device->m_backend->is_playing(m_channel);
 }
 
 void std::experimental::audio::voice::assign_to_submix(submix& parent)
 {
-	m_channel->setChannelGroup(parent.m_channelgroup);
+	if (m_submix != nullptr)
+		m_submix->detach_voice(this);
+
+	m_device->m_backend->set_group(m_channel, parent.m_group);
+	parent.attach_voice(this);
+}
+
+float std::experimental::audio::voice::get_send(const submix& bus) const
+{
+	return GetSend(*m_device->m_backend, m_sends, bus);
+}
+
+void std::experimental::audio::voice::set_send(const submix& bus, float level)
+{
+	if (SetSend(*m_device->m_backend, m_channel, m_sends, bus, bus.m_return_id, level))
+		bus.m_senders.emplace_back(m_channel, &m_sends);
+}
+
+void std::experimental::audio::voice::set_send(const std::string& bus_name, float level)
+{
+	submix* bus = m_device->find_return(bus_name);
+	if (bus == nullptr)
+		throw std::invalid_argument("Unknown return submix");
+	set_send(*bus, level);
+}
+
+void std::experimental::audio::voice::remove_send(const submix& bus)
+{
+	RemoveSend(*m_device->m_backend, m_channel, m_sends, bus);
+	RemoveSender(bus.m_senders, &m_sends);
+}
+
+bool std::experimental::audio::voice::is_metering() const
+{
+	return m_meter != nullptr;
+}
+
+void std::experimental::audio::voice::set_metering(bool enabled)
+{
+	SetMetering(*m_device->m_backend, m_channel, m_meter, m_meter_dsp, enabled);
+}
+
+auto std::experimental::audio::voice::get_levels() const -> meter_levels
+{
+	return GetLevels(m_meter);
 }
 
 void std::experimental::audio::voice::create_dsp(effect_instance* instance)
 {
 	instance->create_dsp(m_device, m_channel);
+	MoveTapsToHead(*m_device->m_backend, m_channel, m_sends, m_meter_dsp);
 }
 
 auto std::experimental::audio::buffer::get_audio_data() const -> memory_buffer_data
 {
 	memory_buffer_data return_value;
 	return_value.description = m_description;
-	if (auto v = std::get_if<std::vector<std::byte>>(&m_data))
+	if (auto v = std::get_if<std::pmr::vector<std::byte>>(&m_data))
 	{
 		return_value.data = memory_buffer(v->data(), v->size());
 	}
@@ -207,6 +873,103 @@ auto std::experimental::audio::buffer::get_audio_data() const -> memory_buffer_d
 	return return_value;
 }
 
+std::experimental::audio::buffer_view::buffer_view(std::shared_ptr<buffer> parent, size_t first_frame, size_t num_frames) :
+	m_buffer(std::move(parent)),
+	m_first_frame(first_frame),
+	m_num_frames(num_frames)
+{
+	if (!m_buffer)
+		throw std::invalid_argument("A buffer view needs a buffer");
+
+	memory_buffer_data data = m_buffer->get_audio_data();
+	size_t frame_size = bytes_per_sample(data.description.format) * data.description.num_channels;
+	if (frame_size == 0)
+		throw std::invalid_argument("Only PCM buffers can be viewed");
+	size_t length = data.data.size / frame_size;
+	if (first_frame > length || num_frames > length - first_frame)
+		throw std::invalid_argument("The view is outside the buffer");
+}
+
+auto std::experimental::audio::buffer_view::get_audio_data() const -> memory_buffer_data
+{
+	// The buffer's samples never move once loaded, so the view can point straight into them.
+	memory_buffer_data return_value = m_buffer->get_audio_data();
+	size_t frame_size = bytes_per_sample(return_value.description.format) * return_value.description.num_channels;
+	return_value.data = memory_buffer(return_value.data.data + m_first_frame * frame_size, m_num_frames * frame_size);
+	return return_value;
+}
+
+auto std::experimental::audio::buffer_view::get_buffer() const -> const std::shared_ptr<buffer>&
+{
+	return m_buffer;
+}
+
+size_t std::experimental::audio::buffer_view::get_first_frame() const
+{
+	return m_first_frame;
+}
+
+size_t std::experimental::audio::buffer_view::get_num_frames() const
+{
+	return m_num_frames;
+}
+
+std::experimental::audio::synth::synth(unsigned int num_channels, unsigned int frequency) :
+	m_description{ memory_buffer_format::pcmfloat, num_channels, frequency }
+{
+	if (num_channels == 0 || frequency == 0)
+		throw std::invalid_argument("A synth needs at least one channel and a frequency");
+}
+
+auto std::experimental::audio::synth::get_audio_data() const -> memory_buffer_data
+{
+	memory_buffer_data return_value;
+	return_value.description = m_description;
+	return return_value;
+}
+
+unsigned int std::experimental::audio::synth::get_num_channels() const
+{
+	return m_description.num_channels;
+}
+
+unsigned int std::experimental::audio::synth::get_frequency() const
+{
+	return m_description.frequency;
+}
+
+std::experimental::audio::stream::stream(const std::filesystem::path& filepath, int subsound) :
+	m_path(filepath),
+	m_subsound(subsound)
+{
+}
+
+auto std::experimental::audio::stream::get_audio_data() const -> memory_buffer_data
+{
+	return memory_buffer_data{};
+}
+
+auto std::experimental::audio::stream::get_path() const -> const std::filesystem::path&
+{
+	return m_path;
+}
+
+int std::experimental::audio::stream::get_subsound() const
+{
+	return m_subsound;
+}
+
+auto std::experimental::audio::buffer::get_loudness() const -> const std::optional<loudness_info>&
+{
+	return m_loudness;
+}
+
+auto std::experimental::audio::buffer::get_loop_points() const -> const std::optional<loop_region>&
+{
+	return m_loop_points;
+}
+
+#if STDAUDIO_FMOD
 static std::experimental::audio::memory_buffer_format ConvertSoundFormat(FMOD_SOUND_FORMAT format)
 {
 	switch (format)
@@ -224,20 +987,24 @@ static std::experimental::audio::memory_buffer_format ConvertSoundFormat(FMOD_SO
 	default:
 		break;
 	}
-	throw std::exception("Unkown format");
+	throw std::runtime_error("Unknown format");
 }
 
-std::shared_ptr<std::experimental::audio::buffer> std::experimental::audio::load_from_disk(const std::experimental::filesystem::path& filepath)
+std::shared_ptr<std::experimental::audio::buffer> std::experimental::audio::load_from_disk(const std::filesystem::path& filepath, std::pmr::memory_resource* resource)
 {
+	if (resource == nullptr)
+		resource = std::pmr::new_delete_resource();
+
 	// TODO: This is pretty horrible.  We create an entire FMOD System object just to decompress a single sound.
 	// This would be okay for a sound or two, but at scale it will explode horribly.
+	install_fmod_allocator();
 	FMOD::System* pLoadSystem = nullptr;
 	FMOD::System_Create(&pLoadSystem);
 	pLoadSystem->setOutput(FMOD_OUTPUTTYPE_NOSOUND_NRT);
 	pLoadSystem->init(1, FMOD_INIT_STREAM_FROM_UPDATE | FMOD_INIT_MIX_FROM_UPDATE | FMOD_INIT_THREAD_UNSAFE, nullptr);
 
 	FMOD::Sound* pSound = nullptr;
-	pLoadSystem->createSound(filepath.generic_u8string().c_str(), FMOD_OPENONLY, nullptr, &pSound);
+	pLoadSystem->createSound(to_utf8(filepath).c_str(), FMOD_OPENONLY, nullptr, &pSound);
 
 	FMOD_SOUND_FORMAT fmod_format = FMOD_SOUND_FORMAT_NONE;
 	int num_channels = 0;
@@ -249,31 +1016,53 @@ std::shared_ptr<std::experimental::audio::buffer> std::experimental::audio::load
 	unsigned int lengthbytes = 0;
 	pSound->getLength(&lengthbytes, FMOD_TIMEUNIT_PCMBYTES);
 
-	auto return_value = std::make_shared<std::experimental::audio::buffer>();
+	// FMOD reports loop points from the file, such as a WAV smpl chunk, and the whole sound otherwise.  Its loop end
+	// is inclusive.
+	unsigned int length = 0;
+	unsigned int loop_start = 0;
+	unsigned int loop_end = 0;
+	pSound->getLength(&length, FMOD_TIMEUNIT_PCM);
+	bool has_loop = pSound->getLoopPoints(&loop_start, FMOD_TIMEUNIT_PCM, &loop_end, FMOD_TIMEUNIT_PCM) == FMOD_OK
+		&& loop_start < loop_end
+		&& (loop_start != 0 || loop_end + 1 < length);
+
+	auto return_value = std::allocate_shared<std::experimental::audio::buffer>(std::pmr::polymorphic_allocator<std::experimental::audio::buffer>(resource));
 	return_value->m_description.format = ConvertSoundFormat(fmod_format);
 	return_value->m_description.frequency = static_cast<unsigned int>(frequency);
 	return_value->m_description.num_channels = static_cast<unsigned int>(num_channels);
+	if (has_loop)
+		return_value->m_loop_points = loop_region{ loop_start, static_cast<size_t>(loop_end) + 1 };
 
-	std::vector<std::byte> data(lengthbytes);
+	std::pmr::vector<std::byte> data(lengthbytes, resource);
 	unsigned int bytes_read = 0;
 	pSound->readData(data.data(), lengthbytes, &bytes_read);
 	data.resize(bytes_read);
-	return_value->m_data = std::move(data);
+	// Emplaced rather than assigned, since assignment would copy the samples into the variant's own allocator.
+	return_value->m_data.emplace<std::pmr::vector<std::byte>>(std::move(data));
 
 	pSound->release();
 	pLoadSystem->release();
 
 	return return_value;
 }
+#else
+std::shared_ptr<std::experimental::audio::buffer> std::experimental::audio::load_from_disk(const std::filesystem::path&, std::pmr::memory_resource*)
+{
+	// Decoding files is left to FMOD, so builds without it can only load from memory.
+	throw std::runtime_error("Loading from disk needs a build with STDAUDIO_FMOD");
+}
+#endif
 
-std::shared_ptr<std::experimental::audio::buffer> std::experimental::audio::load_from_memory(const memory_buffer& buffer, const memory_buffer_description& description, bool copy)
+std::shared_ptr<std::experimental::audio::buffer> std::experimental::audio::load_from_memory(const memory_buffer& buffer, const memory_buffer_description& description, bool copy, std::pmr::memory_resource* resource)
 {
-	auto return_value = std::make_shared<std::experimental::audio::buffer>();
+	if (resource == nullptr)
+		resource = std::pmr::new_delete_resource();
+
+	auto return_value = std::allocate_shared<std::experimental::audio::buffer>(std::pmr::polymorphic_allocator<std::experimental::audio::buffer>(resource));
 	return_value->m_description = description;
 	if (copy)
 	{
-		std::vector<std::byte> copied_buffer(buffer.size);
-		std::copy(buffer.data, buffer.data + buffer.size, copied_buffer.begin());
+		return_value->m_data.emplace<std::pmr::vector<std::byte>>(buffer.data, buffer.data + buffer.size, resource);
 	}
 	else
 	{
@@ -282,87 +1071,654 @@ std::shared_ptr<std::experimental::audio::buffer> std::experimental::audio::load
 	return return_value;
 }
 
-std::experimental::audio::submix::submix(device* dev, FMOD::ChannelGroup* channelgroup, constructor_tag) :
+static bool NeedsConversion(const std::experimental::audio::memory_buffer_description& description, const std::experimental::audio::load_settings& settings)
+{
+	return (settings.format && *settings.format != description.format)
+		|| (settings.frequency && *settings.frequency != description.frequency)
+		|| (settings.num_channels && *settings.num_channels != description.num_channels)
+		|| !settings.channel_matrix.empty()
+		|| settings.analyze_loudness
+		|| settings.normalize_loudness;
+}
+
+std::shared_ptr<std::experimental::audio::buffer> std::experimental::audio::load_from_disk(const std::filesystem::path& filepath, const load_settings& settings, std::pmr::memory_resource* resource)
+{
+	auto source = load_from_disk(filepath, resource);
+	memory_buffer_data source_data = source->get_audio_data();
+	if (!NeedsConversion(source_data.description, settings))
+		return source;
+
+	auto return_value = load_from_memory(source_data.data, source_data.description, settings, resource);
+	if (source->m_loop_points)
+	{
+		double ratio = static_cast<double>(return_value->m_description.frequency) / source_data.description.frequency;
+		return_value->m_loop_points = loop_region{
+			static_cast<size_t>(std::llround(source->m_loop_points->start_frame * ratio)),
+			static_cast<size_t>(std::llround(source->m_loop_points->end_frame * ratio)) };
+	}
+	return return_value;
+}
+
+std::shared_ptr<std::experimental::audio::buffer> std::experimental::audio::load_from_memory(const memory_buffer& buffer, const memory_buffer_description& description, const load_settings& settings, std::pmr::memory_resource* resource)
+{
+	if (resource == nullptr)
+		resource = std::pmr::new_delete_resource();
+
+	memory_buffer_description output_description = description;
+	output_description.format = settings.format.value_or(description.format);
+	output_description.frequency = settings.frequency.value_or(description.frequency);
+	output_description.num_channels = settings.num_channels.value_or(description.num_channels);
+
+	bool input_adpcm = description.format == memory_buffer_format::adpcm;
+	bool output_adpcm = output_description.format == memory_buffer_format::adpcm;
+	size_t input_size = bytes_per_sample(description.format);
+	size_t output_size = bytes_per_sample(output_description.format);
+	if ((input_size == 0 && !input_adpcm) || (output_size == 0 && !output_adpcm) || description.num_channels == 0 || output_description.num_channels == 0)
+		throw std::invalid_argument("Unsupported sample format");
+
+	auto return_value = std::allocate_shared<std::experimental::audio::buffer>(std::pmr::polymorphic_allocator<std::experimental::audio::buffer>(resource));
+	return_value->m_description = output_description;
+
+	size_t num_frames = input_adpcm
+		? adpcm_num_frames(buffer, description.num_channels)
+		: buffer.size / (input_size * description.num_channels);
+	size_t num_samples = num_frames * description.num_channels;
+	bool remap = output_description.num_channels != description.num_channels || !settings.channel_matrix.empty();
+	bool analyze = settings.analyze_loudness || settings.normalize_loudness;
+	if (output_description.frequency == description.frequency && !remap && !analyze && !input_adpcm && !output_adpcm)
+	{
+		auto& data = return_value->m_data.emplace<std::pmr::vector<std::byte>>(num_samples * output_size, resource);
+		convert_samples(buffer.data, description.format, data.data(), output_description.format, num_samples);
+		return return_value;
+	}
+
+	// Mixing and resampling work on float, so decode first and encode to the requested format at the end.  Channels
+	// are mixed first so that there are fewer to resample.
+	std::vector<float> samples(num_samples);
+	if (input_adpcm)
+	{
+		if (num_frames > 0)
+			adpcm_decoder({ buffer, description }).read(samples.data(), num_frames);
+	}
+	else
+	{
+		convert_samples(buffer.data, description.format, reinterpret_cast<std::byte*>(samples.data()), memory_buffer_format::pcmfloat, num_samples);
+	}
+	if (remap)
+	{
+		const std::vector<float>& matrix = settings.channel_matrix.empty()
+			? default_channel_matrix(description.num_channels, output_description.num_channels)
+			: settings.channel_matrix;
+		samples = mix_channels(samples.data(), num_frames, description.num_channels, output_description.num_channels, matrix);
+	}
+	if (output_description.frequency != description.frequency)
+		samples = resampler(description.frequency, output_description.frequency).process_interleaved(samples.data(), num_frames, output_description.num_channels);
+	if (analyze)
+	{
+		size_t output_frames = samples.size() / output_description.num_channels;
+		loudness_info loudness = analyze_loudness(samples.data(), output_frames, output_description.num_channels, output_description.frequency);
+		if (settings.normalize_loudness && std::isfinite(loudness.integrated_loudness) && loudness.peak > 0.0f)
+		{
+			// Loudness, peak and RMS all scale directly with the gain, so there is no need to measure again.
+			float gain = std::pow(10.0f, (*settings.normalize_loudness - loudness.integrated_loudness) / 20.0f);
+			gain = std::min(gain, 1.0f / loudness.peak);
+			for (float& sample : samples)
+				sample *= gain;
+			loudness.integrated_loudness += 20.0f * std::log10(gain);
+			loudness.peak *= gain;
+			loudness.rms *= gain;
+			loudness.normalization_gain = gain;
+		}
+		return_value->m_loudness = loudness;
+	}
+
+	if (output_adpcm)
+	{
+		size_t output_frames = samples.size() / output_description.num_channels;
+		auto& data = return_value->m_data.emplace<std::pmr::vector<std::byte>>(adpcm_encoded_size(output_frames, output_description.num_channels), resource);
+		adpcm_encode(samples.data(), output_frames, output_description.num_channels, data.data());
+		return return_value;
+	}
+
+	auto& data = return_value->m_data.emplace<std::pmr::vector<std::byte>>(samples.size() * output_size, resource);
+	convert_samples(reinterpret_cast<const std::byte*>(samples.data()), memory_buffer_format::pcmfloat, data.data(), output_description.format, samples.size());
+	return return_value;
+}
+
+static void SidechainReadCallback(void* userdata, float* buffer_in, float* buffer_out, size_t length_samples, int num_channels)
+{
+	std::experimental::audio::realtime_scope scope(nullptr, length_samples);
+	std::copy(buffer_in, buffer_in + length_samples * num_channels, buffer_out);
+	static_cast<std::experimental::audio::sidechain_envelope*>(userdata)->process(buffer_in, length_samples, num_channels);
+}
+
+static std::experimental::audio::dsp_result SidechainShouldProcessCallback(void* userdata, bool inputs_idle, size_t, int)
+{
+	if (!inputs_idle)
+		return std::experimental::audio::dsp_result::process;
+
+	static_cast<std::experimental::audio::sidechain_envelope*>(userdata)->set_level(0.0f);
+	return std::experimental::audio::dsp_result::silence;
+}
+
+static void DuckerReadCallback(void* userdata, float* buffer_in, float* buffer_out, size_t length_samples, int num_channels)
+{
+	std::experimental::audio::realtime_scope scope(nullptr, length_samples);
+	static_cast<std::experimental::audio::ducker*>(userdata)->process(buffer_in, buffer_out, length_samples, num_channels);
+}
+
+std::experimental::audio::submix::submix(device* dev, backend_group* group, constructor_tag) :
 	m_device(dev),
-	m_channelgroup(channelgroup)
+	m_group(group)
 {
+	m_device->m_backend->set_user_data(m_group, this);
 }
 
 std::experimental::audio::submix::~submix()
 {
-	m_channelgroup->release();
+	for (voice* v : m_voices)
+	{
+		v->m_submix = nullptr;
+		if (v->m_stolen)
+		{
+			m_device->m_backend->set_mute(v->m_channel, false);
+			v->m_stolen = false;
+		}
+	}
+	auto& limited = m_device->m_voice_limited;
+	limited.erase(std::remove(limited.begin(), limited.end(), this), limited.end());
+	if (m_return_dsp != nullptr)
+	{
+		// Anything still sending here would be left holding this submix, so its sends go first.
+		for (auto& sender : m_senders)
+			RemoveSend(*m_device->m_backend, sender.first, *sender.second, *this);
+		m_senders.clear();
+		m_device->m_returns.erase(m_name);
+		m_device->m_backend->remove_dsp(m_group, m_return_dsp);
+		m_device->m_backend->release(m_return_dsp);
+	}
+	for (auto& send : m_sends)
+		RemoveSender(send.first->m_senders, &m_sends);
+	ReleaseSends(*m_device->m_backend, m_group, m_sends);
+	SetMetering(*m_device->m_backend, m_group, m_meter, m_meter_dsp, false);
+	clear_ducking();
+	if (m_sidechain_dsp != nullptr)
+	{
+		// Anything still ducked by this submix holds on to the envelope, so leave it reading silence.
+		m_device->m_backend->remove_dsp(m_group, m_sidechain_dsp);
+		m_device->m_backend->release(m_sidechain_dsp);
+		m_sidechain->set_level(0.0f);
+	}
+	m_device->m_backend->release(m_group);
 }
 
 float std::experimental::audio::submix::get_volume() const
 {
-	float volume = 0.0f;
-	m_channelgroup->getVolume(&volume);
-	return volume;
+	return m_device->m_backend->get_volume(m_group);
 }
 
 void std::experimental::audio::submix::set_volume(float volume)
 {
-	m_channelgroup->setVolume(volume);
+	m_device->m_backend->set_volume(m_group, volume);
+}
+
+bool std::experimental::audio::submix::is_return() const
+{
+	return m_return_dsp != nullptr;
+}
+
+const std::string& std::experimental::audio::submix::get_name() const
+{
+	return m_name;
+}
+
+void std::experimental::audio::submix::make_return(const std::string& name)
+{
+	// The return goes at the tail so that the submix's own effects process everything sent to it.
+	m_return_dsp = m_device->m_backend->create_return();
+	m_device->m_backend->add_dsp(m_group, m_return_dsp, dsp_position::tail);
+	m_return_id = m_device->m_backend->get_return_id(m_return_dsp);
+	m_name = name;
+}
+
+float std::experimental::audio::submix::get_send(const submix& bus) const
+{
+	return GetSend(*m_device->m_backend, m_sends, bus);
+}
+
+void std::experimental::audio::submix::set_send(const submix& bus, float level)
+{
+	if (&bus == this)
+		throw std::invalid_argument("A submix cannot send to itself");
+	if (SetSend(*m_device->m_backend, m_group, m_sends, bus, bus.m_return_id, level))
+		bus.m_senders.emplace_back(m_group, &m_sends);
+}
+
+void std::experimental::audio::submix::set_send(const std::string& bus_name, float level)
+{
+	submix* bus = m_device->find_return(bus_name);
+	if (bus == nullptr)
+		throw std::invalid_argument("Unknown return submix");
+	set_send(*bus, level);
+}
+
+void std::experimental::audio::submix::remove_send(const submix& bus)
+{
+	RemoveSend(*m_device->m_backend, m_group, m_sends, bus);
+	RemoveSender(bus.m_senders, &m_sends);
+}
+
+void std::experimental::audio::submix::set_voice_limit(unsigned int max_voices, voice_steal_policy policy, voice_steal_mode mode)
+{
+	auto& limited = m_device->m_voice_limited;
+	if (max_voices > 0 && std::find(limited.begin(), limited.end(), this) == limited.end())
+		limited.push_back(this);
+	else if (max_voices == 0)
+		limited.erase(std::remove(limited.begin(), limited.end(), this), limited.end());
+	m_max_voices = max_voices;
+	m_steal_policy = policy;
+	m_steal_mode = mode;
+	enforce_voice_limit();
+}
+
+void std::experimental::audio::submix::clear_voice_limit()
+{
+	auto& limited = m_device->m_voice_limited;
+	limited.erase(std::remove(limited.begin(), limited.end(), this), limited.end());
+	m_max_voices = 0;
+	enforce_voice_limit();
+}
+
+void std::experimental::audio::submix::attach_voice(voice* v)
+{
+	v->m_submix = this;
+	m_voices.push_back(v);
+	enforce_voice_limit();
+}
+
+void std::experimental::audio::submix::detach_voice(voice* v)
+{
+	m_voices.erase(std::remove(m_voices.begin(), m_voices.end(), v), m_voices.end());
+	v->m_submix = nullptr;
+	if (v->m_stolen)
+	{
+		m_device->m_backend->set_mute(v->m_channel, false);
+		v->m_stolen = false;
+	}
+	enforce_voice_limit();
+}
+
+bool std::experimental::audio::submix::is_less_important(const voice& a, const voice& b) const
+{
+	switch (m_steal_policy)
+	{
+	case voice_steal_policy::quietest:
+	{
+		// A muted voice has no audibility, so stolen voices are ranked by their volume instead.
+		auto& backend = *m_device->m_backend;
+		float a_level = a.m_stolen ? backend.get_volume(a.m_channel) : backend.get_audibility(a.m_channel);
+		float b_level = b.m_stolen ? backend.get_volume(b.m_channel) : backend.get_audibility(b.m_channel);
+		if (a_level != b_level)
+			return a_level < b_level;
+		break;
+	}
+	case voice_steal_policy::lowest_priority:
+	{
+		int a_priority = a.get_priority();
+		int b_priority = b.get_priority();
+		if (a_priority != b_priority)
+			return a_priority > b_priority;
+		break;
+	}
+	default:
+		break;
+	}
+	return a.m_sequence < b.m_sequence;
+}
+
+void std::experimental::audio::submix::enforce_voice_limit()
+{
+	std::vector<voice*> active;
+	std::vector<voice*> stolen;
+	for (voice* v : m_voices)
+	{
+		if (!v->is_playing())
+			continue;
+		(v->m_stolen ? stolen : active).push_back(v);
+	}
+
+	auto less_important = [this](const voice* a, const voice* b) { return is_less_important(*a, *b); };
+	size_t max_voices = m_max_voices > 0 ? m_max_voices : std::numeric_limits<size_t>::max();
+
+	while (active.size() > max_voices)
+	{
+		auto victim = std::min_element(active.begin(), active.end(), less_important);
+		if (m_steal_mode == voice_steal_mode::virtualize)
+		{
+			m_device->m_backend->set_mute((*victim)->m_channel, true);
+			(*victim)->m_stolen = true;
+		}
+		else
+		{
+			m_device->m_backend->stop((*victim)->m_channel);
+		}
+		active.erase(victim);
+	}
+
+	while (active.size() < max_voices && !stolen.empty())
+	{
+		auto restored = std::max_element(stolen.begin(), stolen.end(), less_important);
+		m_device->m_backend->set_mute((*restored)->m_channel, false);
+		(*restored)->m_stolen = false;
+		active.push_back(*restored);
+		stolen.erase(restored);
+	}
+}
+
+void std::experimental::audio::submix::set_ducking(submix& key, const ducking_settings& settings)
+{
+	if (&key == this)
+		throw std::invalid_argument("A submix cannot duck itself");
+
+	if (m_ducker && m_ducking_key == &key)
+	{
+		m_ducker->set_settings(settings);
+		return;
+	}
+
+	clear_ducking();
+	key.enable_sidechain();
+
+	auto new_ducker = std::make_unique<ducker>(key.m_sidechain, settings, m_device->m_backend->get_sample_rate());
+	m_ducker_dsp = CreateCustomDSP(*m_device->m_backend, DuckerReadCallback, nullptr, new_ducker.get());
+	m_ducker = std::move(new_ducker);
+	m_ducking_key = &key;
+
+	m_device->m_backend->add_dsp(m_group, m_ducker_dsp, dsp_position::head);
+	MoveTapsToHead(*m_device->m_backend, m_group, m_sends, m_meter_dsp);
+}
+
+void std::experimental::audio::submix::clear_ducking()
+{
+	if (!m_ducker)
+		return;
+
+	m_device->m_backend->remove_dsp(m_group, m_ducker_dsp);
+	m_device->m_backend->release(m_ducker_dsp);
+	m_ducker_dsp = nullptr;
+	m_ducker.reset();
+	m_ducking_key = nullptr;
+}
+
+void std::experimental::audio::submix::enable_sidechain()
+{
+	if (m_sidechain)
+		return;
+
+	m_sidechain = std::make_shared<sidechain_envelope>();
+	m_sidechain_dsp = CreateCustomDSP(*m_device->m_backend, SidechainReadCallback, SidechainShouldProcessCallback, m_sidechain.get());
+	m_device->m_backend->add_dsp(m_group, m_sidechain_dsp, dsp_position::head);
+	MoveTapsToHead(*m_device->m_backend, m_group, m_sends, m_meter_dsp);
+}
+
+bool std::experimental::audio::submix::is_parallel() const
+{
+	return m_parallel;
+}
+
+void std::experimental::audio::submix::set_parallel(bool parallel)
+{
+	m_parallel = parallel;
+	for (auto& instance : m_effects)
+	{
+		set_worker_pool(instance.get());
+	}
+}
+
+void std::experimental::audio::submix::set_worker_pool(effect_instance* instance)
+{
+	if (!m_parallel)
+	{
+		instance->set_worker_pool(nullptr, 0);
+		return;
+	}
+
+	unsigned int block_length = m_device->m_backend->get_block_length();
+	instance->set_worker_pool(m_device->get_worker_pool(), block_length * max_dsp_channels);
 }
 
 void std::experimental::audio::submix::assign_to_submix(submix& parent)
 {
-	parent.m_channelgroup->addGroup(m_channelgroup);
+	m_device->m_backend->add_group(parent.m_group, m_group);
+}
+
+bool std::experimental::audio::submix::is_metering() const
+{
+	return m_meter != nullptr;
+}
+
+void std::experimental::audio::submix::set_metering(bool enabled)
+{
+	SetMetering(*m_device->m_backend, m_group, m_meter, m_meter_dsp, enabled);
+}
+
+auto std::experimental::audio::submix::get_levels() const -> meter_levels
+{
+	return GetLevels(m_meter);
 }
 
 void std::experimental::audio::submix::create_dsp(effect_instance* instance)
 {
-	instance->create_dsp(m_device, m_channelgroup);
+	instance->create_dsp(m_device, m_group);
+	MoveTapsToHead(*m_device->m_backend, m_group, m_sends, m_meter_dsp);
+	if (m_parallel)
+		set_worker_pool(instance);
 }
 
-std::experimental::audio::effect_instance::effect_instance(std::unique_ptr<effect> e) :
-	m_effect(std::move(e))
+std::experimental::audio::effect_instance::effect_instance(std::unique_ptr<effect> e, const allocator_type& allocator) :
+	m_effect(std::move(e)),
+	m_job_input(allocator),
+	m_job_output(allocator)
 {
 }
 
 std::experimental::audio::effect_instance::~effect_instance()
 {
-	m_dsp->release();
+	if (m_dsp != nullptr)
+		m_backend->release(m_dsp);
+
+	// Clearing the flag is the worker's last touch of this, and this thread can afford to wait as long as it takes.
+	while (m_job_pending.load(std::memory_order_acquire))
+		std::this_thread::yield();
+}
+
+static bool IsSilent(const float* buffer, size_t length)
+{
+	// Roughly -100dB; anything quieter than this is treated as silence for bypass purposes.
+	const float threshold = 1.0e-5f;
+	for (size_t i = 0; i < length; i++)
+	{
+		if (buffer[i] > threshold || buffer[i] < -threshold)
+			return false;
+	}
+	return true;
+}
+
+bool std::experimental::audio::effect_instance::should_process(bool inputs_idle, size_t length_samples)
+{
+	// Active inputs may still be silent, which process_effect checks sample by sample.  Idle ones are only worth
+	// processing while the tail lasts.  process_effect counts the tail down, and may still be doing so on a worker.
+	m_job_flush = false;
+	if (!inputs_idle || m_effect->tail_length_samples() == effect::infinite_tail)
+		return true;
+
+	// A late job leaves the tail unknown; process deals with it.
+	if (!wait_for_job(length_samples) || m_tail_remaining > 0)
+		return true;
+
+	// Pooled output is a block behind, so the last block of the tail still has to be played out.
+	m_job_flush = m_job_length != 0;
+	return m_job_flush;
+}
+
+void std::experimental::audio::effect_instance::process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels)
+{
+	// A worker that overran still owns the effect and the job buffers, so this block is silent and its input is
+	// dropped rather than the mixer waiting for it.
+	size_t length = length_samples * num_channels;
+	if (!wait_for_job(length_samples))
+	{
+		m_profile_missed.fetch_add(1, std::memory_order_relaxed);
+		std::fill(buffer_out, buffer_out + length, 0.0f);
+		return;
+	}
+
+	// Blocks bigger than the job buffers were sized for are processed here rather than growing them on this thread.
+	worker_pool* pool = m_worker_pool.load(std::memory_order_acquire);
+	if (pool == nullptr || length > m_job_input.size())
+	{
+		m_job_length = 0;
+		process_block(buffer_in, buffer_out, length_samples, num_channels);
+		return;
+	}
+
+	// Emit the block the workers finished since the last callback, then hand them this one.
+	if (m_job_length == length_samples && m_job_channels == num_channels)
+		std::copy(m_job_output.begin(), m_job_output.begin() + length, buffer_out);
+	else
+		std::fill(buffer_out, buffer_out + length, 0.0f);
+
+	if (m_job_flush)
+	{
+		m_job_length = 0;
+		return;
+	}
+
+	std::copy(buffer_in, buffer_in + length, m_job_input.begin());
+	m_job_length = length_samples;
+	m_job_channels = num_channels;
+
+	m_job_pending.store(true, std::memory_order_release);
+	if (!pool->submit(this))
+		run_job();
+}
+
+void std::experimental::audio::effect_instance::set_worker_pool(worker_pool* pool, size_t reserve_samples)
+{
+	// The job buffers are only touched by the mixer once a pool is set, so growing them beforehand is safe.
+	if (pool != nullptr && m_job_input.empty())
+	{
+		m_job_input.resize(reserve_samples);
+		m_job_output.resize(reserve_samples);
+	}
+	m_worker_pool.store(pool, std::memory_order_release);
 }
 
-static FMOD_RESULT F_CALLBACK EffectReadCallback(
-	FMOD_DSP_STATE *dsp_state,
-	float *inbuffer,
-	float *outbuffer,
-	unsigned int length,
-	int inchannels,
-	int *outchannels
-)
+bool std::experimental::audio::effect_instance::wait_for_job(size_t length_samples) const
 {
-	auto* DSP = reinterpret_cast<FMOD::DSP*>(dsp_state->instance);
+	// Jobs usually finish well within a block, so the mixer rarely gets past the first check.  Otherwise it spins
+	// for at most half a block, leaving itself the rest of the block to mix.  Yielding never blocks, and lets the
+	// worker finish when they share a core.
+	if (!m_job_pending.load(std::memory_order_acquire))
+		return true;
 
-	void* pUserData = nullptr;
-	DSP->getUserData(&pUserData);
-	if(pUserData == nullptr)
-		return FMOD_ERR_INVALID_PARAM;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(0.5 * length_samples / m_backend->get_sample_rate()));
+	while (m_job_pending.load(std::memory_order_acquire))
+	{
+		if (std::chrono::steady_clock::now() >= deadline)
+			return false;
+		std::this_thread::yield();
+	}
+	return true;
+}
 
-	auto* EffectInstance = static_cast<std::experimental::audio::effect_instance*>(pUserData);
-	if (EffectInstance == nullptr)
-		return FMOD_ERR_INVALID_PARAM;
+void std::experimental::audio::effect_instance::run_job()
+{
+	process_block(m_job_input.data(), m_job_output.data(), m_job_length, m_job_channels);
+	m_job_pending.store(false, std::memory_order_release);
+}
 
-	auto* Effect = EffectInstance->get_effect<std::experimental::audio::effect>();
-	if (Effect == nullptr)
-		return FMOD_ERR_INVALID_PARAM;
+auto std::experimental::audio::effect_instance::get_profile() const -> profile_counters
+{
+	profile_counters counters;
+	counters.call_count = m_profile_calls.load(std::memory_order_relaxed);
+	counters.total_time = std::chrono::nanoseconds(m_profile_total_ns.load(std::memory_order_relaxed));
+	counters.worst_block_time = std::chrono::nanoseconds(m_profile_worst_ns.load(std::memory_order_relaxed));
+	counters.missed_deadlines = m_profile_missed.load(std::memory_order_relaxed);
+	return counters;
+}
 
-	Effect->process(inbuffer, outbuffer, length, inchannels);
-	*outchannels = inchannels;
-	return FMOD_OK;
+void std::experimental::audio::effect_instance::reset_profile()
+{
+	// Cleared by the thread doing the processing so a reset can't race with an update.
+	m_profile_reset.store(true, std::memory_order_relaxed);
 }
 
-void std::experimental::audio::effect_instance::create_dsp(device* dev, FMOD::ChannelControl* ChannelControl)
+void std::experimental::audio::effect_instance::process_block(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels)
 {
-	FMOD_DSP_DESCRIPTION description = { 0 };
-	description.pluginsdkversion = FMOD_PLUGIN_SDK_VERSION;
-	description.numinputbuffers = 1;
-	description.numoutputbuffers = 1;
-	description.read = EffectReadCallback;
-	description.userdata = this;
-	dev->m_system->createDSP(&description, &m_dsp);
+	auto start = std::chrono::steady_clock::now();
+	{
+		realtime_scope scope(this, length_samples);
+		process_effect(buffer_in, buffer_out, length_samples, num_channels);
+	}
+	int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
 
-	ChannelControl->addDSP(0, m_dsp);
+	// Only one thread processes an instance at a time, so plain loads and stores are enough here.
+	if (m_profile_reset.load(std::memory_order_relaxed) && m_profile_reset.exchange(false, std::memory_order_relaxed))
+	{
+		m_profile_calls.store(0, std::memory_order_relaxed);
+		m_profile_total_ns.store(0, std::memory_order_relaxed);
+		m_profile_worst_ns.store(0, std::memory_order_relaxed);
+		m_profile_missed.store(0, std::memory_order_relaxed);
+	}
+	m_profile_calls.store(m_profile_calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	m_profile_total_ns.store(m_profile_total_ns.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+	if (elapsed > m_profile_worst_ns.load(std::memory_order_relaxed))
+		m_profile_worst_ns.store(elapsed, std::memory_order_relaxed);
+}
+
+void std::experimental::audio::effect_instance::process_effect(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels)
+{
+	// The only place the tail is counted, once per block: reset by sound, run down by silence.
+	size_t tail_length = m_effect->tail_length_samples();
+	if (tail_length != effect::infinite_tail)
+	{
+		if (!IsSilent(buffer_in, length_samples * num_channels))
+		{
+			m_tail_remaining = tail_length;
+		}
+		else if (m_tail_remaining == 0)
+		{
+			std::fill(buffer_out, buffer_out + length_samples * num_channels, 0.0f);
+			return;
+		}
+		else
+		{
+			m_tail_remaining -= std::min(m_tail_remaining, length_samples);
+		}
+	}
+
+	m_effect->process(buffer_in, buffer_out, length_samples, num_channels);
+}
+
+static void EffectReadCallback(void* userdata, float* buffer_in, float* buffer_out, size_t length_samples, int num_channels)
+{
+	static_cast<std::experimental::audio::effect_instance*>(userdata)->process(buffer_in, buffer_out, length_samples, num_channels);
+}
+
+static std::experimental::audio::dsp_result EffectShouldProcessCallback(void* userdata, bool inputs_idle, size_t length_samples, int)
+{
+	// Returning silence (rather than skip) lets everything downstream go idle as well.
+	if (!static_cast<std::experimental::audio::effect_instance*>(userdata)->should_process(inputs_idle, length_samples))
+		return std::experimental::audio::dsp_result::silence;
+
+	return std::experimental::audio::dsp_result::process;
+}
+
+void std::experimental::audio::effect_instance::create_dsp(device* dev, backend_node* node)
+{
+	m_backend = dev->m_backend.get();
+	m_dsp = CreateCustomDSP(*m_backend, EffectReadCallback, EffectShouldProcessCallback, this);
+	m_backend->add_dsp(node, m_dsp, dsp_position::head);
 }
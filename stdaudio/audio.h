@@ -2,22 +2,20 @@
 
 #include <string>
 #include <memory>
+#include <memory_resource>
 #include <filesystem>
 #include <unordered_map>
 #include <cstdint>
 #include <cstddef>
 #include <variant>
 #include <vector>
-
-namespace FMOD
-{
-	class System;
-	class Channel;
-	class ChannelGroup;
-	class ChannelControl;
-	class Sound;
-	class DSP;
-}
+#include <tuple>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <optional>
 
 namespace std
 {
@@ -32,6 +30,18 @@ namespace std
 			class submix;
 			class effect;
 			class effect_instance;
+			class worker_pool;
+			class level_meter;
+			class sidechain_envelope;
+			class ducker;
+			class backend;
+			class loopback_buffer;
+			class tracking_resource;
+			struct backend_node;
+			struct backend_channel;
+			struct backend_group;
+			struct backend_sound;
+			struct backend_dsp;
 
 			struct guid
 			{
@@ -44,25 +54,255 @@ namespace std
 			struct driver_info
 			{
 				std::string name;
-				guid guid;
+				guid id;
+			};
+
+			struct profile_counters
+			{
+				uint64_t call_count = 0;
+				std::chrono::nanoseconds total_time{ 0 };
+				std::chrono::nanoseconds worst_block_time{ 0 };
+
+				// Blocks a parallel effect's worker hadn't finished in time for, which were played as silence.
+				uint64_t missed_deadlines = 0;
+			};
+
+			// One node of the mix graph.  Effect nodes report their own timings; submix and voice nodes report call
+			// counts and time summed over their effects and everything routed into them, and the worst block of any
+			// one of those.  latency_samples is how far the node delays what passes through it: a block for each
+			// parallel effect, and for a submix its own effects plus the slowest path routed into it.
+			struct profile_node
+			{
+				std::variant<const submix*, const voice*, const effect_instance*> object;
+				profile_counters counters;
+				size_t latency_samples = 0;
+				std::vector<profile_node> children;
+			};
+
+			// Linear sample peak, 4x oversampled true peak and RMS over the last 300ms, and ITU-R BS.1770 short-term
+			// loudness in LUFS over the last 3 seconds.
+			struct meter_levels
+			{
+				float peak = 0.0f;
+				float true_peak = 0.0f;
+				float rms = 0.0f;
+				float short_term_loudness = -std::numeric_limits<float>::infinity();
+			};
+
+			// The key level is the RMS of each mixer block on the key submix.  While it is above threshold the ducked
+			// submix is pulled down to depth_db, and it recovers once the key falls back below.
+			struct ducking_settings
+			{
+				float threshold = 0.01f;
+				float depth_db = -12.0f;
+				float attack_seconds = 0.05f;
+				float release_seconds = 0.5f;
+			};
+
+			// Frames [start_frame, end_frame) of a sound.
+			struct loop_region
+			{
+				size_t start_frame = 0;
+				size_t end_frame = 0;
+			};
+
+			// The mixer jumps back to the loop start itself, so loops are seamless and need no new voice.  count is
+			// the number of passes through the region after the first, as in FMOD: 0 plays once and -1 loops until
+			// the count changes or the voice stops.
+			struct loop_settings
+			{
+				int count = -1;
+
+				// Unset, this is the buffer's own loop points, such as a WAV smpl chunk's, or else the whole sound.
+				std::optional<loop_region> region;
+			};
+
+			enum class voice_steal_policy
+			{
+				oldest,
+				quietest,
+				lowest_priority,
+			};
+
+			enum class voice_steal_mode
+			{
+				virtualize,
+				stop,
+			};
+
+			struct device_profile
+			{
+				float dsp_cpu_usage = 0.0f;
+				float total_cpu_usage = 0.0f;
+				unsigned int block_length = 0;
+				int sample_rate = 0;
+				std::vector<profile_node> nodes;
+			};
+
+			enum class device_backend
+			{
+				fmod,
+				software,
+			};
+
+			enum class device_output
+			{
+				// The software backend has no speaker output and throws for it, so pick another output with it.
+				speakers,
+				none,
+				// Written at the pace of a sound card, a second of audio each second, by both backends.  Render
+				// faster than real time with loopback_manual and write out what read_output returns.
+				wav_file,
+				// The final mix is kept in memory for read_output.  loopback mixes in real time; loopback_manual
+				// mixes only when mix_output is called, so a test decides exactly which block each change lands in.
+				loopback,
+				loopback_manual,
+			};
+
+			enum class memory_category
+			{
+				// The software mixer's channels, groups and DSPs.  FMOD has one allocator for the whole process, so an FMOD
+				// device reports every FMOD allocation in the process, load_from_disk's included.
+				backend,
+				voices,
+				effects,
+				buffers,
+			};
+
+			// Allocations made from a category since the device was created.
+			struct memory_stats
+			{
+				uint64_t allocations = 0;
+				uint64_t deallocations = 0;
+				size_t bytes_in_use = 0;
+				size_t peak_bytes = 0;
+			};
+
+			// Resources the device allocates from, by category.  Null uses the global heap.  The device serializes
+			// access, so unsynchronized pools and arenas are fine, but each must outlive the device and everything
+			// allocated from it.  FMOD devices take no backend resource, since FMOD's allocations outlive any one device.
+			struct memory_settings
+			{
+				std::pmr::memory_resource* backend = nullptr;
+				std::pmr::memory_resource* voices = nullptr;
+				std::pmr::memory_resource* effects = nullptr;
+				std::pmr::memory_resource* buffers = nullptr;
+			};
+
+			// Chooses what mixes the device's voices and where the result goes.  The software backend is portable
+			// and has no speaker output, so it is meant for headless runs and for benchmarking against FMOD.  Its
+			// default output of speakers throws; set output with it.  Builds
+			// without STDAUDIO_FMOD only have the software backend.  Zero sample_rate or block_length leaves the
+			// choice to the backend.
+			struct device_settings
+			{
+				device_backend backend = device_backend::fmod;
+				device_output output = device_output::speakers;
+				std::filesystem::path output_file;
+				int sample_rate = 0;
+				unsigned int block_length = 0;
+				// Capacity of the loopback ring in frames.  Zero holds two seconds.
+				size_t loopback_length = 0;
+				memory_settings memory;
+			};
+
+			// frames_mixed counts every frame the mixer has produced, read or dropped, so noting it when issuing a
+			// command and finding the command's effect in the loopback gives the end-to-end latency in frames.
+			struct loopback_stats
+			{
+				int sample_rate = 0;
+				int num_channels = 0;
+				uint64_t frames_mixed = 0;
+				uint64_t frames_dropped = 0;
+				uint64_t blocks_mixed = 0;
+				std::chrono::nanoseconds total_mix_time{ 0 };
+				std::chrono::nanoseconds worst_mix_time{ 0 };
+			};
+
+			enum class realtime_violation_type
+			{
+				allocation,
+				deallocation,
+				lock,
+				blocking_call,
+				overrun,
+			};
+
+			// effect is null for the library's own mixer callbacks.  function names the offending call; for overruns
+			// it is the processing itself, and duration is how long the block took against its budget.
+			struct realtime_violation
+			{
+				realtime_violation_type type = realtime_violation_type::allocation;
+				const effect_instance* effect = nullptr;
+				const char* function = nullptr;
+				std::chrono::nanoseconds duration{ 0 };
+				std::chrono::nanoseconds budget{ 0 };
 			};
 
 			class device
 			{
 			public:
 				device();
+				explicit device(const device_settings& settings);
 				~device();
 
 				int num_drivers() const;
 				driver_info get_driver(int index) const;
 				void set_driver(int index);
 
+				// Rate the device mixes at.
+				int get_sample_rate() const;
+
 				std::unique_ptr<voice> play_sound(const std::shared_ptr<source>& sound, bool paused = false);
+				std::unique_ptr<voice> play_sound(const std::shared_ptr<source>& sound, const loop_settings& loop, bool paused = false);
 				std::unique_ptr<submix> create_submix();
 
+				// A return submix mixes in whatever voices and submixes send to it, so a single effect on it can
+				// serve all of them.  It can be found by name with find_return.
+				std::unique_ptr<submix> create_return_submix(const std::string& name);
+				submix* find_return(const std::string& name) const;
+
+				// Call once per game frame.  Gives the backend a chance to do its periodic work, and brings back voices
+				// stolen by a submix voice limit once voices that finished on their own have made room.
+				void update();
+
+				device_profile get_profile() const;
+				void reset_profile();
+
+				// Loopback output only.  read_output copies up to num_frames interleaved frames of the final mix, in
+				// order, and returns how many it copied; it never waits for the mixer.  mix_output mixes whole blocks
+				// until at least num_frames have been produced, and needs loopback_manual output.
+				size_t read_output(float* buffer, size_t num_frames);
+				void mix_output(size_t num_frames);
+				loopback_stats get_output_stats() const;
+
+				// Watches effect processing and the library's mixer callbacks for blocks that take longer than budget,
+				// as a fraction of the block's duration.  Builds with STDAUDIO_REALTIME_CHECKS also catch heap
+				// allocation, locks and blocking calls made from them.  The checks are process-wide, and at most 256
+				// violations are kept between calls to take_realtime_violations.
+				void set_realtime_checks(bool enabled, float budget = 0.5f);
+				std::vector<realtime_violation> take_realtime_violations();
+
+				// The device's front for a category, counting into get_memory_stats.  Pass the buffers resource to
+				// load_from_disk or load_from_memory to load into it.
+				std::pmr::memory_resource* get_memory_resource(memory_category category) const;
+				memory_stats get_memory_stats(memory_category category) const;
+
 			private:
 				friend class effect_instance;
-				FMOD::System* m_system;
+				friend class submix;
+				friend class voice;
+				worker_pool* get_worker_pool();
+				std::vector<profile_node> profile_children(backend_group* group) const;
+				void reset_profile(backend_group* group);
+				loopback_buffer* get_loopback() const;
+
+				std::vector<std::unique_ptr<tracking_resource>> m_memory;
+				std::unique_ptr<backend> m_backend;
+				std::unique_ptr<worker_pool> m_worker_pool;
+				std::unordered_map<std::string, submix*> m_returns;
+				std::vector<submix*> m_voice_limited;
+				uint64_t m_voice_sequence = 0;
 			};
 
 			class voice
@@ -70,9 +310,14 @@ namespace std
 			private:
 				struct constructor_tag {};
 			public:
-				voice(device* dev, FMOD::Channel* channel, FMOD::Sound* fmod_sound, const std::shared_ptr<source>& sound, constructor_tag);
+				voice(device* dev, backend_channel* channel, backend_sound* sound_handle, const std::shared_ptr<source>& sound, constructor_tag);
 				~voice();
 
+				// Voices live in their device's voices resource.
+				static void* operator new(size_t size, std::pmr::memory_resource* resource);
+				static void operator delete(void* p, std::pmr::memory_resource* resource);
+				static void operator delete(void* p);
+
 				void stop();
 				void pause();
 				void resume();
@@ -84,14 +329,36 @@ namespace std
 				float get_pitch() const;
 				float get_pan() const;
 
+				// 0 is the most important and 256 the least, as in FMOD.
+				int get_priority() const;
+				void set_priority(int priority);
+
 				bool is_playing() const;
+				bool is_virtual() const;
+
+				// Loop passes left, as in loop_settings::count.  Setting 0 lets a looping voice play on past the loop
+				// end and finish, for example to release an engine loop into its tail.
+				int get_loop_count() const;
+				void set_loop_count(int count);
 
 				void assign_to_submix(submix& parent);
 
+				float get_send(const submix& bus) const;
+				void set_send(const submix& bus, float level);
+				void set_send(const std::string& bus_name, float level);
+				void remove_send(const submix& bus);
+
+				// Meters the voice's output after its effects.  get_levels never blocks and returns zeroes while
+				// metering is disabled.
+				bool is_metering() const;
+				void set_metering(bool enabled);
+				meter_levels get_levels() const;
+
 				template<typename T, typename... Ts>
 				std::weak_ptr<effect_instance> add_effect(Ts&&... ts)
 				{
-					m_effects.emplace_back(make_shared<effect_instance>(make_unique<T>(std::forward<Ts>(ts)...)));
+					std::pmr::polymorphic_allocator<effect_instance> allocator(m_device->get_memory_resource(memory_category::effects));
+					m_effects.emplace_back(allocate_shared<effect_instance>(allocator, make_unique<T>(std::forward<Ts>(ts)...)));
 					create_dsp(m_effects.back().get());
 					return m_effects.back();
 				}
@@ -100,11 +367,18 @@ namespace std
 				void create_dsp(effect_instance*);
 
 				friend class device;
+				friend class submix;
 				device* m_device;
-				FMOD::Channel* m_channel;
-				FMOD::Sound* m_sound;
+				submix* m_submix = nullptr;
+				uint64_t m_sequence = 0;
+				bool m_stolen = false;
+				backend_channel* m_channel;
+				backend_sound* m_sound;
 				std::shared_ptr<source> m_source;
 				std::vector<std::shared_ptr<effect_instance>> m_effects;
+				std::vector<std::pair<const submix*, backend_dsp*>> m_sends;
+				std::unique_ptr<level_meter> m_meter;
+				backend_dsp* m_meter_dsp = nullptr;
 				float pan = 0.0f;
 			};
 
@@ -123,6 +397,10 @@ namespace std
 				pcm24,
 				pcm32,
 				pcmfloat,
+
+				// 4-bit block ADPCM, about a quarter the size of pcm16.  It stays compressed in memory and the backends
+				// decode it as it plays.  Produce it with load_settings::format.
+				adpcm,
 			};
 
 			struct memory_buffer_description
@@ -145,64 +423,331 @@ namespace std
 				virtual memory_buffer_data get_audio_data() const = 0;
 			};
 
+			// Measured once at load.  Integrated loudness is ITU-R BS.1770 gated loudness in LUFS; peak and RMS are
+			// linear over the whole clip.  The values describe the stored samples, after any normalization_gain.
+			struct loudness_info
+			{
+				float integrated_loudness = -std::numeric_limits<float>::infinity();
+				float peak = 0.0f;
+				float rms = 0.0f;
+				float normalization_gain = 1.0f;
+			};
+
+			// Conversions applied once while loading, so that the mixer doesn't repeat them on every playback.  Unset
+			// members keep the source's own value.
+			struct load_settings
+			{
+				std::optional<memory_buffer_format> format;
+
+				// Resamples with a windowed sinc filter, for example to device::get_sample_rate so that voices play
+				// without resampling in the mixer.
+				std::optional<unsigned int> frequency;
+
+				// Mixes the channels down or remaps them, for example to mono for positional sound effects.
+				// channel_matrix, if given, has a row of input channel gains for each output channel; otherwise a
+				// standard downmix is used, following FMOD's channel order.
+				std::optional<unsigned int> num_channels;
+				std::vector<float> channel_matrix;
+
+				// Measures the clip for buffer::get_loudness.  normalize_loudness also scales it to that integrated
+				// loudness in LUFS, limited so that the peak doesn't go over full scale, which removes the need for
+				// runtime normalization on the buses.
+				bool analyze_loudness = false;
+				std::optional<float> normalize_loudness;
+			};
+
 			class buffer : public source
 			{
 			public:
 				memory_buffer_data get_audio_data() const override;
 
+				// Empty unless the buffer was loaded with analyze_loudness or normalize_loudness.
+				const std::optional<loudness_info>& get_loudness() const;
+
+				// Loop points stored in the file, if any, moved to match any change of sample rate at load.
+				const std::optional<loop_region>& get_loop_points() const;
+
 			private:
-				friend std::shared_ptr<buffer> load_from_disk(const std::experimental::filesystem::path&);
-				friend std::shared_ptr<buffer> load_from_memory(const memory_buffer&, const memory_buffer_description&, bool);
-				std::variant<std::vector<std::byte>, memory_buffer> m_data;
+				friend std::shared_ptr<buffer> load_from_disk(const std::filesystem::path&, std::pmr::memory_resource*);
+				friend std::shared_ptr<buffer> load_from_disk(const std::filesystem::path&, const load_settings&, std::pmr::memory_resource*);
+				friend std::shared_ptr<buffer> load_from_memory(const memory_buffer&, const memory_buffer_description&, bool, std::pmr::memory_resource*);
+				friend std::shared_ptr<buffer> load_from_memory(const memory_buffer&, const memory_buffer_description&, const load_settings&, std::pmr::memory_resource*);
+				std::variant<std::pmr::vector<std::byte>, memory_buffer> m_data;
 				memory_buffer_description m_description;
+				std::optional<loudness_info> m_loudness;
+				std::optional<loop_region> m_loop_points;
+			};
+
+			// The buffer and its samples are allocated from resource, or the global heap when it is null.
+			std::shared_ptr<buffer> load_from_disk(const std::filesystem::path& filepath, std::pmr::memory_resource* resource = nullptr);
+			std::shared_ptr<buffer> load_from_disk(const std::filesystem::path& filepath, const load_settings& settings, std::pmr::memory_resource* resource = nullptr);
+			std::shared_ptr<buffer> load_from_memory(const memory_buffer& buffer, const memory_buffer_description& description, bool copy = true, std::pmr::memory_resource* resource = nullptr);
+			std::shared_ptr<buffer> load_from_memory(const memory_buffer& buffer, const memory_buffer_description& description, const load_settings& settings, std::pmr::memory_resource* resource = nullptr);
+
+			// A range of frames within a buffer, played without copying.  The view shares ownership of the buffer, so
+			// slices of a sound sheet (many short cues in one file) can outlive the sheet's own handle.  ADPCM buffers
+			// can't be sliced, since their blocks only decode from the start of the data.
+			class buffer_view : public source
+			{
+			public:
+				buffer_view(std::shared_ptr<buffer> parent, size_t first_frame, size_t num_frames);
+
+				memory_buffer_data get_audio_data() const override;
+
+				const std::shared_ptr<buffer>& get_buffer() const;
+				size_t get_first_frame() const;
+				size_t get_num_frames() const;
+
+			private:
+				std::shared_ptr<buffer> m_buffer;
+				size_t m_first_frame;
+				size_t m_num_frames;
+			};
+
+			// Plays a file as it is decoded instead of loading it up front.  subsound picks an entry of a container
+			// such as a sound pack.  Needs the FMOD backend.
+			class stream : public source
+			{
+			public:
+				explicit stream(const std::filesystem::path& filepath, int subsound = -1);
+
+				// Streams have no data in memory, so this is always empty.
+				memory_buffer_data get_audio_data() const override;
+
+				const std::filesystem::path& get_path() const;
+				int get_subsound() const;
+
+			private:
+				std::filesystem::path m_path;
+				int m_subsound;
+			};
+
+			// A source that produces its samples as it plays, for procedural sounds such as engines, wind or UI tones.
+			// The mixer pulls a block at a time through render, on the mixer or streaming thread, so render must not
+			// block or allocate.  A synth plays on one voice at a time: play_sound throws std::runtime_error while a
+			// voice playing it still exists, stopped or not.
+			class synth : public source
+			{
+			public:
+				synth(unsigned int num_channels, unsigned int frequency);
+
+				// Synths have no data in memory, so this only carries the description.  Samples are always float.
+				memory_buffer_data get_audio_data() const override;
+
+				// Writes num_frames interleaved frames.
+				virtual void render(float* output, size_t num_frames) = 0;
+
+				unsigned int get_num_channels() const;
+				unsigned int get_frequency() const;
+
+			private:
+				friend class device;
+				friend class voice;
+				memory_buffer_description m_description;
+				std::atomic<bool> m_playing{ false };
+			};
+
+			// A sound pack holds many named sounds in one file.  FMOD opens packs through the library's own codec, so
+			// a stream of a pack entry reads straight from the archive and seeks within it.
+			struct pack_source
+			{
+				std::string name;
+				std::shared_ptr<buffer> sound;
 			};
 
-			std::shared_ptr<buffer> load_from_disk(const std::experimental::filesystem::path& filepath);
-			std::shared_ptr<buffer> load_from_memory(const memory_buffer& buffer, const memory_buffer_description& description, bool copy = true);
+			void save_pack(const std::filesystem::path& filepath, const std::vector<pack_source>& entries);
+
+			// Index of the named entry for stream, or -1 if the pack has none.
+			int find_pack_entry(const std::filesystem::path& filepath, const std::string& name);
+
+			// Sample conversions behind load_settings, for callers preparing their own data.  Integer formats map to
+			// [-1, 1), and converting to one rounds to nearest and clips.
+			void convert_samples(const std::byte* input, memory_buffer_format input_format, std::byte* output, memory_buffer_format output_format, size_t num_samples);
+
+			// Planar data holds all num_frames samples of each channel in turn.
+			void deinterleave(const float* input, float* output, size_t num_frames, unsigned int num_channels);
+			void interleave(const float* input, float* output, size_t num_frames, unsigned int num_channels);
 
 			class submix
 			{
 			private:
 				struct constructor_tag {};
 			public:
-				submix(device* dev, FMOD::ChannelGroup* channelgroup, constructor_tag);
+				submix(device* dev, backend_group* group, constructor_tag);
 				~submix();
 
 				float get_volume() const;
+				bool is_parallel() const;
 
 				void set_volume(float volume);
 
+				// Runs this submix's effects on the device's worker threads so that independent submixes are processed
+				// concurrently.  Each effect is its own pipeline stage, one block behind the mixer, rather than the
+				// subtree being joined within the block: every effect adds one block of latency, so a submix with
+				// three effects plays three blocks late.  A block a worker hasn't finished when the mixer needs it is
+				// played as silence and counted in profile_counters::missed_deadlines.
+				void set_parallel(bool parallel);
+
 				void assign_to_submix(submix& parent);
 
+				bool is_return() const;
+				const std::string& get_name() const;
+
+				float get_send(const submix& bus) const;
+				void set_send(const submix& bus, float level);
+				void set_send(const std::string& bus_name, float level);
+				void remove_send(const submix& bus);
+
+				bool is_metering() const;
+				void set_metering(bool enabled);
+				meter_levels get_levels() const;
+
+				// Caps the number of audible voices assigned directly to this submix.  When a new voice pushes it over
+				// the limit the least important one, as ranked by policy, is virtualized or stopped.  Virtualized voices
+				// come back once there is room again: straight away when a voice is stopped, destroyed or moved, and
+				// at the next device::update when one finishes on its own.  A virtualized voice is muted and carries on
+				// silently, holding one of the backend's channels.  The software backend skips mixing it; FMOD mixes it
+				// until it runs short of real channels, and then virtualizes it before anything audible.
+				void set_voice_limit(unsigned int max_voices, voice_steal_policy policy = voice_steal_policy::oldest, voice_steal_mode mode = voice_steal_mode::virtualize);
+				void clear_voice_limit();
+
+				// Ducks this submix whenever key is active.  Both the envelope and the gain run in the mixer.
+				void set_ducking(submix& key, const ducking_settings& settings);
+				void clear_ducking();
+
 				template<typename T, typename... Ts>
 				std::weak_ptr<effect_instance> add_effect(Ts&&... ts)
 				{
-					m_effects.emplace_back(make_shared<effect_instance>(make_unique<T>(std::forward<Ts>(ts)...)));
+					std::pmr::polymorphic_allocator<effect_instance> allocator(m_device->get_memory_resource(memory_category::effects));
+					m_effects.emplace_back(allocate_shared<effect_instance>(allocator, make_unique<T>(std::forward<Ts>(ts)...)));
 					create_dsp(m_effects.back().get());
 					return m_effects.back();
 				}
 
 			private:
 				void create_dsp(effect_instance*);
+				void set_worker_pool(effect_instance*);
+				void make_return(const std::string& name);
+				void enable_sidechain();
+				void attach_voice(voice* v);
+				void detach_voice(voice* v);
+				void enforce_voice_limit();
+				bool is_less_important(const voice& a, const voice& b) const;
 
 				friend class device;
 				friend class voice;
 				device* m_device;
-				FMOD::ChannelGroup* m_channelgroup;
+				backend_group* m_group;
 				std::vector<std::shared_ptr<effect_instance>> m_effects;
+				std::vector<std::pair<const submix*, backend_dsp*>> m_sends;
+				std::unique_ptr<level_meter> m_meter;
+				backend_dsp* m_meter_dsp = nullptr;
+				std::shared_ptr<sidechain_envelope> m_sidechain;
+				backend_dsp* m_sidechain_dsp = nullptr;
+				std::unique_ptr<ducker> m_ducker;
+				backend_dsp* m_ducker_dsp = nullptr;
+				const submix* m_ducking_key = nullptr;
+				std::vector<voice*> m_voices;
+
+				// Voices and submixes sending to this return, as their node and send list, so that it can take their
+				// sends down with it.  Kept up to date by set_send and remove_send on a const submix.
+				mutable std::vector<std::pair<backend_node*, std::vector<std::pair<const submix*, backend_dsp*>>*>> m_senders;
+				unsigned int m_max_voices = 0;
+				voice_steal_policy m_steal_policy = voice_steal_policy::oldest;
+				voice_steal_mode m_steal_mode = voice_steal_mode::virtualize;
+				bool m_parallel = false;
+				std::string m_name;
+				backend_dsp* m_return_dsp = nullptr;
+				int m_return_id = -1;
 			};
 
 			class effect
 			{
 			public:
+				static constexpr size_t infinite_tail = static_cast<size_t>(-1);
+
 				virtual ~effect() {}
 				virtual void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) = 0;
+
+				// Number of samples the effect keeps producing output after its input goes silent.  Once the input
+				// and the tail are both silent the effect is bypassed until its input becomes active again.
+				virtual size_t tail_length_samples() const { return infinite_tail; }
+			};
+
+			// Fuses several effects into a single DSP node.  The members are run back-to-back in small chunks so the
+			// intermediate results stay in cache, and are called non-virtually so the compiler can inline them.
+			template<typename... Ts>
+			class chain : public effect
+			{
+			public:
+				static_assert(sizeof...(Ts) > 0, "chain requires at least one effect");
+
+				chain() = default;
+				explicit chain(Ts... effects) : m_effects(std::move(effects)...) {}
+
+				template<size_t I>
+				auto& get() { return std::get<I>(m_effects); }
+				template<size_t I>
+				const auto& get() const { return std::get<I>(m_effects); }
+
+				void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+				{
+					const size_t chunk_samples = std::max<size_t>(1, scratch_size / num_channels);
+					for (size_t offset = 0; offset < length_samples; offset += chunk_samples)
+					{
+						size_t length = std::min(chunk_samples, length_samples - offset);
+						size_t position = offset * num_channels;
+						process_chunk(buffer_in + position, buffer_out + position, length, num_channels, std::index_sequence_for<Ts...>{});
+					}
+				}
+
+				size_t tail_length_samples() const override
+				{
+					return std::apply([](const Ts&... effects)
+					{
+						size_t total = 0;
+						for (size_t tail : { effects.Ts::tail_length_samples()... })
+						{
+							if (tail == infinite_tail)
+								return infinite_tail;
+							total += tail;
+						}
+						return total;
+					}, m_effects);
+				}
+
+			private:
+				static constexpr size_t scratch_size = 1024;
+
+				template<size_t... Is>
+				void process_chunk(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels, std::index_sequence<Is...>)
+				{
+					(process_stage<Is>(buffer_in, buffer_out, length_samples, num_channels), ...);
+				}
+
+				// Stages alternate between the scratch buffer and the output so that the last one lands in the output.
+				template<size_t I>
+				void process_stage(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels)
+				{
+					using T = std::tuple_element_t<I, std::tuple<Ts...>>;
+					constexpr bool writes_output = (sizeof...(Ts) - 1 - I) % 2 == 0;
+					float* stage_out = writes_output ? buffer_out : m_scratch;
+					float* stage_in = (I == 0) ? buffer_in : (writes_output ? m_scratch : buffer_out);
+					std::get<I>(m_effects).T::process(stage_in, stage_out, length_samples, num_channels);
+				}
+
+				std::tuple<Ts...> m_effects;
+				float m_scratch[scratch_size];
 			};
 
 			class effect_instance
 			{
 			public:
-				effect_instance(std::unique_ptr<effect> e);
+				// Voices and submixes create instances with allocate_shared, which passes the allocator along so that
+				// the job buffers come from the same resource.
+				using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+				effect_instance(std::unique_ptr<effect> e, const allocator_type& allocator = {});
 				~effect_instance();
 
 				template<typename T>
@@ -210,13 +755,41 @@ namespace std
 				template<typename T>
 				const T* get_effect() const { return static_cast<T*>(m_effect.get()); }
 
+				bool should_process(bool inputs_idle, size_t length_samples);
+				void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels);
+
+				profile_counters get_profile() const;
+				void reset_profile();
+
 			private:
 				friend class voice;
 				friend class submix;
-				void create_dsp(device* dev, FMOD::ChannelControl* ChannelControl);
+				friend class worker_pool;
+				void create_dsp(device* dev, backend_node* node);
+				void set_worker_pool(worker_pool* pool, size_t reserve_samples);
+				void process_block(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels);
+				void process_effect(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels);
+				bool wait_for_job(size_t length_samples) const;
+				void run_job();
 
 				std::unique_ptr<effect> m_effect;
-				FMOD::DSP* m_dsp;
+				backend* m_backend = nullptr;
+				backend_dsp* m_dsp = nullptr;
+				size_t m_tail_remaining = 0;
+
+				std::atomic<worker_pool*> m_worker_pool{ nullptr };
+				std::atomic<bool> m_job_pending{ false };
+				bool m_job_flush = false;
+				std::pmr::vector<float> m_job_input;
+				std::pmr::vector<float> m_job_output;
+				size_t m_job_length = 0;
+				int m_job_channels = 0;
+
+				std::atomic<uint64_t> m_profile_calls{ 0 };
+				std::atomic<int64_t> m_profile_total_ns{ 0 };
+				std::atomic<int64_t> m_profile_worst_ns{ 0 };
+				std::atomic<uint64_t> m_profile_missed{ 0 };
+				std::atomic<bool> m_profile_reset{ false };
 			};
 		}
 	}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "audio.h"
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			// Handles are opaque; each backend maps them onto its own objects.  Channels and groups are both nodes,
+			// which is what volume, pause and DSP placement operate on.
+			struct backend_node {};
+			struct backend_channel : backend_node {};
+			struct backend_group : backend_node {};
+			struct backend_sound;
+			struct backend_dsp;
+			class fmod_backend;
+			class software_backend;
+
+			// What a DSP node wants the mixer to do with the current block.  skip passes the input through untouched,
+			// silence outputs nothing and lets everything downstream go idle.
+			enum class dsp_result
+			{
+				process,
+				skip,
+				silence,
+			};
+
+			// Without a should_process callback the node is processed every block, idle or not.
+			struct dsp_callbacks
+			{
+				void (*read)(void* userdata, float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) = nullptr;
+				dsp_result (*should_process)(void* userdata, bool inputs_idle, size_t length_samples, int num_channels) = nullptr;
+				void* userdata = nullptr;
+			};
+
+			// A sound whose samples come from read, a block at a time, rather than from memory.  read fills
+			// length_frames interleaved frames of num_channels float channels at frequency.
+			struct generator_callbacks
+			{
+				void (*read)(void* userdata, float* output, size_t length_frames) = nullptr;
+				void* userdata = nullptr;
+				unsigned int num_channels = 0;
+				unsigned int frequency = 0;
+			};
+
+			// The widest block a DSP callback is handed, matching FMOD's limit.  DSPs that keep per-channel state size it
+			// for this up front so the mixer thread never has to grow it.
+			constexpr int max_dsp_channels = 32;
+
+			// Head DSPs run after the node's fader, tail DSPs before it.
+			enum class dsp_position
+			{
+				head,
+				tail,
+			};
+
+			// Everything device, voice, submix and effect_instance need from the layer that does the mixing.  A backend
+			// is chosen when the device is constructed and is driven from the game thread; only the DSP callbacks run
+			// on the mixer thread.
+			class backend
+			{
+			public:
+				virtual ~backend() {}
+
+				virtual int num_drivers() const = 0;
+				virtual driver_info get_driver(int index) const = 0;
+				virtual void set_driver(int index) = 0;
+
+				virtual int get_sample_rate() const = 0;
+				virtual unsigned int get_block_length() const = 0;
+
+				// Periodic game-thread work, once per device::update.
+				virtual void update() = 0;
+
+				// Percentages of real time spent in the DSP graph and in the mixer as a whole.
+				virtual void get_cpu_usage(float& dsp_usage, float& total_usage) const = 0;
+
+				// FMOD has one allocator for the whole process, so the FMOD backend counts its allocations itself and
+				// returns true.  Backends that allocate from the resource they were created with return false.
+				virtual bool get_memory_stats(memory_stats& stats) const = 0;
+
+				// Null unless the backend was created with loopback output.  mix_loopback mixes synchronously and is
+				// only valid for loopback_manual.
+				virtual loopback_buffer* get_loopback() = 0;
+				virtual void mix_loopback(size_t num_frames) = 0;
+
+				virtual backend_sound* create_sound(const memory_buffer_data& data) = 0;
+				virtual backend_sound* create_stream(const std::filesystem::path& filepath, int subsound) = 0;
+				virtual backend_sound* create_generator(const generator_callbacks& generator) = 0;
+				virtual backend_channel* play(backend_sound* sound, bool paused) = 0;
+				virtual backend_group* create_group() = 0;
+				virtual backend_group* get_master_group() = 0;
+
+				virtual void release(backend_sound* sound) = 0;
+				virtual void release(backend_channel* channel) = 0;
+				virtual void release(backend_group* group) = 0;
+				virtual void release(backend_dsp* dsp) = 0;
+
+				virtual float get_volume(backend_node* node) const = 0;
+				virtual void set_volume(backend_node* node, float volume) = 0;
+				virtual void set_paused(backend_node* node, bool paused) = 0;
+				virtual void set_mute(backend_node* node, bool mute) = 0;
+				virtual void* get_user_data(backend_node* node) const = 0;
+				virtual void set_user_data(backend_node* node, void* user_data) = 0;
+				virtual void add_dsp(backend_node* node, backend_dsp* dsp, dsp_position position) = 0;
+				virtual void remove_dsp(backend_node* node, backend_dsp* dsp) = 0;
+				virtual void move_dsp_to_head(backend_node* node, backend_dsp* dsp) = 0;
+
+				virtual void stop(backend_channel* channel) = 0;
+				virtual float get_pitch(backend_channel* channel) const = 0;
+				virtual void set_pitch(backend_channel* channel, float pitch) = 0;
+				virtual void set_pan(backend_channel* channel, float pan) = 0;
+				virtual int get_priority(backend_channel* channel) const = 0;
+				virtual void set_priority(backend_channel* channel, int priority) = 0;
+				// Plays [start_frame, end_frame) count more times after the first pass, or forever for -1.  An
+				// end_frame of 0 means the end of the sound.
+				virtual void set_loop(backend_channel* channel, int count, size_t start_frame, size_t end_frame) = 0;
+				virtual int get_loop_count(backend_channel* channel) const = 0;
+				virtual void set_loop_count(backend_channel* channel, int count) = 0;
+				virtual float get_audibility(backend_channel* channel) const = 0;
+				virtual bool is_playing(backend_channel* channel) const = 0;
+				virtual bool is_virtual(backend_channel* channel) const = 0;
+				virtual void set_group(backend_channel* channel, backend_group* group) = 0;
+
+				virtual void add_group(backend_group* parent, backend_group* child) = 0;
+				virtual size_t get_num_groups(backend_group* group) const = 0;
+				virtual backend_group* get_group(backend_group* group, size_t index) const = 0;
+				virtual size_t get_num_channels(backend_group* group) const = 0;
+				virtual backend_channel* get_channel(backend_group* group, size_t index) const = 0;
+
+				virtual backend_dsp* create_dsp(const dsp_callbacks& callbacks) = 0;
+				virtual backend_dsp* create_send(int return_id, float level) = 0;
+				virtual backend_dsp* create_return() = 0;
+				virtual float get_send_level(backend_dsp* dsp) const = 0;
+				virtual void set_send_level(backend_dsp* dsp, float level) = 0;
+				virtual int get_return_id(backend_dsp* dsp) const = 0;
+			};
+
+			// resource takes the backend's own allocations in place of settings.memory.backend, so that the device can
+			// count them.  The FMOD backend only exists in builds with STDAUDIO_FMOD.
+#if STDAUDIO_FMOD
+			std::unique_ptr<backend> create_fmod_backend(const device_settings& settings, std::pmr::memory_resource* resource);
+
+			// Routes FMOD's allocations to one resource that lives as long as the process.  Must run before any FMOD
+			// system is created; throws if FMOD refuses it.
+			void install_fmod_allocator();
+#endif
+			std::unique_ptr<backend> create_software_backend(const device_settings& settings, std::pmr::memory_resource* resource);
+
+			// FMOD takes file names as UTF-8, and u8string returns std::string before C++20 and std::u8string after.
+			inline std::string to_utf8(const std::filesystem::path& path)
+			{
+				auto utf8 = path.generic_u8string();
+				return std::string(utf8.begin(), utf8.end());
+			}
+		}
+	}
+}
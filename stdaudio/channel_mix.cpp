@@ -0,0 +1,96 @@
+#include "channel_mix.h"
+#include "simd.h"
+#include <stdexcept>
+
+static void ScaledAdd(float* output, const float* input, float gain, size_t length)
+{
+	size_t i = 0;
+#if STDAUDIO_SSE
+	const __m128 gain4 = _mm_set1_ps(gain);
+	for (; i + 4 <= length; i += 4)
+		_mm_storeu_ps(output + i, _mm_add_ps(_mm_loadu_ps(output + i), _mm_mul_ps(_mm_loadu_ps(input + i), gain4)));
+#endif
+	for (; i < length; i++)
+		output[i] += input[i] * gain;
+}
+
+static std::vector<float> SurroundToStereo(unsigned int input_channels)
+{
+	// L R C LFE SL SR BL BR, or L R SL SR for quad.
+	const float minus_3db = 0.70710678f;
+	std::vector<float> matrix(2 * input_channels, 0.0f);
+	matrix[0] = 1.0f;
+	matrix[input_channels + 1] = 1.0f;
+	if (input_channels == 4)
+	{
+		matrix[2] = minus_3db;
+		matrix[input_channels + 3] = minus_3db;
+		return matrix;
+	}
+
+	matrix[2] = minus_3db;
+	matrix[input_channels + 2] = minus_3db;
+	for (unsigned int channel = 4; channel < input_channels; channel++)
+		matrix[(channel % 2) * input_channels + channel] = minus_3db;
+	return matrix;
+}
+
+std::vector<float> std::experimental::audio::default_channel_matrix(unsigned int input_channels, unsigned int output_channels)
+{
+	if (input_channels == 0 || output_channels == 0)
+		throw std::invalid_argument("Invalid channel count");
+
+	std::vector<float> matrix(output_channels * input_channels, 0.0f);
+	bool surround = input_channels == 4 || input_channels == 6 || input_channels == 8;
+	if (surround && output_channels <= 2)
+	{
+		std::vector<float> stereo = SurroundToStereo(input_channels);
+		if (output_channels == 2)
+			return stereo;
+		for (unsigned int channel = 0; channel < input_channels; channel++)
+			matrix[channel] = 0.5f * (stereo[channel] + stereo[input_channels + channel]);
+		return matrix;
+	}
+
+	if (output_channels == 1)
+	{
+		for (unsigned int channel = 0; channel < input_channels; channel++)
+			matrix[channel] = 1.0f / input_channels;
+		return matrix;
+	}
+
+	if (input_channels == 1)
+	{
+		matrix[0] = 1.0f;
+		matrix[1] = 1.0f;
+		return matrix;
+	}
+
+	for (unsigned int channel = 0; channel < input_channels; channel++)
+		matrix[(channel % output_channels) * input_channels + channel] = 1.0f;
+	return matrix;
+}
+
+std::vector<float> std::experimental::audio::mix_channels(const float* input, size_t num_frames, unsigned int input_channels, unsigned int output_channels, const std::vector<float>& matrix)
+{
+	if (matrix.size() != static_cast<size_t>(input_channels) * output_channels)
+		throw std::invalid_argument("The channel matrix does not match the channel counts");
+
+	// Working on planar data turns each matrix entry into one contiguous scaled add.
+	std::vector<float> planar_input(num_frames * input_channels);
+	std::vector<float> planar_output(num_frames * output_channels, 0.0f);
+	deinterleave(input, planar_input.data(), num_frames, input_channels);
+	for (unsigned int output = 0; output < output_channels; output++)
+	{
+		for (unsigned int channel = 0; channel < input_channels; channel++)
+		{
+			float gain = matrix[output * input_channels + channel];
+			if (gain != 0.0f)
+				ScaledAdd(planar_output.data() + output * num_frames, planar_input.data() + channel * num_frames, gain, num_frames);
+		}
+	}
+
+	std::vector<float> output(num_frames * output_channels);
+	interleave(planar_output.data(), output.data(), num_frames, output_channels);
+	return output;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "audio.h"
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			// Matrix behind load_settings::num_channels when no channel_matrix is given, row-major with one row per
+			// output channel.  Layouts follow FMOD's order (L R C LFE SL SR [BL BR]).  Surround folds down to stereo
+			// with the usual -3dB center and surround gains and no LFE, and mono takes the average of that stereo
+			// pair.  Mono to stereo duplicates the channel.  Other layouts keep the channels they have in common and
+			// fold any extra ones onto the outputs in turn.
+			std::vector<float> default_channel_matrix(unsigned int input_channels, unsigned int output_channels);
+
+			// Applies matrix to num_frames interleaved frames.
+			std::vector<float> mix_channels(const float* input, size_t num_frames, unsigned int input_channels, unsigned int output_channels, const std::vector<float>& matrix);
+		}
+	}
+}
@@ -0,0 +1,340 @@
+#include "convolution_reverb.h"
+#include "simd.h"
+#include "sample_format.h"
+#include <cmath>
+#include <stdexcept>
+
+// Real-input FFT built on a half-length radix-2 complex FFT.  Spectra are stored split (separate real and imaginary
+// arrays) so that the complex multiply-accumulate in the convolution vectorizes cleanly.
+class std::experimental::audio::convolution_reverb::real_fft
+{
+public:
+	explicit real_fft(size_t size) :
+		m_size(size),
+		m_half(size / 2),
+		m_bitrev(m_half),
+		m_cos(m_half / 2 + 1),
+		m_sin(m_half / 2 + 1),
+		m_real_cos(m_half + 1),
+		m_real_sin(m_half + 1),
+		m_work_re(m_half),
+		m_work_im(m_half)
+	{
+		const double pi = 3.14159265358979323846;
+
+		size_t bits = 0;
+		while ((size_t(1) << bits) < m_half)
+			bits++;
+		for (size_t i = 0; i < m_half; i++)
+		{
+			size_t reversed = 0;
+			for (size_t b = 0; b < bits; b++)
+			{
+				if (i & (size_t(1) << b))
+					reversed |= size_t(1) << (bits - 1 - b);
+			}
+			m_bitrev[i] = reversed;
+		}
+		for (size_t k = 0; k < m_cos.size(); k++)
+		{
+			m_cos[k] = static_cast<float>(std::cos(2.0 * pi * k / m_half));
+			m_sin[k] = static_cast<float>(std::sin(2.0 * pi * k / m_half));
+		}
+		for (size_t k = 0; k <= m_half; k++)
+		{
+			m_real_cos[k] = static_cast<float>(std::cos(2.0 * pi * k / m_size));
+			m_real_sin[k] = static_cast<float>(std::sin(2.0 * pi * k / m_size));
+		}
+	}
+
+	// size real samples in, size / 2 + 1 bins out.
+	void forward(const float* input, float* out_re, float* out_im)
+	{
+		for (size_t k = 0; k < m_half; k++)
+		{
+			m_work_re[k] = input[2 * k];
+			m_work_im[k] = input[2 * k + 1];
+		}
+		transform(m_work_re.data(), m_work_im.data(), -1.0f);
+
+		for (size_t k = 0; k <= m_half; k++)
+		{
+			size_t a = k % m_half;
+			size_t b = (m_half - k) % m_half;
+			float sum_re = 0.5f * (m_work_re[a] + m_work_re[b]);
+			float sum_im = 0.5f * (m_work_im[a] - m_work_im[b]);
+			float odd_re = 0.5f * (m_work_im[a] + m_work_im[b]);
+			float odd_im = -0.5f * (m_work_re[a] - m_work_re[b]);
+			float c = m_real_cos[k];
+			float s = m_real_sin[k];
+			out_re[k] = sum_re + c * odd_re + s * odd_im;
+			out_im[k] = sum_im + c * odd_im - s * odd_re;
+		}
+	}
+
+	// size / 2 + 1 bins in, size real samples out.  The result is scaled by size.
+	void inverse(const float* in_re, const float* in_im, float* output)
+	{
+		for (size_t k = 0; k < m_half; k++)
+		{
+			size_t b = m_half - k;
+			float sum_re = in_re[k] + in_re[b];
+			float sum_im = in_im[k] - in_im[b];
+			float diff_re = in_re[k] - in_re[b];
+			float diff_im = in_im[k] + in_im[b];
+			float c = m_real_cos[k];
+			float s = m_real_sin[k];
+			float odd_re = diff_re * c - diff_im * s;
+			float odd_im = diff_re * s + diff_im * c;
+			m_work_re[k] = sum_re - odd_im;
+			m_work_im[k] = sum_im + odd_re;
+		}
+		transform(m_work_re.data(), m_work_im.data(), 1.0f);
+
+		for (size_t k = 0; k < m_half; k++)
+		{
+			output[2 * k] = m_work_re[k];
+			output[2 * k + 1] = m_work_im[k];
+		}
+	}
+
+private:
+	void transform(float* re, float* im, float direction) const
+	{
+		for (size_t i = 0; i < m_half; i++)
+		{
+			size_t j = m_bitrev[i];
+			if (j > i)
+			{
+				std::swap(re[i], re[j]);
+				std::swap(im[i], im[j]);
+			}
+		}
+
+		for (size_t length = 2; length <= m_half; length <<= 1)
+		{
+			size_t half_length = length / 2;
+			size_t step = m_half / length;
+			for (size_t start = 0; start < m_half; start += length)
+			{
+				for (size_t k = 0; k < half_length; k++)
+				{
+					float wr = m_cos[k * step];
+					float wi = direction * m_sin[k * step];
+					size_t a = start + k;
+					size_t b = a + half_length;
+					float tr = re[b] * wr - im[b] * wi;
+					float ti = re[b] * wi + im[b] * wr;
+					re[b] = re[a] - tr;
+					im[b] = im[a] - ti;
+					re[a] += tr;
+					im[a] += ti;
+				}
+			}
+		}
+	}
+
+	size_t m_size;
+	size_t m_half;
+	std::vector<size_t> m_bitrev;
+	std::vector<float> m_cos;
+	std::vector<float> m_sin;
+	std::vector<float> m_real_cos;
+	std::vector<float> m_real_sin;
+	std::vector<float> m_work_re;
+	std::vector<float> m_work_im;
+};
+
+static void ComplexMultiplyAccumulate(
+	const float* x_re,
+	const float* x_im,
+	const float* h_re,
+	const float* h_im,
+	float* y_re,
+	float* y_im,
+	size_t count)
+{
+	size_t i = 0;
+#if STDAUDIO_SSE
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 xr = _mm_loadu_ps(x_re + i);
+		__m128 xi = _mm_loadu_ps(x_im + i);
+		__m128 hr = _mm_loadu_ps(h_re + i);
+		__m128 hi = _mm_loadu_ps(h_im + i);
+		__m128 yr = _mm_loadu_ps(y_re + i);
+		__m128 yi = _mm_loadu_ps(y_im + i);
+		yr = _mm_add_ps(yr, _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi)));
+		yi = _mm_add_ps(yi, _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr)));
+		_mm_storeu_ps(y_re + i, yr);
+		_mm_storeu_ps(y_im + i, yi);
+	}
+#endif
+	for (; i < count; i++)
+	{
+		y_re[i] += x_re[i] * h_re[i] - x_im[i] * h_im[i];
+		y_im[i] += x_re[i] * h_im[i] + x_im[i] * h_re[i];
+	}
+}
+
+static size_t RoundUpPowerOfTwo(size_t value)
+{
+	size_t result = 1;
+	while (result < value)
+		result <<= 1;
+	return result;
+}
+
+std::experimental::audio::convolution_reverb::convolution_reverb(const std::shared_ptr<buffer>& impulse_response, size_t partition_size, unsigned int max_channels) :
+	m_partition_size(RoundUpPowerOfTwo(std::max<size_t>(partition_size, 4)))
+{
+	auto audio_data = impulse_response->get_audio_data();
+	size_t sample_size = bytes_per_sample(audio_data.description.format);
+	m_ir_channels = audio_data.description.num_channels;
+	if (sample_size == 0 || m_ir_channels == 0)
+		throw std::invalid_argument("Unsupported impulse response format");
+
+	m_ir_length = audio_data.data.size / (sample_size * m_ir_channels);
+	m_num_partitions = std::max<size_t>(1, (m_ir_length + m_partition_size - 1) / m_partition_size);
+	m_bin_stride = (m_partition_size + 1 + 3) & ~size_t(3);
+	m_fft = std::make_unique<real_fft>(m_partition_size * 2);
+
+	// The inverse transform is unnormalized, so fold the 1 / N scale into the impulse response spectra.
+	const float scale = 1.0f / (m_partition_size * 2);
+	m_ir_re.assign(m_ir_channels * m_num_partitions * m_bin_stride, 0.0f);
+	m_ir_im.assign(m_ir_channels * m_num_partitions * m_bin_stride, 0.0f);
+	std::vector<float> partition(m_partition_size * 2);
+	for (unsigned int channel = 0; channel < m_ir_channels; channel++)
+	{
+		for (size_t p = 0; p < m_num_partitions; p++)
+		{
+			std::fill(partition.begin(), partition.end(), 0.0f);
+			for (size_t i = 0; i < m_partition_size; i++)
+			{
+				size_t frame = p * m_partition_size + i;
+				if (frame >= m_ir_length)
+					break;
+				partition[i] = scale * read_sample(audio_data.data.data + (frame * m_ir_channels + channel) * sample_size, audio_data.description.format);
+			}
+			size_t offset = (channel * m_num_partitions + p) * m_bin_stride;
+			m_fft->forward(partition.data(), m_ir_re.data() + offset, m_ir_im.data() + offset);
+		}
+	}
+
+	m_accum_re.resize(m_bin_stride);
+	m_accum_im.resize(m_bin_stride);
+	m_time_scratch.resize(m_partition_size * 2);
+
+	m_channels.resize(std::max(max_channels, m_ir_channels));
+	for (auto& state : m_channels)
+	{
+		state.input_history.assign(m_partition_size * 2, 0.0f);
+		state.input_fifo.assign(m_partition_size, 0.0f);
+		state.output_fifo.assign(m_partition_size, 0.0f);
+		state.spectra_re.assign(m_num_partitions * m_bin_stride, 0.0f);
+		state.spectra_im.assign(m_num_partitions * m_bin_stride, 0.0f);
+	}
+}
+
+std::experimental::audio::convolution_reverb::~convolution_reverb()
+{
+}
+
+float std::experimental::audio::convolution_reverb::get_wet() const
+{
+	return m_wet.load(std::memory_order_relaxed);
+}
+
+float std::experimental::audio::convolution_reverb::get_dry() const
+{
+	return m_dry.load(std::memory_order_relaxed);
+}
+
+void std::experimental::audio::convolution_reverb::set_wet(float wet)
+{
+	m_wet.store(wet, std::memory_order_relaxed);
+}
+
+void std::experimental::audio::convolution_reverb::set_dry(float dry)
+{
+	m_dry.store(dry, std::memory_order_relaxed);
+}
+
+size_t std::experimental::audio::convolution_reverb::tail_length_samples() const
+{
+	return m_num_partitions * m_partition_size + m_partition_size;
+}
+
+void std::experimental::audio::convolution_reverb::process_partition(channel_state& state, unsigned int ir_channel)
+{
+	// Overlap-save: the transform window is the previous partition followed by the new one.
+	std::copy(state.input_history.begin() + m_partition_size, state.input_history.end(), state.input_history.begin());
+	std::copy(state.input_fifo.begin(), state.input_fifo.end(), state.input_history.begin() + m_partition_size);
+
+	size_t slot_offset = m_current_partition * m_bin_stride;
+	m_fft->forward(state.input_history.data(), state.spectra_re.data() + slot_offset, state.spectra_im.data() + slot_offset);
+
+	std::fill(m_accum_re.begin(), m_accum_re.end(), 0.0f);
+	std::fill(m_accum_im.begin(), m_accum_im.end(), 0.0f);
+	for (size_t p = 0; p < m_num_partitions; p++)
+	{
+		size_t slot = (m_current_partition + m_num_partitions - p) % m_num_partitions;
+		size_t input_offset = slot * m_bin_stride;
+		size_t ir_offset = (ir_channel * m_num_partitions + p) * m_bin_stride;
+		ComplexMultiplyAccumulate(
+			state.spectra_re.data() + input_offset,
+			state.spectra_im.data() + input_offset,
+			m_ir_re.data() + ir_offset,
+			m_ir_im.data() + ir_offset,
+			m_accum_re.data(),
+			m_accum_im.data(),
+			m_bin_stride);
+	}
+
+	m_fft->inverse(m_accum_re.data(), m_accum_im.data(), m_time_scratch.data());
+	std::copy(m_time_scratch.begin() + m_partition_size, m_time_scratch.end(), state.output_fifo.begin());
+}
+
+void std::experimental::audio::convolution_reverb::process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels)
+{
+	const float wet = m_wet.load(std::memory_order_relaxed);
+	const float dry = m_dry.load(std::memory_order_relaxed);
+	const int convolved_channels = std::min(num_channels, static_cast<int>(m_channels.size()));
+
+	size_t done = 0;
+	while (done < length_samples)
+	{
+		size_t count = std::min(m_partition_size - m_fifo_position, length_samples - done);
+		for (int channel = 0; channel < convolved_channels; channel++)
+		{
+			auto& state = m_channels[channel];
+			const float* in = buffer_in + done * num_channels + channel;
+			float* out = buffer_out + done * num_channels + channel;
+			for (size_t i = 0; i < count; i++)
+			{
+				float sample = in[i * num_channels];
+				state.input_fifo[m_fifo_position + i] = sample;
+				out[i * num_channels] = dry * sample + wet * state.output_fifo[m_fifo_position + i];
+			}
+		}
+		for (int channel = convolved_channels; channel < num_channels; channel++)
+		{
+			const float* in = buffer_in + done * num_channels + channel;
+			float* out = buffer_out + done * num_channels + channel;
+			for (size_t i = 0; i < count; i++)
+				out[i * num_channels] = dry * in[i * num_channels];
+		}
+
+		m_fifo_position += count;
+		done += count;
+		if (m_fifo_position == m_partition_size)
+		{
+			for (int channel = 0; channel < convolved_channels; channel++)
+			{
+				process_partition(m_channels[channel], channel % m_ir_channels);
+			}
+			m_current_partition = (m_current_partition + 1) % m_num_partitions;
+			m_fifo_position = 0;
+		}
+	}
+}
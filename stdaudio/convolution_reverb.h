@@ -0,0 +1,67 @@
+#pragma once
+
+#include "audio.h"
+#include <atomic>
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			// Uniformly partitioned overlap-save convolution.  The impulse response is split into partitions of
+			// partition_size samples which are transformed once up front, so each block costs one forward and one
+			// inverse FFT plus a complex multiply-accumulate per partition.  Latency is exactly one partition.
+			// Partitions are all the same size, so the multiply-accumulate, and with it the CPU cost, grows linearly
+			// with the length of the impulse response.
+			class convolution_reverb : public effect
+			{
+			public:
+				// State is allocated here for max_channels, or the impulse response's channel count if that is more.
+				// Channels past that in a wider block pass through at the dry level.
+				explicit convolution_reverb(const std::shared_ptr<buffer>& impulse_response, size_t partition_size = 512, unsigned int max_channels = 2);
+				~convolution_reverb();
+
+				float get_wet() const;
+				float get_dry() const;
+
+				void set_wet(float wet);
+				void set_dry(float dry);
+
+				void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override;
+				size_t tail_length_samples() const override;
+
+			private:
+				class real_fft;
+
+				struct channel_state
+				{
+					std::vector<float> input_history;
+					std::vector<float> input_fifo;
+					std::vector<float> output_fifo;
+					std::vector<float> spectra_re;
+					std::vector<float> spectra_im;
+				};
+
+				void process_partition(channel_state& state, unsigned int ir_channel);
+
+				std::unique_ptr<real_fft> m_fft;
+				size_t m_partition_size;
+				size_t m_num_partitions;
+				size_t m_bin_stride;
+				size_t m_ir_length;
+				unsigned int m_ir_channels;
+				std::vector<float> m_ir_re;
+				std::vector<float> m_ir_im;
+				std::vector<channel_state> m_channels;
+				std::vector<float> m_accum_re;
+				std::vector<float> m_accum_im;
+				std::vector<float> m_time_scratch;
+				size_t m_fifo_position = 0;
+				size_t m_current_partition = 0;
+				std::atomic<float> m_wet{ 1.0f };
+				std::atomic<float> m_dry{ 0.0f };
+			};
+		}
+	}
+}
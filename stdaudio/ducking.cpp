@@ -0,0 +1,73 @@
+#include "ducking.h"
+#include "simd.h"
+#include <cmath>
+
+void std::experimental::audio::sidechain_envelope::process(const float* buffer, size_t length_samples, int num_channels)
+{
+	size_t length = length_samples * num_channels;
+	size_t i = 0;
+	float sum = 0.0f;
+#if STDAUDIO_SSE
+	__m128 sum4 = _mm_setzero_ps();
+	for (; i + 4 <= length; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(buffer + i);
+		sum4 = _mm_add_ps(sum4, _mm_mul_ps(x, x));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, sum4);
+	sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+	for (; i < length; i++)
+		sum += buffer[i] * buffer[i];
+
+	set_level(length > 0 ? std::sqrt(sum / length) : 0.0f);
+}
+
+void std::experimental::audio::sidechain_envelope::set_level(float level)
+{
+	m_level.store(level, std::memory_order_relaxed);
+}
+
+float std::experimental::audio::sidechain_envelope::get_level() const
+{
+	return m_level.load(std::memory_order_relaxed);
+}
+
+std::experimental::audio::ducker::ducker(std::shared_ptr<sidechain_envelope> key, const ducking_settings& settings, int sample_rate) :
+	m_key(std::move(key)),
+	m_threshold(settings.threshold),
+	m_depth_db(settings.depth_db),
+	m_attack_seconds(settings.attack_seconds),
+	m_release_seconds(settings.release_seconds),
+	m_sample_rate(static_cast<float>(sample_rate))
+{
+}
+
+void std::experimental::audio::ducker::set_settings(const ducking_settings& settings)
+{
+	m_threshold.store(settings.threshold, std::memory_order_relaxed);
+	m_depth_db.store(settings.depth_db, std::memory_order_relaxed);
+	m_attack_seconds.store(settings.attack_seconds, std::memory_order_relaxed);
+	m_release_seconds.store(settings.release_seconds, std::memory_order_relaxed);
+}
+
+void std::experimental::audio::ducker::process(const float* buffer_in, float* buffer_out, size_t length_samples, int num_channels)
+{
+	const bool ducking = m_key->get_level() > m_threshold.load(std::memory_order_relaxed);
+	const float target = ducking ? std::pow(10.0f, m_depth_db.load(std::memory_order_relaxed) / 20.0f) : 1.0f;
+	const float time = (target < m_gain ? m_attack_seconds : m_release_seconds).load(std::memory_order_relaxed);
+	const float coefficient = time > 0.0f ? std::exp(-1.0f / (time * m_sample_rate)) : 0.0f;
+
+	float gain = m_gain;
+	for (size_t i = 0; i < length_samples; i++)
+	{
+		gain = target + coefficient * (gain - target);
+		for (int channel = 0; channel < num_channels; channel++)
+		{
+			size_t index = i * num_channels + channel;
+			buffer_out[index] = buffer_in[index] * gain;
+		}
+	}
+	m_gain = gain;
+}
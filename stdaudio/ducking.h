@@ -0,0 +1,44 @@
+#pragma once
+
+#include "audio.h"
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			// Envelope follower on a key submix.  Runs on the mixer thread and publishes the RMS level of each block.
+			class sidechain_envelope
+			{
+			public:
+				void process(const float* buffer, size_t length_samples, int num_channels);
+				void set_level(float level);
+				float get_level() const;
+
+			private:
+				std::atomic<float> m_level{ 0.0f };
+			};
+
+			// Gain stage on a ducked submix, driven by a key's sidechain_envelope.  The gain is smoothed per sample
+			// with separate attack and release times so ducking never clicks.
+			class ducker
+			{
+			public:
+				ducker(std::shared_ptr<sidechain_envelope> key, const ducking_settings& settings, int sample_rate);
+
+				void set_settings(const ducking_settings& settings);
+				void process(const float* buffer_in, float* buffer_out, size_t length_samples, int num_channels);
+
+			private:
+				std::shared_ptr<sidechain_envelope> m_key;
+				std::atomic<float> m_threshold;
+				std::atomic<float> m_depth_db;
+				std::atomic<float> m_attack_seconds;
+				std::atomic<float> m_release_seconds;
+				float m_sample_rate;
+				float m_gain = 1.0f;
+			};
+		}
+	}
+}
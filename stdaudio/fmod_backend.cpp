@@ -0,0 +1,1082 @@
+#include "adpcm.h"
+#include "backend.h"
+#include "loopback.h"
+#include "memory_tracking.h"
+#include "pack.h"
+#include "sample_format.h"
+#include "fmod/fmod.hpp"
+#include "fmod/fmod_errors.h"
+#include "fmod/fmod_codec.h"
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+// Handles are the FMOD objects themselves.  Channels and groups go through ChannelControl so that the node and the
+// typed handles always agree on the address.
+static FMOD::ChannelControl* ToFMOD(std::experimental::audio::backend_node* node)
+{
+	return reinterpret_cast<FMOD::ChannelControl*>(node);
+}
+
+static FMOD::Channel* ToFMOD(std::experimental::audio::backend_channel* channel)
+{
+	return static_cast<FMOD::Channel*>(ToFMOD(static_cast<std::experimental::audio::backend_node*>(channel)));
+}
+
+static FMOD::ChannelGroup* ToFMOD(std::experimental::audio::backend_group* group)
+{
+	return static_cast<FMOD::ChannelGroup*>(ToFMOD(static_cast<std::experimental::audio::backend_node*>(group)));
+}
+
+static FMOD::Sound* ToFMOD(std::experimental::audio::backend_sound* sound)
+{
+	return reinterpret_cast<FMOD::Sound*>(sound);
+}
+
+static FMOD::DSP* ToFMOD(std::experimental::audio::backend_dsp* dsp)
+{
+	return reinterpret_cast<FMOD::DSP*>(dsp);
+}
+
+static std::experimental::audio::backend_channel* ToHandle(FMOD::Channel* channel)
+{
+	return static_cast<std::experimental::audio::backend_channel*>(reinterpret_cast<std::experimental::audio::backend_node*>(static_cast<FMOD::ChannelControl*>(channel)));
+}
+
+static std::experimental::audio::backend_group* ToHandle(FMOD::ChannelGroup* group)
+{
+	return static_cast<std::experimental::audio::backend_group*>(reinterpret_cast<std::experimental::audio::backend_node*>(static_cast<FMOD::ChannelControl*>(group)));
+}
+
+static std::experimental::audio::backend_dsp* ToHandle(FMOD::DSP* dsp)
+{
+	return reinterpret_cast<std::experimental::audio::backend_dsp*>(dsp);
+}
+
+static void* GetDSPUserData(FMOD_DSP_STATE* dsp_state)
+{
+	// The user data lookup goes through the DSP API, so cache the result in the plugin data for subsequent blocks.
+	if (dsp_state->plugindata == nullptr)
+	{
+		auto* DSP = reinterpret_cast<FMOD::DSP*>(dsp_state->instance);
+		DSP->getUserData(&dsp_state->plugindata);
+	}
+	return dsp_state->plugindata;
+}
+
+static FMOD_RESULT F_CALLBACK CustomReadCallback(
+	FMOD_DSP_STATE *dsp_state,
+	float *inbuffer,
+	float *outbuffer,
+	unsigned int length,
+	int inchannels,
+	int *outchannels
+)
+{
+	auto* Callbacks = static_cast<std::experimental::audio::dsp_callbacks*>(GetDSPUserData(dsp_state));
+	if (Callbacks == nullptr)
+		return FMOD_ERR_INVALID_PARAM;
+
+	Callbacks->read(Callbacks->userdata, inbuffer, outbuffer, length, inchannels);
+	*outchannels = inchannels;
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALLBACK CustomShouldIProcessCallback(
+	FMOD_DSP_STATE *dsp_state,
+	FMOD_BOOL inputsidle,
+	unsigned int length,
+	FMOD_CHANNELMASK,
+	int inchannels,
+	FMOD_SPEAKERMODE
+)
+{
+	auto* Callbacks = static_cast<std::experimental::audio::dsp_callbacks*>(GetDSPUserData(dsp_state));
+	if (Callbacks == nullptr)
+		return FMOD_ERR_INVALID_PARAM;
+
+	switch (Callbacks->should_process(Callbacks->userdata, inputsidle != 0, length, inchannels))
+	{
+	case std::experimental::audio::dsp_result::skip:
+		return FMOD_ERR_DSP_DONTPROCESS;
+	case std::experimental::audio::dsp_result::silence:
+		return FMOD_ERR_DSP_SILENCE;
+	default:
+		break;
+	}
+	return FMOD_OK;
+}
+
+static FMOD_SOUND_FORMAT ConvertSoundFormat(std::experimental::audio::memory_buffer_format format)
+{
+	switch (format)
+	{
+	case std::experimental::audio::memory_buffer_format::pcm8:
+		return FMOD_SOUND_FORMAT_PCM8;
+	case std::experimental::audio::memory_buffer_format::pcm16:
+		return FMOD_SOUND_FORMAT_PCM16;
+	case std::experimental::audio::memory_buffer_format::pcm24:
+		return FMOD_SOUND_FORMAT_PCM24;
+	case std::experimental::audio::memory_buffer_format::pcm32:
+		return FMOD_SOUND_FORMAT_PCM32;
+	case std::experimental::audio::memory_buffer_format::pcmfloat:
+		return FMOD_SOUND_FORMAT_PCMFLOAT;
+	default:
+		break;
+	}
+	return FMOD_SOUND_FORMAT_NONE;
+}
+
+// State behind the sound pack codec.  Each pack entry is a subsound, read straight out of the pack through FMOD's
+// file callbacks, so a stream never holds more than FMOD's own decode buffer.
+struct pack_codec
+{
+	std::vector<std::experimental::audio::pack_table_entry> entries;
+	std::vector<FMOD_CODEC_WAVEFORMAT> formats;
+	size_t current = 0;
+	unsigned int position = 0;
+
+	// ADPCM entries decode a block at a time.
+	std::vector<std::byte> block_data;
+	std::vector<float> block_samples;
+	size_t decoded_block = std::numeric_limits<size_t>::max();
+};
+
+static size_t PackFrameSize(const std::experimental::audio::pack_table_entry& entry)
+{
+	return std::experimental::audio::bytes_per_sample(static_cast<std::experimental::audio::memory_buffer_format>(entry.format)) * entry.num_channels;
+}
+
+static FMOD_RESULT F_CALLBACK PackOpenCallback(FMOD_CODEC_STATE* codec_state, FMOD_MODE, FMOD_CREATESOUNDEXINFO*)
+{
+	std::experimental::audio::pack_header header;
+	unsigned int bytes_read = 0;
+	FMOD_RESULT result = codec_state->fileread(codec_state->filehandle, &header, sizeof(header), &bytes_read, nullptr);
+	if (result != FMOD_OK || bytes_read != sizeof(header) || !std::experimental::audio::is_valid_pack_header(header) || header.num_entries == 0)
+		return FMOD_ERR_FORMAT;
+
+	auto codec = std::make_unique<pack_codec>();
+	codec->entries.resize(header.num_entries);
+	unsigned int table_size = static_cast<unsigned int>(sizeof(std::experimental::audio::pack_table_entry) * header.num_entries);
+	result = codec_state->fileread(codec_state->filehandle, codec->entries.data(), table_size, &bytes_read, nullptr);
+	if (result != FMOD_OK || bytes_read != table_size)
+		return FMOD_ERR_FORMAT;
+
+	codec->formats.resize(header.num_entries);
+	for (size_t i = 0; i < codec->entries.size(); i++)
+	{
+		const auto& entry = codec->entries[i];
+		if (!std::experimental::audio::is_valid_pack_entry(entry) || static_cast<uint64_t>(entry.offset) + entry.size > codec_state->filesize)
+			return FMOD_ERR_FORMAT;
+
+		FMOD_CODEC_WAVEFORMAT& format = codec->formats[i];
+		memset(&format, 0, sizeof(format));
+		format.name = entry.name;
+		format.channels = static_cast<int>(entry.num_channels);
+		format.frequency = static_cast<int>(entry.frequency);
+		format.lengthbytes = entry.size;
+		if (entry.format == static_cast<uint32_t>(std::experimental::audio::memory_buffer_format::adpcm))
+		{
+			// ADPCM entries play as float, with the length from their own header.
+			std::experimental::audio::adpcm_header adpcm;
+			if (entry.size < sizeof(adpcm)
+				|| codec_state->fileseek(codec_state->filehandle, entry.offset, nullptr) != FMOD_OK
+				|| codec_state->fileread(codec_state->filehandle, &adpcm, sizeof(adpcm), &bytes_read, nullptr) != FMOD_OK
+				|| bytes_read != sizeof(adpcm)
+				|| memcmp(adpcm.magic, std::experimental::audio::adpcm_magic, sizeof(adpcm.magic)) != 0
+				|| std::experimental::audio::adpcm_encoded_size(adpcm.num_frames, entry.num_channels) > entry.size)
+				return FMOD_ERR_FORMAT;
+			format.format = FMOD_SOUND_FORMAT_PCMFLOAT;
+			format.lengthpcm = adpcm.num_frames;
+		}
+		else
+		{
+			format.format = ConvertSoundFormat(static_cast<std::experimental::audio::memory_buffer_format>(entry.format));
+			format.lengthpcm = static_cast<unsigned int>(entry.size / PackFrameSize(entry));
+		}
+	}
+
+	codec_state->numsubsounds = static_cast<int>(header.num_entries);
+	codec_state->waveformat = codec->formats.data();
+	codec_state->waveformatversion = FMOD_CODEC_WAVEFORMAT_VERSION;
+	codec_state->plugindata = codec.release();
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALLBACK PackCloseCallback(FMOD_CODEC_STATE* codec_state)
+{
+	delete static_cast<pack_codec*>(codec_state->plugindata);
+	codec_state->plugindata = nullptr;
+	return FMOD_OK;
+}
+
+static FMOD_RESULT PackReadAdpcm(FMOD_CODEC_STATE* codec_state, pack_codec* codec, float* output, unsigned int count, unsigned int* samples_out)
+{
+	using std::experimental::audio::adpcm_block_frames;
+
+	const auto& entry = codec->entries[codec->current];
+	const size_t block_size = std::experimental::audio::adpcm_block_size(entry.num_channels);
+	codec->block_data.resize(block_size);
+	codec->block_samples.resize(adpcm_block_frames * entry.num_channels);
+
+	while (*samples_out < count)
+	{
+		size_t block = codec->position / adpcm_block_frames;
+		size_t offset = codec->position % adpcm_block_frames;
+		if (block != codec->decoded_block)
+		{
+			unsigned int bytes_read = 0;
+			unsigned int block_offset = static_cast<unsigned int>(entry.offset + sizeof(std::experimental::audio::adpcm_header) + block * block_size);
+			FMOD_RESULT result = codec_state->fileseek(codec_state->filehandle, block_offset, nullptr);
+			if (result == FMOD_OK)
+				result = codec_state->fileread(codec_state->filehandle, codec->block_data.data(), static_cast<unsigned int>(block_size), &bytes_read, nullptr);
+			if (bytes_read != block_size)
+				return *samples_out > 0 ? FMOD_OK : (result != FMOD_OK ? result : FMOD_ERR_FILE_BAD);
+
+			std::experimental::audio::adpcm_decode(codec->block_data.data(), 1, entry.num_channels, codec->block_samples.data());
+			codec->decoded_block = block;
+		}
+
+		unsigned int length = static_cast<unsigned int>(std::min<size_t>(count - *samples_out, adpcm_block_frames - offset));
+		std::copy_n(codec->block_samples.data() + offset * entry.num_channels, length * entry.num_channels, output + *samples_out * entry.num_channels);
+		*samples_out += length;
+		codec->position += length;
+	}
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALLBACK PackReadCallback(FMOD_CODEC_STATE* codec_state, void* buffer, unsigned int samples_in, unsigned int* samples_out)
+{
+	auto codec = static_cast<pack_codec*>(codec_state->plugindata);
+	const auto& entry = codec->entries[codec->current];
+	const FMOD_CODEC_WAVEFORMAT& format = codec->formats[codec->current];
+	unsigned int count = std::min(samples_in, format.lengthpcm - std::min(codec->position, format.lengthpcm));
+	*samples_out = 0;
+	if (count == 0)
+		return FMOD_ERR_FILE_EOF;
+	if (entry.format == static_cast<uint32_t>(std::experimental::audio::memory_buffer_format::adpcm))
+		return PackReadAdpcm(codec_state, codec, static_cast<float*>(buffer), count, samples_out);
+
+	// Reads are sequential, but seek anyway in case FMOD read the file elsewhere in between.
+	size_t frame_size = PackFrameSize(entry);
+	FMOD_RESULT result = codec_state->fileseek(codec_state->filehandle, static_cast<unsigned int>(entry.offset + codec->position * frame_size), nullptr);
+	if (result != FMOD_OK)
+		return result;
+
+	unsigned int bytes_read = 0;
+	result = codec_state->fileread(codec_state->filehandle, buffer, static_cast<unsigned int>(count * frame_size), &bytes_read, nullptr);
+	*samples_out = static_cast<unsigned int>(bytes_read / frame_size);
+	codec->position += *samples_out;
+	return result == FMOD_ERR_FILE_EOF && *samples_out > 0 ? FMOD_OK : result;
+}
+
+static FMOD_RESULT F_CALLBACK PackSetPositionCallback(FMOD_CODEC_STATE* codec_state, int subsound, unsigned int position, FMOD_TIMEUNIT postype)
+{
+	auto codec = static_cast<pack_codec*>(codec_state->plugindata);
+	if (postype != FMOD_TIMEUNIT_PCM)
+		return FMOD_ERR_FORMAT;
+	if (subsound >= 0)
+	{
+		if (static_cast<size_t>(subsound) >= codec->entries.size())
+			return FMOD_ERR_INVALID_PARAM;
+		if (codec->current != static_cast<size_t>(subsound))
+			codec->decoded_block = std::numeric_limits<size_t>::max();
+		codec->current = static_cast<size_t>(subsound);
+	}
+	codec->position = std::min(position, codec->formats[codec->current].lengthpcm);
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALLBACK PackGetPositionCallback(FMOD_CODEC_STATE* codec_state, unsigned int* position, FMOD_TIMEUNIT postype)
+{
+	if (postype != FMOD_TIMEUNIT_PCM)
+		return FMOD_ERR_FORMAT;
+	*position = static_cast<pack_codec*>(codec_state->plugindata)->position;
+	return FMOD_OK;
+}
+
+// ADPCM buffers and synths play as user streams, read through callbacks into FMOD's stream buffer.  An ADPCM
+// sound has its own decoder reading from the buffer's memory, so the samples stay compressed.
+struct user_sound
+{
+	virtual ~user_sound() {}
+	virtual void read(float* output, size_t num_frames) = 0;
+	virtual void seek(size_t) {}
+};
+
+struct adpcm_sound : user_sound
+{
+	explicit adpcm_sound(const std::experimental::audio::memory_buffer_data& data) :
+		decoder(data)
+	{
+	}
+
+	void read(float* output, size_t num_frames) override
+	{
+		size_t frames_read = decoder.read(output, num_frames);
+		std::fill(output + frames_read * decoder.get_num_channels(), output + num_frames * decoder.get_num_channels(), 0.0f);
+	}
+
+	void seek(size_t frame) override
+	{
+		decoder.seek(frame);
+	}
+
+	std::experimental::audio::adpcm_decoder decoder;
+};
+
+// A generator has no position, so FMOD's seeks at the loop point are ignored and it just keeps reading.
+struct generator_sound : user_sound
+{
+	explicit generator_sound(const std::experimental::audio::generator_callbacks& callbacks) :
+		generator(callbacks)
+	{
+	}
+
+	void read(float* output, size_t num_frames) override
+	{
+		generator.read(generator.userdata, output, num_frames);
+	}
+
+	std::experimental::audio::generator_callbacks generator;
+};
+
+static user_sound* GetUserSound(FMOD_SOUND* sound)
+{
+	void* user_data = nullptr;
+	reinterpret_cast<FMOD::Sound*>(sound)->getUserData(&user_data);
+	return static_cast<user_sound*>(user_data);
+}
+
+static FMOD_RESULT F_CALLBACK UserSoundReadCallback(FMOD_SOUND* sound, void* data, unsigned int datalen)
+{
+	int num_channels = 0;
+	reinterpret_cast<FMOD::Sound*>(sound)->getFormat(nullptr, nullptr, &num_channels, nullptr);
+	GetUserSound(sound)->read(static_cast<float*>(data), datalen / (sizeof(float) * num_channels));
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALLBACK UserSoundSetPositionCallback(FMOD_SOUND* sound, int, unsigned int position, FMOD_TIMEUNIT postype)
+{
+	if (postype != FMOD_TIMEUNIT_PCM)
+		return FMOD_ERR_FORMAT;
+	GetUserSound(sound)->seek(position);
+	return FMOD_OK;
+}
+
+// State behind the loopback output plugin.  FMOD hands it to init as driver data and back to every other callback
+// through the plugin data.
+struct loopback_output
+{
+	std::unique_ptr<std::experimental::audio::loopback_buffer> buffer;
+	size_t capacity = 0;
+	FMOD_OUTPUT_STATE* state = nullptr;
+	std::vector<float> block;
+	unsigned int block_length = 0;
+	int sample_rate = 0;
+	std::chrono::steady_clock::time_point deadline;
+};
+
+static void MixLoopbackBlock(loopback_output* Output)
+{
+	auto start = std::chrono::steady_clock::now();
+	Output->state->readfrommixer(Output->state, Output->block.data(), Output->block_length);
+	auto mix_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+	Output->buffer->write(Output->block.data(), Output->block_length, mix_time);
+}
+
+static FMOD_RESULT F_CALLBACK LoopbackGetNumDriversCallback(FMOD_OUTPUT_STATE *, int *numdrivers)
+{
+	*numdrivers = 1;
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALLBACK LoopbackGetDriverInfoCallback(
+	FMOD_OUTPUT_STATE *,
+	int,
+	char *name,
+	int namelen,
+	FMOD_GUID *guid,
+	int *,
+	FMOD_SPEAKERMODE *speakermode,
+	int *speakermodechannels
+)
+{
+	if (name != nullptr && namelen > 0)
+	{
+		strncpy(name, "Loopback", namelen);
+		name[namelen - 1] = '\0';
+	}
+	if (guid != nullptr)
+		memset(guid, 0, sizeof(FMOD_GUID));
+	if (speakermode != nullptr)
+		*speakermode = FMOD_SPEAKERMODE_STEREO;
+	if (speakermodechannels != nullptr)
+		*speakermodechannels = 2;
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALLBACK LoopbackInitCallback(
+	FMOD_OUTPUT_STATE *output_state,
+	int,
+	FMOD_INITFLAGS,
+	int *outputrate,
+	FMOD_SPEAKERMODE *speakermode,
+	int *speakermodechannels,
+	FMOD_SOUND_FORMAT *outputformat,
+	int dspbufferlength,
+	int,
+	void *extradriverdata
+)
+{
+	auto* Output = static_cast<loopback_output*>(extradriverdata);
+	if (Output == nullptr)
+		return FMOD_ERR_INVALID_PARAM;
+
+	*speakermode = FMOD_SPEAKERMODE_STEREO;
+	*speakermodechannels = 2;
+	*outputformat = FMOD_SOUND_FORMAT_PCMFLOAT;
+
+	size_t capacity = Output->capacity > 0 ? Output->capacity : 2 * static_cast<size_t>(*outputrate);
+	Output->buffer = std::make_unique<std::experimental::audio::loopback_buffer>(capacity, 2, *outputrate);
+	Output->block.resize(dspbufferlength * 2);
+	Output->block_length = dspbufferlength;
+	Output->sample_rate = *outputrate;
+	Output->state = output_state;
+	output_state->plugindata = Output;
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALLBACK LoopbackStartCallback(FMOD_OUTPUT_STATE *output_state)
+{
+	static_cast<loopback_output*>(output_state->plugindata)->deadline = std::chrono::steady_clock::now();
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALLBACK LoopbackCloseCallback(FMOD_OUTPUT_STATE *)
+{
+	return FMOD_OK;
+}
+
+static FMOD_RESULT F_CALLBACK LoopbackMixerCallback(FMOD_OUTPUT_STATE *output_state)
+{
+	// Runs on FMOD's mixer thread and paces it like a sound card pulling one block per block period.
+	auto* Output = static_cast<loopback_output*>(output_state->plugindata);
+	std::this_thread::sleep_until(Output->deadline);
+	MixLoopbackBlock(Output);
+	Output->deadline += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(static_cast<double>(Output->block_length) / Output->sample_rate));
+	return FMOD_OK;
+}
+
+// FMOD takes one allocator for the whole process, shared by every device and by load_from_disk, so its allocations
+// go to a resource that is never destroyed rather than to any one device's.
+static std::experimental::audio::tracking_resource& FMODMemory()
+{
+	static auto* resource = new std::experimental::audio::tracking_resource(nullptr);
+	return *resource;
+}
+
+static void* F_CALLBACK FMODAllocCallback(unsigned int size, FMOD_MEMORY_TYPE, const char*)
+{
+	return std::experimental::audio::allocate_object(&FMODMemory(), size);
+}
+
+static void* F_CALLBACK FMODReallocCallback(void* ptr, unsigned int size, FMOD_MEMORY_TYPE type, const char* sourcestr)
+{
+	if (ptr == nullptr)
+		return FMODAllocCallback(size, type, sourcestr);
+	return std::experimental::audio::reallocate_object(ptr, size);
+}
+
+static void F_CALLBACK FMODFreeCallback(void* ptr, FMOD_MEMORY_TYPE, const char*)
+{
+	std::experimental::audio::deallocate_object(ptr);
+}
+
+void std::experimental::audio::install_fmod_allocator()
+{
+	// Only the first call reaches FMOD; it fails if something else created an FMOD system before it.
+	static const FMOD_RESULT result = FMOD::Memory_Initialize(nullptr, 0, FMODAllocCallback, FMODReallocCallback, FMODFreeCallback);
+	if (result != FMOD_OK)
+		throw std::runtime_error(std::string("Could not install FMOD's allocator: ") + FMOD_ErrorString(result));
+}
+
+class std::experimental::audio::fmod_backend : public backend
+{
+public:
+	fmod_backend(const device_settings& settings, std::pmr::memory_resource*)
+	{
+		if (settings.memory.backend != nullptr)
+			throw std::invalid_argument("FMOD allocates for the whole process, so an FMOD device cannot take a backend resource");
+		install_fmod_allocator();
+
+		FMOD_RESULT result = FMOD::System_Create(&m_system);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+
+		switch (settings.output)
+		{
+		case device_output::none:
+			m_system->setOutput(FMOD_OUTPUTTYPE_NOSOUND);
+			break;
+		case device_output::wav_file:
+			m_system->setOutput(FMOD_OUTPUTTYPE_WAVWRITER);
+			break;
+		case device_output::loopback:
+		case device_output::loopback_manual:
+			set_loopback_output(settings);
+			break;
+		default:
+			break;
+		}
+		if (settings.sample_rate > 0)
+			m_system->setSoftwareFormat(settings.sample_rate, FMOD_SPEAKERMODE_DEFAULT, 0);
+		if (settings.block_length > 0)
+			m_system->setDSPBufferSize(settings.block_length, 4);
+
+		// The wav writer takes the file name through the driver data, and the loopback plugin takes its state.
+		std::string output_file = to_utf8(settings.output_file);
+		void* extra_driver_data = nullptr;
+		if (settings.output == device_output::wav_file)
+			extra_driver_data = const_cast<char*>(output_file.c_str());
+		else if (settings.output == device_output::loopback || settings.output == device_output::loopback_manual)
+			extra_driver_data = &m_loopback;
+
+		register_pack_codec();
+
+		// Voices virtualized by a submix voice limit are only muted.  FMOD_INIT_VOL0_BECOMES_VIRTUAL would stop
+		// FMOD mixing them, but also every voice a game fades to zero, so they are left to FMOD's own virtual
+		// voices instead, which take the least audible channels first once the real ones run out.
+		result = m_system->init(128, FMOD_INIT_NORMAL, extra_driver_data);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+	}
+
+	~fmod_backend()
+	{
+		m_system->release();
+	}
+
+	int num_drivers() const override
+	{
+		int num_drivers = 0;
+		m_system->getNumDrivers(&num_drivers);
+		return num_drivers;
+	}
+
+	driver_info get_driver(int index) const override
+	{
+		FMOD_GUID fmod_guid;
+		char name[512];
+		FMOD_RESULT result = m_system->getDriverInfo(index, name, 512, &fmod_guid, nullptr, nullptr, nullptr);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+
+		name[511] = '\0';
+
+		driver_info info;
+		info.name.assign(name);
+		info.id = *reinterpret_cast<guid*>(&fmod_guid);
+
+		return info;
+	}
+
+	void set_driver(int index) override
+	{
+		FMOD_RESULT result = m_system->setDriver(index);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+	}
+
+	int get_sample_rate() const override
+	{
+		int sample_rate = 0;
+		m_system->getSoftwareFormat(&sample_rate, nullptr, nullptr);
+		return sample_rate;
+	}
+
+	unsigned int get_block_length() const override
+	{
+		unsigned int block_length = 0;
+		m_system->getDSPBufferSize(&block_length, nullptr);
+		return block_length;
+	}
+
+	void update() override
+	{
+		// FMOD moves channels in and out of virtual only here.
+		m_system->update();
+	}
+
+	void get_cpu_usage(float& dsp_usage, float& total_usage) const override
+	{
+		m_system->getCPUUsage(&dsp_usage, nullptr, nullptr, nullptr, &total_usage);
+	}
+
+	bool get_memory_stats(memory_stats& stats) const override
+	{
+		stats = FMODMemory().get_stats();
+		return true;
+	}
+
+	loopback_buffer* get_loopback() override
+	{
+		return m_loopback.buffer.get();
+	}
+
+	void mix_loopback(size_t num_frames) override
+	{
+		if (m_loopback_realtime)
+			throw std::runtime_error("Only loopback_manual output can be mixed on demand");
+
+		for (size_t done = 0; done < num_frames; done += m_loopback.block_length)
+			MixLoopbackBlock(&m_loopback);
+	}
+
+	backend_sound* create_sound(const memory_buffer_data& data) override
+	{
+		if (data.description.format == memory_buffer_format::adpcm)
+			return create_adpcm_sound(data);
+
+		FMOD::Sound* fmod_sound = nullptr;
+		FMOD_CREATESOUNDEXINFO ex_info = { 0 };
+		ex_info.cbsize = sizeof(FMOD_CREATESOUNDEXINFO);
+		ex_info.format = ConvertSoundFormat(data.description.format);
+		ex_info.defaultfrequency = data.description.frequency;
+		ex_info.numchannels = data.description.num_channels;
+		ex_info.length = static_cast<unsigned int>(data.data.size);
+		FMOD_RESULT result = m_system->createSound(
+			reinterpret_cast<const char*>(data.data.data),
+			FMOD_OPENMEMORY_POINT | FMOD_LOOP_NORMAL | FMOD_2D | FMOD_OPENRAW,
+			&ex_info,
+			&fmod_sound);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+
+		fmod_sound->setLoopCount(0);
+		return reinterpret_cast<backend_sound*>(fmod_sound);
+	}
+
+	backend_sound* create_stream(const std::filesystem::path& filepath, int subsound) override
+	{
+		FMOD::Sound* fmod_sound = nullptr;
+		FMOD_RESULT result = m_system->createSound(to_utf8(filepath).c_str(), FMOD_CREATESTREAM | FMOD_LOOP_NORMAL | FMOD_2D, nullptr, &fmod_sound);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+
+		// A subsound is released through its parent, which owns the file.
+		if (subsound >= 0)
+		{
+			FMOD::Sound* fmod_subsound = nullptr;
+			result = fmod_sound->getSubSound(subsound, &fmod_subsound);
+			if (result != FMOD_OK)
+			{
+				fmod_sound->release();
+				throw std::runtime_error(FMOD_ErrorString(result));
+			}
+			fmod_sound = fmod_subsound;
+		}
+
+		fmod_sound->setLoopCount(0);
+		return reinterpret_cast<backend_sound*>(fmod_sound);
+	}
+
+	backend_sound* create_generator(const generator_callbacks& generator) override
+	{
+		// The stream is as long as FMOD allows and loops forever, so the generator plays until stopped.  A 100ms
+		// decode buffer, against FMOD's default of 400ms, keeps parameter changes from lagging too far behind.
+		unsigned int frame_size = static_cast<unsigned int>(generator.num_channels * sizeof(float));
+		unsigned int length = std::numeric_limits<unsigned int>::max() / frame_size * frame_size;
+		FMOD::Sound* fmod_sound = create_user_sound(std::make_unique<generator_sound>(generator), generator.num_channels, generator.frequency, length, generator.frequency / 10);
+		fmod_sound->setLoopCount(-1);
+		return reinterpret_cast<backend_sound*>(fmod_sound);
+	}
+
+	backend_channel* play(backend_sound* sound, bool paused) override
+	{
+		FMOD::Channel* fmod_channel = nullptr;
+		FMOD_RESULT result = m_system->playSound(ToFMOD(sound), nullptr, paused, &fmod_channel);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+		return ToHandle(fmod_channel);
+	}
+
+	backend_group* create_group() override
+	{
+		FMOD::ChannelGroup* fmod_channelgroup = nullptr;
+		FMOD_RESULT result = m_system->createChannelGroup(nullptr, &fmod_channelgroup);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+		return ToHandle(fmod_channelgroup);
+	}
+
+	backend_group* get_master_group() override
+	{
+		FMOD::ChannelGroup* master = nullptr;
+		m_system->getMasterChannelGroup(&master);
+		return ToHandle(master);
+	}
+
+	void release(backend_sound* sound) override
+	{
+		FMOD::Sound* parent = nullptr;
+		ToFMOD(sound)->getSubSoundParent(&parent);
+
+		// Only user streams carry user data.  The stream is gone once release returns, so its state can follow.
+		void* user_data = nullptr;
+		ToFMOD(sound)->getUserData(&user_data);
+		(parent != nullptr ? parent : ToFMOD(sound))->release();
+		delete static_cast<user_sound*>(user_data);
+	}
+
+	void release(backend_channel* channel) override
+	{
+		// FMOD owns its channels; stopping one hands it back.
+		ToFMOD(channel)->stop();
+	}
+
+	void release(backend_group* group) override
+	{
+		ToFMOD(group)->release();
+	}
+
+	void release(backend_dsp* dsp) override
+	{
+		// Custom DSPs own a copy of their callbacks, which the mixer may use until the DSP is gone.
+		void* user_data = nullptr;
+		ToFMOD(dsp)->getUserData(&user_data);
+		ToFMOD(dsp)->release();
+		delete static_cast<dsp_callbacks*>(user_data);
+	}
+
+	float get_volume(backend_node* node) const override
+	{
+		float volume = 0.0f;
+		ToFMOD(node)->getVolume(&volume);
+		return volume;
+	}
+
+	void set_volume(backend_node* node, float volume) override
+	{
+		ToFMOD(node)->setVolume(volume);
+	}
+
+	void set_paused(backend_node* node, bool paused) override
+	{
+		ToFMOD(node)->setPaused(paused);
+	}
+
+	void set_mute(backend_node* node, bool mute) override
+	{
+		ToFMOD(node)->setMute(mute);
+	}
+
+	void* get_user_data(backend_node* node) const override
+	{
+		void* user_data = nullptr;
+		ToFMOD(node)->getUserData(&user_data);
+		return user_data;
+	}
+
+	void set_user_data(backend_node* node, void* user_data) override
+	{
+		ToFMOD(node)->setUserData(user_data);
+	}
+
+	void add_dsp(backend_node* node, backend_dsp* dsp, dsp_position position) override
+	{
+		FMOD_RESULT result = ToFMOD(node)->addDSP(position == dsp_position::head ? FMOD_CHANNELCONTROL_DSP_HEAD : FMOD_CHANNELCONTROL_DSP_TAIL, ToFMOD(dsp));
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+	}
+
+	void remove_dsp(backend_node* node, backend_dsp* dsp) override
+	{
+		ToFMOD(node)->removeDSP(ToFMOD(dsp));
+	}
+
+	void move_dsp_to_head(backend_node* node, backend_dsp* dsp) override
+	{
+		ToFMOD(node)->setDSPIndex(ToFMOD(dsp), 0);
+	}
+
+	void stop(backend_channel* channel) override
+	{
+		ToFMOD(channel)->stop();
+	}
+
+	float get_pitch(backend_channel* channel) const override
+	{
+		float pitch = 0.0f;
+		ToFMOD(channel)->getPitch(&pitch);
+		return pitch;
+	}
+
+	void set_pitch(backend_channel* channel, float pitch) override
+	{
+		ToFMOD(channel)->setPitch(pitch);
+	}
+
+	void set_pan(backend_channel* channel, float pan) override
+	{
+		ToFMOD(channel)->setPan(pan);
+	}
+
+	int get_priority(backend_channel* channel) const override
+	{
+		int priority = 0;
+		ToFMOD(channel)->getPriority(&priority);
+		return priority;
+	}
+
+	void set_priority(backend_channel* channel, int priority) override
+	{
+		ToFMOD(channel)->setPriority(priority);
+	}
+
+	void set_loop(backend_channel* channel, int count, size_t start_frame, size_t end_frame) override
+	{
+		// FMOD's loop end is inclusive.
+		if (end_frame == 0)
+		{
+			FMOD::Sound* sound = nullptr;
+			unsigned int length = 0;
+			ToFMOD(channel)->getCurrentSound(&sound);
+			if (sound != nullptr)
+				sound->getLength(&length, FMOD_TIMEUNIT_PCM);
+			end_frame = length;
+		}
+		FMOD_RESULT result = ToFMOD(channel)->setLoopPoints(static_cast<unsigned int>(start_frame), FMOD_TIMEUNIT_PCM, static_cast<unsigned int>(end_frame - 1), FMOD_TIMEUNIT_PCM);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+		ToFMOD(channel)->setLoopCount(count);
+	}
+
+	int get_loop_count(backend_channel* channel) const override
+	{
+		int count = 0;
+		ToFMOD(channel)->getLoopCount(&count);
+		return count;
+	}
+
+	void set_loop_count(backend_channel* channel, int count) override
+	{
+		ToFMOD(channel)->setLoopCount(count);
+	}
+
+	float get_audibility(backend_channel* channel) const override
+	{
+		float audibility = 0.0f;
+		ToFMOD(channel)->getAudibility(&audibility);
+		return audibility;
+	}
+
+	bool is_playing(backend_channel* channel) const override
+	{
+		bool playing = false;
+		ToFMOD(channel)->isPlaying(&playing);
+		return playing;
+	}
+
+	bool is_virtual(backend_channel* channel) const override
+	{
+		bool is_virtual = false;
+		ToFMOD(channel)->isVirtual(&is_virtual);
+		return is_virtual;
+	}
+
+	void set_group(backend_channel* channel, backend_group* group) override
+	{
+		ToFMOD(channel)->setChannelGroup(ToFMOD(group));
+	}
+
+	void add_group(backend_group* parent, backend_group* child) override
+	{
+		ToFMOD(parent)->addGroup(ToFMOD(child));
+	}
+
+	size_t get_num_groups(backend_group* group) const override
+	{
+		int num_groups = 0;
+		ToFMOD(group)->getNumGroups(&num_groups);
+		return static_cast<size_t>(num_groups);
+	}
+
+	backend_group* get_group(backend_group* group, size_t index) const override
+	{
+		FMOD::ChannelGroup* child = nullptr;
+		ToFMOD(group)->getGroup(static_cast<int>(index), &child);
+		return ToHandle(child);
+	}
+
+	size_t get_num_channels(backend_group* group) const override
+	{
+		int num_channels = 0;
+		ToFMOD(group)->getNumChannels(&num_channels);
+		return static_cast<size_t>(num_channels);
+	}
+
+	backend_channel* get_channel(backend_group* group, size_t index) const override
+	{
+		FMOD::Channel* channel = nullptr;
+		ToFMOD(group)->getChannel(static_cast<int>(index), &channel);
+		return ToHandle(channel);
+	}
+
+	backend_dsp* create_dsp(const dsp_callbacks& callbacks) override
+	{
+		auto user_data = std::make_unique<dsp_callbacks>(callbacks);
+
+		FMOD_DSP_DESCRIPTION description = { 0 };
+		description.pluginsdkversion = FMOD_PLUGIN_SDK_VERSION;
+		description.numinputbuffers = 1;
+		description.numoutputbuffers = 1;
+		description.read = callbacks.read ? CustomReadCallback : nullptr;
+		description.shouldiprocess = callbacks.should_process ? CustomShouldIProcessCallback : nullptr;
+		description.userdata = user_data.get();
+
+		FMOD::DSP* dsp = nullptr;
+		FMOD_RESULT result = m_system->createDSP(&description, &dsp);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+
+		user_data.release();
+		return ToHandle(dsp);
+	}
+
+	backend_dsp* create_send(int return_id, float level) override
+	{
+		FMOD::DSP* dsp = nullptr;
+		FMOD_RESULT result = m_system->createDSPByType(FMOD_DSP_TYPE_SEND, &dsp);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+
+		dsp->setParameterInt(FMOD_DSP_SEND_RETURNID, return_id);
+		dsp->setParameterFloat(FMOD_DSP_SEND_LEVEL, level);
+		return ToHandle(dsp);
+	}
+
+	backend_dsp* create_return() override
+	{
+		FMOD::DSP* dsp = nullptr;
+		FMOD_RESULT result = m_system->createDSPByType(FMOD_DSP_TYPE_RETURN, &dsp);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+		return ToHandle(dsp);
+	}
+
+	float get_send_level(backend_dsp* dsp) const override
+	{
+		float level = 0.0f;
+		ToFMOD(dsp)->getParameterFloat(FMOD_DSP_SEND_LEVEL, &level, nullptr, 0);
+		return level;
+	}
+
+	void set_send_level(backend_dsp* dsp, float level) override
+	{
+		ToFMOD(dsp)->setParameterFloat(FMOD_DSP_SEND_LEVEL, level);
+	}
+
+	int get_return_id(backend_dsp* dsp) const override
+	{
+		int return_id = -1;
+		ToFMOD(dsp)->getParameterInt(FMOD_DSP_RETURN_ID, &return_id, nullptr, 0);
+		return return_id;
+	}
+
+private:
+	void set_loopback_output(const device_settings& settings)
+	{
+		// Without a mixer callback FMOD starts no mixer thread, so loopback_manual only mixes in mix_loopback.
+		m_loopback.capacity = settings.loopback_length;
+		m_loopback_realtime = settings.output == device_output::loopback;
+
+		FMOD_OUTPUT_DESCRIPTION description = { 0 };
+		description.apiversion = FMOD_OUTPUT_PLUGIN_VERSION;
+		description.name = "stdaudio loopback";
+		description.polling = 0;
+		description.getnumdrivers = LoopbackGetNumDriversCallback;
+		description.getdriverinfo = LoopbackGetDriverInfoCallback;
+		description.init = LoopbackInitCallback;
+		description.start = LoopbackStartCallback;
+		description.close = LoopbackCloseCallback;
+		description.mixer = m_loopback_realtime ? LoopbackMixerCallback : nullptr;
+
+		unsigned int handle = 0;
+		FMOD_RESULT result = m_system->registerOutput(&description, &handle);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+
+		result = m_system->setOutputByPlugin(handle);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+	}
+
+	backend_sound* create_adpcm_sound(const memory_buffer_data& data)
+	{
+		auto sound = std::make_unique<adpcm_sound>(data);
+		unsigned int length = static_cast<unsigned int>(sound->decoder.get_length() * data.description.num_channels * sizeof(float));
+		FMOD::Sound* fmod_sound = create_user_sound(std::move(sound), data.description.num_channels, data.description.frequency, length, 0);
+		fmod_sound->setLoopCount(0);
+		return reinterpret_cast<backend_sound*>(fmod_sound);
+	}
+
+	FMOD::Sound* create_user_sound(std::unique_ptr<user_sound> sound, unsigned int num_channels, unsigned int frequency, unsigned int length, unsigned int decode_buffer_size)
+	{
+		FMOD::Sound* fmod_sound = nullptr;
+		FMOD_CREATESOUNDEXINFO ex_info = { 0 };
+		ex_info.cbsize = sizeof(FMOD_CREATESOUNDEXINFO);
+		ex_info.format = FMOD_SOUND_FORMAT_PCMFLOAT;
+		ex_info.defaultfrequency = frequency;
+		ex_info.numchannels = num_channels;
+		ex_info.length = length;
+		ex_info.decodebuffersize = decode_buffer_size;
+		ex_info.pcmreadcallback = UserSoundReadCallback;
+		ex_info.pcmsetposcallback = UserSoundSetPositionCallback;
+		ex_info.userdata = sound.get();
+		FMOD_RESULT result = m_system->createSound(
+			nullptr,
+			FMOD_OPENUSER | FMOD_CREATESTREAM | FMOD_LOOP_NORMAL | FMOD_2D,
+			&ex_info,
+			&fmod_sound);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+
+		sound.release();
+		return fmod_sound;
+	}
+
+	void register_pack_codec()
+	{
+		// FMOD keeps a pointer to the description, so it has to outlive the system.  The codec checks the pack header
+		// before anything else, so trying it ahead of FMOD's own codecs costs one small read.
+		static FMOD_CODEC_DESCRIPTION description = []
+		{
+			FMOD_CODEC_DESCRIPTION d = { 0 };
+			d.name = "stdaudio pack";
+			d.version = std::experimental::audio::pack_version;
+			d.timeunits = FMOD_TIMEUNIT_PCM;
+			d.open = PackOpenCallback;
+			d.close = PackCloseCallback;
+			d.read = PackReadCallback;
+			d.setposition = PackSetPositionCallback;
+			d.getposition = PackGetPositionCallback;
+			return d;
+		}();
+
+		unsigned int handle = 0;
+		FMOD_RESULT result = m_system->registerCodec(&description, &handle, 0);
+		if (result != FMOD_OK)
+			throw std::runtime_error(FMOD_ErrorString(result));
+	}
+
+	FMOD::System* m_system;
+	loopback_output m_loopback;
+	bool m_loopback_realtime = false;
+};
+
+auto std::experimental::audio::create_fmod_backend(const device_settings& settings, std::pmr::memory_resource* resource) -> std::unique_ptr<backend>
+{
+	return std::make_unique<fmod_backend>(settings, resource);
+}
@@ -0,0 +1,227 @@
+#include "granular_synth.h"
+#include "simd.h"
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+// Adds length frames of a Hann-windowed grain to stereo output.  The grain reads samples from position on by step
+// per frame, and its window is 0.5 - 0.5 * cos(phase), with the phase starting at window_phase.
+static void RenderGrain(const float* samples, double position, float step, double window_phase, double window_step, float left_gain, float right_gain, float* output, size_t length)
+{
+	// Offsets are relative to the first whole sample so that they stay small enough for float.
+	const size_t base = static_cast<size_t>(position);
+	const float first_offset = static_cast<float>(position - base);
+	size_t i = 0;
+#if STDAUDIO_SSE2
+	// The window is a cosine turned by a fixed rotation every four frames, which is exact enough over one block.
+	const __m128 first = _mm_setr_ps(first_offset, first_offset + step, first_offset + 2 * step, first_offset + 3 * step);
+	const __m128 steps = _mm_set1_ps(step);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 rotate_cos = _mm_set1_ps(static_cast<float>(std::cos(4 * window_step)));
+	const __m128 rotate_sin = _mm_set1_ps(static_cast<float>(std::sin(4 * window_step)));
+	const __m128 left = _mm_set1_ps(left_gain);
+	const __m128 right = _mm_set1_ps(right_gain);
+	__m128 cosines = _mm_setr_ps(
+		static_cast<float>(std::cos(window_phase)), static_cast<float>(std::cos(window_phase + window_step)),
+		static_cast<float>(std::cos(window_phase + 2 * window_step)), static_cast<float>(std::cos(window_phase + 3 * window_step)));
+	__m128 sines = _mm_setr_ps(
+		static_cast<float>(std::sin(window_phase)), static_cast<float>(std::sin(window_phase + window_step)),
+		static_cast<float>(std::sin(window_phase + 2 * window_step)), static_cast<float>(std::sin(window_phase + 3 * window_step)));
+	alignas(16) int32_t indices[4];
+	const float* source = samples + base;
+	for (; i + 4 <= length; i += 4)
+	{
+		__m128 offsets = _mm_add_ps(first, _mm_mul_ps(_mm_set1_ps(static_cast<float>(i)), steps));
+		__m128i whole = _mm_cvttps_epi32(offsets);
+		__m128 fraction = _mm_sub_ps(offsets, _mm_cvtepi32_ps(whole));
+		_mm_store_si128(reinterpret_cast<__m128i*>(indices), whole);
+		__m128 a = _mm_setr_ps(source[indices[0]], source[indices[1]], source[indices[2]], source[indices[3]]);
+		__m128 b = _mm_setr_ps(source[indices[0] + 1], source[indices[1] + 1], source[indices[2] + 1], source[indices[3] + 1]);
+		__m128 sample = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), fraction));
+		sample = _mm_mul_ps(sample, _mm_sub_ps(half, _mm_mul_ps(half, cosines)));
+
+		__m128 l = _mm_mul_ps(sample, left);
+		__m128 r = _mm_mul_ps(sample, right);
+		_mm_storeu_ps(output + 2 * i, _mm_add_ps(_mm_loadu_ps(output + 2 * i), _mm_unpacklo_ps(l, r)));
+		_mm_storeu_ps(output + 2 * i + 4, _mm_add_ps(_mm_loadu_ps(output + 2 * i + 4), _mm_unpackhi_ps(l, r)));
+
+		__m128 next_cosines = _mm_sub_ps(_mm_mul_ps(cosines, rotate_cos), _mm_mul_ps(sines, rotate_sin));
+		sines = _mm_add_ps(_mm_mul_ps(sines, rotate_cos), _mm_mul_ps(cosines, rotate_sin));
+		cosines = next_cosines;
+	}
+#endif
+	for (; i < length; i++)
+	{
+		float offset = first_offset + step * i;
+		size_t index = static_cast<size_t>(offset);
+		float fraction = offset - index;
+		float sample = samples[base + index] + (samples[base + index + 1] - samples[base + index]) * fraction;
+		sample *= 0.5f - 0.5f * static_cast<float>(std::cos(window_phase + window_step * i));
+		output[2 * i] += sample * left_gain;
+		output[2 * i + 1] += sample * right_gain;
+	}
+}
+
+std::experimental::audio::granular_synth::granular_synth(const std::vector<std::shared_ptr<source>>& sources, const granular_settings& settings, unsigned int max_grains, unsigned int frequency) :
+	synth(2, frequency),
+	m_grains(max_grains),
+	m_random_state(std::random_device()() | 1)
+{
+	if (sources.empty() || max_grains == 0)
+		throw std::invalid_argument("A granular synth needs at least one source and one grain");
+
+	for (auto& s : sources)
+	{
+		memory_buffer_data data = s->get_audio_data();
+		if (data.data.data == nullptr)
+			throw std::invalid_argument("Granular sources must have their data in memory");
+
+		grain_source entry;
+		if (data.description.format == memory_buffer_format::pcmfloat && data.description.num_channels == 1)
+		{
+			entry.data = s;
+		}
+		else
+		{
+			load_settings convert;
+			convert.format = memory_buffer_format::pcmfloat;
+			convert.num_channels = 1;
+			entry.data = load_from_memory(data.data, data.description, convert);
+			data = entry.data->get_audio_data();
+		}
+		entry.samples = reinterpret_cast<const float*>(data.data.data);
+		entry.length = data.data.size / sizeof(float);
+		entry.rate = static_cast<double>(data.description.frequency) / frequency;
+		m_sources.push_back(std::move(entry));
+	}
+	set_settings(settings);
+}
+
+auto std::experimental::audio::granular_synth::get_settings() const -> granular_settings
+{
+	granular_settings return_value;
+	return_value.density = m_density.load(std::memory_order_relaxed);
+	return_value.grain_seconds = m_grain_seconds.load(std::memory_order_relaxed);
+	return_value.position = m_position.load(std::memory_order_relaxed);
+	return_value.position_spread = m_position_spread.load(std::memory_order_relaxed);
+	return_value.pitch_spread = m_pitch_spread.load(std::memory_order_relaxed);
+	return_value.pan_spread = m_pan_spread.load(std::memory_order_relaxed);
+	return return_value;
+}
+
+void std::experimental::audio::granular_synth::set_settings(const granular_settings& settings)
+{
+	// Each value is read on its own, so a render between these stores sees a mix of old and new, which is harmless.
+	m_density.store(std::min(std::max(settings.density, 0.0f), static_cast<float>(get_frequency())), std::memory_order_relaxed);
+	m_grain_seconds.store(std::max(settings.grain_seconds, 0.0f), std::memory_order_relaxed);
+	m_position.store(std::min(std::max(settings.position, 0.0f), 1.0f), std::memory_order_relaxed);
+	m_position_spread.store(std::max(settings.position_spread, 0.0f), std::memory_order_relaxed);
+	m_pitch_spread.store(std::max(settings.pitch_spread, 0.0f), std::memory_order_relaxed);
+	m_pan_spread.store(std::min(std::max(settings.pan_spread, 0.0f), 1.0f), std::memory_order_relaxed);
+}
+
+unsigned int std::experimental::audio::granular_synth::get_active_grains() const
+{
+	return m_active_grains.load(std::memory_order_relaxed);
+}
+
+void std::experimental::audio::granular_synth::render(float* output, size_t num_frames)
+{
+	const granular_settings settings = get_settings();
+	std::fill(output, output + num_frames * 2, 0.0f);
+
+	// Grains already playing carry on from the start of the block, and finished ones are swapped out.
+	for (size_t i = 0; i < m_num_grains;)
+	{
+		render_grain(m_grains[i], output, num_frames);
+		if (m_grains[i].elapsed == m_grains[i].length)
+			std::swap(m_grains[i], m_grains[--m_num_grains]);
+		else
+			i++;
+	}
+
+	// New grains start part way through the block, at intervals of 0.5 to 1.5 times the average.  When the
+	// bank is full, grains are skipped rather than cutting off ones that are playing, and since nothing frees a
+	// slot until the next block, the rest of this block's starts are skipped at once.
+	if (settings.density > 0.0f)
+	{
+		const double interval = get_frequency() / settings.density;
+		m_next_grain = std::min(m_next_grain, interval * 1.5);
+		for (; m_next_grain < num_frames; m_next_grain += interval * (0.5 + random()))
+		{
+			if (m_num_grains == m_grains.size())
+			{
+				m_next_grain = static_cast<double>(num_frames);
+				break;
+			}
+
+			grain& g = m_grains[m_num_grains];
+			size_t offset = static_cast<size_t>(m_next_grain);
+			if (!start_grain(settings, g))
+				continue;
+			render_grain(g, output + offset * 2, num_frames - offset);
+			if (g.elapsed < g.length)
+				m_num_grains++;
+		}
+		m_next_grain -= num_frames;
+	}
+	else
+	{
+		m_next_grain = 0.0;
+	}
+	m_active_grains.store(static_cast<unsigned int>(m_num_grains), std::memory_order_relaxed);
+}
+
+bool std::experimental::audio::granular_synth::start_grain(const granular_settings& settings, grain& g)
+{
+	const double pi = 3.14159265358979323846;
+
+	const grain_source& s = m_sources[std::min(static_cast<size_t>(random() * m_sources.size()), m_sources.size() - 1)];
+	g.samples = s.samples;
+	g.step = static_cast<float>(s.rate * std::pow(2.0, settings.pitch_spread * (2.0f * random() - 1.0f) / 12.0));
+	g.length = static_cast<size_t>(settings.grain_seconds * get_frequency());
+	g.elapsed = 0;
+
+	// Interpolation reads one sample past the last position, and one more leaves room for rounding.  Sources
+	// shorter than a grain get shorter grains.
+	const double available = static_cast<double>(s.length) - 2.0;
+	if (available < 1.0 || g.length < 4)
+		return false;
+	double span = (g.length - 1) * static_cast<double>(g.step);
+	if (span > available - 1.0)
+	{
+		g.length = static_cast<size_t>((available - 1.0) / g.step) + 1;
+		span = (g.length - 1) * static_cast<double>(g.step);
+	}
+	if (g.length < 4)
+		return false;
+	g.window_step = 2.0 * pi / g.length;
+
+	double center = settings.position * s.length - span / 2.0;
+	double start = center + settings.position_spread * s.length * (2.0f * random() - 1.0f);
+	g.start = std::min(std::max(start, 0.0), available - span);
+
+	// Equal-power pan, with uncorrelated grains adding up in power as they overlap.
+	const double pan = settings.pan_spread * (2.0f * random() - 1.0f);
+	const double angle = (pan + 1.0) * pi / 4.0;
+	const double gain = 1.0 / std::sqrt(std::max(1.0, static_cast<double>(settings.density) * settings.grain_seconds));
+	g.left_gain = static_cast<float>(std::cos(angle) * gain);
+	g.right_gain = static_cast<float>(std::sin(angle) * gain);
+	return true;
+}
+
+void std::experimental::audio::granular_synth::render_grain(grain& g, float* output, size_t num_frames)
+{
+	size_t length = std::min(num_frames, g.length - g.elapsed);
+	RenderGrain(g.samples, g.start + g.elapsed * static_cast<double>(g.step), g.step, g.elapsed * g.window_step, g.window_step, g.left_gain, g.right_gain, output, length);
+	g.elapsed += length;
+}
+
+float std::experimental::audio::granular_synth::random()
+{
+	// xorshift32, uniform in [0, 1).
+	m_random_state ^= m_random_state << 13;
+	m_random_state ^= m_random_state >> 17;
+	m_random_state ^= m_random_state << 5;
+	return (m_random_state >> 8) * (1.0f / 16777216.0f);
+}
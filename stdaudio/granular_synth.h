@@ -0,0 +1,90 @@
+#pragma once
+
+#include "audio.h"
+#include <atomic>
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			struct granular_settings
+			{
+				// Average number of grains started per second, at most one per frame.  Start times are jittered so
+				// grains don't form a tone.
+				float density = 20.0f;
+				float grain_seconds = 0.1f;
+
+				// Grains start around position, as a fraction of the source's length, up to position_spread either side.
+				float position = 0.5f;
+				float position_spread = 0.5f;
+
+				// Largest random pitch offset either way, in semitones.
+				float pitch_spread = 0.0f;
+
+				// 0 keeps every grain centered, 1 spreads them across the whole stereo field.
+				float pan_spread = 1.0f;
+			};
+
+			// Dense textures such as rain or crowds from a few recordings, in one stereo voice.  Grains are short
+			// Hann-windowed pieces of the sources, each with a random source, start, pitch and pan, and overlapping
+			// grains are mixed with SSE.  Once grains overlap, output is scaled by the average overlap so that a denser
+			// texture isn't a louder one.  Settings can change while playing and apply from the next block.
+			class granular_synth : public synth
+			{
+			public:
+				// Sources are buffers or buffer_views.  Mono float data is read in place, anything else is converted
+				// to mono float once here.
+				explicit granular_synth(const std::vector<std::shared_ptr<source>>& sources, const granular_settings& settings = granular_settings(), unsigned int max_grains = 64, unsigned int frequency = 48000);
+
+				granular_settings get_settings() const;
+				void set_settings(const granular_settings& settings);
+
+				// Grains sounding as of the last render.
+				unsigned int get_active_grains() const;
+
+				void render(float* output, size_t num_frames) override;
+
+			private:
+				struct grain_source
+				{
+					std::shared_ptr<source> data;
+					const float* samples;
+					size_t length;
+					double rate;
+				};
+
+				struct grain
+				{
+					const float* samples;
+					double start;
+					float step;
+					size_t length;
+					size_t elapsed;
+					double window_step;
+					float left_gain;
+					float right_gain;
+				};
+
+				bool start_grain(const granular_settings& settings, grain& g);
+				void render_grain(grain& g, float* output, size_t num_frames);
+				float random();
+
+				std::vector<grain_source> m_sources;
+				std::vector<grain> m_grains;
+				size_t m_num_grains = 0;
+				double m_next_grain = 0.0;
+				uint32_t m_random_state;
+
+				std::atomic<float> m_density;
+				std::atomic<float> m_grain_seconds;
+				std::atomic<float> m_position;
+				std::atomic<float> m_position_spread;
+				std::atomic<float> m_pitch_spread;
+				std::atomic<float> m_pan_spread;
+				std::atomic<unsigned int> m_active_grains{ 0 };
+			};
+		}
+	}
+}
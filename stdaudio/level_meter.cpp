@@ -0,0 +1,337 @@
+#include "level_meter.h"
+#include "backend.h"
+#include "simd.h"
+#include <cmath>
+
+static void PeakAndSumSquares(const float* buffer, size_t length, float& peak, double& sum_squares)
+{
+	size_t i = 0;
+	float max_value = 0.0f;
+	float sum = 0.0f;
+#if STDAUDIO_SSE
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	__m128 max4 = _mm_setzero_ps();
+	__m128 sum4 = _mm_setzero_ps();
+	for (; i + 4 <= length; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(buffer + i);
+		max4 = _mm_max_ps(max4, _mm_andnot_ps(sign_mask, x));
+		sum4 = _mm_add_ps(sum4, _mm_mul_ps(x, x));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, max4);
+	max_value = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+	_mm_storeu_ps(lanes, sum4);
+	sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+	for (; i < length; i++)
+	{
+		max_value = std::max(max_value, std::abs(buffer[i]));
+		sum += buffer[i] * buffer[i];
+	}
+	peak = std::max(peak, max_value);
+	sum_squares += sum;
+}
+
+static float Biquad(const float* coefficients, float* state, float input)
+{
+	// Transposed direct form II; coefficients are b0, b1, b2, a1, a2.
+	float output = coefficients[0] * input + state[0];
+	state[0] = coefficients[1] * input - coefficients[3] * output + state[1];
+	state[1] = coefficients[2] * input - coefficients[4] * output;
+	return output;
+}
+
+static float ChannelWeight(int channel, int num_channels)
+{
+	// BS.1770 weights for FMOD's 5.1 / 7.1 ordering (L R C LFE SL SR [BL BR]).  The LFE is excluded.
+	if (num_channels < 6)
+		return 1.0f;
+	if (channel == 3)
+		return 0.0f;
+	return channel > 3 ? 1.41f : 1.0f;
+}
+
+static void KWeightingFilters(int sample_rate, float* shelf, float* highpass)
+{
+	// K-weighting filters from ITU-R BS.1770, recomputed for the given rate.
+	const double pi = 3.14159265358979323846;
+	{
+		const double f0 = 1681.974450955533;
+		const double gain_db = 3.999843853973347;
+		const double q = 0.7071752369554196;
+		double k = std::tan(pi * f0 / sample_rate);
+		double vh = std::pow(10.0, gain_db / 20.0);
+		double vb = std::pow(vh, 0.4996667741545416);
+		double a0 = 1.0 + k / q + k * k;
+		shelf[0] = static_cast<float>((vh + vb * k / q + k * k) / a0);
+		shelf[1] = static_cast<float>(2.0 * (k * k - vh) / a0);
+		shelf[2] = static_cast<float>((vh - vb * k / q + k * k) / a0);
+		shelf[3] = static_cast<float>(2.0 * (k * k - 1.0) / a0);
+		shelf[4] = static_cast<float>((1.0 - k / q + k * k) / a0);
+	}
+	{
+		const double f0 = 38.13547087602444;
+		const double q = 0.5003270373238773;
+		double k = std::tan(pi * f0 / sample_rate);
+		double a0 = 1.0 + k / q + k * k;
+		highpass[0] = 1.0f;
+		highpass[1] = -2.0f;
+		highpass[2] = 1.0f;
+		highpass[3] = static_cast<float>(2.0 * (k * k - 1.0) / a0);
+		highpass[4] = static_cast<float>((1.0 - k / q + k * k) / a0);
+	}
+}
+
+std::experimental::audio::level_meter::level_meter(int sample_rate) :
+	m_block_length(std::max(1, sample_rate / 10)),
+	m_short_term_loudness(-std::numeric_limits<float>::infinity())
+{
+	KWeightingFilters(sample_rate, m_shelf, m_highpass);
+
+	// 4x oversampling interpolator for true peak: a Hann windowed sinc split into polyphase branches.
+	const double pi = 3.14159265358979323846;
+	const size_t length = true_peak_phases * true_peak_taps;
+	for (size_t n = 0; n < length; n++)
+	{
+		double t = (static_cast<double>(n) - (length - 1) / 2.0) / true_peak_phases;
+		double sinc = (t == 0.0) ? 1.0 : std::sin(pi * t) / (pi * t);
+		double window = 0.5 - 0.5 * std::cos(2.0 * pi * (n + 0.5) / length);
+		m_interpolator[n % true_peak_phases][n / true_peak_phases] = static_cast<float>(sinc * window);
+	}
+
+	m_channels.resize(max_dsp_channels);
+}
+
+float std::experimental::audio::level_meter::process_true_peak(channel_state& state, float sample)
+{
+	// The history is stored twice so the most recent taps are always contiguous.
+	state.history_position = (state.history_position + true_peak_taps - 1) % true_peak_taps;
+	state.history[state.history_position] = sample;
+	state.history[state.history_position + true_peak_taps] = sample;
+	const float* taps = state.history + state.history_position;
+
+	float peak = 0.0f;
+	for (size_t phase = 0; phase < true_peak_phases; phase++)
+	{
+		float sum = 0.0f;
+		for (size_t k = 0; k < true_peak_taps; k++)
+			sum += m_interpolator[phase][k] * taps[k];
+		peak = std::max(peak, std::abs(sum));
+	}
+	return peak;
+}
+
+void std::experimental::audio::level_meter::process(const float* buffer, size_t length_samples, int num_channels)
+{
+	// Channels past max_dsp_channels still count towards peak and RMS, but not loudness or true peak.
+	const int weighted_channels = std::min(num_channels, static_cast<int>(m_channels.size()));
+
+	size_t done = 0;
+	while (done < length_samples)
+	{
+		size_t count = std::min(m_block_length - m_block_position, length_samples - done);
+		const float* block_start = buffer + done * num_channels;
+
+		PeakAndSumSquares(block_start, count * num_channels, m_block_peak, m_block_sum_squares);
+
+		for (int channel = 0; channel < weighted_channels; channel++)
+		{
+			auto& state = m_channels[channel];
+			float weighted_sum = 0.0f;
+			float true_peak = m_block_true_peak;
+			for (size_t i = 0; i < count; i++)
+			{
+				float sample = block_start[i * num_channels + channel];
+				float weighted = Biquad(m_highpass, state.highpass_state, Biquad(m_shelf, state.shelf_state, sample));
+				weighted_sum += weighted * weighted;
+				true_peak = std::max(true_peak, process_true_peak(state, sample));
+			}
+			state.weighted_sum += weighted_sum;
+			m_block_true_peak = true_peak;
+		}
+
+		m_block_position += count;
+		done += count;
+		if (m_block_position == m_block_length)
+		{
+			finish_block(num_channels);
+			publish();
+		}
+	}
+}
+
+void std::experimental::audio::level_meter::process_silence(size_t length_samples, int num_channels)
+{
+	// Idle input contributes nothing to the sums, so only the block accounting has to move forward.  The filters
+	// and interpolator have rung out on the silence, so they start clean when sound resumes.
+	for (auto& state : m_channels)
+	{
+		std::fill(std::begin(state.shelf_state), std::end(state.shelf_state), 0.0f);
+		std::fill(std::begin(state.highpass_state), std::end(state.highpass_state), 0.0f);
+		std::fill(std::begin(state.history), std::end(state.history), 0.0f);
+	}
+
+	size_t done = 0;
+	while (done < length_samples)
+	{
+		size_t count = std::min(m_block_length - m_block_position, length_samples - done);
+		m_block_position += count;
+		done += count;
+		if (m_block_position == m_block_length)
+		{
+			finish_block(num_channels);
+			publish();
+		}
+	}
+}
+
+void std::experimental::audio::level_meter::finish_block(int num_channels)
+{
+	auto& current = m_blocks[m_current_block];
+	current.loudness_power = 0.0f;
+	for (int channel = 0; channel < std::min(num_channels, static_cast<int>(m_channels.size())); channel++)
+	{
+		auto& state = m_channels[channel];
+		current.loudness_power += ChannelWeight(channel, num_channels) * static_cast<float>(state.weighted_sum / m_block_length);
+		state.weighted_sum = 0.0;
+	}
+	current.mean_square = static_cast<float>(m_block_sum_squares / (m_block_length * num_channels));
+	current.peak = m_block_peak;
+	current.true_peak = std::max(m_block_true_peak, m_block_peak);
+
+	m_current_block = (m_current_block + 1) % num_blocks;
+	m_block_position = 0;
+	m_block_sum_squares = 0.0;
+	m_block_peak = 0.0f;
+	m_block_true_peak = 0.0f;
+}
+
+void std::experimental::audio::level_meter::publish()
+{
+	// Peak and RMS cover the last 300ms, short-term loudness the last 3s.
+	const size_t level_blocks = 3;
+	float peak = 0.0f;
+	float true_peak = 0.0f;
+	float mean_square = 0.0f;
+	float loudness_power = 0.0f;
+	for (size_t i = 0; i < num_blocks; i++)
+	{
+		const auto& b = m_blocks[(m_current_block + num_blocks - 1 - i) % num_blocks];
+		if (i < level_blocks)
+		{
+			peak = std::max(peak, b.peak);
+			true_peak = std::max(true_peak, b.true_peak);
+			mean_square += b.mean_square;
+		}
+		loudness_power += b.loudness_power;
+	}
+	loudness_power /= num_blocks;
+
+	m_peak.store(peak, std::memory_order_relaxed);
+	m_true_peak.store(true_peak, std::memory_order_relaxed);
+	m_rms.store(std::sqrt(mean_square / level_blocks), std::memory_order_relaxed);
+	m_short_term_loudness.store(
+		loudness_power > 0.0f ? -0.691f + 10.0f * std::log10(loudness_power) : -std::numeric_limits<float>::infinity(),
+		std::memory_order_relaxed);
+}
+
+auto std::experimental::audio::level_meter::get_levels() const -> meter_levels
+{
+	meter_levels levels;
+	levels.peak = m_peak.load(std::memory_order_relaxed);
+	levels.true_peak = m_true_peak.load(std::memory_order_relaxed);
+	levels.rms = m_rms.load(std::memory_order_relaxed);
+	levels.short_term_loudness = m_short_term_loudness.load(std::memory_order_relaxed);
+	return levels;
+}
+
+auto std::experimental::audio::analyze_loudness(const float* buffer, size_t num_frames, int num_channels, int sample_rate) -> loudness_info
+{
+	loudness_info info;
+	if (num_frames == 0 || num_channels <= 0)
+		return info;
+
+	// Summed in chunks so that the float partial sums stay accurate over long clips.
+	const size_t chunk_size = 4096;
+	const size_t num_samples = num_frames * num_channels;
+	float peak = 0.0f;
+	double sum_squares = 0.0;
+	for (size_t i = 0; i < num_samples; i += chunk_size)
+		PeakAndSumSquares(buffer + i, std::min(chunk_size, num_samples - i), peak, sum_squares);
+	info.peak = peak;
+	info.rms = static_cast<float>(std::sqrt(sum_squares / num_samples));
+
+	// Channel-weighted K-weighted power of each 100ms step.  Gating blocks are four steps long, overlapping by 75%.
+	// Clips shorter than one gating block are measured as a single block.
+	float shelf[5];
+	float highpass[5];
+	KWeightingFilters(sample_rate, shelf, highpass);
+	const size_t step_length = std::max(1, sample_rate / 10);
+	const size_t steps_per_block = 4;
+	size_t num_steps = std::max<size_t>(1, num_frames / step_length);
+	std::vector<double> step_power(num_steps, 0.0);
+	for (int channel = 0; channel < num_channels; channel++)
+	{
+		float shelf_state[2] = {};
+		float highpass_state[2] = {};
+		double weight = ChannelWeight(channel, num_channels);
+		for (size_t step = 0; step < num_steps; step++)
+		{
+			size_t end = (num_steps == 1) ? num_frames : (step + 1) * step_length;
+			double sum = 0.0;
+			for (size_t i = step * step_length; i < end; i++)
+			{
+				float weighted = Biquad(highpass, highpass_state, Biquad(shelf, shelf_state, buffer[i * num_channels + channel]));
+				sum += weighted * weighted;
+			}
+			step_power[step] += weight * sum;
+		}
+	}
+
+	// A lone step runs to the end of the clip, but two or three whole steps leave the remainder out.
+	std::vector<double> block_power;
+	if (num_steps < steps_per_block)
+	{
+		double sum = 0.0;
+		for (double power : step_power)
+			sum += power;
+		block_power.push_back(sum / (num_steps == 1 ? num_frames : num_steps * step_length));
+	}
+	else
+	{
+		for (size_t step = 0; step + steps_per_block <= num_steps; step++)
+		{
+			double sum = 0.0;
+			for (size_t k = 0; k < steps_per_block; k++)
+				sum += step_power[step + k];
+			block_power.push_back(sum / (steps_per_block * step_length));
+		}
+	}
+
+	// Absolute gate at -70 LUFS, then a relative gate 10 LU below the loudness of what passed it.
+	auto gated_mean = [&](double threshold_power)
+	{
+		double sum = 0.0;
+		size_t count = 0;
+		for (double power : block_power)
+		{
+			if (power > threshold_power)
+			{
+				sum += power;
+				count++;
+			}
+		}
+		return count > 0 ? sum / count : 0.0;
+	};
+	auto to_power = [](double loudness) { return std::pow(10.0, (loudness + 0.691) / 10.0); };
+
+	double absolute_mean = gated_mean(to_power(-70.0));
+	if (absolute_mean <= 0.0)
+		return info;
+	double relative_threshold = -0.691 + 10.0 * std::log10(absolute_mean) - 10.0;
+	double integrated_mean = gated_mean(std::max(to_power(-70.0), to_power(relative_threshold)));
+	if (integrated_mean > 0.0)
+		info.integrated_loudness = static_cast<float>(-0.691 + 10.0 * std::log10(integrated_mean));
+	return info;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "audio.h"
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			// Analysis behind voice and submix metering.  process() runs on the mixer thread and results are
+			// published through atomics once per 100ms analysis block, so get_levels() never blocks either side.
+			class level_meter
+			{
+			public:
+				explicit level_meter(int sample_rate);
+
+				void process(const float* buffer, size_t length_samples, int num_channels);
+				void process_silence(size_t length_samples, int num_channels);
+				meter_levels get_levels() const;
+
+			private:
+				static constexpr size_t true_peak_phases = 4;
+				static constexpr size_t true_peak_taps = 12;
+				static constexpr size_t num_blocks = 30;
+
+				struct channel_state
+				{
+					float shelf_state[2] = {};
+					float highpass_state[2] = {};
+					float history[true_peak_taps * 2] = {};
+					size_t history_position = 0;
+					double weighted_sum = 0.0;
+				};
+
+				struct block
+				{
+					float loudness_power = 0.0f;
+					float mean_square = 0.0f;
+					float peak = 0.0f;
+					float true_peak = 0.0f;
+				};
+
+				float process_true_peak(channel_state& state, float sample);
+				void finish_block(int num_channels);
+				void publish();
+
+				// b0, b1, b2, a1, a2
+				float m_shelf[5];
+				float m_highpass[5];
+				float m_interpolator[true_peak_phases][true_peak_taps];
+				size_t m_block_length;
+
+				std::vector<channel_state> m_channels;
+				size_t m_block_position = 0;
+				double m_block_sum_squares = 0.0;
+				float m_block_peak = 0.0f;
+				float m_block_true_peak = 0.0f;
+				block m_blocks[num_blocks];
+				size_t m_current_block = 0;
+
+				std::atomic<float> m_peak{ 0.0f };
+				std::atomic<float> m_true_peak{ 0.0f };
+				std::atomic<float> m_rms{ 0.0f };
+				std::atomic<float> m_short_term_loudness;
+			};
+
+			// Offline analysis for load_settings::analyze_loudness.  Integrated loudness is gated as in ITU-R BS.1770-4.
+			loudness_info analyze_loudness(const float* buffer, size_t num_frames, int num_channels, int sample_rate);
+		}
+	}
+}
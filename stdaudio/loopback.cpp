@@ -0,0 +1,65 @@
+#include "loopback.h"
+
+std::experimental::audio::loopback_buffer::loopback_buffer(size_t capacity_frames, int num_channels, int sample_rate) :
+	m_ring(capacity_frames * num_channels),
+	m_capacity(capacity_frames),
+	m_num_channels(num_channels),
+	m_sample_rate(sample_rate)
+{
+}
+
+int std::experimental::audio::loopback_buffer::get_num_channels() const
+{
+	return m_num_channels;
+}
+
+void std::experimental::audio::loopback_buffer::write(const float* buffer, size_t num_frames, std::chrono::nanoseconds mix_time)
+{
+	uint64_t write_position = m_write_position.load(std::memory_order_relaxed);
+	uint64_t read_position = m_read_position.load(std::memory_order_acquire);
+	size_t space = m_capacity - static_cast<size_t>(write_position - read_position);
+	size_t count = std::min(num_frames, space);
+
+	// Copy in at most two pieces, around the end of the ring.
+	size_t offset = static_cast<size_t>(write_position % m_capacity);
+	size_t first = std::min(count, m_capacity - offset);
+	std::copy(buffer, buffer + first * m_num_channels, m_ring.begin() + offset * m_num_channels);
+	std::copy(buffer + first * m_num_channels, buffer + count * m_num_channels, m_ring.begin());
+	m_write_position.store(write_position + count, std::memory_order_release);
+
+	// Only the mixer updates the statistics, so plain loads and stores are enough here.
+	int64_t elapsed = mix_time.count();
+	m_frames_mixed.store(m_frames_mixed.load(std::memory_order_relaxed) + num_frames, std::memory_order_relaxed);
+	m_frames_dropped.store(m_frames_dropped.load(std::memory_order_relaxed) + (num_frames - count), std::memory_order_relaxed);
+	m_blocks_mixed.store(m_blocks_mixed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	m_total_mix_ns.store(m_total_mix_ns.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+	if (elapsed > m_worst_mix_ns.load(std::memory_order_relaxed))
+		m_worst_mix_ns.store(elapsed, std::memory_order_relaxed);
+}
+
+size_t std::experimental::audio::loopback_buffer::read(float* buffer, size_t num_frames)
+{
+	uint64_t read_position = m_read_position.load(std::memory_order_relaxed);
+	uint64_t write_position = m_write_position.load(std::memory_order_acquire);
+	size_t count = std::min(num_frames, static_cast<size_t>(write_position - read_position));
+
+	size_t offset = static_cast<size_t>(read_position % m_capacity);
+	size_t first = std::min(count, m_capacity - offset);
+	std::copy(m_ring.begin() + offset * m_num_channels, m_ring.begin() + (offset + first) * m_num_channels, buffer);
+	std::copy(m_ring.begin(), m_ring.begin() + (count - first) * m_num_channels, buffer + first * m_num_channels);
+	m_read_position.store(read_position + count, std::memory_order_release);
+	return count;
+}
+
+auto std::experimental::audio::loopback_buffer::get_stats() const -> loopback_stats
+{
+	loopback_stats stats;
+	stats.sample_rate = m_sample_rate;
+	stats.num_channels = m_num_channels;
+	stats.frames_mixed = m_frames_mixed.load(std::memory_order_relaxed);
+	stats.frames_dropped = m_frames_dropped.load(std::memory_order_relaxed);
+	stats.blocks_mixed = m_blocks_mixed.load(std::memory_order_relaxed);
+	stats.total_mix_time = std::chrono::nanoseconds(m_total_mix_ns.load(std::memory_order_relaxed));
+	stats.worst_mix_time = std::chrono::nanoseconds(m_worst_mix_ns.load(std::memory_order_relaxed));
+	return stats;
+}
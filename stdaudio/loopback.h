@@ -0,0 +1,41 @@
+#pragma once
+
+#include "audio.h"
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			// Final mix of a device with loopback output.  The mixer is the only writer and the application the only
+			// reader, so the ring is lock-free on both sides.  When the reader falls behind, new frames are dropped
+			// and counted rather than overwriting ones it has not read yet.
+			class loopback_buffer
+			{
+			public:
+				loopback_buffer(size_t capacity_frames, int num_channels, int sample_rate);
+
+				int get_num_channels() const;
+
+				void write(const float* buffer, size_t num_frames, std::chrono::nanoseconds mix_time);
+				size_t read(float* buffer, size_t num_frames);
+				loopback_stats get_stats() const;
+
+			private:
+				std::vector<float> m_ring;
+				size_t m_capacity;
+				int m_num_channels;
+				int m_sample_rate;
+				std::atomic<uint64_t> m_write_position{ 0 };
+				std::atomic<uint64_t> m_read_position{ 0 };
+
+				std::atomic<uint64_t> m_frames_mixed{ 0 };
+				std::atomic<uint64_t> m_frames_dropped{ 0 };
+				std::atomic<uint64_t> m_blocks_mixed{ 0 };
+				std::atomic<int64_t> m_total_mix_ns{ 0 };
+				std::atomic<int64_t> m_worst_mix_ns{ 0 };
+			};
+		}
+	}
+}
@@ -0,0 +1,102 @@
+#include "memory_tracking.h"
+#include <cstring>
+
+namespace
+{
+	struct alignas(std::max_align_t) allocation_header
+	{
+		std::pmr::memory_resource* resource;
+		size_t size;
+	};
+}
+
+std::experimental::audio::tracking_resource::tracking_resource(std::pmr::memory_resource* upstream) :
+	m_upstream(upstream != nullptr ? upstream : std::pmr::new_delete_resource()),
+	m_serialize(upstream != nullptr)
+{
+}
+
+auto std::experimental::audio::tracking_resource::get_stats() const -> memory_stats
+{
+	memory_stats stats;
+	stats.allocations = m_allocations.load(std::memory_order_relaxed);
+	stats.deallocations = m_deallocations.load(std::memory_order_relaxed);
+	stats.bytes_in_use = m_bytes_in_use.load(std::memory_order_relaxed);
+	stats.peak_bytes = m_peak_bytes.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void* std::experimental::audio::tracking_resource::do_allocate(size_t bytes, size_t alignment)
+{
+	void* p;
+	if (m_serialize)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		p = m_upstream->allocate(bytes, alignment);
+	}
+	else
+	{
+		p = m_upstream->allocate(bytes, alignment);
+	}
+
+	m_allocations.fetch_add(1, std::memory_order_relaxed);
+	size_t in_use = m_bytes_in_use.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+	size_t peak = m_peak_bytes.load(std::memory_order_relaxed);
+	while (in_use > peak && !m_peak_bytes.compare_exchange_weak(peak, in_use, std::memory_order_relaxed))
+	{
+	}
+	return p;
+}
+
+void std::experimental::audio::tracking_resource::do_deallocate(void* p, size_t bytes, size_t alignment)
+{
+	if (m_serialize)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_upstream->deallocate(p, bytes, alignment);
+	}
+	else
+	{
+		m_upstream->deallocate(p, bytes, alignment);
+	}
+	m_deallocations.fetch_add(1, std::memory_order_relaxed);
+	m_bytes_in_use.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+bool std::experimental::audio::tracking_resource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
+
+void* std::experimental::audio::allocate_object(std::pmr::memory_resource* resource, size_t size)
+{
+	if (resource == nullptr)
+		resource = std::pmr::new_delete_resource();
+
+	auto header = static_cast<allocation_header*>(resource->allocate(sizeof(allocation_header) + size, alignof(allocation_header)));
+	header->resource = resource;
+	header->size = size;
+	return header + 1;
+}
+
+void* std::experimental::audio::reallocate_object(void* p, size_t size)
+{
+	if (p == nullptr)
+		return allocate_object(nullptr, size);
+
+	// Blocks stay with the resource they were first allocated from.
+	auto header = static_cast<allocation_header*>(p) - 1;
+	void* new_p = allocate_object(header->resource, size);
+	std::memcpy(new_p, p, std::min(size, header->size));
+	deallocate_object(p);
+	return new_p;
+}
+
+void std::experimental::audio::deallocate_object(void* p)
+{
+	if (p == nullptr)
+		return;
+
+	auto header = static_cast<allocation_header*>(p) - 1;
+	header->resource->deallocate(header, sizeof(allocation_header) + header->size, alignof(allocation_header));
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "audio.h"
+#include <mutex>
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			// Front for one memory category of a device.  Allocations from a caller's resource are serialized here, so
+			// it can be an unsynchronized pool or arena even though voices and effects allocate from several threads.
+			// The global heap needs no lock, and the counters are atomic, so FMOD's mixer thread never blocks here.
+			class tracking_resource : public std::pmr::memory_resource
+			{
+			public:
+				explicit tracking_resource(std::pmr::memory_resource* upstream);
+
+				memory_stats get_stats() const;
+
+			private:
+				void* do_allocate(size_t bytes, size_t alignment) override;
+				void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+				bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+				std::pmr::memory_resource* m_upstream;
+				bool m_serialize;
+				std::mutex m_lock;
+				std::atomic<uint64_t> m_allocations{ 0 };
+				std::atomic<uint64_t> m_deallocations{ 0 };
+				std::atomic<size_t> m_bytes_in_use{ 0 };
+				std::atomic<size_t> m_peak_bytes{ 0 };
+			};
+
+			// For allocations whose size is unknown when they are freed: class-specific operator delete and FMOD's
+			// free callback.  The block records its resource and size just in front of the pointer returned.
+			void* allocate_object(std::pmr::memory_resource* resource, size_t size);
+			void* reallocate_object(void* p, size_t size);
+			void deallocate_object(void* p);
+		}
+	}
+}
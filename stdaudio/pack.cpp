@@ -0,0 +1,85 @@
+#include "pack.h"
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+bool std::experimental::audio::is_valid_pack_header(const pack_header& header)
+{
+	return memcmp(header.magic, pack_magic, sizeof(pack_magic)) == 0 && header.version == pack_version;
+}
+
+bool std::experimental::audio::is_valid_pack_entry(const pack_table_entry& entry)
+{
+	return entry.format <= static_cast<uint32_t>(memory_buffer_format::adpcm)
+		&& entry.num_channels > 0
+		&& entry.frequency > 0
+		&& entry.name[pack_name_length - 1] == '\0';
+}
+
+void std::experimental::audio::save_pack(const std::filesystem::path& filepath, const std::vector<pack_source>& entries)
+{
+	std::vector<pack_table_entry> table(entries.size());
+	uint64_t offset = sizeof(pack_header) + sizeof(pack_table_entry) * entries.size();
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (entries[i].name.size() >= pack_name_length)
+			throw std::invalid_argument("Pack entry names must be shorter than 48 characters");
+		if (!entries[i].sound)
+			throw std::invalid_argument("Pack entries need a buffer");
+
+		memory_buffer_data data = entries[i].sound->get_audio_data();
+		auto& entry = table[i];
+		memset(&entry, 0, sizeof(entry));
+		memcpy(entry.name, entries[i].name.data(), entries[i].name.size());
+		entry.format = static_cast<uint32_t>(data.description.format);
+		entry.num_channels = data.description.num_channels;
+		entry.frequency = data.description.frequency;
+
+		offset = (offset + pack_alignment - 1) / pack_alignment * pack_alignment;
+		if (offset + data.data.size > std::numeric_limits<uint32_t>::max())
+			throw std::invalid_argument("Packs are limited to 4GB");
+		entry.offset = static_cast<uint32_t>(offset);
+		entry.size = static_cast<uint32_t>(data.data.size);
+		offset += data.data.size;
+	}
+
+	std::ofstream file(filepath, std::ios::binary);
+	if (!file)
+		throw std::runtime_error("Unable to open the pack file");
+
+	pack_header header = {};
+	memcpy(header.magic, pack_magic, sizeof(pack_magic));
+	header.version = pack_version;
+	header.num_entries = static_cast<uint32_t>(entries.size());
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(table.data()), sizeof(pack_table_entry) * table.size());
+
+	const char padding[pack_alignment] = {};
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		size_t position = static_cast<size_t>(file.tellp());
+		file.write(padding, table[i].offset - position);
+		memory_buffer_data data = entries[i].sound->get_audio_data();
+		file.write(reinterpret_cast<const char*>(data.data.data), data.data.size);
+	}
+	if (!file)
+		throw std::runtime_error("Unable to write the pack file");
+}
+
+int std::experimental::audio::find_pack_entry(const std::filesystem::path& filepath, const std::string& name)
+{
+	std::ifstream file(filepath, std::ios::binary);
+	pack_header header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || !is_valid_pack_header(header))
+		throw std::runtime_error("Not a sound pack");
+
+	for (uint32_t i = 0; i < header.num_entries; i++)
+	{
+		pack_table_entry entry;
+		if (!file.read(reinterpret_cast<char*>(&entry), sizeof(entry)))
+			break;
+		if (strncmp(entry.name, name.c_str(), pack_name_length) == 0)
+			return static_cast<int>(i);
+	}
+	return -1;
+}
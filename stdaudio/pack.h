@@ -0,0 +1,46 @@
+#pragma once
+
+#include "audio.h"
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			// On-disk layout of a sound pack: a header, a table of entries, then each entry's samples aligned to
+			// pack_alignment.  Fields are little endian.  Offsets are 32-bit because FMOD seeks with 32-bit
+			// positions, so a pack holds at most 4GB.
+			constexpr char pack_magic[4] = { 'S', 'A', 'P', 'K' };
+			constexpr uint32_t pack_version = 1;
+			constexpr size_t pack_alignment = 16;
+			constexpr size_t pack_name_length = 48;
+
+			struct pack_header
+			{
+				char magic[4];
+				uint32_t version;
+				uint32_t num_entries;
+				uint32_t reserved;
+			};
+
+			// format holds a memory_buffer_format.
+			struct pack_table_entry
+			{
+				char name[pack_name_length];
+				uint32_t format;
+				uint32_t num_channels;
+				uint32_t frequency;
+				uint32_t offset;
+				uint32_t size;
+				uint32_t reserved[3];
+			};
+
+			static_assert(sizeof(pack_header) == 16, "pack_header must match the file layout");
+			static_assert(sizeof(pack_table_entry) == 80, "pack_table_entry must match the file layout");
+
+			bool is_valid_pack_header(const pack_header& header);
+			bool is_valid_pack_entry(const pack_table_entry& entry);
+		}
+	}
+}
@@ -0,0 +1,327 @@
+#include "realtime_check.h"
+#include <cstdlib>
+#include <new>
+
+#if defined(STDAUDIO_REALTIME_CHECKS) && defined(__linux__)
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// Bounded multi-producer queue (one sequence number per cell) so that the mixer and the worker threads can report
+// concurrently without locks.  Reports that don't fit are dropped.
+namespace
+{
+	const size_t violation_queue_size = 256;
+
+	struct violation_cell
+	{
+		std::atomic<size_t> sequence;
+		std::experimental::audio::realtime_violation violation;
+	};
+
+	struct violation_queue
+	{
+		violation_queue()
+		{
+			for (size_t i = 0; i < violation_queue_size; i++)
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		violation_cell cells[violation_queue_size];
+		std::atomic<size_t> enqueue_position{ 0 };
+		std::atomic<size_t> dequeue_position{ 0 };
+	};
+
+	violation_queue g_violations;
+	std::atomic<bool> g_enabled{ false };
+	std::atomic<int> g_sample_rate{ 48000 };
+	std::atomic<float> g_budget{ 0.5f };
+
+	thread_local bool t_in_scope = false;
+	thread_local bool t_reporting = false;
+	thread_local const std::experimental::audio::effect_instance* t_instance = nullptr;
+}
+
+static void PushViolation(const std::experimental::audio::realtime_violation& violation)
+{
+	size_t position = g_violations.enqueue_position.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		violation_cell& cell = g_violations.cells[position % violation_queue_size];
+		size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		if (sequence == position)
+		{
+			if (g_violations.enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				cell.violation = violation;
+				cell.sequence.store(position + 1, std::memory_order_release);
+				return;
+			}
+		}
+		else if (sequence < position)
+		{
+			return;
+		}
+		else
+		{
+			position = g_violations.enqueue_position.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+static bool PopViolation(std::experimental::audio::realtime_violation& violation)
+{
+	size_t position = g_violations.dequeue_position.load(std::memory_order_relaxed);
+	violation_cell& cell = g_violations.cells[position % violation_queue_size];
+	if (cell.sequence.load(std::memory_order_acquire) != position + 1)
+		return false;
+
+	// Only the game thread dequeues, so the position can simply be advanced.
+	violation = cell.violation;
+	cell.sequence.store(position + violation_queue_size, std::memory_order_release);
+	g_violations.dequeue_position.store(position + 1, std::memory_order_relaxed);
+	return true;
+}
+
+static void Report(
+	std::experimental::audio::realtime_violation_type type,
+	const std::experimental::audio::effect_instance* instance,
+	const char* function,
+	std::chrono::nanoseconds duration,
+	std::chrono::nanoseconds budget)
+{
+	// Reporting itself must not trip the hooks.
+	if (t_reporting)
+		return;
+	t_reporting = true;
+
+	std::experimental::audio::realtime_violation violation;
+	violation.type = type;
+	violation.effect = instance;
+	violation.function = function;
+	violation.duration = duration;
+	violation.budget = budget;
+	PushViolation(violation);
+
+	t_reporting = false;
+}
+
+void std::experimental::audio::realtime_checks::enable(int sample_rate, float budget)
+{
+	g_sample_rate.store(sample_rate > 0 ? sample_rate : 48000, std::memory_order_relaxed);
+	g_budget.store(budget, std::memory_order_relaxed);
+	g_enabled.store(true, std::memory_order_release);
+}
+
+void std::experimental::audio::realtime_checks::disable()
+{
+	g_enabled.store(false, std::memory_order_release);
+}
+
+bool std::experimental::audio::realtime_checks::is_enabled()
+{
+	return g_enabled.load(std::memory_order_relaxed);
+}
+
+bool std::experimental::audio::realtime_checks::in_scope()
+{
+	return t_in_scope && !t_reporting && g_enabled.load(std::memory_order_relaxed);
+}
+
+void std::experimental::audio::realtime_checks::report(realtime_violation_type type, const char* function)
+{
+	Report(type, t_instance, function, std::chrono::nanoseconds(0), std::chrono::nanoseconds(0));
+}
+
+auto std::experimental::audio::realtime_checks::take_violations() -> std::vector<realtime_violation>
+{
+	std::vector<realtime_violation> violations;
+	realtime_violation violation;
+	while (PopViolation(violation))
+		violations.push_back(violation);
+	return violations;
+}
+
+std::experimental::audio::realtime_scope::realtime_scope(const effect_instance* instance, size_t length_samples) :
+	m_active(g_enabled.load(std::memory_order_relaxed))
+{
+	if (!m_active)
+		return;
+
+	m_instance = instance;
+	m_previous_instance = t_instance;
+	m_previous_in_scope = t_in_scope;
+	m_length_samples = length_samples;
+	t_instance = instance;
+	t_in_scope = true;
+	m_start = std::chrono::steady_clock::now();
+}
+
+std::experimental::audio::realtime_scope::~realtime_scope()
+{
+	if (!m_active)
+		return;
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start);
+	auto budget = std::chrono::nanoseconds(static_cast<int64_t>(
+		1.0e9 * g_budget.load(std::memory_order_relaxed) * m_length_samples / g_sample_rate.load(std::memory_order_relaxed)));
+	if (elapsed > budget)
+		Report(realtime_violation_type::overrun, m_instance, "process", elapsed, budget);
+
+	t_instance = m_previous_instance;
+	t_in_scope = m_previous_in_scope;
+}
+
+#ifdef STDAUDIO_REALTIME_CHECKS
+
+// Replacing the global allocation functions catches every allocation made through new, including the ones inside
+// the standard containers.  Everything still ends up in malloc and free.
+void* operator new(std::size_t size)
+{
+	if (std::experimental::audio::realtime_checks::in_scope())
+		std::experimental::audio::realtime_checks::report(std::experimental::audio::realtime_violation_type::allocation, "operator new");
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	if (std::experimental::audio::realtime_checks::in_scope())
+		std::experimental::audio::realtime_checks::report(std::experimental::audio::realtime_violation_type::allocation, "operator new");
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept
+{
+	if (p != nullptr && std::experimental::audio::realtime_checks::in_scope())
+		std::experimental::audio::realtime_checks::report(std::experimental::audio::realtime_violation_type::deallocation, "operator delete");
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+	operator delete(p);
+}
+
+#ifdef __linux__
+
+// Locks and blocking calls are caught by interposing the C library entry points that std::mutex, condition
+// variables, sleeps and file I/O end up in.  There is no equivalent for the Win32 API without patching it, so on
+// Windows only allocations and overruns are reported.
+template<typename F>
+static F NextSymbol(std::atomic<F>& cached, const char* name)
+{
+	F next = cached.load(std::memory_order_relaxed);
+	if (next == nullptr)
+	{
+		next = reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+		cached.store(next, std::memory_order_relaxed);
+	}
+	return next;
+}
+
+static void CheckCall(std::experimental::audio::realtime_violation_type type, const char* function)
+{
+	if (std::experimental::audio::realtime_checks::in_scope())
+		std::experimental::audio::realtime_checks::report(type, function);
+}
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept
+{
+	static std::atomic<int (*)(pthread_mutex_t*)> next{ nullptr };
+	CheckCall(std::experimental::audio::realtime_violation_type::lock, "pthread_mutex_lock");
+	return NextSymbol(next, "pthread_mutex_lock")(mutex);
+}
+
+extern "C" int pthread_cond_wait(pthread_cond_t* condition, pthread_mutex_t* mutex)
+{
+	static std::atomic<int (*)(pthread_cond_t*, pthread_mutex_t*)> next{ nullptr };
+	CheckCall(std::experimental::audio::realtime_violation_type::blocking_call, "pthread_cond_wait");
+	return NextSymbol(next, "pthread_cond_wait")(condition, mutex);
+}
+
+extern "C" int pthread_cond_timedwait(pthread_cond_t* condition, pthread_mutex_t* mutex, const struct timespec* time)
+{
+	static std::atomic<int (*)(pthread_cond_t*, pthread_mutex_t*, const struct timespec*)> next{ nullptr };
+	CheckCall(std::experimental::audio::realtime_violation_type::blocking_call, "pthread_cond_timedwait");
+	return NextSymbol(next, "pthread_cond_timedwait")(condition, mutex, time);
+}
+
+extern "C" int sem_wait(sem_t* semaphore)
+{
+	static std::atomic<int (*)(sem_t*)> next{ nullptr };
+	CheckCall(std::experimental::audio::realtime_violation_type::blocking_call, "sem_wait");
+	return NextSymbol(next, "sem_wait")(semaphore);
+}
+
+extern "C" int nanosleep(const struct timespec* duration, struct timespec* remaining)
+{
+	static std::atomic<int (*)(const struct timespec*, struct timespec*)> next{ nullptr };
+	CheckCall(std::experimental::audio::realtime_violation_type::blocking_call, "nanosleep");
+	return NextSymbol(next, "nanosleep")(duration, remaining);
+}
+
+extern "C" int clock_nanosleep(clockid_t clock, int flags, const struct timespec* time, struct timespec* remaining)
+{
+	static std::atomic<int (*)(clockid_t, int, const struct timespec*, struct timespec*)> next{ nullptr };
+	CheckCall(std::experimental::audio::realtime_violation_type::blocking_call, "clock_nanosleep");
+	return NextSymbol(next, "clock_nanosleep")(clock, flags, time, remaining);
+}
+
+extern "C" int usleep(useconds_t microseconds)
+{
+	static std::atomic<int (*)(useconds_t)> next{ nullptr };
+	CheckCall(std::experimental::audio::realtime_violation_type::blocking_call, "usleep");
+	return NextSymbol(next, "usleep")(microseconds);
+}
+
+extern "C" ssize_t read(int fd, void* buffer, size_t count)
+{
+	static std::atomic<ssize_t (*)(int, void*, size_t)> next{ nullptr };
+	CheckCall(std::experimental::audio::realtime_violation_type::blocking_call, "read");
+	return NextSymbol(next, "read")(fd, buffer, count);
+}
+
+extern "C" ssize_t write(int fd, const void* buffer, size_t count)
+{
+	static std::atomic<ssize_t (*)(int, const void*, size_t)> next{ nullptr };
+	CheckCall(std::experimental::audio::realtime_violation_type::blocking_call, "write");
+	return NextSymbol(next, "write")(fd, buffer, count);
+}
+
+#endif
+#endif
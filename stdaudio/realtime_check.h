@@ -0,0 +1,46 @@
+#pragma once
+
+#include "audio.h"
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			// Process-wide switch and violation queue behind device::set_realtime_checks.  Reporting never allocates or
+			// blocks, so it is safe from inside the hooks and from any mixer or worker thread.
+			class realtime_checks
+			{
+			public:
+				static void enable(int sample_rate, float budget);
+				static void disable();
+				static bool is_enabled();
+				static bool in_scope();
+
+				static void report(realtime_violation_type type, const char* function);
+				static std::vector<realtime_violation> take_violations();
+			};
+
+			// Marks the calling thread as running mixer code while it is alive, and reports an overrun if the block
+			// took longer than its budget.  Costs a single relaxed load while the checks are disabled.
+			class realtime_scope
+			{
+			public:
+				realtime_scope(const effect_instance* instance, size_t length_samples);
+				~realtime_scope();
+
+				realtime_scope(const realtime_scope&) = delete;
+				realtime_scope& operator=(const realtime_scope&) = delete;
+
+			private:
+				bool m_active;
+				const effect_instance* m_instance = nullptr;
+				const effect_instance* m_previous_instance = nullptr;
+				bool m_previous_in_scope = false;
+				size_t m_length_samples = 0;
+				std::chrono::steady_clock::time_point m_start;
+			};
+		}
+	}
+}
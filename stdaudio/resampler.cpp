@@ -0,0 +1,147 @@
+#include "resampler.h"
+#include "simd.h"
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+static double BesselI0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+static float DotProduct(const float* a, const float* b, size_t length)
+{
+	size_t i = 0;
+	float sum = 0.0f;
+#if STDAUDIO_SSE
+	__m128 sum4 = _mm_setzero_ps();
+	for (; i + 4 <= length; i += 4)
+		sum4 = _mm_add_ps(sum4, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	float lanes[4];
+	_mm_storeu_ps(lanes, sum4);
+	sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+	for (; i < length; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+std::experimental::audio::resampler::resampler(unsigned int input_rate, unsigned int output_rate)
+{
+	if (input_rate == 0 || output_rate == 0)
+		throw std::invalid_argument("Invalid resampler rate");
+
+	uint64_t divisor = std::gcd(input_rate, output_rate);
+	m_upsample = output_rate / divisor;
+	m_downsample = input_rate / divisor;
+	m_num_phases = std::min(m_upsample, max_phases);
+
+	// 32 taps either side when upsampling.  Downsampling lowers the cutoff, so the filter widens to match.
+	const double ratio = static_cast<double>(m_upsample) / m_downsample;
+	const double cutoff = 0.5 * std::min(1.0, ratio) * 0.91;
+	m_half_length = static_cast<size_t>(std::ceil(32.0 / std::min(1.0, ratio)));
+	m_half_length += m_half_length % 2;
+	m_taps = m_half_length * 2;
+
+	// Kaiser window with beta 8.6, roughly 90dB of stopband attenuation.  Each phase is normalized to unity gain
+	// at DC.
+	const double pi = 3.14159265358979323846;
+	const double beta = 8.6;
+	const double window_scale = 1.0 / BesselI0(beta);
+	m_coefficients.resize(m_num_phases * m_taps);
+	for (uint64_t phase = 0; phase < m_num_phases; phase++)
+	{
+		double fraction = static_cast<double>(phase) / m_num_phases;
+		float* row = m_coefficients.data() + phase * m_taps;
+		double sum = 0.0;
+		for (size_t k = 0; k < m_taps; k++)
+		{
+			double distance = static_cast<double>(k) - (m_half_length - 1) - fraction;
+			double x = 2.0 * cutoff * distance;
+			double sinc = (x == 0.0) ? 1.0 : std::sin(pi * x) / (pi * x);
+			double position = distance / m_half_length;
+			double window = std::abs(position) < 1.0 ? BesselI0(beta * std::sqrt(1.0 - position * position)) * window_scale : 0.0;
+			row[k] = static_cast<float>(sinc * window);
+			sum += row[k];
+		}
+		for (size_t k = 0; k < m_taps; k++)
+			row[k] = static_cast<float>(row[k] / sum);
+	}
+}
+
+size_t std::experimental::audio::resampler::get_output_length(size_t input_length) const
+{
+	return static_cast<size_t>((input_length * m_upsample + m_downsample - 1) / m_downsample);
+}
+
+void std::experimental::audio::resampler::process(const float* input, size_t input_length, float* output, size_t begin, size_t end) const
+{
+	for (size_t n = begin; n < end; n++)
+	{
+		uint64_t position = n * m_downsample;
+		uint64_t index = position / m_upsample;
+		uint64_t phase = ((position % m_upsample) * m_num_phases + m_upsample / 2) / m_upsample;
+		if (phase == m_num_phases)
+		{
+			phase = 0;
+			index++;
+		}
+
+		// The window covers input samples [first, first + taps).  Only the ones near the ends need bounds checks.
+		const float* row = m_coefficients.data() + phase * m_taps;
+		int64_t first = static_cast<int64_t>(index) - static_cast<int64_t>(m_half_length - 1);
+		if (first >= 0 && first + static_cast<int64_t>(m_taps) <= static_cast<int64_t>(input_length))
+		{
+			output[n] = DotProduct(row, input + first, m_taps);
+		}
+		else
+		{
+			float sum = 0.0f;
+			for (size_t k = 0; k < m_taps; k++)
+			{
+				int64_t i = first + static_cast<int64_t>(k);
+				if (i >= 0 && i < static_cast<int64_t>(input_length))
+					sum += row[k] * input[i];
+			}
+			output[n] = sum;
+		}
+	}
+}
+
+std::vector<float> std::experimental::audio::resampler::process_interleaved(const float* input, size_t num_frames, unsigned int num_channels) const
+{
+	const size_t output_frames = get_output_length(num_frames);
+	std::vector<float> planar_input(num_frames * num_channels);
+	std::vector<float> planar_output(output_frames * num_channels);
+	deinterleave(input, planar_input.data(), num_frames, num_channels);
+
+	// Every output sample is independent, so each thread takes a contiguous slice of every channel.
+	const size_t min_frames_per_thread = 65536;
+	size_t num_threads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), output_frames / min_frames_per_thread));
+	auto run = [&](size_t slice)
+	{
+		size_t begin = output_frames * slice / num_threads;
+		size_t end = output_frames * (slice + 1) / num_threads;
+		for (unsigned int channel = 0; channel < num_channels; channel++)
+			process(planar_input.data() + channel * num_frames, num_frames, planar_output.data() + channel * output_frames, begin, end);
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t slice = 1; slice < num_threads; slice++)
+		threads.emplace_back(run, slice);
+	run(0);
+	for (auto& thread : threads)
+		thread.join();
+
+	std::vector<float> output(output_frames * num_channels);
+	interleave(planar_output.data(), output.data(), output_frames, num_channels);
+	return output;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "audio.h"
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			// Windowed sinc polyphase resampler for converting whole buffers at load time.  The rate ratio is reduced
+			// to output_rate / input_rate = L / M, and output sample n reads the filter phase n * M mod L.  Ratios
+			// with more than max_phases phases round to the nearest of max_phases, which stays well below the
+			// filter's stopband.
+			class resampler
+			{
+			public:
+				resampler(unsigned int input_rate, unsigned int output_rate);
+
+				size_t get_output_length(size_t input_length) const;
+
+				// Resamples one channel.  input holds all input_length samples; output receives samples [begin, end).
+				void process(const float* input, size_t input_length, float* output, size_t begin, size_t end) const;
+
+				// Resamples an interleaved buffer, splitting long ones across threads.
+				std::vector<float> process_interleaved(const float* input, size_t num_frames, unsigned int num_channels) const;
+
+			private:
+				static constexpr uint64_t max_phases = 512;
+
+				uint64_t m_upsample;
+				uint64_t m_downsample;
+				uint64_t m_num_phases;
+				size_t m_half_length;
+				size_t m_taps;
+				std::vector<float> m_coefficients;
+			};
+		}
+	}
+}
@@ -0,0 +1,265 @@
+#include "sample_format.h"
+#include "simd.h"
+#include <stdexcept>
+
+// Conversions go through float a chunk at a time, so each format needs only a decoder and an encoder rather than a
+// kernel for every pair.
+static const size_t convert_chunk_size = 256;
+
+template<std::experimental::audio::memory_buffer_format Format>
+static void DecodeScalar(const std::byte* input, float* output, size_t begin, size_t end)
+{
+	const size_t sample_size = std::experimental::audio::bytes_per_sample(Format);
+	for (size_t i = begin; i < end; i++)
+		output[i] = std::experimental::audio::read_sample<Format>(input + i * sample_size);
+}
+
+template<std::experimental::audio::memory_buffer_format Format>
+static void EncodeScalar(const float* input, std::byte* output, size_t begin, size_t end)
+{
+	const size_t sample_size = std::experimental::audio::bytes_per_sample(Format);
+	for (size_t i = begin; i < end; i++)
+		std::experimental::audio::write_sample<Format>(output + i * sample_size, input[i]);
+}
+
+#if STDAUDIO_SSE2
+// Widens the low four lanes of a vector of 16-bit integers to 32 bits, keeping the sign.
+static __m128i WidenLow16(__m128i x)
+{
+	return _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), x), 16);
+}
+
+static __m128i WidenHigh16(__m128i x)
+{
+	return _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), x), 16);
+}
+
+// Scales and clamps to the integer range before converting, since out of range conversions give INT_MIN.
+static __m128i ScaleToInt(__m128 x, float scale, float max_value)
+{
+	x = _mm_mul_ps(x, _mm_set1_ps(scale));
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-scale)), _mm_set1_ps(max_value));
+	return _mm_cvtps_epi32(x);
+}
+#endif
+
+static void Decode(const std::byte* input, std::experimental::audio::memory_buffer_format format, float* output, size_t length)
+{
+	using std::experimental::audio::memory_buffer_format;
+
+	size_t i = 0;
+	switch (format)
+	{
+	case memory_buffer_format::pcm8:
+#if STDAUDIO_SSE2
+	{
+		const __m128 scale = _mm_set1_ps(1.0f / 128.0f);
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+			__m128i low = _mm_srai_epi16(_mm_unpacklo_epi8(_mm_setzero_si128(), x), 8);
+			__m128i high = _mm_srai_epi16(_mm_unpackhi_epi8(_mm_setzero_si128(), x), 8);
+			_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(WidenLow16(low)), scale));
+			_mm_storeu_ps(output + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(WidenHigh16(low)), scale));
+			_mm_storeu_ps(output + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(WidenLow16(high)), scale));
+			_mm_storeu_ps(output + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(WidenHigh16(high)), scale));
+		}
+	}
+#endif
+		DecodeScalar<memory_buffer_format::pcm8>(input, output, i, length);
+		break;
+	case memory_buffer_format::pcm16:
+#if STDAUDIO_SSE2
+	{
+		const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+		for (; i + 8 <= length; i += 8)
+		{
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i * 2));
+			_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(WidenLow16(x)), scale));
+			_mm_storeu_ps(output + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(WidenHigh16(x)), scale));
+		}
+	}
+#endif
+		DecodeScalar<memory_buffer_format::pcm16>(input, output, i, length);
+		break;
+	case memory_buffer_format::pcm24:
+#if STDAUDIO_SSE2
+	{
+		// Four samples take 12 bytes, but the load reads 16, so stop while there is room for the extra bytes.
+		// Shifting the whole register by 3, 6 and 9 bytes brings each sample to the bottom of a lane.
+		const __m128 scale = _mm_set1_ps(1.0f / 8388608.0f);
+		for (; i + 6 <= length; i += 4)
+		{
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i * 3));
+			__m128i ab = _mm_unpacklo_epi32(x, _mm_srli_si128(x, 3));
+			__m128i cd = _mm_unpacklo_epi32(_mm_srli_si128(x, 6), _mm_srli_si128(x, 9));
+			__m128i samples = _mm_srai_epi32(_mm_slli_epi32(_mm_unpacklo_epi64(ab, cd), 8), 8);
+			_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(samples), scale));
+		}
+	}
+#endif
+		DecodeScalar<memory_buffer_format::pcm24>(input, output, i, length);
+		break;
+	case memory_buffer_format::pcm32:
+#if STDAUDIO_SSE2
+	{
+		const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+		for (; i + 4 <= length; i += 4)
+		{
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i * 4));
+			_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+		}
+	}
+#endif
+		DecodeScalar<memory_buffer_format::pcm32>(input, output, i, length);
+		break;
+	case memory_buffer_format::pcmfloat:
+		memcpy(output, input, length * sizeof(float));
+		break;
+	default:
+		throw std::invalid_argument("Unsupported sample format");
+	}
+}
+
+static void Encode(const float* input, std::byte* output, std::experimental::audio::memory_buffer_format format, size_t length)
+{
+	using std::experimental::audio::memory_buffer_format;
+
+	size_t i = 0;
+	switch (format)
+	{
+	case memory_buffer_format::pcm8:
+#if STDAUDIO_SSE2
+		for (; i + 16 <= length; i += 16)
+		{
+			__m128i a = _mm_packs_epi32(ScaleToInt(_mm_loadu_ps(input + i), 128.0f, 127.0f), ScaleToInt(_mm_loadu_ps(input + i + 4), 128.0f, 127.0f));
+			__m128i b = _mm_packs_epi32(ScaleToInt(_mm_loadu_ps(input + i + 8), 128.0f, 127.0f), ScaleToInt(_mm_loadu_ps(input + i + 12), 128.0f, 127.0f));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_packs_epi16(a, b));
+		}
+#endif
+		EncodeScalar<memory_buffer_format::pcm8>(input, output, i, length);
+		break;
+	case memory_buffer_format::pcm16:
+#if STDAUDIO_SSE2
+		for (; i + 8 <= length; i += 8)
+		{
+			__m128i x = _mm_packs_epi32(ScaleToInt(_mm_loadu_ps(input + i), 32768.0f, 32767.0f), ScaleToInt(_mm_loadu_ps(input + i + 4), 32768.0f, 32767.0f));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i * 2), x);
+		}
+#endif
+		EncodeScalar<memory_buffer_format::pcm16>(input, output, i, length);
+		break;
+	case memory_buffer_format::pcm24:
+#if STDAUDIO_SSE2
+		for (; i + 4 <= length; i += 4)
+		{
+			int32_t samples[4];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(samples), ScaleToInt(_mm_loadu_ps(input + i), 8388608.0f, 8388607.0f));
+			for (size_t k = 0; k < 4; k++)
+			{
+				std::byte* p = output + (i + k) * 3;
+				p[0] = static_cast<std::byte>(samples[k] & 0xff);
+				p[1] = static_cast<std::byte>((samples[k] >> 8) & 0xff);
+				p[2] = static_cast<std::byte>((samples[k] >> 16) & 0xff);
+			}
+		}
+#endif
+		EncodeScalar<memory_buffer_format::pcm24>(input, output, i, length);
+		break;
+	case memory_buffer_format::pcm32:
+#if STDAUDIO_SSE2
+		for (; i + 4 <= length; i += 4)
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(output + i * 4), ScaleToInt(_mm_loadu_ps(input + i), 2147483648.0f, 2147483520.0f));
+#endif
+		EncodeScalar<memory_buffer_format::pcm32>(input, output, i, length);
+		break;
+	case memory_buffer_format::pcmfloat:
+		memcpy(output, input, length * sizeof(float));
+		break;
+	default:
+		throw std::invalid_argument("Unsupported sample format");
+	}
+}
+
+void std::experimental::audio::convert_samples(
+	const std::byte* input,
+	memory_buffer_format input_format,
+	std::byte* output,
+	memory_buffer_format output_format,
+	size_t num_samples)
+{
+	if (input_format == output_format)
+	{
+		memcpy(output, input, num_samples * bytes_per_sample(input_format));
+		return;
+	}
+
+	const size_t input_size = bytes_per_sample(input_format);
+	const size_t output_size = bytes_per_sample(output_format);
+	if (input_format == memory_buffer_format::pcmfloat)
+	{
+		Encode(reinterpret_cast<const float*>(input), output, output_format, num_samples);
+		return;
+	}
+	if (output_format == memory_buffer_format::pcmfloat)
+	{
+		Decode(input, input_format, reinterpret_cast<float*>(output), num_samples);
+		return;
+	}
+
+	float chunk[convert_chunk_size];
+	for (size_t done = 0; done < num_samples; done += convert_chunk_size)
+	{
+		size_t length = std::min(convert_chunk_size, num_samples - done);
+		Decode(input + done * input_size, input_format, chunk, length);
+		Encode(chunk, output + done * output_size, output_format, length);
+	}
+}
+
+void std::experimental::audio::deinterleave(const float* input, float* output, size_t num_frames, unsigned int num_channels)
+{
+	size_t i = 0;
+#if STDAUDIO_SSE
+	if (num_channels == 2)
+	{
+		float* left = output;
+		float* right = output + num_frames;
+		for (; i + 4 <= num_frames; i += 4)
+		{
+			__m128 a = _mm_loadu_ps(input + i * 2);
+			__m128 b = _mm_loadu_ps(input + i * 2 + 4);
+			_mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+	}
+#endif
+	for (; i < num_frames; i++)
+	{
+		for (unsigned int channel = 0; channel < num_channels; channel++)
+			output[channel * num_frames + i] = input[i * num_channels + channel];
+	}
+}
+
+void std::experimental::audio::interleave(const float* input, float* output, size_t num_frames, unsigned int num_channels)
+{
+	size_t i = 0;
+#if STDAUDIO_SSE
+	if (num_channels == 2)
+	{
+		const float* left = input;
+		const float* right = input + num_frames;
+		for (; i + 4 <= num_frames; i += 4)
+		{
+			__m128 l = _mm_loadu_ps(left + i);
+			__m128 r = _mm_loadu_ps(right + i);
+			_mm_storeu_ps(output + i * 2, _mm_unpacklo_ps(l, r));
+			_mm_storeu_ps(output + i * 2 + 4, _mm_unpackhi_ps(l, r));
+		}
+	}
+#endif
+	for (; i < num_frames; i++)
+	{
+		for (unsigned int channel = 0; channel < num_channels; channel++)
+			output[i * num_channels + channel] = input[channel * num_frames + i];
+	}
+}
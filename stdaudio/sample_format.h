@@ -0,0 +1,134 @@
+#pragma once
+
+#include "audio.h"
+#include <cmath>
+#include <cstring>
+
+// Per-sample access to the memory_buffer_format encodings.  Integer formats are signed little endian, as FMOD
+// expects, and map to [-1, 1).  Writing rounds to nearest and clips, matching the vectorized converters.
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			inline size_t bytes_per_sample(memory_buffer_format format)
+			{
+				switch (format)
+				{
+				case memory_buffer_format::pcm8:
+					return 1;
+				case memory_buffer_format::pcm16:
+					return 2;
+				case memory_buffer_format::pcm24:
+					return 3;
+				case memory_buffer_format::pcm32:
+				case memory_buffer_format::pcmfloat:
+					return 4;
+				default:
+					break;
+				}
+				return 0;
+			}
+
+			template<memory_buffer_format Format>
+			float read_sample(const std::byte* data);
+
+			template<>
+			inline float read_sample<memory_buffer_format::pcm8>(const std::byte* data)
+			{
+				return static_cast<int8_t>(data[0]) / 128.0f;
+			}
+
+			template<>
+			inline float read_sample<memory_buffer_format::pcm16>(const std::byte* data)
+			{
+				int16_t value;
+				memcpy(&value, data, sizeof(value));
+				return value / 32768.0f;
+			}
+
+			template<>
+			inline float read_sample<memory_buffer_format::pcm24>(const std::byte* data)
+			{
+				int32_t value = (static_cast<int32_t>(data[0]) << 8) | (static_cast<int32_t>(data[1]) << 16) | (static_cast<int32_t>(data[2]) << 24);
+				return (value >> 8) / 8388608.0f;
+			}
+
+			template<>
+			inline float read_sample<memory_buffer_format::pcm32>(const std::byte* data)
+			{
+				int32_t value;
+				memcpy(&value, data, sizeof(value));
+				return value / 2147483648.0f;
+			}
+
+			template<>
+			inline float read_sample<memory_buffer_format::pcmfloat>(const std::byte* data)
+			{
+				float value;
+				memcpy(&value, data, sizeof(value));
+				return value;
+			}
+
+			template<memory_buffer_format Format>
+			void write_sample(std::byte* data, float value);
+
+			template<>
+			inline void write_sample<memory_buffer_format::pcm8>(std::byte* data, float value)
+			{
+				data[0] = static_cast<std::byte>(static_cast<int8_t>(std::lrint(std::min(std::max(value * 128.0f, -128.0f), 127.0f))));
+			}
+
+			template<>
+			inline void write_sample<memory_buffer_format::pcm16>(std::byte* data, float value)
+			{
+				int16_t sample = static_cast<int16_t>(std::lrint(std::min(std::max(value * 32768.0f, -32768.0f), 32767.0f)));
+				memcpy(data, &sample, sizeof(sample));
+			}
+
+			template<>
+			inline void write_sample<memory_buffer_format::pcm24>(std::byte* data, float value)
+			{
+				int32_t sample = static_cast<int32_t>(std::lrint(std::min(std::max(value * 8388608.0f, -8388608.0f), 8388607.0f)));
+				data[0] = static_cast<std::byte>(sample & 0xff);
+				data[1] = static_cast<std::byte>((sample >> 8) & 0xff);
+				data[2] = static_cast<std::byte>((sample >> 16) & 0xff);
+			}
+
+			template<>
+			inline void write_sample<memory_buffer_format::pcm32>(std::byte* data, float value)
+			{
+				// 2147483520 is the largest float below 2^31.
+				int32_t sample = static_cast<int32_t>(std::lrint(std::min(std::max(value * 2147483648.0f, -2147483648.0f), 2147483520.0f)));
+				memcpy(data, &sample, sizeof(sample));
+			}
+
+			template<>
+			inline void write_sample<memory_buffer_format::pcmfloat>(std::byte* data, float value)
+			{
+				memcpy(data, &value, sizeof(value));
+			}
+
+			inline float read_sample(const std::byte* data, memory_buffer_format format)
+			{
+				switch (format)
+				{
+				case memory_buffer_format::pcm8:
+					return read_sample<memory_buffer_format::pcm8>(data);
+				case memory_buffer_format::pcm16:
+					return read_sample<memory_buffer_format::pcm16>(data);
+				case memory_buffer_format::pcm24:
+					return read_sample<memory_buffer_format::pcm24>(data);
+				case memory_buffer_format::pcm32:
+					return read_sample<memory_buffer_format::pcm32>(data);
+				case memory_buffer_format::pcmfloat:
+					return read_sample<memory_buffer_format::pcmfloat>(data);
+				default:
+					break;
+				}
+				return 0.0f;
+			}
+		}
+	}
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// Shared switch for the hand-vectorized kernels.  Every kernel keeps a scalar loop for the remainder (and for
+// targets without SSE), so nothing depends on the intrinsics being available.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define STDAUDIO_SSE 1
+#endif
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#include <emmintrin.h>
+#define STDAUDIO_SSE2 1
+#endif
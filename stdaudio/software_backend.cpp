@@ -0,0 +1,441 @@
+#include "backend.h"
+#include "software_mixer.h"
+#include "loopback.h"
+#include "memory_tracking.h"
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+static std::experimental::audio::software_mixer::node* ToMixer(std::experimental::audio::backend_node* node)
+{
+	return reinterpret_cast<std::experimental::audio::software_mixer::node*>(node);
+}
+
+static std::experimental::audio::software_mixer::channel* ToMixer(std::experimental::audio::backend_channel* channel)
+{
+	return static_cast<std::experimental::audio::software_mixer::channel*>(ToMixer(static_cast<std::experimental::audio::backend_node*>(channel)));
+}
+
+static std::experimental::audio::software_mixer::channel_group* ToMixer(std::experimental::audio::backend_group* group)
+{
+	return static_cast<std::experimental::audio::software_mixer::channel_group*>(ToMixer(static_cast<std::experimental::audio::backend_node*>(group)));
+}
+
+static std::experimental::audio::software_mixer::dsp* ToMixer(std::experimental::audio::backend_dsp* dsp)
+{
+	return reinterpret_cast<std::experimental::audio::software_mixer::dsp*>(dsp);
+}
+
+static std::experimental::audio::backend_channel* ToHandle(std::experimental::audio::software_mixer::channel* channel)
+{
+	return static_cast<std::experimental::audio::backend_channel*>(reinterpret_cast<std::experimental::audio::backend_node*>(static_cast<std::experimental::audio::software_mixer::node*>(channel)));
+}
+
+static std::experimental::audio::backend_group* ToHandle(std::experimental::audio::software_mixer::channel_group* group)
+{
+	return static_cast<std::experimental::audio::backend_group*>(reinterpret_cast<std::experimental::audio::backend_node*>(static_cast<std::experimental::audio::software_mixer::node*>(group)));
+}
+
+static std::experimental::audio::backend_dsp* ToHandle(std::experimental::audio::software_mixer::dsp* dsp)
+{
+	return reinterpret_cast<std::experimental::audio::backend_dsp*>(dsp);
+}
+
+static void WriteLittleEndian(std::ofstream& file, uint32_t value, size_t num_bytes)
+{
+	for (size_t i = 0; i < num_bytes; i++)
+		file.put(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+static void WriteWavHeader(std::ofstream& file, int sample_rate, int num_channels, uint32_t data_bytes)
+{
+	// 32-bit float samples, written as a plain fmt chunk with format tag 3.
+	file.write("RIFF", 4);
+	WriteLittleEndian(file, 36 + data_bytes, 4);
+	file.write("WAVEfmt ", 8);
+	WriteLittleEndian(file, 16, 4);
+	WriteLittleEndian(file, 3, 2);
+	WriteLittleEndian(file, num_channels, 2);
+	WriteLittleEndian(file, sample_rate, 4);
+	WriteLittleEndian(file, sample_rate * num_channels * 4, 4);
+	WriteLittleEndian(file, num_channels * 4, 2);
+	WriteLittleEndian(file, 32, 2);
+	file.write("data", 4);
+	WriteLittleEndian(file, data_bytes, 4);
+}
+
+// What play needs to start a channel: a memory source, or a generator when generator.read is set.
+struct software_sound
+{
+	std::experimental::audio::memory_buffer_data data;
+	std::experimental::audio::generator_callbacks generator;
+};
+
+class std::experimental::audio::software_backend : public backend
+{
+public:
+	software_backend(const device_settings& settings, std::pmr::memory_resource* resource) :
+		m_mixer(settings.sample_rate > 0 ? settings.sample_rate : 48000, 2, settings.block_length > 0 ? settings.block_length : 1024, resource),
+		m_resource(resource)
+	{
+		switch (settings.output)
+		{
+		case device_output::none:
+			break;
+		case device_output::wav_file:
+			m_file.open(settings.output_file, std::ios::binary);
+			if (!m_file)
+				throw std::runtime_error("Unable to open the output file");
+			WriteWavHeader(m_file, m_mixer.get_sample_rate(), m_mixer.get_num_channels(), 0);
+			break;
+		case device_output::loopback:
+		case device_output::loopback_manual:
+		{
+			size_t capacity = settings.loopback_length > 0 ? settings.loopback_length : 2 * m_mixer.get_sample_rate();
+			m_loopback = std::make_unique<loopback_buffer>(capacity, m_mixer.get_num_channels(), m_mixer.get_sample_rate());
+			break;
+		}
+		default:
+			throw std::runtime_error("The software backend has no speaker output");
+		}
+
+		m_block.resize(m_mixer.get_block_length() * m_mixer.get_num_channels());
+		if (settings.output != device_output::loopback_manual)
+			m_thread = std::thread([this] { mixer_thread(); });
+	}
+
+	~software_backend()
+	{
+		m_quit.store(true);
+		if (m_thread.joinable())
+			m_thread.join();
+
+		if (m_file.is_open())
+		{
+			m_file.seekp(0);
+			WriteWavHeader(m_file, m_mixer.get_sample_rate(), m_mixer.get_num_channels(), static_cast<uint32_t>(m_bytes_written));
+		}
+	}
+
+	int num_drivers() const override
+	{
+		return 0;
+	}
+
+	driver_info get_driver(int) const override
+	{
+		throw std::runtime_error("The software backend has no drivers");
+	}
+
+	void set_driver(int) override
+	{
+		throw std::runtime_error("The software backend has no drivers");
+	}
+
+	int get_sample_rate() const override
+	{
+		return m_mixer.get_sample_rate();
+	}
+
+	unsigned int get_block_length() const override
+	{
+		return static_cast<unsigned int>(m_mixer.get_block_length());
+	}
+
+	void update() override
+	{
+	}
+
+	void get_cpu_usage(float& dsp_usage, float& total_usage) const override
+	{
+		dsp_usage = m_mixer.get_cpu_usage();
+		total_usage = dsp_usage;
+	}
+
+	bool get_memory_stats(memory_stats&) const override
+	{
+		return false;
+	}
+
+	loopback_buffer* get_loopback() override
+	{
+		return m_loopback.get();
+	}
+
+	void mix_loopback(size_t num_frames) override
+	{
+		if (m_thread.joinable())
+			throw std::runtime_error("Only loopback_manual output can be mixed on demand");
+
+		const size_t block_length = m_mixer.get_block_length();
+		for (size_t done = 0; done < num_frames; done += block_length)
+			mix_block(block_length);
+	}
+
+	backend_sound* create_sound(const memory_buffer_data& data) override
+	{
+		// The mixer reads straight from the source's memory, so a sound is just its description.
+		void* p = allocate_object(m_resource, sizeof(software_sound));
+		return reinterpret_cast<backend_sound*>(new (p) software_sound{ data, {} });
+	}
+
+	backend_sound* create_generator(const generator_callbacks& generator) override
+	{
+		void* p = allocate_object(m_resource, sizeof(software_sound));
+		return reinterpret_cast<backend_sound*>(new (p) software_sound{ {}, generator });
+	}
+
+	backend_sound* create_stream(const std::filesystem::path&, int) override
+	{
+		throw std::runtime_error("The software backend cannot stream");
+	}
+
+	backend_channel* play(backend_sound* sound, bool paused) override
+	{
+		auto s = reinterpret_cast<software_sound*>(sound);
+		if (s->generator.read != nullptr)
+			return ToHandle(m_mixer.play(s->generator, nullptr, paused));
+		return ToHandle(m_mixer.play(s->data, nullptr, paused));
+	}
+
+	backend_group* create_group() override
+	{
+		return ToHandle(m_mixer.create_group());
+	}
+
+	backend_group* get_master_group() override
+	{
+		return ToHandle(m_mixer.get_master());
+	}
+
+	void release(backend_sound* sound) override
+	{
+		deallocate_object(sound);
+	}
+
+	void release(backend_channel* channel) override
+	{
+		m_mixer.release(ToMixer(channel));
+	}
+
+	void release(backend_group* group) override
+	{
+		m_mixer.release(ToMixer(group));
+	}
+
+	void release(backend_dsp* dsp) override
+	{
+		m_mixer.release(ToMixer(dsp));
+	}
+
+	float get_volume(backend_node* node) const override
+	{
+		return ToMixer(node)->get_volume();
+	}
+
+	void set_volume(backend_node* node, float volume) override
+	{
+		ToMixer(node)->set_volume(volume);
+	}
+
+	void set_paused(backend_node* node, bool paused) override
+	{
+		ToMixer(node)->set_paused(paused);
+	}
+
+	void set_mute(backend_node* node, bool mute) override
+	{
+		ToMixer(node)->set_mute(mute);
+	}
+
+	void* get_user_data(backend_node* node) const override
+	{
+		return ToMixer(node)->get_user_data();
+	}
+
+	void set_user_data(backend_node* node, void* user_data) override
+	{
+		ToMixer(node)->set_user_data(user_data);
+	}
+
+	void add_dsp(backend_node* node, backend_dsp* dsp, dsp_position position) override
+	{
+		ToMixer(node)->add_dsp(ToMixer(dsp), position);
+	}
+
+	void remove_dsp(backend_node* node, backend_dsp* dsp) override
+	{
+		ToMixer(node)->remove_dsp(ToMixer(dsp));
+	}
+
+	void move_dsp_to_head(backend_node* node, backend_dsp* dsp) override
+	{
+		ToMixer(node)->move_dsp_to_head(ToMixer(dsp));
+	}
+
+	void stop(backend_channel* channel) override
+	{
+		ToMixer(channel)->stop();
+	}
+
+	float get_pitch(backend_channel* channel) const override
+	{
+		return ToMixer(channel)->get_pitch();
+	}
+
+	void set_pitch(backend_channel* channel, float pitch) override
+	{
+		ToMixer(channel)->set_pitch(pitch);
+	}
+
+	void set_pan(backend_channel* channel, float pan) override
+	{
+		ToMixer(channel)->set_pan(pan);
+	}
+
+	int get_priority(backend_channel* channel) const override
+	{
+		return ToMixer(channel)->get_priority();
+	}
+
+	void set_priority(backend_channel* channel, int priority) override
+	{
+		ToMixer(channel)->set_priority(priority);
+	}
+
+	void set_loop(backend_channel* channel, int count, size_t start_frame, size_t end_frame) override
+	{
+		ToMixer(channel)->set_loop(count, start_frame, end_frame);
+	}
+
+	int get_loop_count(backend_channel* channel) const override
+	{
+		return ToMixer(channel)->get_loop_count();
+	}
+
+	void set_loop_count(backend_channel* channel, int count) override
+	{
+		ToMixer(channel)->set_loop_count(count);
+	}
+
+	float get_audibility(backend_channel* channel) const override
+	{
+		return ToMixer(channel)->get_audibility();
+	}
+
+	bool is_playing(backend_channel* channel) const override
+	{
+		return ToMixer(channel)->is_playing();
+	}
+
+	bool is_virtual(backend_channel* channel) const override
+	{
+		return ToMixer(channel)->is_virtual();
+	}
+
+	void set_group(backend_channel* channel, backend_group* group) override
+	{
+		ToMixer(channel)->set_group(ToMixer(group));
+	}
+
+	void add_group(backend_group* parent, backend_group* child) override
+	{
+		ToMixer(parent)->add_group(ToMixer(child));
+	}
+
+	size_t get_num_groups(backend_group* group) const override
+	{
+		return ToMixer(group)->get_num_groups();
+	}
+
+	backend_group* get_group(backend_group* group, size_t index) const override
+	{
+		return ToHandle(ToMixer(group)->get_group(index));
+	}
+
+	size_t get_num_channels(backend_group* group) const override
+	{
+		return ToMixer(group)->get_num_channels();
+	}
+
+	backend_channel* get_channel(backend_group* group, size_t index) const override
+	{
+		return ToHandle(ToMixer(group)->get_channel(index));
+	}
+
+	backend_dsp* create_dsp(const dsp_callbacks& callbacks) override
+	{
+		return ToHandle(m_mixer.create_dsp(callbacks));
+	}
+
+	backend_dsp* create_send(int return_id, float level) override
+	{
+		return ToHandle(m_mixer.create_send(return_id, level));
+	}
+
+	backend_dsp* create_return() override
+	{
+		return ToHandle(m_mixer.create_return());
+	}
+
+	float get_send_level(backend_dsp* dsp) const override
+	{
+		return ToMixer(dsp)->get_send_level();
+	}
+
+	void set_send_level(backend_dsp* dsp, float level) override
+	{
+		ToMixer(dsp)->set_send_level(level);
+	}
+
+	int get_return_id(backend_dsp* dsp) const override
+	{
+		return ToMixer(dsp)->get_return_id();
+	}
+
+private:
+	void mix_block(size_t length)
+	{
+		auto start = std::chrono::steady_clock::now();
+		m_mixer.render(m_block.data(), length);
+		auto mix_time = std::chrono::steady_clock::now() - start;
+
+		const size_t count = length * m_mixer.get_num_channels();
+		if (m_loopback)
+			m_loopback->write(m_block.data(), length, std::chrono::duration_cast<std::chrono::nanoseconds>(mix_time));
+		if (m_file.is_open())
+		{
+			m_file.write(reinterpret_cast<const char*>(m_block.data()), count * sizeof(float));
+			m_bytes_written += count * sizeof(float);
+		}
+	}
+
+	void mixer_thread()
+	{
+		// Mix one block per block period, as a sound card would pull them.
+		const size_t block_length = m_mixer.get_block_length();
+		const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(static_cast<double>(block_length) / m_mixer.get_sample_rate()));
+		auto deadline = std::chrono::steady_clock::now();
+		while (!m_quit.load())
+		{
+			mix_block(block_length);
+			deadline += period;
+			std::this_thread::sleep_until(deadline);
+		}
+	}
+
+	software_mixer m_mixer;
+	std::pmr::memory_resource* m_resource;
+	std::vector<float> m_block;
+	std::unique_ptr<loopback_buffer> m_loopback;
+	std::ofstream m_file;
+	size_t m_bytes_written = 0;
+	std::atomic<bool> m_quit{ false };
+	std::thread m_thread;
+};
+
+auto std::experimental::audio::create_software_backend(const device_settings& settings, std::pmr::memory_resource* resource) -> std::unique_ptr<backend>
+{
+	return std::make_unique<software_backend>(settings, resource);
+}
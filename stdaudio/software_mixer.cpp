@@ -0,0 +1,1237 @@
+#include "software_mixer.h"
+#include "memory_tracking.h"
+#include "sample_format.h"
+#include "simd.h"
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+static void AddInto(float* output, const float* input, size_t count)
+{
+	size_t i = 0;
+#if STDAUDIO_SSE
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(output + i, _mm_add_ps(_mm_loadu_ps(output + i), _mm_loadu_ps(input + i)));
+#endif
+	for (; i < count; i++)
+		output[i] += input[i];
+}
+
+static void Scale(float* buffer, float gain, size_t count)
+{
+	size_t i = 0;
+#if STDAUDIO_SSE
+	const __m128 gain4 = _mm_set1_ps(gain);
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(buffer + i, _mm_mul_ps(_mm_loadu_ps(buffer + i), gain4));
+#endif
+	for (; i < count; i++)
+		buffer[i] *= gain;
+}
+
+static void MixInto(float* output, int output_channels, const float* source, int source_channels, size_t frames, float volume, float pan)
+{
+	if (source_channels == 1 && output_channels >= 2)
+	{
+		// Constant power pan of a mono source across the front pair.
+		const float angle = (pan + 1.0f) * 0.25f * 3.14159265f;
+		const float left = volume * std::cos(angle);
+		const float right = volume * std::sin(angle);
+		for (size_t f = 0; f < frames; f++)
+		{
+			output[f * output_channels] += source[f] * left;
+			output[f * output_channels + 1] += source[f] * right;
+		}
+		return;
+	}
+
+	// Multichannel sources map channel for channel; pan acts as a balance on the front pair.
+	float gains[2] = { volume, volume };
+	if (source_channels >= 2 && output_channels >= 2)
+	{
+		gains[0] *= std::min(1.0f, 1.0f - pan);
+		gains[1] *= std::min(1.0f, 1.0f + pan);
+	}
+
+	if (source_channels == 2 && output_channels == 2)
+	{
+		size_t i = 0;
+		const size_t count = frames * 2;
+#if STDAUDIO_SSE
+		const __m128 gain4 = _mm_setr_ps(gains[0], gains[1], gains[0], gains[1]);
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps(output + i, _mm_add_ps(_mm_loadu_ps(output + i), _mm_mul_ps(_mm_loadu_ps(source + i), gain4)));
+#endif
+		for (; i < count; i++)
+			output[i] += source[i] * gains[i & 1];
+		return;
+	}
+
+	const int channels = std::min(source_channels, output_channels);
+	for (size_t f = 0; f < frames; f++)
+	{
+		for (int c = 0; c < channels; c++)
+			output[f * output_channels + c] += source[f * source_channels + c] * (c < 2 ? gains[c] : volume);
+	}
+}
+
+static void ConvertPcm16(const std::byte* data, float* output, size_t count)
+{
+	size_t i = 0;
+#if STDAUDIO_SSE2
+	const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 2));
+		__m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+		__m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+		_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+		_mm_storeu_ps(output + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+	}
+#endif
+	for (; i < count; i++)
+		output[i] = std::experimental::audio::read_sample<std::experimental::audio::memory_buffer_format::pcm16>(data + i * 2);
+}
+
+template<std::experimental::audio::memory_buffer_format Format>
+static size_t Resample(const std::byte* data, int channels, size_t length_frames, double& position, double step, float* output, size_t frames)
+{
+	const size_t sample_size = std::experimental::audio::bytes_per_sample(Format);
+	size_t i = 0;
+
+	if (step == 1.0 && position == std::floor(position))
+	{
+		// Unity rate on a whole sample: a straight conversion.
+		size_t start = static_cast<size_t>(position);
+		size_t count = start < length_frames ? std::min(frames, length_frames - start) : 0;
+		const std::byte* source = data + start * channels * sample_size;
+		if (Format == std::experimental::audio::memory_buffer_format::pcm16)
+			ConvertPcm16(source, output, count * channels);
+		else if (Format == std::experimental::audio::memory_buffer_format::pcmfloat)
+			memcpy(output, source, count * channels * sizeof(float));
+		else
+		{
+			for (size_t s = 0; s < count * channels; s++)
+				output[s] = std::experimental::audio::read_sample<Format>(source + s * sample_size);
+		}
+		position += count;
+		return count;
+	}
+
+	for (; i < frames; i++)
+	{
+		size_t index = static_cast<size_t>(position);
+		if (index >= length_frames)
+			break;
+		size_t next = index + 1 < length_frames ? index + 1 : index;
+		float fraction = static_cast<float>(position - index);
+		for (int c = 0; c < channels; c++)
+		{
+			float a = std::experimental::audio::read_sample<Format>(data + (index * channels + c) * sample_size);
+			float b = std::experimental::audio::read_sample<Format>(data + (next * channels + c) * sample_size);
+			output[i * channels + c] = a + (b - a) * fraction;
+		}
+		position += step;
+	}
+	return i;
+}
+
+static size_t Resample(const std::experimental::audio::memory_buffer_data& data, size_t length_frames, double& position, double step, float* output, size_t frames)
+{
+	using format = std::experimental::audio::memory_buffer_format;
+	const int channels = static_cast<int>(data.description.num_channels);
+	switch (data.description.format)
+	{
+	case format::pcm8:
+		return Resample<format::pcm8>(data.data.data, channels, length_frames, position, step, output, frames);
+	case format::pcm16:
+		return Resample<format::pcm16>(data.data.data, channels, length_frames, position, step, output, frames);
+	case format::pcm24:
+		return Resample<format::pcm24>(data.data.data, channels, length_frames, position, step, output, frames);
+	case format::pcm32:
+		return Resample<format::pcm32>(data.data.data, channels, length_frames, position, step, output, frames);
+	case format::pcmfloat:
+		return Resample<format::pcmfloat>(data.data.data, channels, length_frames, position, step, output, frames);
+	default:
+		break;
+	}
+	return 0;
+}
+
+// ADPCM channels decode through their own decoder, which keeps the current block so that stepping through it one
+// frame at a time doesn't decode it again.
+static size_t Resample(std::experimental::audio::adpcm_decoder& decoder, int channels, size_t length_frames, double& position, double step, float* output, size_t frames)
+{
+	if (step == 1.0 && position == std::floor(position))
+	{
+		size_t start = static_cast<size_t>(std::min<double>(position, static_cast<double>(length_frames)));
+		decoder.seek(start);
+		size_t count = decoder.read(output, std::min(frames, length_frames - start));
+		position += count;
+		return count;
+	}
+
+	size_t i = 0;
+	for (; i < frames; i++)
+	{
+		size_t index = static_cast<size_t>(position);
+		if (index >= length_frames)
+			break;
+		const float* a = decoder.get_frames(index);
+		const float* b = index + 1 < length_frames ? a + channels : a;
+		float fraction = static_cast<float>(position - index);
+		for (int c = 0; c < channels; c++)
+			output[i * channels + c] = a[c] + (b[c] - a[c]) * fraction;
+		position += step;
+	}
+	return i;
+}
+
+template<typename T>
+static void EraseValue(std::vector<T>& values, const T& value)
+{
+	values.erase(std::remove(values.begin(), values.end(), value), values.end());
+}
+
+template<typename T>
+static std::unique_ptr<T> TakeOwned(std::vector<std::unique_ptr<T>>& values, const T* value)
+{
+	auto it = std::find_if(values.begin(), values.end(), [value](const std::unique_ptr<T>& p) { return p.get() == value; });
+	if (it == values.end())
+		return nullptr;
+	std::unique_ptr<T> owned = std::move(*it);
+	values.erase(it);
+	return owned;
+}
+
+template<typename T, typename U>
+void std::experimental::audio::software_mixer::link_front(mix_list<T>& list, U* item)
+{
+	item->m_mix_prev = nullptr;
+	item->m_mix_next = list.first;
+	if (list.first)
+		list.first->m_mix_prev = item;
+	else
+		list.last = item;
+	list.first = item;
+}
+
+template<typename T, typename U>
+void std::experimental::audio::software_mixer::link_back(mix_list<T>& list, U* item)
+{
+	item->m_mix_next = nullptr;
+	item->m_mix_prev = list.last;
+	if (list.last)
+		list.last->m_mix_next = item;
+	else
+		list.first = item;
+	list.last = item;
+}
+
+template<typename T, typename U>
+void std::experimental::audio::software_mixer::unlink(mix_list<T>& list, U* item)
+{
+	if (item->m_mix_prev)
+		item->m_mix_prev->m_mix_next = item->m_mix_next;
+	else
+		list.first = item->m_mix_next;
+	if (item->m_mix_next)
+		item->m_mix_next->m_mix_prev = item->m_mix_prev;
+	else
+		list.last = item->m_mix_prev;
+	item->m_mix_prev = nullptr;
+	item->m_mix_next = nullptr;
+}
+
+std::experimental::audio::software_mixer::node::node(software_mixer* mixer) :
+	m_mixer(mixer)
+{
+}
+
+std::experimental::audio::software_mixer::node::~node()
+{
+}
+
+void* std::experimental::audio::software_mixer::node::operator new(size_t size, std::pmr::memory_resource* resource)
+{
+	return allocate_object(resource, size);
+}
+
+void std::experimental::audio::software_mixer::node::operator delete(void* p, std::pmr::memory_resource*)
+{
+	deallocate_object(p);
+}
+
+void std::experimental::audio::software_mixer::node::operator delete(void* p)
+{
+	deallocate_object(p);
+}
+
+float std::experimental::audio::software_mixer::node::get_volume() const
+{
+	return m_volume.load(std::memory_order_relaxed);
+}
+
+void std::experimental::audio::software_mixer::node::set_volume(float volume)
+{
+	m_volume.store(volume, std::memory_order_relaxed);
+}
+
+bool std::experimental::audio::software_mixer::node::get_mute() const
+{
+	return m_mute.load(std::memory_order_relaxed);
+}
+
+void std::experimental::audio::software_mixer::node::set_mute(bool mute)
+{
+	m_mute.store(mute, std::memory_order_relaxed);
+}
+
+bool std::experimental::audio::software_mixer::node::get_paused() const
+{
+	return m_paused.load(std::memory_order_relaxed);
+}
+
+void std::experimental::audio::software_mixer::node::set_paused(bool paused)
+{
+	m_paused.store(paused, std::memory_order_relaxed);
+}
+
+void* std::experimental::audio::software_mixer::node::get_user_data() const
+{
+	return m_user_data;
+}
+
+void std::experimental::audio::software_mixer::node::set_user_data(void* user_data)
+{
+	m_user_data = user_data;
+}
+
+void std::experimental::audio::software_mixer::node::add_dsp(dsp* d, dsp_position position)
+{
+	if (d->m_owner)
+	{
+		EraseValue(d->m_owner->m_head_dsps, d);
+		EraseValue(d->m_owner->m_tail_dsps, d);
+	}
+	d->m_owner = this;
+
+	// Chains are ordered from the head, so head insertions go to the front.
+	if (position == dsp_position::head)
+		m_head_dsps.insert(m_head_dsps.begin(), d);
+	else
+		m_tail_dsps.push_back(d);
+
+	command c{ command::type::add_dsp };
+	c.target = this;
+	c.d = d;
+	c.position = position;
+	m_mixer->send(c);
+}
+
+void std::experimental::audio::software_mixer::node::remove_dsp(dsp* d)
+{
+	if (d->m_owner != this)
+		return;
+	EraseValue(m_head_dsps, d);
+	EraseValue(m_tail_dsps, d);
+	d->m_owner = nullptr;
+
+	command c{ command::type::remove_dsp };
+	c.d = d;
+	m_mixer->send(c);
+}
+
+void std::experimental::audio::software_mixer::node::move_dsp_to_head(dsp* d)
+{
+	if (d->m_owner != this)
+		return;
+	add_dsp(d, dsp_position::head);
+}
+
+void std::experimental::audio::software_mixer::node::process_dsps(const mix_list<dsp>& chain, float*& buffer, float*& scratch, size_t length, bool& idle)
+{
+	// Signal flows from the end of the chain towards the head.  An idle buffer is always zeroed.
+	const int num_channels = m_mixer->m_num_channels;
+	const size_t count = length * num_channels;
+	const uint64_t block = m_mixer->m_block_index;
+	for (dsp* d = chain.last; d; d = d->m_mix_prev)
+	{
+		if (d->m_released.load(std::memory_order_acquire))
+			continue;
+
+		switch (d->m_kind)
+		{
+		case dsp::kind::send:
+		{
+			dsp::return_bus* bus = d->m_bus.get();
+			if (idle || !bus)
+				break;
+			float level = d->m_send_level.load(std::memory_order_relaxed);
+			float* target = bus->buffers[block & 1].data();
+			if (bus->written[block & 1] == block)
+			{
+				for (size_t i = 0; i < count; i++)
+					target[i] += buffer[i] * level;
+			}
+			else
+			{
+				for (size_t i = 0; i < count; i++)
+					target[i] = buffer[i] * level;
+				bus->written[block & 1] = block;
+			}
+			break;
+		}
+		case dsp::kind::ret:
+		{
+			// Returns play what their sends accumulated during the previous block.
+			dsp::return_bus* bus = d->m_bus.get();
+			const uint64_t previous = block - 1;
+			if (bus->written[previous & 1] != previous)
+				break;
+			AddInto(buffer, bus->buffers[previous & 1].data(), count);
+			idle = false;
+			break;
+		}
+		case dsp::kind::custom:
+		{
+			dsp_result result = dsp_result::process;
+			if (d->m_callbacks.should_process)
+				result = d->m_callbacks.should_process(d->m_callbacks.userdata, idle, length, num_channels);
+			if (result == dsp_result::skip)
+				break;
+			if (result == dsp_result::silence)
+			{
+				if (!idle)
+					std::fill(buffer, buffer + count, 0.0f);
+				idle = true;
+				break;
+			}
+			if (d->m_callbacks.read)
+			{
+				d->m_callbacks.read(d->m_callbacks.userdata, buffer, scratch, length, num_channels);
+				std::swap(buffer, scratch);
+				idle = false;
+			}
+			break;
+		}
+		}
+	}
+}
+
+std::experimental::audio::software_mixer::channel::channel(software_mixer* mixer, const memory_buffer_data& data) :
+	node(mixer),
+	m_data(data),
+	m_bytes_per_sample(bytes_per_sample(data.description.format))
+{
+	if (data.description.format == memory_buffer_format::adpcm)
+	{
+		m_decoder = std::make_unique<adpcm_decoder>(data);
+		m_length_frames = m_decoder->get_length();
+		return;
+	}
+
+	const size_t frame_size = m_bytes_per_sample * data.description.num_channels;
+	m_length_frames = frame_size ? data.data.size / frame_size : 0;
+}
+
+std::experimental::audio::software_mixer::channel::channel(software_mixer* mixer, const generator_callbacks& generator) :
+	node(mixer),
+	m_bytes_per_sample(sizeof(float)),
+	m_length_frames(std::numeric_limits<size_t>::max()),
+	m_generator(generator),
+	m_carry(2 * generator.num_channels)
+{
+	m_data.description = { memory_buffer_format::pcmfloat, generator.num_channels, generator.frequency };
+}
+
+float std::experimental::audio::software_mixer::channel::get_pitch() const
+{
+	return m_pitch.load(std::memory_order_relaxed);
+}
+
+void std::experimental::audio::software_mixer::channel::set_pitch(float pitch)
+{
+	m_pitch.store(pitch, std::memory_order_relaxed);
+}
+
+float std::experimental::audio::software_mixer::channel::get_pan() const
+{
+	return m_pan.load(std::memory_order_relaxed);
+}
+
+void std::experimental::audio::software_mixer::channel::set_pan(float pan)
+{
+	m_pan.store(std::max(-1.0f, std::min(1.0f, pan)), std::memory_order_relaxed);
+}
+
+int std::experimental::audio::software_mixer::channel::get_priority() const
+{
+	return m_priority.load(std::memory_order_relaxed);
+}
+
+void std::experimental::audio::software_mixer::channel::set_priority(int priority)
+{
+	m_priority.store(priority, std::memory_order_relaxed);
+}
+
+float std::experimental::audio::software_mixer::channel::get_audibility() const
+{
+	float audibility = 1.0f;
+	for (const node* n = this; n; n = n->m_parent)
+	{
+		if (n->get_mute())
+			return 0.0f;
+		audibility *= n->get_volume();
+	}
+	return audibility;
+}
+
+bool std::experimental::audio::software_mixer::channel::is_playing() const
+{
+	return m_playing.load(std::memory_order_relaxed);
+}
+
+bool std::experimental::audio::software_mixer::channel::is_virtual() const
+{
+	return get_mute();
+}
+
+int std::experimental::audio::software_mixer::channel::get_loop_count() const
+{
+	return m_loop_count.load(std::memory_order_relaxed);
+}
+
+void std::experimental::audio::software_mixer::channel::set_loop_count(int count)
+{
+	m_loop_count.store(count, std::memory_order_relaxed);
+}
+
+void std::experimental::audio::software_mixer::channel::set_loop(int count, size_t start_frame, size_t end_frame)
+{
+	// The region is read while rendering, so it changes between blocks.  The count is stored here rather than with
+	// the region so that get_loop_count sees it at once and a set_loop_count made before the next block isn't undone.
+	m_loop_count.store(count, std::memory_order_relaxed);
+
+	command c{ command::type::set_loop };
+	c.target = this;
+	c.start_frame = start_frame;
+	c.end_frame = end_frame;
+	m_mixer->send(c);
+}
+
+void std::experimental::audio::software_mixer::channel::stop()
+{
+	m_playing.store(false, std::memory_order_relaxed);
+}
+
+auto std::experimental::audio::software_mixer::channel::get_group() const -> channel_group*
+{
+	return m_parent;
+}
+
+void std::experimental::audio::software_mixer::channel::set_group(channel_group* group)
+{
+	group = group ? group : m_mixer->m_master.get();
+	if (m_parent)
+		EraseValue(m_parent->m_channels, this);
+	m_parent = group;
+	group->m_channels.push_back(this);
+	m_mixer->reserve_scratch(m_mixer->depth(this), 0);
+
+	command c{ command::type::move_channel };
+	c.target = this;
+	c.group = group;
+	m_mixer->send(c);
+}
+
+void std::experimental::audio::software_mixer::channel_group::add_group(channel_group* child)
+{
+	for (const node* n = this; n; n = n->m_parent)
+	{
+		if (n == child)
+			throw std::invalid_argument("Cannot add a group to itself or one of its descendants");
+	}
+	if (child->m_parent)
+		EraseValue(child->m_parent->m_groups, child);
+	child->m_parent = this;
+	m_groups.push_back(child);
+
+	// The child's subtree now starts one level below this group, and its channels one further down.
+	size_t height = 0;
+	std::vector<std::pair<const channel_group*, size_t>> pending{ { child, 1 } };
+	while (!pending.empty())
+	{
+		auto [g, h] = pending.back();
+		pending.pop_back();
+		height = std::max(height, h);
+		for (const channel_group* grandchild : g->m_groups)
+			pending.emplace_back(grandchild, h + 1);
+	}
+	m_mixer->reserve_scratch(m_mixer->depth(this) + height + 1, 0);
+
+	command c{ command::type::move_group };
+	c.target = child;
+	c.group = this;
+	m_mixer->send(c);
+}
+
+size_t std::experimental::audio::software_mixer::channel_group::get_num_groups() const
+{
+	return m_groups.size();
+}
+
+auto std::experimental::audio::software_mixer::channel_group::get_group(size_t index) const -> channel_group*
+{
+	return index < m_groups.size() ? m_groups[index] : nullptr;
+}
+
+size_t std::experimental::audio::software_mixer::channel_group::get_num_channels() const
+{
+	return m_channels.size();
+}
+
+auto std::experimental::audio::software_mixer::channel_group::get_channel(size_t index) const -> channel*
+{
+	return index < m_channels.size() ? m_channels[index] : nullptr;
+}
+
+void* std::experimental::audio::software_mixer::dsp::operator new(size_t size, std::pmr::memory_resource* resource)
+{
+	return allocate_object(resource, size);
+}
+
+void std::experimental::audio::software_mixer::dsp::operator delete(void* p, std::pmr::memory_resource*)
+{
+	deallocate_object(p);
+}
+
+void std::experimental::audio::software_mixer::dsp::operator delete(void* p)
+{
+	deallocate_object(p);
+}
+
+float std::experimental::audio::software_mixer::dsp::get_send_level() const
+{
+	return m_send_level.load(std::memory_order_relaxed);
+}
+
+void std::experimental::audio::software_mixer::dsp::set_send_level(float level)
+{
+	m_send_level.store(level, std::memory_order_relaxed);
+}
+
+int std::experimental::audio::software_mixer::dsp::get_return_id() const
+{
+	return m_return_id;
+}
+
+std::experimental::audio::software_mixer::software_mixer(int sample_rate, int num_channels, size_t block_length, std::pmr::memory_resource* resource) :
+	m_sample_rate(sample_rate),
+	m_num_channels(num_channels),
+	m_block_length(block_length),
+	m_resource(resource),
+	m_master(new (resource) channel_group(this))
+{
+	if (sample_rate <= 0 || num_channels <= 0 || block_length == 0)
+		throw std::invalid_argument("Invalid software mixer format");
+
+	// Room for groups a few levels deep and stereo sources, before the mixer thread exists.
+	reserve_scratch(4, 2);
+	m_mix_scratch = m_scratch.get();
+}
+
+std::experimental::audio::software_mixer::~software_mixer()
+{
+}
+
+int std::experimental::audio::software_mixer::get_sample_rate() const
+{
+	return m_sample_rate;
+}
+
+int std::experimental::audio::software_mixer::get_num_channels() const
+{
+	return m_num_channels;
+}
+
+size_t std::experimental::audio::software_mixer::get_block_length() const
+{
+	return m_block_length;
+}
+
+float std::experimental::audio::software_mixer::get_cpu_usage() const
+{
+	return m_cpu_usage.load(std::memory_order_relaxed);
+}
+
+auto std::experimental::audio::software_mixer::get_master() -> channel_group*
+{
+	return m_master.get();
+}
+
+auto std::experimental::audio::software_mixer::create_group() -> channel_group*
+{
+	m_groups.emplace_back(new (m_resource) channel_group(this));
+	channel_group* group = m_groups.back().get();
+	m_master->add_group(group);
+	return group;
+}
+
+auto std::experimental::audio::software_mixer::play(const memory_buffer_data& data, channel_group* group, bool paused) -> channel*
+{
+	if ((bytes_per_sample(data.description.format) == 0 && data.description.format != memory_buffer_format::adpcm) || data.description.num_channels == 0)
+		throw std::invalid_argument("Unsupported buffer format");
+
+	m_channels.emplace_back(new (m_resource) channel(this, data));
+	channel* c = m_channels.back().get();
+	c->set_paused(paused);
+	reserve_scratch(0, data.description.num_channels);
+	c->set_group(group);
+	return c;
+}
+
+auto std::experimental::audio::software_mixer::play(const generator_callbacks& generator, channel_group* group, bool paused) -> channel*
+{
+	if (generator.read == nullptr || generator.num_channels == 0 || generator.frequency == 0)
+		throw std::invalid_argument("Invalid generator");
+
+	m_channels.emplace_back(new (m_resource) channel(this, generator));
+	channel* c = m_channels.back().get();
+	c->set_paused(paused);
+	reserve_scratch(0, generator.num_channels);
+	c->set_group(group);
+	return c;
+}
+
+auto std::experimental::audio::software_mixer::create_dsp(const dsp_callbacks& callbacks) -> dsp*
+{
+	m_dsps.emplace_back(new (m_resource) dsp());
+	m_dsps.back()->m_callbacks = callbacks;
+	return m_dsps.back().get();
+}
+
+auto std::experimental::audio::software_mixer::create_send(int return_id, float level) -> dsp*
+{
+	m_dsps.emplace_back(new (m_resource) dsp());
+	dsp* d = m_dsps.back().get();
+	d->m_kind = dsp::kind::send;
+	d->m_return_id = return_id;
+	d->m_send_level.store(level, std::memory_order_relaxed);
+	auto bus = m_returns.find(return_id);
+	if (bus != m_returns.end())
+		d->m_bus = bus->second;
+	return d;
+}
+
+auto std::experimental::audio::software_mixer::create_return() -> dsp*
+{
+	m_dsps.emplace_back(new (m_resource) dsp());
+	dsp* d = m_dsps.back().get();
+	d->m_kind = dsp::kind::ret;
+	d->m_return_id = m_next_return_id++;
+	d->m_bus = std::make_shared<dsp::return_bus>();
+	d->m_bus->buffers[0].assign(m_block_length * m_num_channels, 0.0f);
+	d->m_bus->buffers[1].assign(m_block_length * m_num_channels, 0.0f);
+	m_returns[d->m_return_id] = d->m_bus;
+	return d;
+}
+
+void std::experimental::audio::software_mixer::release(channel_group* group)
+{
+	if (!group || group == m_master.get())
+		return;
+
+	// As with FMOD, whatever was routed through the group falls back to the master.
+	if (group->m_parent)
+		EraseValue(group->m_parent->m_groups, group);
+	for (auto child : group->m_groups)
+	{
+		child->m_parent = m_master.get();
+		m_master->m_groups.push_back(child);
+	}
+	for (auto c : group->m_channels)
+	{
+		c->m_parent = m_master.get();
+		m_master->m_channels.push_back(c);
+	}
+	for (auto d : group->m_head_dsps)
+		d->m_owner = nullptr;
+	for (auto d : group->m_tail_dsps)
+		d->m_owner = nullptr;
+
+	command c{ command::type::release_group };
+	c.target = group;
+	send(c);
+
+	retired r;
+	r.n = TakeOwned(m_groups, group);
+	retire(std::move(r));
+}
+
+void std::experimental::audio::software_mixer::release(channel* c)
+{
+	if (!c)
+		return;
+
+	if (c->m_parent)
+		EraseValue(c->m_parent->m_channels, c);
+	for (auto d : c->m_head_dsps)
+		d->m_owner = nullptr;
+	for (auto d : c->m_tail_dsps)
+		d->m_owner = nullptr;
+
+	// The caller frees the source once this returns, so the mixer has to be done reading it.
+	c->m_released.store(true);
+	wait_for_block();
+
+	command cmd{ command::type::release_channel };
+	cmd.target = c;
+	send(cmd);
+
+	retired r;
+	r.n = TakeOwned(m_channels, c);
+	retire(std::move(r));
+}
+
+void std::experimental::audio::software_mixer::release(dsp* d)
+{
+	if (!d)
+		return;
+
+	if (d->m_owner)
+	{
+		EraseValue(d->m_owner->m_head_dsps, d);
+		EraseValue(d->m_owner->m_tail_dsps, d);
+	}
+	if (d->m_kind == dsp::kind::ret)
+		m_returns.erase(d->m_return_id);
+
+	// As with channels, the callbacks' userdata goes away once this returns.
+	d->m_released.store(true);
+	if (d->m_kind == dsp::kind::custom)
+		wait_for_block();
+
+	command c{ command::type::release_dsp };
+	c.d = d;
+	send(c);
+
+	retired r;
+	r.d = TakeOwned(m_dsps, d);
+	retire(std::move(r));
+}
+
+void std::experimental::audio::software_mixer::send(const command& c)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_command_lock);
+		m_commands.push_back(c);
+	}
+	m_commands_sent++;
+	collect();
+}
+
+void std::experimental::audio::software_mixer::retire(retired r)
+{
+	r.command = m_commands_sent;
+	m_retired.push_back(std::move(r));
+}
+
+void std::experimental::audio::software_mixer::collect()
+{
+	const uint64_t applied = m_commands_applied.load(std::memory_order_acquire);
+	m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(), [applied](const retired& r) { return r.command <= applied; }), m_retired.end());
+}
+
+void std::experimental::audio::software_mixer::wait_for_block() const
+{
+	// A block that starts after the caller's store sees it, so only one already under way can still be using what
+	// was released.  Without a mixer thread nothing is ever under way here.
+	const uint64_t started = m_blocks_started.load();
+	while (m_blocks_finished.load() < started)
+		std::this_thread::yield();
+}
+
+void std::experimental::audio::software_mixer::reserve_scratch(size_t depth, size_t source_channels)
+{
+	if (m_scratch && depth <= m_scratch->depth && source_channels <= m_scratch->source_channels)
+		return;
+
+	// Grown on this thread and swapped in by command, ahead of the command that needs it.
+	auto buffers = std::make_unique<scratch_buffers>();
+	buffers->depth = std::max(depth, m_scratch ? m_scratch->depth : 0);
+	buffers->source_channels = std::max(source_channels, m_scratch ? m_scratch->source_channels : 0);
+	buffers->mix.resize((buffers->depth + 1) * 2 * m_block_length * m_num_channels);
+	buffers->source.resize(m_block_length * buffers->source_channels);
+	buffers->generator.resize((m_block_length + 3) * buffers->source_channels);
+
+	if (m_scratch)
+	{
+		command c{ command::type::set_scratch };
+		c.scratch = buffers.get();
+		send(c);
+
+		retired r;
+		r.scratch = std::move(m_scratch);
+		retire(std::move(r));
+	}
+	m_scratch = std::move(buffers);
+}
+
+size_t std::experimental::audio::software_mixer::depth(const node* n) const
+{
+	size_t depth = 0;
+	for (const node* p = n->m_parent; p; p = p->m_parent)
+		depth++;
+	return depth;
+}
+
+void std::experimental::audio::software_mixer::apply_commands()
+{
+	{
+		// If the game thread is queueing right now, its commands wait for the next block.
+		std::unique_lock<std::mutex> lock(m_command_lock, std::try_to_lock);
+		if (!lock.owns_lock() || m_commands.empty())
+			return;
+		m_commands.swap(m_applying);
+	}
+
+	for (const command& c : m_applying)
+		apply(c);
+	m_commands_applied.fetch_add(m_applying.size(), std::memory_order_release);
+	m_applying.clear();
+}
+
+void std::experimental::audio::software_mixer::apply(const command& c)
+{
+	switch (c.kind)
+	{
+	case command::type::move_group:
+		unlink(c.target);
+		c.target->m_mix_parent = c.group;
+		link_back(c.group->m_mix_groups, c.target);
+		break;
+	case command::type::move_channel:
+		unlink(c.target);
+		c.target->m_mix_parent = c.group;
+		link_back(c.group->m_mix_channels, c.target);
+		break;
+	case command::type::add_dsp:
+	{
+		unlink(c.d);
+		mix_list<dsp>& chain = c.position == dsp_position::head ? c.target->m_mix_head_dsps : c.target->m_mix_tail_dsps;
+		if (c.position == dsp_position::head)
+			link_front(chain, c.d);
+		else
+			link_back(chain, c.d);
+		c.d->m_mix_chain = &chain;
+		break;
+	}
+	case command::type::remove_dsp:
+	case command::type::release_dsp:
+		unlink(c.d);
+		break;
+	case command::type::release_group:
+	{
+		auto group = static_cast<channel_group*>(c.target);
+		unlink(group);
+		while (node* child = group->m_mix_groups.first)
+		{
+			unlink(child);
+			child->m_mix_parent = m_master.get();
+			link_back(m_master->m_mix_groups, child);
+		}
+		while (node* child = group->m_mix_channels.first)
+		{
+			unlink(child);
+			child->m_mix_parent = m_master.get();
+			link_back(m_master->m_mix_channels, child);
+		}
+		while (group->m_mix_head_dsps.first)
+			unlink(group->m_mix_head_dsps.first);
+		while (group->m_mix_tail_dsps.first)
+			unlink(group->m_mix_tail_dsps.first);
+		break;
+	}
+	case command::type::release_channel:
+		unlink(c.target);
+		while (c.target->m_mix_head_dsps.first)
+			unlink(c.target->m_mix_head_dsps.first);
+		while (c.target->m_mix_tail_dsps.first)
+			unlink(c.target->m_mix_tail_dsps.first);
+		break;
+	case command::type::set_loop:
+	{
+		auto target = static_cast<channel*>(c.target);
+		target->m_loop_start = c.start_frame;
+		target->m_loop_end = c.end_frame;
+		break;
+	}
+	case command::type::set_scratch:
+		m_mix_scratch = c.scratch;
+		break;
+	}
+}
+
+void std::experimental::audio::software_mixer::unlink(node* n)
+{
+	// DSPs stay with the node; only the routing changes.
+	channel_group* parent = n->m_mix_parent;
+	if (!parent)
+		return;
+	if (dynamic_cast<channel*>(n))
+		unlink(parent->m_mix_channels, n);
+	else
+		unlink(parent->m_mix_groups, n);
+	n->m_mix_parent = nullptr;
+}
+
+void std::experimental::audio::software_mixer::unlink(dsp* d)
+{
+	if (!d->m_mix_chain)
+		return;
+	unlink(*d->m_mix_chain, d);
+	d->m_mix_chain = nullptr;
+}
+
+float* std::experimental::audio::software_mixer::scratch(size_t depth, size_t index)
+{
+	return m_mix_scratch->mix.data() + (depth * 2 + index) * m_block_length * m_num_channels;
+}
+
+void std::experimental::audio::software_mixer::render(float* output, size_t num_frames)
+{
+	size_t done = 0;
+	while (done < num_frames)
+	{
+		size_t length = std::min(m_block_length, num_frames - done);
+		auto start = std::chrono::high_resolution_clock::now();
+		m_blocks_started.fetch_add(1);
+		apply_commands();
+		render_block(output + done * m_num_channels, length);
+		m_blocks_finished.fetch_add(1);
+		std::chrono::duration<float> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+		// Smoothed percentage of the block's real time spent mixing, as FMOD reports it.
+		float usage = 100.0f * elapsed.count() * m_sample_rate / length;
+		float previous = m_cpu_usage.load(std::memory_order_relaxed);
+		m_cpu_usage.store(previous + (usage - previous) * 0.1f, std::memory_order_relaxed);
+		done += length;
+	}
+}
+
+void std::experimental::audio::software_mixer::render_block(float* output, size_t length)
+{
+	float* mix = scratch(0, 0);
+	if (render_group(m_master.get(), mix, length, 0))
+		std::copy(mix, mix + length * m_num_channels, output);
+	else
+		std::fill(output, output + length * m_num_channels, 0.0f);
+
+	// Sends wrote this block's side of each return, which the returns play during the next block.
+	m_block_index++;
+}
+
+bool std::experimental::audio::software_mixer::render_group(channel_group* group, float* output, size_t length, size_t depth)
+{
+	if (group->get_paused())
+		return false;
+
+	const size_t count = length * m_num_channels;
+	float* buffer = output;
+	float* temp = scratch(depth, 1);
+	std::fill(buffer, buffer + count, 0.0f);
+
+	bool idle = true;
+	float* child = scratch(depth + 1, 0);
+	for (node* n = group->m_mix_groups.first; n; n = n->m_mix_next)
+	{
+		if (render_group(static_cast<channel_group*>(n), child, length, depth + 1))
+		{
+			AddInto(buffer, child, count);
+			idle = false;
+		}
+	}
+	for (node* n = group->m_mix_channels.first; n; n = n->m_mix_next)
+	{
+		if (render_channel(static_cast<channel*>(n), child, length, depth + 1))
+		{
+			AddInto(buffer, child, count);
+			idle = false;
+		}
+	}
+
+	group->process_dsps(group->m_mix_tail_dsps, buffer, temp, length, idle);
+	if (!idle)
+	{
+		if (group->get_mute())
+		{
+			std::fill(buffer, buffer + count, 0.0f);
+			idle = true;
+		}
+		else
+			Scale(buffer, group->get_volume(), count);
+	}
+	group->process_dsps(group->m_mix_head_dsps, buffer, temp, length, idle);
+
+	if (buffer != output)
+		std::copy(buffer, buffer + count, output);
+	return !idle;
+}
+
+void std::experimental::audio::software_mixer::render_generator(channel* c, double step, float* output, size_t length)
+{
+	const size_t channels = c->m_data.description.num_channels;
+	auto& generator = c->m_generator;
+	if (step == 1.0 && c->m_position == 0.0 && c->m_carry_frames == 0)
+	{
+		generator.read(generator.userdata, output, length);
+		return;
+	}
+
+	// The scratch holds a block and a few frames, so high steps are read in pieces that fit.
+	const size_t capacity = m_mix_scratch->generator.size() / channels;
+	float* frames = m_mix_scratch->generator.data();
+	size_t done = 0;
+	while (done < length)
+	{
+		// Frames wholly before the next position are never interpolated from, so drop them first.  Only steps
+		// above one leave any.
+		const size_t skip = static_cast<size_t>(c->m_position);
+		if (skip > 0)
+		{
+			size_t kept = skip < c->m_carry_frames ? c->m_carry_frames - skip : 0;
+			std::copy_n(c->m_carry.data() + (c->m_carry_frames - kept) * channels, kept * channels, c->m_carry.data());
+			for (size_t dropped = c->m_carry_frames - kept; dropped < skip;)
+			{
+				size_t count = std::min(skip - dropped, capacity);
+				generator.read(generator.userdata, frames, count);
+				dropped += count;
+			}
+			c->m_carry_frames = kept;
+			c->m_position -= skip;
+		}
+
+		// With the position below one, this many frames always fit.
+		size_t count = std::min(length - done, static_cast<size_t>((capacity - 2 - c->m_position) / step) + 1);
+		read_generator(c, step, output + done * channels, count, capacity);
+		done += count;
+	}
+}
+
+void std::experimental::audio::software_mixer::read_generator(channel* c, double step, float* output, size_t length, size_t capacity)
+{
+	// Reads just enough new frames after the carried ones to interpolate every output frame.
+	const size_t channels = c->m_data.description.num_channels;
+	auto& generator = c->m_generator;
+	const double last = c->m_position + step * (length - 1);
+	const size_t total = std::min(std::max(static_cast<size_t>(std::ceil(last)) + 1, c->m_carry_frames), capacity);
+	float* frames = m_mix_scratch->generator.data();
+	std::copy_n(c->m_carry.data(), c->m_carry_frames * channels, frames);
+	if (total > c->m_carry_frames)
+		generator.read(generator.userdata, frames + c->m_carry_frames * channels, total - c->m_carry_frames);
+
+	for (size_t i = 0; i < length; i++)
+	{
+		double position = c->m_position + step * i;
+		size_t index = static_cast<size_t>(position);
+		float fraction = static_cast<float>(position - index);
+		const float* a = frames + index * channels;
+		const float* b = fraction > 0.0f ? a + channels : a;
+		for (size_t channel = 0; channel < channels; channel++)
+			output[i * channels + channel] = a[channel] + (b[channel] - a[channel]) * fraction;
+	}
+
+	// The next piece starts from the frame before its first position, and at most two frames carry over.
+	const double next = last + step;
+	const size_t base = std::min(static_cast<size_t>(next), total);
+	c->m_carry_frames = total - base;
+	std::copy_n(frames + base * channels, c->m_carry_frames * channels, c->m_carry.data());
+	c->m_position = next - base;
+}
+
+size_t std::experimental::audio::software_mixer::loop_end(const channel* c) const
+{
+	return c->m_loop_end != 0 ? std::min(c->m_loop_end, c->m_length_frames) : c->m_length_frames;
+}
+
+bool std::experimental::audio::software_mixer::wrap_loop(channel* c)
+{
+	bool wrapped = false;
+	for (;;)
+	{
+		int count = c->m_loop_count.load(std::memory_order_relaxed);
+		size_t end = loop_end(c);
+		if (count == 0 || c->m_position < end || c->m_loop_start >= end)
+			return wrapped;
+
+		c->m_position -= static_cast<double>(end - c->m_loop_start);
+		wrapped = true;
+
+		// The game thread may have set a new count meanwhile, in which case that one wins.
+		if (count > 0)
+			c->m_loop_count.compare_exchange_strong(count, count - 1, std::memory_order_relaxed);
+	}
+}
+
+bool std::experimental::audio::software_mixer::render_channel(channel* c, float* output, size_t length, size_t depth)
+{
+	if (!c->is_playing() || c->get_paused() || c->m_released.load(std::memory_order_acquire))
+		return false;
+
+	const int source_channels = static_cast<int>(c->m_data.description.num_channels);
+	const double step = static_cast<double>(c->m_data.description.frequency) * c->get_pitch() / m_sample_rate;
+
+	// A muted channel is virtual: it keeps its place in the source without being mixed.  A generator has no
+	// place to keep, so it just isn't read.
+	if (c->get_mute() && c->m_generator.read != nullptr)
+		return false;
+	if (c->get_mute())
+	{
+		c->m_position += step * length;
+		wrap_loop(c);
+		if (c->m_position >= c->m_length_frames)
+			c->stop();
+		return false;
+	}
+
+	// A looping channel reads up to the loop end, jumps back and carries on within the same block, so the loop
+	// point lands on the exact frame.
+	float* source_frames = m_mix_scratch->source.data();
+	size_t frames = 0;
+	if (c->m_generator.read != nullptr)
+	{
+		render_generator(c, step, source_frames, length);
+		frames = length;
+	}
+	while (frames < length)
+	{
+		size_t end = c->m_loop_count.load(std::memory_order_relaxed) != 0 ? loop_end(c) : c->m_length_frames;
+		float* source = source_frames + frames * source_channels;
+		frames += c->m_decoder
+			? Resample(*c->m_decoder, source_channels, end, c->m_position, step, source, length - frames)
+			: Resample(c->m_data, end, c->m_position, step, source, length - frames);
+		if (frames == length || !wrap_loop(c))
+			break;
+	}
+	if (frames < length)
+		c->stop();
+
+	// Panned into the output layout at unity, so that the tail DSPs run before the fader as they do on groups.
+	const size_t count = length * m_num_channels;
+	std::fill(output, output + count, 0.0f);
+	MixInto(output, m_num_channels, source_frames, source_channels, frames, 1.0f, c->get_pan());
+
+	float* buffer = output;
+	float* temp = scratch(depth, 1);
+	bool idle = false;
+	c->process_dsps(c->m_mix_tail_dsps, buffer, temp, length, idle);
+	if (!idle)
+		Scale(buffer, c->get_volume(), count);
+	c->process_dsps(c->m_mix_head_dsps, buffer, temp, length, idle);
+
+	if (buffer != output)
+		std::copy(buffer, buffer + count, output);
+	return !idle;
+}
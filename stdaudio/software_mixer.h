@@ -0,0 +1,328 @@
+#pragma once
+
+#include "adpcm.h"
+#include "backend.h"
+#include <mutex>
+#include <unordered_map>
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			// Portable mixer with no platform or FMOD dependencies.  It mirrors the pieces of FMOD the library uses:
+			// channels playing memory sources, channel groups summed into a tree under a master group, DSP chains on
+			// both (head DSPs run after the fader, tail DSPs before it), and send/return pairs.
+			//
+			// Summing, gain and unity-rate pcm16 conversion use SSE.  Channels whose rate or pitch differs from the
+			// mixer's are resampled by scalar linear interpolation, which is neither vectorized nor band-limited, so
+			// sounds loaded at the device's rate with load_settings::frequency are both cheaper and cleaner.
+			//
+			// Everything but render() is called from one game thread, which keeps its own view of the graph for
+			// queries and hands each change to the mixer through a command queue.  render() applies the commands
+			// between blocks and never waits on the game thread.  Volume, pitch, pan, mute and pause are atomics read
+			// directly.  Releasing a channel or DSP waits for a block in progress to finish, so that its source or
+			// callbacks can be freed straight after.
+			class software_mixer
+			{
+			public:
+				class dsp;
+				class channel_group;
+
+				// Intrusive list the mixer walks, so that applying a command never allocates.
+				template<typename T>
+				struct mix_list
+				{
+					T* first = nullptr;
+					T* last = nullptr;
+				};
+
+				class node
+				{
+				public:
+					virtual ~node();
+
+					static void* operator new(size_t size, std::pmr::memory_resource* resource);
+					static void operator delete(void* p, std::pmr::memory_resource* resource);
+					static void operator delete(void* p);
+
+					float get_volume() const;
+					void set_volume(float volume);
+					bool get_mute() const;
+					void set_mute(bool mute);
+					bool get_paused() const;
+					void set_paused(bool paused);
+
+					void* get_user_data() const;
+					void set_user_data(void* user_data);
+
+					void add_dsp(dsp* d, dsp_position position);
+					void remove_dsp(dsp* d);
+					void move_dsp_to_head(dsp* d);
+
+				protected:
+					friend class software_mixer;
+					explicit node(software_mixer* mixer);
+					void process_dsps(const mix_list<dsp>& chain, float*& buffer, float*& scratch, size_t length, bool& idle);
+
+					software_mixer* m_mixer;
+
+					// The game thread's view.
+					channel_group* m_parent = nullptr;
+					std::vector<dsp*> m_head_dsps;
+					std::vector<dsp*> m_tail_dsps;
+
+					// The mixer's view, which catches up as it applies commands.
+					channel_group* m_mix_parent = nullptr;
+					node* m_mix_prev = nullptr;
+					node* m_mix_next = nullptr;
+					mix_list<dsp> m_mix_head_dsps;
+					mix_list<dsp> m_mix_tail_dsps;
+					std::atomic<float> m_volume{ 1.0f };
+					std::atomic<bool> m_mute{ false };
+					std::atomic<bool> m_paused{ false };
+					void* m_user_data = nullptr;
+				};
+
+				class channel : public node
+				{
+				public:
+					float get_pitch() const;
+					void set_pitch(float pitch);
+					float get_pan() const;
+					void set_pan(float pan);
+					int get_priority() const;
+					void set_priority(int priority);
+
+					// Plays [start_frame, end_frame) count more times, or forever for -1.  An end_frame of 0 is the end
+					// of the data.  The count is set straight away, as with set_loop_count, and the region applies from
+					// the next block.
+					int get_loop_count() const;
+					void set_loop_count(int count);
+					void set_loop(int count, size_t start_frame, size_t end_frame);
+
+					float get_audibility() const;
+					bool is_playing() const;
+					bool is_virtual() const;
+					void stop();
+
+					channel_group* get_group() const;
+					void set_group(channel_group* group);
+
+				private:
+					friend class software_mixer;
+					channel(software_mixer* mixer, const memory_buffer_data& data);
+					channel(software_mixer* mixer, const generator_callbacks& generator);
+
+					memory_buffer_data m_data;
+					size_t m_bytes_per_sample;
+					size_t m_length_frames;
+					std::unique_ptr<adpcm_decoder> m_decoder;
+					double m_position = 0.0;
+					size_t m_loop_start = 0;
+					size_t m_loop_end = 0;
+					std::atomic<int> m_loop_count{ 0 };
+
+					// Generators are read a block at a time.  m_position is then relative to the first carried frame,
+					// the one or two frames of the last block that the next still interpolates from.
+					generator_callbacks m_generator;
+					std::vector<float> m_carry;
+					size_t m_carry_frames = 0;
+					std::atomic<float> m_pitch{ 1.0f };
+					std::atomic<float> m_pan{ 0.0f };
+					std::atomic<int> m_priority{ 128 };
+					std::atomic<bool> m_playing{ true };
+					std::atomic<bool> m_released{ false };
+				};
+
+				class channel_group : public node
+				{
+				public:
+					void add_group(channel_group* child);
+
+					size_t get_num_groups() const;
+					channel_group* get_group(size_t index) const;
+					size_t get_num_channels() const;
+					channel* get_channel(size_t index) const;
+
+				private:
+					friend class software_mixer;
+					using node::node;
+
+					std::vector<channel_group*> m_groups;
+					std::vector<channel*> m_channels;
+					mix_list<node> m_mix_groups;
+					mix_list<node> m_mix_channels;
+				};
+
+				class dsp
+				{
+				public:
+					static void* operator new(size_t size, std::pmr::memory_resource* resource);
+					static void operator delete(void* p, std::pmr::memory_resource* resource);
+					static void operator delete(void* p);
+
+					float get_send_level() const;
+					void set_send_level(float level);
+					int get_return_id() const;
+
+				private:
+					friend class software_mixer;
+
+					// Sends write the side for the current block and the return plays the previous block's side.
+					// written holds the block each side was last written in; the first send of a block overwrites
+					// rather than adds, so sides never need clearing.
+					struct return_bus
+					{
+						std::vector<float> buffers[2];
+						uint64_t written[2] = {};
+					};
+
+					enum class kind
+					{
+						custom,
+						send,
+						ret,
+					};
+
+					dsp_callbacks m_callbacks;
+					kind m_kind = kind::custom;
+					int m_return_id = -1;
+					std::atomic<float> m_send_level{ 1.0f };
+					std::atomic<bool> m_released{ false };
+
+					// Sends and their return share the bus, so a send outliving its return stays harmless.
+					std::shared_ptr<return_bus> m_bus;
+
+					node* m_owner = nullptr;
+					mix_list<dsp>* m_mix_chain = nullptr;
+					dsp* m_mix_prev = nullptr;
+					dsp* m_mix_next = nullptr;
+				};
+
+				// Channels, groups and DSPs are allocated from resource, or the global heap when it is null.
+				software_mixer(int sample_rate, int num_channels, size_t block_length, std::pmr::memory_resource* resource = nullptr);
+				~software_mixer();
+
+				int get_sample_rate() const;
+				int get_num_channels() const;
+				size_t get_block_length() const;
+				float get_cpu_usage() const;
+
+				channel_group* get_master();
+				channel_group* create_group();
+				channel* play(const memory_buffer_data& data, channel_group* group, bool paused);
+				channel* play(const generator_callbacks& generator, channel_group* group, bool paused);
+				dsp* create_dsp(const dsp_callbacks& callbacks);
+				dsp* create_send(int return_id, float level);
+				dsp* create_return();
+
+				void release(channel_group* group);
+				void release(channel* c);
+				void release(dsp* d);
+
+				// Mixes num_frames interleaved frames of get_num_channels() channels into output.
+				void render(float* output, size_t num_frames);
+
+			private:
+				// Two block buffers per level of the tree, plus room to read sources of up to source_channels.  The
+				// game thread replaces them with larger ones when the graph outgrows them.
+				struct scratch_buffers
+				{
+					size_t depth = 0;
+					size_t source_channels = 0;
+					std::vector<float> mix;
+					std::vector<float> source;
+					std::vector<float> generator;
+				};
+
+				struct command
+				{
+					enum class type
+					{
+						move_group,
+						move_channel,
+						add_dsp,
+						remove_dsp,
+						release_group,
+						release_channel,
+						release_dsp,
+						set_loop,
+						set_scratch,
+					};
+
+					type kind;
+					node* target = nullptr;
+					channel_group* group = nullptr;
+					dsp* d = nullptr;
+					dsp_position position = dsp_position::head;
+					size_t start_frame = 0;
+					size_t end_frame = 0;
+					scratch_buffers* scratch = nullptr;
+				};
+
+				// Objects the mixer may still point to, freed once it has applied the command that unlinks them.
+				struct retired
+				{
+					uint64_t command = 0;
+					std::unique_ptr<node> n;
+					std::unique_ptr<dsp> d;
+					std::unique_ptr<scratch_buffers> scratch;
+				};
+
+				void send(const command& c);
+				void retire(retired r);
+				void collect();
+				void wait_for_block() const;
+				void reserve_scratch(size_t depth, size_t source_channels);
+				void apply_commands();
+				void apply(const command& c);
+				void unlink(node* n);
+				void unlink(dsp* d);
+				template<typename T, typename U> static void link_front(mix_list<T>& list, U* item);
+				template<typename T, typename U> static void link_back(mix_list<T>& list, U* item);
+				template<typename T, typename U> static void unlink(mix_list<T>& list, U* item);
+				size_t depth(const node* n) const;
+
+				void render_block(float* output, size_t length);
+				bool render_group(channel_group* group, float* output, size_t length, size_t depth);
+				bool render_channel(channel* c, float* output, size_t length, size_t depth);
+				void render_generator(channel* c, double step, float* output, size_t length);
+				void read_generator(channel* c, double step, float* output, size_t length, size_t capacity);
+				size_t loop_end(const channel* c) const;
+				bool wrap_loop(channel* c);
+				float* scratch(size_t depth, size_t index);
+
+				int m_sample_rate;
+				int m_num_channels;
+				size_t m_block_length;
+				std::atomic<float> m_cpu_usage{ 0.0f };
+				std::pmr::memory_resource* m_resource;
+
+				// Game thread.
+				std::unique_ptr<channel_group> m_master;
+				std::vector<std::unique_ptr<channel_group>> m_groups;
+				std::vector<std::unique_ptr<channel>> m_channels;
+				std::vector<std::unique_ptr<dsp>> m_dsps;
+				std::unordered_map<int, std::shared_ptr<dsp::return_bus>> m_returns;
+				int m_next_return_id = 0;
+				std::unique_ptr<scratch_buffers> m_scratch;
+				std::vector<retired> m_retired;
+				uint64_t m_commands_sent = 0;
+
+				// The mixer only ever try_locks m_command_lock, and takes the whole queue at once.
+				std::mutex m_command_lock;
+				std::vector<command> m_commands;
+				std::vector<command> m_applying;
+				std::atomic<uint64_t> m_commands_applied{ 0 };
+				std::atomic<uint64_t> m_blocks_started{ 0 };
+				std::atomic<uint64_t> m_blocks_finished{ 0 };
+
+				// Mixer thread.
+				scratch_buffers* m_mix_scratch = nullptr;
+				uint64_t m_block_index = 1;
+			};
+		}
+	}
+}
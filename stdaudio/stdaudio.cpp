@@ -33,6 +33,9 @@ public:
 		}
 	}
 
+	// A 1kHz one-pole filter decays below -100dB well within this many samples.
+	size_t tail_length_samples() const override { return 128; }
+
 private:
 	float previous_entry[2] = { 0.0f };
 };
@@ -61,6 +64,7 @@ int main()
 		voice->assign_to_submix(*sfx);
 		while (voice->is_playing())
 		{
+			audio_device.update();
 			std::this_thread::sleep_for(100ms);
 		}
 	}
@@ -70,6 +74,7 @@ int main()
 		//voice->add_effect<LowPassFilter>();
 		while (voice->is_playing())
 		{
+			audio_device.update();
 			std::this_thread::sleep_for(100ms);
 		}
 	}
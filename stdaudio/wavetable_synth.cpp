@@ -0,0 +1,320 @@
+#include "wavetable_synth.h"
+#include "simd.h"
+#include <cmath>
+#include <stdexcept>
+
+// Phases are 32-bit fixed point: the top bits index the table and the rest are the interpolation fraction.
+static const int wavetable_fraction_bits = 21;
+static const uint32_t wavetable_fraction_mask = (1u << wavetable_fraction_bits) - 1;
+static const float wavetable_fraction_scale = 1.0f / (1u << wavetable_fraction_bits);
+
+static std::vector<float> ShapeHarmonics(std::experimental::audio::wavetable_shape shape, size_t num_harmonics)
+{
+	const double pi = 3.14159265358979323846;
+
+	std::vector<float> harmonics(num_harmonics, 0.0f);
+	for (size_t h = 1; h <= num_harmonics; h++)
+	{
+		double amplitude = 0.0;
+		switch (shape)
+		{
+		case std::experimental::audio::wavetable_shape::sine:
+			amplitude = h == 1 ? 1.0 : 0.0;
+			break;
+		case std::experimental::audio::wavetable_shape::triangle:
+			amplitude = h % 2 == 1 ? 8.0 / (pi * pi * h * h) * (h % 4 == 1 ? 1.0 : -1.0) : 0.0;
+			break;
+		case std::experimental::audio::wavetable_shape::square:
+			amplitude = h % 2 == 1 ? 4.0 / (pi * h) : 0.0;
+			break;
+		case std::experimental::audio::wavetable_shape::saw:
+			amplitude = 2.0 / (pi * h) * (h % 2 == 1 ? 1.0 : -1.0);
+			break;
+		}
+		harmonics[h - 1] = static_cast<float>(amplitude);
+	}
+	return harmonics;
+}
+
+static size_t EnvelopeSamples(float seconds, unsigned int frequency)
+{
+	if (!(seconds >= 0.0f))
+		throw std::invalid_argument("Envelope times can't be negative");
+	return std::max<size_t>(1, static_cast<size_t>(seconds * frequency + 0.5f));
+}
+
+// Adds length samples of one oscillator to output, with a gain that starts at level and moves by slope per sample.
+static void RenderOscillator(const float* table, uint32_t& phase, uint32_t increment, float level, float slope, float* output, size_t length)
+{
+	size_t i = 0;
+#if STDAUDIO_SSE2
+	// Four consecutive samples per iteration.  The table reads are scalar, everything around them is not.
+	__m128i phases = _mm_setr_epi32(static_cast<int>(phase), static_cast<int>(phase + increment), static_cast<int>(phase + 2 * increment), static_cast<int>(phase + 3 * increment));
+	const __m128i phase_step = _mm_set1_epi32(static_cast<int>(increment * 4));
+	const __m128i fraction_mask = _mm_set1_epi32(static_cast<int>(wavetable_fraction_mask));
+	const __m128 fraction_scale = _mm_set1_ps(wavetable_fraction_scale);
+	__m128 gains = _mm_setr_ps(level, level + slope, level + 2 * slope, level + 3 * slope);
+	const __m128 gain_step = _mm_set1_ps(4 * slope);
+	alignas(16) int32_t indices[4];
+	for (; i + 4 <= length; i += 4)
+	{
+		_mm_store_si128(reinterpret_cast<__m128i*>(indices), _mm_srli_epi32(phases, wavetable_fraction_bits));
+		__m128 fraction = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(phases, fraction_mask)), fraction_scale);
+		__m128 a = _mm_setr_ps(table[indices[0]], table[indices[1]], table[indices[2]], table[indices[3]]);
+		__m128 b = _mm_setr_ps(table[indices[0] + 1], table[indices[1] + 1], table[indices[2] + 1], table[indices[3] + 1]);
+		__m128 sample = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), fraction));
+		_mm_storeu_ps(output + i, _mm_add_ps(_mm_loadu_ps(output + i), _mm_mul_ps(sample, gains)));
+		phases = _mm_add_epi32(phases, phase_step);
+		gains = _mm_add_ps(gains, gain_step);
+	}
+	phase += increment * static_cast<uint32_t>(i);
+	level += slope * i;
+#endif
+	for (; i < length; i++)
+	{
+		uint32_t index = phase >> wavetable_fraction_bits;
+		float fraction = (phase & wavetable_fraction_mask) * wavetable_fraction_scale;
+		output[i] += (table[index] + (table[index + 1] - table[index]) * fraction) * level;
+		phase += increment;
+		level += slope;
+	}
+}
+
+std::experimental::audio::wavetable_synth::wavetable_synth(wavetable_shape shape, const envelope_settings& envelope, unsigned int max_notes, unsigned int frequency) :
+	wavetable_synth(ShapeHarmonics(shape, table_size / 2), envelope, max_notes, frequency)
+{
+}
+
+std::experimental::audio::wavetable_synth::wavetable_synth(const std::vector<float>& harmonics, const envelope_settings& envelope, unsigned int max_notes, unsigned int frequency) :
+	synth(1, frequency),
+	m_notes(max_notes),
+	m_attack_samples(EnvelopeSamples(envelope.attack_seconds, frequency)),
+	m_decay_samples(EnvelopeSamples(envelope.decay_seconds, frequency)),
+	m_release_samples(EnvelopeSamples(envelope.release_seconds, frequency)),
+	m_sustain_level(envelope.sustain_level)
+{
+	static_assert(size_t(1) << (32 - wavetable_fraction_bits) == table_size, "The phase format must match the table size");
+
+	if (max_notes == 0)
+		throw std::invalid_argument("A wavetable synth needs at least one note");
+	if (!(m_sustain_level >= 0.0f && m_sustain_level <= 1.0f))
+		throw std::invalid_argument("Sustain level must be between 0 and 1");
+	build_tables(harmonics);
+}
+
+bool std::experimental::audio::wavetable_synth::note_on(int note, float velocity)
+{
+	return push_event({ event_type::note_on, note, std::min(std::max(velocity, 0.0f), 1.0f) });
+}
+
+bool std::experimental::audio::wavetable_synth::note_off(int note)
+{
+	return push_event({ event_type::note_off, note, 0.0f });
+}
+
+bool std::experimental::audio::wavetable_synth::all_notes_off()
+{
+	return push_event({ event_type::all_notes_off, 0, 0.0f });
+}
+
+unsigned int std::experimental::audio::wavetable_synth::get_active_notes() const
+{
+	return m_active_notes.load(std::memory_order_relaxed);
+}
+
+void std::experimental::audio::wavetable_synth::render(float* output, size_t num_frames)
+{
+	// Events apply at the start of the block that picks them up.
+	uint32_t read_position = m_event_read.load(std::memory_order_relaxed);
+	uint32_t write_position = m_event_write.load(std::memory_order_acquire);
+	for (; read_position != write_position; read_position++)
+		handle_event(m_events[read_position % max_events]);
+	m_event_read.store(read_position, std::memory_order_release);
+
+	std::fill(output, output + num_frames, 0.0f);
+
+	// Each note renders in runs over which its envelope is a single straight line.
+	unsigned int active_notes = 0;
+	for (auto& n : m_notes)
+	{
+		size_t frames = 0;
+		while (frames < num_frames && n.current_stage != stage::idle)
+		{
+			size_t run = std::min(num_frames - frames, n.stage_remaining);
+			RenderOscillator(n.table, n.phase, n.increment, n.level * n.velocity, n.slope * n.velocity, output + frames, run);
+			frames += run;
+			n.level += n.slope * run;
+			if (n.current_stage == stage::sustain)
+				continue;
+
+			n.stage_remaining -= run;
+			if (n.stage_remaining == 0)
+			{
+				switch (n.current_stage)
+				{
+				case stage::attack:
+					enter_stage(n, stage::decay);
+					break;
+				case stage::decay:
+					enter_stage(n, stage::sustain);
+					break;
+				default:
+					enter_stage(n, stage::idle);
+					break;
+				}
+			}
+		}
+		if (n.current_stage != stage::idle)
+			active_notes++;
+	}
+	m_active_notes.store(active_notes, std::memory_order_relaxed);
+}
+
+void std::experimental::audio::wavetable_synth::build_tables(const std::vector<float>& harmonics)
+{
+	const double pi = 3.14159265358979323846;
+
+	std::vector<double> sine(table_size);
+	for (size_t i = 0; i < table_size; i++)
+		sine[i] = std::sin(2.0 * pi * i / table_size);
+
+	// Table t holds harmonics up to (table_size / 2) >> t.  Going from the top octave down, each table only adds the
+	// harmonics its lower notes leave room for.
+	std::vector<double> sum(table_size, 0.0);
+	m_tables.assign(num_tables * (table_size + 1), 0.0f);
+	size_t num_harmonics = 0;
+	double peak = 0.0;
+	for (size_t t = num_tables; t-- > 0;)
+	{
+		size_t max_harmonic = std::min((table_size / 2) >> t, harmonics.size());
+		for (size_t h = num_harmonics + 1; h <= max_harmonic; h++)
+		{
+			const double amplitude = harmonics[h - 1];
+			if (amplitude == 0.0)
+				continue;
+			for (size_t i = 0; i < table_size; i++)
+				sum[i] += amplitude * sine[(h * i) & (table_size - 1)];
+		}
+		num_harmonics = std::max(num_harmonics, max_harmonic);
+
+		float* table = m_tables.data() + t * (table_size + 1);
+		for (size_t i = 0; i < table_size; i++)
+		{
+			table[i] = static_cast<float>(sum[i]);
+			peak = std::max(peak, std::abs(sum[i]));
+		}
+		table[table_size] = table[0];
+	}
+
+	// One scale for every table, so that notes keep the same level across octaves.
+	if (peak == 0.0)
+		throw std::invalid_argument("A wavetable needs at least one harmonic");
+	const float scale = static_cast<float>(1.0 / peak);
+	for (auto& sample : m_tables)
+		sample *= scale;
+}
+
+bool std::experimental::audio::wavetable_synth::push_event(const event& e)
+{
+	uint32_t write_position = m_event_write.load(std::memory_order_relaxed);
+	uint32_t read_position = m_event_read.load(std::memory_order_acquire);
+	if (write_position - read_position >= max_events)
+		return false;
+
+	m_events[write_position % max_events] = e;
+	m_event_write.store(write_position + 1, std::memory_order_release);
+	return true;
+}
+
+void std::experimental::audio::wavetable_synth::handle_event(const event& e)
+{
+	switch (e.type)
+	{
+	case event_type::note_on:
+		start_note(e.note, e.velocity);
+		break;
+	case event_type::note_off:
+	case event_type::all_notes_off:
+		for (auto& n : m_notes)
+		{
+			bool held = n.current_stage != stage::idle && n.current_stage != stage::release;
+			if (held && (e.type == event_type::all_notes_off || n.note == e.note))
+				enter_stage(n, stage::release);
+		}
+		break;
+	}
+}
+
+void std::experimental::audio::wavetable_synth::start_note(int note, float velocity)
+{
+	const double frequency = 440.0 * std::pow(2.0, (note - 69) / 12.0);
+	const double increment = frequency / get_frequency() * 4294967296.0;
+	if (velocity <= 0.0f || increment >= 2147483648.0)
+		return;
+
+	// Retrigger the same note if it is still held, otherwise use a free slot or take over the quietest note.
+	note_state* slot = nullptr;
+	for (auto& n : m_notes)
+	{
+		if (n.note == note && n.current_stage != stage::idle && n.current_stage != stage::release)
+		{
+			slot = &n;
+			break;
+		}
+	}
+	if (!slot)
+	{
+		slot = &*std::min_element(m_notes.begin(), m_notes.end(), [](const note_state& a, const note_state& b)
+		{
+			return (a.current_stage == stage::idle ? -1.0f : a.level * a.velocity) < (b.current_stage == stage::idle ? -1.0f : b.level * b.velocity);
+		});
+		slot->phase = 0;
+		slot->level = 0.0f;
+	}
+
+	// The lowest table whose harmonics all stay below Nyquist at this pitch.
+	slot->increment = static_cast<uint32_t>(increment);
+	size_t t = 0;
+	while (t + 1 < num_tables && (uint64_t(1) << (wavetable_fraction_bits + t)) < slot->increment)
+		t++;
+
+	slot->note = note;
+	slot->velocity = velocity;
+	slot->table = m_tables.data() + t * (table_size + 1);
+	enter_stage(*slot, stage::attack);
+}
+
+void std::experimental::audio::wavetable_synth::enter_stage(note_state& n, stage s)
+{
+	n.current_stage = s;
+	switch (s)
+	{
+	case stage::idle:
+		n.level = 0.0f;
+		n.slope = 0.0f;
+		n.stage_remaining = 0;
+		break;
+	case stage::attack:
+		// A retriggered note rises from where it was, at the same rate.
+		n.stage_remaining = std::max<size_t>(1, static_cast<size_t>((1.0f - n.level) * m_attack_samples + 0.5f));
+		n.slope = (1.0f - n.level) / n.stage_remaining;
+		break;
+	case stage::decay:
+		n.level = 1.0f;
+		n.stage_remaining = m_decay_samples;
+		n.slope = (m_sustain_level - 1.0f) / n.stage_remaining;
+		break;
+	case stage::sustain:
+		n.level = m_sustain_level;
+		n.slope = 0.0f;
+		n.stage_remaining = std::numeric_limits<size_t>::max();
+		if (m_sustain_level == 0.0f)
+			enter_stage(n, stage::idle);
+		break;
+	case stage::release:
+		// Release falls at the rate that takes full level to silence in the release time.
+		n.stage_remaining = std::max<size_t>(1, static_cast<size_t>(n.level * m_release_samples + 0.5f));
+		n.slope = -n.level / n.stage_remaining;
+		break;
+	}
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "audio.h"
+#include <atomic>
+
+namespace std
+{
+	namespace experimental
+	{
+		namespace audio
+		{
+			enum class wavetable_shape
+			{
+				sine,
+				triangle,
+				square,
+				saw
+			};
+
+			// Times are in seconds, sustain_level is linear gain.
+			struct envelope_settings
+			{
+				float attack_seconds = 0.005f;
+				float decay_seconds = 0.1f;
+				float sustain_level = 0.7f;
+				float release_seconds = 0.2f;
+			};
+
+			// Polyphonic instrument that mixes all of its notes into one mono voice.  Each waveform is stored as one
+			// table per octave holding only the harmonics that stay below Nyquist there, so notes never alias.  Notes
+			// play from a fixed bank with a 32-bit phase accumulator and a linear ADSR each, four samples at a time.
+			// note_on and note_off queue events for the next render without blocking, from one thread at a time.
+			class wavetable_synth : public synth
+			{
+			public:
+				explicit wavetable_synth(wavetable_shape shape, const envelope_settings& envelope = envelope_settings(), unsigned int max_notes = 16, unsigned int frequency = 48000);
+
+				// Custom waveform from the amplitudes of its harmonics, starting with the fundamental.
+				explicit wavetable_synth(const std::vector<float>& harmonics, const envelope_settings& envelope = envelope_settings(), unsigned int max_notes = 16, unsigned int frequency = 48000);
+
+				// MIDI note numbers, with 69 at 440Hz.  Starting a note that is already held retriggers it, and a
+				// new note past max_notes takes over the quietest one.  Both return false if the event queue is full.
+				bool note_on(int note, float velocity = 1.0f);
+				bool note_off(int note);
+				bool all_notes_off();
+
+				// Notes sounding as of the last render, including ones in their release.
+				unsigned int get_active_notes() const;
+
+				void render(float* output, size_t num_frames) override;
+
+			private:
+				static constexpr size_t table_size = 2048;
+				static constexpr size_t num_tables = 11;
+				static constexpr size_t max_events = 256;
+
+				enum class event_type
+				{
+					note_on,
+					note_off,
+					all_notes_off
+				};
+
+				struct event
+				{
+					event_type type;
+					int note;
+					float velocity;
+				};
+
+				enum class stage
+				{
+					idle,
+					attack,
+					decay,
+					sustain,
+					release
+				};
+
+				struct note_state
+				{
+					int note = 0;
+					float velocity = 0.0f;
+					const float* table = nullptr;
+					uint32_t phase = 0;
+					uint32_t increment = 0;
+					stage current_stage = stage::idle;
+					float level = 0.0f;
+					float slope = 0.0f;
+					size_t stage_remaining = 0;
+				};
+
+				void build_tables(const std::vector<float>& harmonics);
+				bool push_event(const event& e);
+				void handle_event(const event& e);
+				void start_note(int note, float velocity);
+				void enter_stage(note_state& n, stage s);
+
+				// Guard sample at the end of each table so interpolation never wraps.
+				std::vector<float> m_tables;
+				std::vector<note_state> m_notes;
+				size_t m_attack_samples;
+				size_t m_decay_samples;
+				size_t m_release_samples;
+				float m_sustain_level;
+
+				event m_events[max_events];
+				std::atomic<uint32_t> m_event_write{ 0 };
+				std::atomic<uint32_t> m_event_read{ 0 };
+				std::atomic<unsigned int> m_active_notes{ 0 };
+			};
+		}
+	}
+}
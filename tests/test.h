@@ -0,0 +1,63 @@
+#pragma once
+
+#include "audio.h"
+#include <cstdio>
+#include <vector>
+
+// Just enough harness for the loopback tests.  A failed CHECK prints where it failed and the test carries on, and
+// main returns test_result() so that ctest sees the failure.
+inline int& test_failures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+inline int test_result()
+{
+	if (test_failures() > 0)
+		std::printf("%d check(s) failed\n", test_failures());
+	return test_failures() > 0 ? 1 : 0;
+}
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			test_failures()++; \
+		} \
+	} while (false)
+
+// Software backend mixing on demand into the loopback, in blocks of block_length stereo frames.
+inline std::experimental::audio::device_settings loopback_settings(unsigned int block_length = 256, int sample_rate = 48000)
+{
+	std::experimental::audio::device_settings settings;
+	settings.backend = std::experimental::audio::device_backend::software;
+	settings.output = std::experimental::audio::device_output::loopback_manual;
+	settings.sample_rate = sample_rate;
+	settings.block_length = block_length;
+	return settings;
+}
+
+// Mixes and reads back num_frames interleaved stereo frames.
+inline std::vector<float> mix(std::experimental::audio::device& dev, size_t num_frames)
+{
+	std::vector<float> output(num_frames * 2);
+	dev.mix_output(num_frames);
+	size_t read = dev.read_output(output.data(), num_frames);
+	output.resize(read * 2);
+	return output;
+}
+
+// Float buffer holding samples, which the caller keeps alive while it plays.
+inline std::shared_ptr<std::experimental::audio::buffer> float_buffer(const std::vector<float>& samples, unsigned int num_channels, unsigned int frequency = 48000)
+{
+	std::experimental::audio::memory_buffer_description description;
+	description.format = std::experimental::audio::memory_buffer_format::pcmfloat;
+	description.num_channels = num_channels;
+	description.frequency = frequency;
+	return std::experimental::audio::load_from_memory(
+		std::experimental::audio::memory_buffer(reinterpret_cast<const std::byte*>(samples.data()), samples.size() * sizeof(float)),
+		description, true);
+}
@@ -0,0 +1,129 @@
+#include "test.h"
+#include "adpcm.h"
+#include <cmath>
+
+using namespace std::experimental::audio;
+
+// Stereo tone that doesn't end on a block boundary, with a different pitch in each channel.
+static std::vector<float> tone(size_t num_frames)
+{
+	const double pi = 3.14159265358979323846;
+	std::vector<float> samples(num_frames * 2);
+	for (size_t i = 0; i < num_frames; i++)
+	{
+		samples[2 * i] = static_cast<float>(0.5 * std::sin(2.0 * pi * 440.0 * i / 48000));
+		samples[2 * i + 1] = static_cast<float>(0.25 * std::sin(2.0 * pi * 1000.0 * i / 48000));
+	}
+	return samples;
+}
+
+static std::vector<std::byte> encode(const std::vector<float>& samples, unsigned int num_channels)
+{
+	size_t num_frames = samples.size() / num_channels;
+	std::vector<std::byte> encoded(adpcm_encoded_size(num_frames, num_channels));
+	adpcm_encode(samples.data(), num_frames, num_channels, encoded.data());
+	return encoded;
+}
+
+static std::vector<float> decode(const std::vector<std::byte>& encoded, size_t num_frames, unsigned int num_channels)
+{
+	size_t num_blocks = (num_frames + adpcm_block_frames - 1) / adpcm_block_frames;
+	std::vector<float> decoded(num_blocks * adpcm_block_frames * num_channels);
+	adpcm_decode(encoded.data() + sizeof(adpcm_header), num_blocks, num_channels, decoded.data());
+	decoded.resize(num_frames * num_channels);
+	return decoded;
+}
+
+// Encoding keeps the length and comes back within the 4-bit codec's usual signal to noise ratio.
+static void TestRoundTrip()
+{
+	const size_t num_frames = 48000 + 100;
+	std::vector<float> samples = tone(num_frames);
+	std::vector<std::byte> encoded = encode(samples, 2);
+	CHECK(adpcm_num_frames(memory_buffer(encoded.data(), encoded.size()), 2) == num_frames);
+	CHECK(adpcm_num_frames(memory_buffer(encoded.data(), encoded.size() - 1), 2) == 0);
+
+	std::vector<float> decoded = decode(encoded, num_frames, 2);
+	for (unsigned int c = 0; c < 2; c++)
+	{
+		double signal = 0.0;
+		double noise = 0.0;
+		for (size_t i = 0; i < num_frames; i++)
+		{
+			double error = decoded[i * 2 + c] - samples[i * 2 + c];
+			signal += samples[i * 2 + c] * samples[i * 2 + c];
+			noise += error * error;
+		}
+		CHECK(10.0 * std::log10(signal / noise) > 35.0);
+	}
+
+	// The first sample of each block is stored whole.
+	for (size_t i = 0; i < num_frames * 2; i += adpcm_block_frames * 2)
+		CHECK(std::abs(decoded[i] - samples[i]) < 1.0f / 32768.0f);
+}
+
+// Reads in uneven pieces, and after seeking, give exactly what decoding whole blocks does.
+static void TestDecoderMatchesBlocks()
+{
+	const size_t num_frames = adpcm_block_frames * 5 + 37;
+	std::vector<float> samples = tone(num_frames);
+	std::vector<std::byte> encoded = encode(samples, 2);
+	std::vector<float> expected = decode(encoded, num_frames, 2);
+
+	memory_buffer_description description;
+	description.format = memory_buffer_format::adpcm;
+	description.num_channels = 2;
+	description.frequency = 48000;
+	adpcm_decoder decoder({ memory_buffer(encoded.data(), encoded.size()), description });
+	CHECK(decoder.get_length() == num_frames);
+
+	std::vector<float> output(num_frames * 2);
+	size_t done = 0;
+	for (size_t piece = 1; done < num_frames; piece = piece * 3 % 401 + 1)
+		done += decoder.read(output.data() + done * 2, piece);
+	CHECK(done == num_frames);
+	CHECK(decoder.read(output.data(), 1) == 0);
+	CHECK(output == expected);
+
+	for (size_t frame : { size_t(700), size_t(0), num_frames - 1, adpcm_block_frames - 1 })
+	{
+		decoder.seek(frame);
+		float pair[4] = {};
+		CHECK(decoder.read(pair, 2) == std::min<size_t>(2, num_frames - frame));
+		CHECK(pair[0] == expected[frame * 2] && pair[1] == expected[frame * 2 + 1]);
+		const float* frames = decoder.get_frames(frame);
+		CHECK(frames[0] == expected[frame * 2] && frames[1] == expected[frame * 2 + 1]);
+	}
+}
+
+// A buffer compressed at load plays through the mixer exactly as the codec decodes it.
+static void TestLoadedBufferPlays()
+{
+	const size_t num_frames = 3000;
+	std::vector<float> samples = tone(num_frames);
+	memory_buffer_description description;
+	description.format = memory_buffer_format::pcmfloat;
+	description.num_channels = 2;
+	description.frequency = 48000;
+	load_settings settings;
+	settings.format = memory_buffer_format::adpcm;
+	auto b = load_from_memory(memory_buffer(reinterpret_cast<const std::byte*>(samples.data()), samples.size() * sizeof(float)), description, settings);
+
+	memory_buffer_data data = b->get_audio_data();
+	CHECK(data.description.format == memory_buffer_format::adpcm);
+	std::vector<float> expected = decode(encode(samples, 2), num_frames, 2);
+
+	device dev(loopback_settings(256));
+	auto voice = dev.play_sound(b);
+	std::vector<float> output = mix(dev, 256 * 13);
+	for (size_t i = 0; i < output.size(); i++)
+		CHECK(output[i] == (i < expected.size() ? expected[i] : 0.0f));
+}
+
+int main()
+{
+	TestRoundTrip();
+	TestDecoderMatchesBlocks();
+	TestLoadedBufferPlays();
+	return test_result();
+}
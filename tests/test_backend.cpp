@@ -0,0 +1,162 @@
+#include "test.h"
+#include "backend.h"
+#include "loopback.h"
+
+using namespace std::experimental::audio;
+
+// Mixes num_frames through the backend's manual loopback and reads them back.
+static std::vector<float> MixBackend(backend& b, size_t num_frames)
+{
+	std::vector<float> output(num_frames * 2);
+	b.mix_loopback(num_frames);
+	size_t read = b.get_loopback()->read(output.data(), num_frames);
+	output.resize(read * 2);
+	return output;
+}
+
+static backend_sound* CreateConstantSound(backend& b, const std::vector<float>& samples)
+{
+	memory_buffer_data data;
+	data.data = memory_buffer(reinterpret_cast<const std::byte*>(samples.data()), samples.size() * sizeof(float));
+	data.description.format = memory_buffer_format::pcmfloat;
+	data.description.num_channels = 2;
+	data.description.frequency = 48000;
+	return b.create_sound(data);
+}
+
+// Settings and the group tree are reported back as they were made.
+static void TestGraph()
+{
+	auto b = create_software_backend(loopback_settings(128, 44100), std::pmr::new_delete_resource());
+	CHECK(b->get_sample_rate() == 44100);
+	CHECK(b->get_block_length() == 128);
+	CHECK(b->get_loopback() != nullptr);
+
+	backend_group* master = b->get_master_group();
+	backend_group* group = b->create_group();
+	b->add_group(master, group);
+	CHECK(b->get_num_groups(master) == 1);
+	CHECK(b->get_group(master, 0) == group);
+
+	int tag = 0;
+	b->set_user_data(group, &tag);
+	CHECK(b->get_user_data(group) == &tag);
+	b->set_volume(group, 0.5f);
+	CHECK(b->get_volume(group) == 0.5f);
+
+	std::vector<float> samples(2 * 1024, 0.25f);
+	backend_sound* sound = CreateConstantSound(*b, samples);
+	backend_channel* channel = b->play(sound, true);
+	b->set_group(channel, group);
+	CHECK(b->get_num_channels(group) == 1);
+	CHECK(b->get_channel(group, 0) == channel);
+	CHECK(b->is_playing(channel));
+
+	b->set_pitch(channel, 2.0f);
+	CHECK(b->get_pitch(channel) == 2.0f);
+	b->set_priority(channel, 7);
+	CHECK(b->get_priority(channel) == 7);
+
+	b->release(channel);
+	b->release(sound);
+	b->release(group);
+}
+
+// A paused channel is silent, and once unpaused it plays at the product of its own and its group's volumes.
+static void TestMixing()
+{
+	auto b = create_software_backend(loopback_settings(), std::pmr::new_delete_resource());
+	backend_group* group = b->create_group();
+	b->add_group(b->get_master_group(), group);
+	b->set_volume(group, 0.5f);
+
+	std::vector<float> samples(2 * 1024, 0.5f);
+	backend_sound* sound = CreateConstantSound(*b, samples);
+	backend_channel* channel = b->play(sound, true);
+	b->set_group(channel, group);
+	b->set_volume(channel, 0.5f);
+
+	for (float sample : MixBackend(*b, 256))
+		CHECK(sample == 0.0f);
+	b->set_paused(channel, false);
+	for (float sample : MixBackend(*b, 256))
+		CHECK(sample == 0.125f);
+
+	b->stop(channel);
+	CHECK(!b->is_playing(channel));
+	for (float sample : MixBackend(*b, 256))
+		CHECK(sample == 0.0f);
+
+	b->release(channel);
+	b->release(sound);
+	b->release(group);
+}
+
+struct dsp_state
+{
+	float gain = 2.0f;
+	dsp_result result = dsp_result::process;
+	int reads = 0;
+};
+
+static void GainRead(void* userdata, float* buffer_in, float* buffer_out, size_t length_samples, int num_channels)
+{
+	auto* state = static_cast<dsp_state*>(userdata);
+	state->reads++;
+	for (size_t i = 0; i < length_samples * num_channels; i++)
+		buffer_out[i] = buffer_in[i] * state->gain;
+}
+
+static dsp_result GainShouldProcess(void* userdata, bool, size_t, int)
+{
+	return static_cast<dsp_state*>(userdata)->result;
+}
+
+// Custom DSPs run on the node they are added to, and their should_process result is honoured.
+static void TestDsp()
+{
+	auto b = create_software_backend(loopback_settings(), std::pmr::new_delete_resource());
+	std::vector<float> samples(2 * 2048, 0.25f);
+	backend_sound* sound = CreateConstantSound(*b, samples);
+	backend_channel* channel = b->play(sound, false);
+
+	dsp_state state;
+	dsp_callbacks callbacks;
+	callbacks.read = GainRead;
+	callbacks.should_process = GainShouldProcess;
+	callbacks.userdata = &state;
+	backend_dsp* dsp = b->create_dsp(callbacks);
+	b->add_dsp(channel, dsp, dsp_position::head);
+
+	for (float sample : MixBackend(*b, 256))
+		CHECK(sample == 0.5f);
+	CHECK(state.reads == 1);
+
+	state.result = dsp_result::skip;
+	for (float sample : MixBackend(*b, 256))
+		CHECK(sample == 0.25f);
+	CHECK(state.reads == 1);
+
+	state.result = dsp_result::silence;
+	for (float sample : MixBackend(*b, 256))
+		CHECK(sample == 0.0f);
+	CHECK(state.reads == 1);
+
+	b->remove_dsp(channel, dsp);
+	state.result = dsp_result::process;
+	for (float sample : MixBackend(*b, 256))
+		CHECK(sample == 0.25f);
+	CHECK(state.reads == 1);
+
+	b->release(dsp);
+	b->release(channel);
+	b->release(sound);
+}
+
+int main()
+{
+	TestGraph();
+	TestMixing();
+	TestDsp();
+	return test_result();
+}
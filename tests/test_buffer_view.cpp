@@ -0,0 +1,94 @@
+#include "test.h"
+#include <stdexcept>
+
+using namespace std::experimental::audio;
+
+template<typename F>
+static bool Throws(F f)
+{
+	try
+	{
+		f();
+	}
+	catch (const std::invalid_argument&)
+	{
+		return true;
+	}
+	return false;
+}
+
+// Stereo frames counting up from 1, so each frame says where it came from.
+static std::vector<float> Frames(size_t num_frames)
+{
+	std::vector<float> samples(num_frames * 2);
+	for (size_t i = 0; i < samples.size(); i++)
+		samples[i] = static_cast<float>(i / 2 + 1) / 1024.0f;
+	return samples;
+}
+
+// Views may reach the last frame, or be empty at the end, but not run past it, however the sum wraps.
+static void TestBounds()
+{
+	std::vector<float> samples = Frames(100);
+	auto parent = float_buffer(samples, 2);
+
+	CHECK(!Throws([&] { buffer_view(parent, 0, 100); }));
+	CHECK(!Throws([&] { buffer_view(parent, 40, 60); }));
+	CHECK(!Throws([&] { buffer_view(parent, 100, 0); }));
+	CHECK(Throws([&] { buffer_view(parent, 40, 61); }));
+	CHECK(Throws([&] { buffer_view(parent, 101, 0); }));
+	CHECK(Throws([&] { buffer_view(parent, 1, static_cast<size_t>(-1)); }));
+	CHECK(Throws([&] { buffer_view(nullptr, 0, 0); }));
+
+	load_settings settings;
+	settings.format = memory_buffer_format::adpcm;
+	memory_buffer_description description;
+	description.format = memory_buffer_format::pcmfloat;
+	description.num_channels = 2;
+	description.frequency = 48000;
+	auto adpcm = load_from_memory(memory_buffer(reinterpret_cast<const std::byte*>(samples.data()), samples.size() * sizeof(float)), description, settings);
+	CHECK(Throws([&] { buffer_view(adpcm, 0, 1); }));
+}
+
+// A view points into its buffer's samples rather than copying them.
+static void TestData()
+{
+	std::vector<float> samples = Frames(100);
+	auto parent = float_buffer(samples, 2);
+	buffer_view view(parent, 25, 50);
+	CHECK(view.get_buffer() == parent);
+	CHECK(view.get_first_frame() == 25);
+	CHECK(view.get_num_frames() == 50);
+
+	memory_buffer_data data = view.get_audio_data();
+	CHECK(data.description.num_channels == 2);
+	CHECK(data.data.data == parent->get_audio_data().data.data + 25 * 2 * sizeof(float));
+	CHECK(data.data.size == 50 * 2 * sizeof(float));
+}
+
+// A view plays just its slice, and keeps the buffer alive after the caller lets go of it.
+static void TestPlay()
+{
+	std::vector<float> samples = Frames(1000);
+	auto parent = load_from_memory(
+		memory_buffer(reinterpret_cast<const std::byte*>(samples.data()), samples.size() * sizeof(float)),
+		memory_buffer_description{ memory_buffer_format::pcmfloat, 2, 48000 });
+	device dev(loopback_settings(256));
+	auto view = std::make_shared<buffer_view>(parent, 300, 200);
+	parent.reset();
+	auto voice = dev.play_sound(view);
+
+	std::vector<float> output = mix(dev, 256);
+	for (size_t i = 0; i < 200 * 2; i++)
+		CHECK(output[i] == samples[300 * 2 + i]);
+	for (size_t i = 200 * 2; i < output.size(); i++)
+		CHECK(output[i] == 0.0f);
+}
+
+int main()
+{
+	TestBounds();
+	TestData();
+	TestPlay();
+	return test_result();
+}
@@ -0,0 +1,122 @@
+#include "test.h"
+
+using namespace std::experimental::audio;
+
+class gain_effect : public effect
+{
+public:
+	explicit gain_effect(float gain = 1.0f) :
+		m_gain(gain)
+	{
+	}
+
+	void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+	{
+		for (size_t i = 0; i < length_samples * num_channels; i++)
+			buffer_out[i] = buffer_in[i] * m_gain;
+	}
+
+	size_t tail_length_samples() const override { return 0; }
+
+private:
+	float m_gain;
+};
+
+// Carries state between calls, so the chain's chunking would show if it dropped or repeated samples.
+class smoothing_effect : public effect
+{
+public:
+	void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+	{
+		for (size_t i = 0; i < length_samples; i++)
+		{
+			for (int channel = 0; channel < num_channels; channel++)
+			{
+				m_state[channel] += 0.25f * (buffer_in[i * num_channels + channel] - m_state[channel]);
+				buffer_out[i * num_channels + channel] = m_state[channel];
+			}
+		}
+	}
+
+	size_t tail_length_samples() const override { return 100; }
+
+private:
+	float m_state[2] = {};
+};
+
+static std::vector<float> Ramp(size_t num_frames)
+{
+	std::vector<float> samples(2 * num_frames);
+	for (size_t i = 0; i < samples.size(); i++)
+		samples[i] = static_cast<float>(i % 71) / 71.0f - 0.5f;
+	return samples;
+}
+
+// A chain gives the same output as its members run one after another, over blocks longer than its scratch buffer.
+template<typename... Ts>
+static void CheckMatchesSequence(Ts... effects)
+{
+	const size_t num_frames = 1500;
+	std::vector<float> input = Ramp(num_frames);
+
+	chain<Ts...> fused(effects...);
+	std::vector<float> fused_output(input.size());
+	fused.process(input.data(), fused_output.data(), num_frames, 2);
+
+	std::vector<float> expected = input;
+	std::vector<float> scratch(input.size());
+	effect* members[] = { &effects... };
+	for (effect* member : members)
+	{
+		member->process(expected.data(), scratch.data(), num_frames, 2);
+		expected.swap(scratch);
+	}
+
+	CHECK(fused_output == expected);
+}
+
+static void TestMatchesSequence()
+{
+	CheckMatchesSequence(smoothing_effect());
+	CheckMatchesSequence(gain_effect(0.5f), smoothing_effect());
+	CheckMatchesSequence(smoothing_effect(), gain_effect(0.5f), smoothing_effect());
+	CheckMatchesSequence(gain_effect(2.0f), smoothing_effect(), gain_effect(0.5f), smoothing_effect());
+}
+
+// The members' tails add up, and an infinite tail anywhere makes the chain's infinite.
+static void TestTail()
+{
+	CHECK((chain<gain_effect, smoothing_effect, smoothing_effect>().tail_length_samples() == 200));
+	CHECK((chain<gain_effect, gain_effect>().tail_length_samples() == 0));
+
+	class endless_effect : public gain_effect
+	{
+	public:
+		size_t tail_length_samples() const override { return infinite_tail; }
+	};
+	CHECK((chain<smoothing_effect, endless_effect>().tail_length_samples() == effect::infinite_tail));
+}
+
+// A chain plays through a submix like any other effect.
+static void TestOnSubmix()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	bus->add_effect<chain<gain_effect, gain_effect>>(gain_effect(0.5f), gain_effect(0.5f));
+	std::vector<float> samples(2 * 256, 0.5f);
+	auto voice = dev.play_sound(float_buffer(samples, 2));
+	voice->assign_to_submix(*bus);
+
+	std::vector<float> output = mix(dev, 256);
+	CHECK(output.size() == samples.size());
+	for (float sample : output)
+		CHECK(sample == 0.125f);
+}
+
+int main()
+{
+	TestMatchesSequence();
+	TestTail();
+	TestOnSubmix();
+	return test_result();
+}
@@ -0,0 +1,119 @@
+#include "test.h"
+#include "channel_mix.h"
+#include <cmath>
+#include <stdexcept>
+
+using namespace std::experimental::audio;
+
+static bool Near(float a, float b)
+{
+	return std::abs(a - b) < 1.0e-6f;
+}
+
+// 5.1 folds down with the center and surrounds at -3dB and the LFE dropped, and mono averages that pair.
+static void TestSurroundDownmix()
+{
+	const float minus_3db = 0.70710678f;
+	std::vector<float> stereo = default_channel_matrix(6, 2);
+	const float expected_left[] = { 1.0f, 0.0f, minus_3db, 0.0f, minus_3db, 0.0f };
+	const float expected_right[] = { 0.0f, 1.0f, minus_3db, 0.0f, 0.0f, minus_3db };
+	CHECK(stereo.size() == 12);
+	for (size_t channel = 0; channel < 6; channel++)
+	{
+		CHECK(Near(stereo[channel], expected_left[channel]));
+		CHECK(Near(stereo[6 + channel], expected_right[channel]));
+	}
+
+	std::vector<float> mono = default_channel_matrix(6, 1);
+	for (size_t channel = 0; channel < 6; channel++)
+		CHECK(Near(mono[channel], 0.5f * (expected_left[channel] + expected_right[channel])));
+
+	// Quad has its surrounds straight after the front pair.
+	std::vector<float> quad = default_channel_matrix(4, 2);
+	CHECK(Near(quad[2], minus_3db) && quad[3] == 0.0f);
+	CHECK(quad[6] == 0.0f && Near(quad[7], minus_3db));
+}
+
+// Mono duplicates to stereo, stereo averages to mono, and other layouts wrap their extra channels onto the outputs.
+static void TestOtherLayouts()
+{
+	CHECK((default_channel_matrix(1, 2) == std::vector<float>{ 1.0f, 1.0f }));
+	CHECK((default_channel_matrix(2, 1) == std::vector<float>{ 0.5f, 0.5f }));
+	CHECK((default_channel_matrix(2, 2) == std::vector<float>{ 1.0f, 0.0f, 0.0f, 1.0f }));
+	CHECK((default_channel_matrix(3, 2) == std::vector<float>{ 1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f }));
+
+	bool threw = false;
+	try
+	{
+		default_channel_matrix(0, 2);
+	}
+	catch (const std::invalid_argument&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+}
+
+// mix_channels applies the matrix to every frame, including those past the last full vector.
+static void TestMatrix()
+{
+	const size_t num_frames = 11;
+	std::vector<float> input(num_frames * 3);
+	for (size_t i = 0; i < input.size(); i++)
+		input[i] = static_cast<float>(i % 3 + 1) * (1.0f + i / 3);
+
+	std::vector<float> matrix = { 1.0f, 0.0f, 0.5f, 0.0f, -1.0f, 0.25f };
+	std::vector<float> output = mix_channels(input.data(), num_frames, 3, 2, matrix);
+	CHECK(output.size() == num_frames * 2);
+	for (size_t frame = 0; frame < num_frames; frame++)
+	{
+		const float* in = input.data() + frame * 3;
+		CHECK(Near(output[frame * 2], in[0] + 0.5f * in[2]));
+		CHECK(Near(output[frame * 2 + 1], -in[1] + 0.25f * in[2]));
+	}
+
+	bool threw = false;
+	try
+	{
+		mix_channels(input.data(), num_frames, 3, 2, std::vector<float>(5, 1.0f));
+	}
+	catch (const std::invalid_argument&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+}
+
+// Loading with num_channels remaps the buffer with the default matrix.
+static void TestLoad()
+{
+	std::vector<float> samples;
+	for (int frame = 0; frame < 100; frame++)
+	{
+		samples.push_back(0.5f);
+		samples.push_back(0.25f);
+	}
+	memory_buffer_description description;
+	description.format = memory_buffer_format::pcmfloat;
+	description.num_channels = 2;
+	description.frequency = 48000;
+	load_settings settings;
+	settings.num_channels = 1;
+	auto b = load_from_memory(memory_buffer(reinterpret_cast<const std::byte*>(samples.data()), samples.size() * sizeof(float)), description, settings);
+
+	auto audio_data = b->get_audio_data();
+	CHECK(audio_data.description.num_channels == 1);
+	CHECK(audio_data.data.size == 100 * sizeof(float));
+	const float* mono = reinterpret_cast<const float*>(audio_data.data.data);
+	for (size_t i = 0; i < audio_data.data.size / sizeof(float); i++)
+		CHECK(mono[i] == 0.375f);
+}
+
+int main()
+{
+	TestSurroundDownmix();
+	TestOtherLayouts();
+	TestMatrix();
+	TestLoad();
+	return test_result();
+}
@@ -0,0 +1,118 @@
+#include "test.h"
+#include "convolution_reverb.h"
+#include <cmath>
+
+using namespace std::experimental::audio;
+
+// Deterministic noise in [-0.5, 0.5).
+static std::vector<float> Noise(size_t count, unsigned int seed)
+{
+	std::vector<float> samples(count);
+	for (auto& sample : samples)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		sample = static_cast<float>(seed >> 8) / static_cast<float>(1u << 24) - 0.5f;
+	}
+	return samples;
+}
+
+// Time-domain convolution of one channel, delayed by latency samples.
+static std::vector<float> DirectConvolution(const std::vector<float>& input, const std::vector<float>& ir, int num_channels, int input_channel, int ir_channel, int ir_channels, size_t latency)
+{
+	size_t num_frames = input.size() / num_channels;
+	size_t ir_length = ir.size() / ir_channels;
+	std::vector<float> output(num_frames, 0.0f);
+	for (size_t n = latency; n < num_frames; n++)
+	{
+		double sum = 0.0;
+		for (size_t k = 0; k < ir_length && k <= n - latency; k++)
+			sum += static_cast<double>(ir[k * ir_channels + ir_channel]) * input[(n - latency - k) * num_channels + input_channel];
+		output[n] = static_cast<float>(sum);
+	}
+	return output;
+}
+
+// Processes input in uneven blocks, so partitions straddle the calls.
+static std::vector<float> Process(convolution_reverb& reverb, const std::vector<float>& input, int num_channels)
+{
+	std::vector<float> output(input.size());
+	std::vector<float> block_in;
+	std::vector<float> block_out;
+	size_t num_frames = input.size() / num_channels;
+	size_t frame = 0;
+	for (size_t block = 0; frame < num_frames; block++)
+	{
+		size_t length = std::min<size_t>(block % 2 == 0 ? 37 : 300, num_frames - frame);
+		block_in.assign(input.begin() + frame * num_channels, input.begin() + (frame + length) * num_channels);
+		block_out.resize(block_in.size());
+		reverb.process(block_in.data(), block_out.data(), length, num_channels);
+		std::copy(block_out.begin(), block_out.end(), output.begin() + frame * num_channels);
+		frame += length;
+	}
+	return output;
+}
+
+// The output matches direct convolution with each channel's impulse response, one partition late.
+static void TestMatchesDirect()
+{
+	const size_t partition_size = 128;
+	std::vector<float> ir = Noise(2 * 700, 1);
+	std::vector<float> input = Noise(2 * 2000, 2);
+	convolution_reverb reverb(float_buffer(ir, 2), partition_size);
+	CHECK(reverb.tail_length_samples() == 6 * partition_size + partition_size);
+
+	std::vector<float> output = Process(reverb, input, 2);
+	for (int channel = 0; channel < 2; channel++)
+	{
+		std::vector<float> expected = DirectConvolution(input, ir, 2, channel, channel, 2, partition_size);
+		float worst = 0.0f;
+		for (size_t n = 0; n < expected.size(); n++)
+			worst = std::max(worst, std::abs(output[n * 2 + channel] - expected[n]));
+		CHECK(worst < 1e-4f);
+	}
+}
+
+// A mono impulse response convolves every channel, and the dry level mixes in the undelayed input.
+static void TestMonoImpulseAndDry()
+{
+	const size_t partition_size = 64;
+	std::vector<float> ir = Noise(150, 3);
+	std::vector<float> input = Noise(2 * 1000, 4);
+	convolution_reverb reverb(float_buffer(ir, 1), partition_size);
+	reverb.set_wet(0.5f);
+	reverb.set_dry(0.25f);
+
+	std::vector<float> output = Process(reverb, input, 2);
+	for (int channel = 0; channel < 2; channel++)
+	{
+		std::vector<float> expected = DirectConvolution(input, ir, 2, channel, 0, 1, partition_size);
+		float worst = 0.0f;
+		for (size_t n = 0; n < expected.size(); n++)
+			worst = std::max(worst, std::abs(output[n * 2 + channel] - (0.5f * expected[n] + 0.25f * input[n * 2 + channel])));
+		CHECK(worst < 1e-4f);
+	}
+}
+
+// Channels past max_channels pass through at the dry level.
+static void TestExtraChannelsPassDry()
+{
+	std::vector<float> ir = Noise(100, 5);
+	std::vector<float> input = Noise(4 * 500, 6);
+	convolution_reverb reverb(float_buffer(ir, 1), 64, 2);
+	reverb.set_dry(0.5f);
+
+	std::vector<float> output = Process(reverb, input, 4);
+	for (size_t n = 0; n < 500; n++)
+	{
+		CHECK(output[n * 4 + 2] == 0.5f * input[n * 4 + 2]);
+		CHECK(output[n * 4 + 3] == 0.5f * input[n * 4 + 3]);
+	}
+}
+
+int main()
+{
+	TestMatchesDirect();
+	TestMonoImpulseAndDry();
+	TestExtraChannelsPassDry();
+	return test_result();
+}
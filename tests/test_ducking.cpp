@@ -0,0 +1,84 @@
+#include "test.h"
+#include "ducking.h"
+#include <cmath>
+
+using namespace std::experimental::audio;
+
+static float DecibelsToGain(float db)
+{
+	return std::pow(10.0f, db / 20.0f);
+}
+
+// The ducked gain eases towards depth with the attack time constant and back with the release one.
+static void TestSmoothing()
+{
+	auto key = std::make_shared<sidechain_envelope>();
+	ducking_settings settings;
+	settings.depth_db = -12.0f;
+	settings.attack_seconds = 0.01f;
+	settings.release_seconds = 0.1f;
+	ducker duck(key, settings, 48000);
+	const float depth = DecibelsToGain(settings.depth_db);
+
+	std::vector<float> ones(480, 1.0f);
+	std::vector<float> output(480);
+	duck.process(ones.data(), output.data(), 480, 1);
+	CHECK(output.back() == 1.0f);
+
+	// Above the threshold, 10ms of attack covers 1 - 1/e of the way down.
+	std::vector<float> key_block(256, 0.5f);
+	key->process(key_block.data(), 128, 2);
+	CHECK(std::abs(key->get_level() - 0.5f) < 1.0e-6f);
+	duck.process(ones.data(), output.data(), 480, 1);
+	CHECK(std::abs(output.back() - (depth + (1.0f - depth) * std::exp(-1.0f))) < 1.0e-3f);
+	for (size_t i = 1; i < output.size(); i++)
+		CHECK(output[i] <= output[i - 1]);
+
+	// Long enough to settle at the depth, then back below the threshold and 100ms of release.
+	for (int i = 0; i < 10; i++)
+		duck.process(ones.data(), output.data(), 480, 1);
+	CHECK(std::abs(output.back() - depth) < 1.0e-3f);
+	key->set_level(0.0f);
+	std::vector<float> release(4800, 1.0f);
+	std::vector<float> released(4800);
+	duck.process(release.data(), released.data(), 4800, 1);
+	CHECK(std::abs(released.back() - (1.0f + (depth - 1.0f) * std::exp(-1.0f))) < 1.0e-3f);
+}
+
+// A submix keyed on another is pulled down while the key plays, and comes back once it stops.
+static void TestSubmix()
+{
+	device dev(loopback_settings(256));
+	auto music = dev.create_submix();
+	auto dialogue = dev.create_submix();
+	ducking_settings settings;
+	settings.depth_db = -12.0f;
+	settings.attack_seconds = 0.0f;
+	settings.release_seconds = 0.0f;
+	music->set_ducking(*dialogue, settings);
+
+	std::vector<float> music_samples(2 * 256 * 16, 0.5f);
+	auto music_voice = dev.play_sound(float_buffer(music_samples, 2));
+	music_voice->assign_to_submix(*music);
+	std::vector<float> output = mix(dev, 256 * 2);
+	CHECK(output.back() == 0.5f);
+
+	std::vector<float> dialogue_samples(2 * 256 * 4, 0.25f);
+	auto dialogue_voice = dev.play_sound(float_buffer(dialogue_samples, 2));
+	dialogue_voice->assign_to_submix(*dialogue);
+	output = mix(dev, 256 * 3);
+	CHECK(std::abs(output.back() - (0.5f * DecibelsToGain(settings.depth_db) + 0.25f)) < 1.0e-5f);
+
+	// Once the dialogue has finished the music returns to full level.
+	output = mix(dev, 256 * 4);
+	CHECK(output.back() == 0.5f);
+
+	music->clear_ducking();
+}
+
+int main()
+{
+	TestSmoothing();
+	TestSubmix();
+	return test_result();
+}
@@ -0,0 +1,82 @@
+#include "test.h"
+#include "granular_synth.h"
+#include <cmath>
+
+using namespace std::experimental::audio;
+
+static std::shared_ptr<buffer> ConstantSource(std::vector<float>& samples)
+{
+	samples.assign(48000, 0.5f);
+	return float_buffer(samples, 1);
+}
+
+// Density is held to one grain per frame, and a full bank caps the grains however dense the settings.
+static void TestDensityClamped()
+{
+	std::vector<float> samples;
+	granular_settings settings;
+	settings.density = 1.0e9f;
+	settings.grain_seconds = 0.05f;
+	granular_synth granular({ ConstantSource(samples) }, settings, 16);
+	CHECK(granular.get_settings().density == 48000.0f);
+
+	std::vector<float> output(2 * 512);
+	granular.render(output.data(), 512);
+	CHECK(granular.get_active_grains() == 16);
+	for (float sample : output)
+		CHECK(std::isfinite(sample) && std::abs(sample) <= 1.0f);
+
+	settings.density = -5.0f;
+	granular.set_settings(settings);
+	CHECK(granular.get_settings().density == 0.0f);
+}
+
+// Without new grains the texture dies away once the last grain ends.
+static void TestStopsWithoutDensity()
+{
+	std::vector<float> samples;
+	granular_settings settings;
+	settings.density = 200.0f;
+	settings.grain_seconds = 0.01f;
+	granular_synth granular({ ConstantSource(samples) }, settings);
+
+	std::vector<float> output(2 * 4800);
+	granular.render(output.data(), 4800);
+	bool sounded = false;
+	for (float sample : output)
+		sounded |= sample != 0.0f;
+	CHECK(sounded);
+	CHECK(granular.get_active_grains() > 0);
+
+	settings.density = 0.0f;
+	granular.set_settings(settings);
+	output.resize(2 * 480);
+	granular.render(output.data(), 480);
+	granular.render(output.data(), 480);
+	CHECK(granular.get_active_grains() == 0);
+	for (float sample : output)
+		CHECK(sample == 0.0f);
+}
+
+// Sources shorter than a grain give shorter grains that still fit inside them.
+static void TestShortSource()
+{
+	std::vector<float> samples(100, 0.5f);
+	granular_settings settings;
+	settings.density = 1000.0f;
+	settings.grain_seconds = 0.1f;
+	granular_synth granular({ float_buffer(samples, 1) }, settings);
+
+	std::vector<float> output(2 * 4800);
+	granular.render(output.data(), 4800);
+	for (float sample : output)
+		CHECK(std::isfinite(sample) && std::abs(sample) <= 1.0f);
+}
+
+int main()
+{
+	TestDensityClamped();
+	TestStopsWithoutDensity();
+	TestShortSource();
+	return test_result();
+}
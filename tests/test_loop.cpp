@@ -0,0 +1,125 @@
+#include "test.h"
+#include <stdexcept>
+
+using namespace std::experimental::audio;
+
+// Stereo frames counting up from 1, so the output shows which frame played where.
+static std::vector<float> Frames(size_t num_frames)
+{
+	std::vector<float> samples(num_frames * 2);
+	for (size_t i = 0; i < samples.size(); i++)
+		samples[i] = static_cast<float>(i / 2 + 1) / 1024.0f;
+	return samples;
+}
+
+// The frame index behind each output frame, or -1 for silence.
+static std::vector<int> FrameIndices(const std::vector<float>& output)
+{
+	std::vector<int> indices;
+	for (size_t i = 0; i < output.size(); i += 2)
+		indices.push_back(static_cast<int>(output[i] * 1024.0f + 0.5f) - 1);
+	return indices;
+}
+
+static std::vector<int> Range(int first, int last)
+{
+	std::vector<int> indices;
+	for (int i = first; i < last; i++)
+		indices.push_back(i);
+	return indices;
+}
+
+// A region plays count more times after the first pass and then runs on to the end, jumping on the exact frame even
+// where the region doesn't line up with the mixer's blocks.
+static void TestCount()
+{
+	std::vector<float> samples = Frames(30);
+	device dev(loopback_settings(16));
+	loop_settings loop;
+	loop.count = 2;
+	loop.region = loop_region{ 10, 21 };
+	auto voice = dev.play_sound(float_buffer(samples, 2), loop);
+
+	std::vector<int> expected = Range(0, 21);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		std::vector<int> region = Range(10, 21);
+		expected.insert(expected.end(), region.begin(), region.end());
+	}
+	std::vector<int> tail = Range(21, 30);
+	expected.insert(expected.end(), tail.begin(), tail.end());
+	expected.resize(16 * 5, -1);
+
+	CHECK(FrameIndices(mix(dev, 16 * 5)) == expected);
+	CHECK(!voice->is_playing());
+}
+
+// Without a region the whole sound loops.
+static void TestWholeSound()
+{
+	std::vector<float> samples = Frames(30);
+	device dev(loopback_settings(16));
+	loop_settings loop;
+	loop.count = 1;
+	auto voice = dev.play_sound(float_buffer(samples, 2), loop);
+
+	std::vector<int> expected = Range(0, 30);
+	expected.insert(expected.end(), expected.begin(), expected.end());
+	expected.resize(16 * 4, -1);
+	CHECK(FrameIndices(mix(dev, 16 * 4)) == expected);
+}
+
+// An endless loop carries on until its count is set to 0, and then plays out past the region to the end.
+static void TestRelease()
+{
+	std::vector<float> samples = Frames(40);
+	device dev(loopback_settings(16));
+	loop_settings loop;
+	loop.region = loop_region{ 5, 13 };
+	auto voice = dev.play_sound(float_buffer(samples, 2), loop);
+	CHECK(voice->get_loop_count() == -1);
+
+	std::vector<int> indices = FrameIndices(mix(dev, 16 * 20));
+	for (size_t i = 5; i < indices.size(); i++)
+		CHECK(indices[i] == static_cast<int>(5 + (i - 5) % 8));
+	CHECK(voice->is_playing());
+
+	voice->set_loop_count(0);
+	indices = FrameIndices(mix(dev, 16 * 4));
+	size_t end = 0;
+	while (end < indices.size() && indices[end] != 12)
+		end++;
+	CHECK(end < 8);
+	for (size_t i = end + 1; i < end + 1 + 27; i++)
+		CHECK(indices[i] == static_cast<int>(13 + i - end - 1));
+	for (size_t i = end + 1 + 27; i < indices.size(); i++)
+		CHECK(indices[i] == -1);
+}
+
+// Empty and inverted regions are rejected.
+static void TestEmptyRegion()
+{
+	std::vector<float> samples = Frames(30);
+	device dev(loopback_settings(16));
+	loop_settings loop;
+	loop.region = loop_region{ 10, 10 };
+	bool threw = false;
+	try
+	{
+		dev.play_sound(float_buffer(samples, 2), loop);
+	}
+	catch (const std::invalid_argument&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+}
+
+int main()
+{
+	TestCount();
+	TestWholeSound();
+	TestRelease();
+	TestEmptyRegion();
+	return test_result();
+}
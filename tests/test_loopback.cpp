@@ -0,0 +1,90 @@
+#include "test.h"
+#include "loopback.h"
+#include <chrono>
+#include <thread>
+
+using namespace std::experimental::audio;
+
+// Frames come back in order, across reads that split the ring's wrap point.
+static void TestRingOrder()
+{
+	loopback_buffer ring(100, 2, 48000);
+	std::vector<float> block(2 * 60);
+	std::vector<float> read(2 * 100);
+	float next_written = 0.0f;
+	float next_read = 0.0f;
+	for (int pass = 0; pass < 5; pass++)
+	{
+		for (float& sample : block)
+			sample = next_written++;
+		ring.write(block.data(), 60, std::chrono::nanoseconds(0));
+
+		size_t frames = ring.read(read.data(), 100);
+		CHECK(frames == 60);
+		for (size_t i = 0; i < frames * 2; i++)
+			CHECK(read[i] == next_read++);
+	}
+	CHECK(ring.get_stats().frames_mixed == 300);
+	CHECK(ring.get_stats().frames_dropped == 0);
+}
+
+// A reader that falls behind loses the newest frames, counted, and keeps the ones it had not read.
+static void TestOverflowDrops()
+{
+	loopback_buffer ring(100, 1, 48000);
+	std::vector<float> block(80);
+	for (size_t i = 0; i < block.size(); i++)
+		block[i] = static_cast<float>(i);
+	ring.write(block.data(), 80, std::chrono::nanoseconds(0));
+	ring.write(block.data(), 80, std::chrono::nanoseconds(0));
+
+	loopback_stats stats = ring.get_stats();
+	CHECK(stats.frames_mixed == 160);
+	CHECK(stats.frames_dropped == 60);
+	CHECK(stats.blocks_mixed == 2);
+
+	std::vector<float> read(200);
+	CHECK(ring.read(read.data(), 200) == 100);
+	for (size_t i = 0; i < 80; i++)
+		CHECK(read[i] == static_cast<float>(i));
+	for (size_t i = 80; i < 100; i++)
+		CHECK(read[i] == static_cast<float>(i - 80));
+}
+
+// loopback_manual mixes whole blocks on request and nothing in between.
+static void TestManualBlocks()
+{
+	device dev(loopback_settings(256));
+	CHECK(dev.get_output_stats().frames_mixed == 0);
+	dev.mix_output(300);
+	loopback_stats stats = dev.get_output_stats();
+	CHECK(stats.frames_mixed == 512);
+	CHECK(stats.blocks_mixed == 2);
+	CHECK(stats.num_channels == 2);
+	CHECK(stats.sample_rate == 48000);
+
+	std::vector<float> output(2 * 1024);
+	CHECK(dev.read_output(output.data(), 1024) == 512);
+	CHECK(dev.read_output(output.data(), 1024) == 0);
+}
+
+// Real-time loopback mixes on its own at about the pace of the sample rate.
+static void TestRealtimePace()
+{
+	device_settings settings = loopback_settings(480);
+	settings.output = device_output::loopback;
+	device dev(settings);
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	uint64_t frames = dev.get_output_stats().frames_mixed;
+	CHECK(frames > 0);
+	CHECK(frames <= 48000 / 2);
+}
+
+int main()
+{
+	TestRingOrder();
+	TestOverflowDrops();
+	TestManualBlocks();
+	TestRealtimePace();
+	return test_result();
+}
@@ -0,0 +1,68 @@
+#include "test.h"
+#include <cmath>
+
+using namespace std::experimental::audio;
+
+// Stereo 997Hz sine, the BS.1770 reference tone, with the same signal on both channels.
+static std::vector<float> sine(size_t num_frames, float amplitude, unsigned int frequency = 48000)
+{
+	const double pi = 3.14159265358979323846;
+	std::vector<float> samples(num_frames * 2);
+	for (size_t i = 0; i < num_frames; i++)
+	{
+		float sample = static_cast<float>(amplitude * std::sin(2.0 * pi * 997.0 * i / frequency));
+		samples[2 * i] = sample;
+		samples[2 * i + 1] = sample;
+	}
+	return samples;
+}
+
+static loudness_info analyze(const std::vector<float>& samples)
+{
+	memory_buffer_description description;
+	description.format = memory_buffer_format::pcmfloat;
+	description.num_channels = 2;
+	description.frequency = 48000;
+	load_settings settings;
+	settings.analyze_loudness = true;
+	auto b = load_from_memory(memory_buffer(reinterpret_cast<const std::byte*>(samples.data()), samples.size() * sizeof(float)), description, settings);
+	return *b->get_loudness();
+}
+
+// A full scale reference tone reads -3.01 LUFS per channel, so in stereo at half amplitude it reads -6.02.
+static void TestReferenceTone()
+{
+	loudness_info info = analyze(sine(48000 * 3, 0.5f));
+	CHECK(std::abs(info.integrated_loudness - -6.02f) < 0.05f);
+	CHECK(std::abs(info.peak - 0.5f) < 1.0e-3f);
+	CHECK(std::abs(info.rms - 0.5f / std::sqrt(2.0f)) < 1.0e-3f);
+}
+
+// Clips shorter than a gating block measure the same as long ones, whether or not they end on a step boundary.
+static void TestShortClips()
+{
+	for (size_t num_frames : { 2400, 4800, 9600, 12000, 14400, 16800 })
+	{
+		loudness_info info = analyze(sine(num_frames, 0.5f));
+		CHECK(std::abs(info.integrated_loudness - -6.02f) < 0.05f);
+	}
+}
+
+// Quiet passages more than 10 LU below the rest are gated out of the integrated loudness.  Of the 20 gating blocks
+// that pass, 17 are all tone and the 3 straddling the drop hold 3/4, 1/2 and 1/4 of its power.
+static void TestRelativeGate()
+{
+	std::vector<float> loud = sine(48000 * 2, 0.5f);
+	std::vector<float> quiet = sine(48000 * 2, 0.005f);
+	loud.insert(loud.end(), quiet.begin(), quiet.end());
+	loudness_info info = analyze(loud);
+	CHECK(std::abs(info.integrated_loudness - (-6.02f + 10.0f * std::log10(18.5f / 20.0f))) < 0.05f);
+}
+
+int main()
+{
+	TestReferenceTone();
+	TestShortClips();
+	TestRelativeGate();
+	return test_result();
+}
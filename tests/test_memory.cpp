@@ -0,0 +1,98 @@
+#include "test.h"
+
+using namespace std::experimental::audio;
+
+// Counts what reaches it, to check that the device routes each category to the resource it was given.
+class counting_resource : public std::pmr::memory_resource
+{
+public:
+	size_t allocations = 0;
+	size_t bytes_in_use = 0;
+
+private:
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		allocations++;
+		bytes_in_use += bytes;
+		return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override
+	{
+		bytes_in_use -= bytes;
+		std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+class gain_effect : public effect
+{
+public:
+	void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+	{
+		for (size_t i = 0; i < length_samples * num_channels; i++)
+			buffer_out[i] = buffer_in[i] * 0.5f;
+	}
+};
+
+// Voices and effects are counted in their categories and come from the caller's resources.
+static void TestCategories()
+{
+	counting_resource voices;
+	counting_resource effects;
+	device_settings settings = loopback_settings();
+	settings.memory.voices = &voices;
+	settings.memory.effects = &effects;
+	{
+		device dev(settings);
+		std::vector<float> samples(2 * 256, 0.25f);
+		auto sound = dev.play_sound(float_buffer(samples, 2));
+		auto bus = dev.create_submix();
+		bus->add_effect<gain_effect>();
+
+		memory_stats voice_stats = dev.get_memory_stats(memory_category::voices);
+		CHECK(voice_stats.allocations > 0);
+		CHECK(voice_stats.bytes_in_use > 0);
+		CHECK(voices.allocations == voice_stats.allocations);
+		CHECK(effects.allocations == dev.get_memory_stats(memory_category::effects).allocations);
+		CHECK(effects.allocations > 0);
+		CHECK(dev.get_memory_stats(memory_category::backend).allocations > 0);
+
+		sound.reset();
+		voice_stats = dev.get_memory_stats(memory_category::voices);
+		CHECK(voice_stats.bytes_in_use == 0);
+		CHECK(voice_stats.deallocations == voice_stats.allocations);
+		CHECK(voice_stats.peak_bytes > 0);
+	}
+	CHECK(voices.bytes_in_use == 0);
+	CHECK(effects.bytes_in_use == 0);
+}
+
+// A buffer loaded into the buffers resource is counted there until it is released.
+static void TestBuffers()
+{
+	device dev(loopback_settings());
+	std::vector<float> samples(2 * 1000, 0.25f);
+	memory_buffer_description description;
+	description.format = memory_buffer_format::pcmfloat;
+	description.num_channels = 2;
+	description.frequency = 48000;
+	auto sound = load_from_memory(
+		memory_buffer(reinterpret_cast<const std::byte*>(samples.data()), samples.size() * sizeof(float)),
+		description, true, dev.get_memory_resource(memory_category::buffers));
+	CHECK(dev.get_memory_stats(memory_category::buffers).bytes_in_use >= samples.size() * sizeof(float));
+
+	sound.reset();
+	CHECK(dev.get_memory_stats(memory_category::buffers).bytes_in_use == 0);
+}
+
+int main()
+{
+	TestCategories();
+	TestBuffers();
+	return test_result();
+}
@@ -0,0 +1,98 @@
+#include "test.h"
+#include "level_meter.h"
+#include <cmath>
+
+using namespace std::experimental::audio;
+
+// Stereo sine with the same signal on both channels.
+static std::vector<float> Sine(size_t num_frames, float amplitude, double frequency, double phase = 0.0)
+{
+	const double pi = 3.14159265358979323846;
+	std::vector<float> samples(num_frames * 2);
+	for (size_t i = 0; i < num_frames; i++)
+	{
+		float sample = static_cast<float>(amplitude * std::sin(2.0 * pi * frequency * i / 48000.0 + phase));
+		samples[2 * i] = sample;
+		samples[2 * i + 1] = sample;
+	}
+	return samples;
+}
+
+// Feeds the meter in mixer-sized blocks.
+static void Process(level_meter& meter, const std::vector<float>& samples)
+{
+	const size_t block_length = 256;
+	size_t num_frames = samples.size() / 2;
+	for (size_t frame = 0; frame < num_frames; frame += block_length)
+		meter.process(samples.data() + frame * 2, std::min(block_length, num_frames - frame), 2);
+}
+
+// Three seconds of the half amplitude reference tone read their known peak, RMS and -6.02 LUFS.
+static void TestReferenceTone()
+{
+	level_meter meter(48000);
+	CHECK(meter.get_levels().short_term_loudness == -std::numeric_limits<float>::infinity());
+	Process(meter, Sine(48000 * 3, 0.5f, 997.0));
+
+	meter_levels levels = meter.get_levels();
+	CHECK(std::abs(levels.peak - 0.5f) < 1.0e-3f);
+	CHECK(std::abs(levels.rms - 0.5f / std::sqrt(2.0f)) < 1.0e-3f);
+	CHECK(std::abs(levels.short_term_loudness - -6.02f) < 0.1f);
+	CHECK(levels.true_peak >= levels.peak);
+}
+
+// A quarter sample rate sine sampled 45 degrees off its crests peaks between the samples.
+static void TestTruePeak()
+{
+	const double pi = 3.14159265358979323846;
+	level_meter meter(48000);
+	Process(meter, Sine(48000, 1.0f, 12000.0, pi / 4.0));
+
+	meter_levels levels = meter.get_levels();
+	CHECK(std::abs(levels.peak - 1.0f / std::sqrt(2.0f)) < 1.0e-3f);
+	CHECK(levels.true_peak > 0.9f);
+	CHECK(levels.true_peak < 1.1f);
+}
+
+// Peak and RMS fall to zero once 300ms of silence has passed, while short-term loudness still holds the tone.
+static void TestSilence()
+{
+	level_meter meter(48000);
+	Process(meter, Sine(48000, 0.5f, 997.0));
+	meter.process_silence(48000 * 3 / 10, 2);
+
+	meter_levels levels = meter.get_levels();
+	CHECK(levels.peak == 0.0f);
+	CHECK(levels.rms == 0.0f);
+	CHECK(std::abs(levels.short_term_loudness - (-6.02f + 10.0f * std::log10(1.0f / 3.0f))) < 0.1f);
+}
+
+// A metered submix reports what passes through it, and nothing while metering is off.
+static void TestSubmix()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	std::vector<float> samples(2 * 48000, 0.25f);
+	auto voice = dev.play_sound(float_buffer(samples, 2));
+	voice->assign_to_submix(*bus);
+
+	CHECK(!bus->is_metering());
+	bus->set_metering(true);
+	CHECK(bus->is_metering());
+	mix(dev, 48000 / 2);
+	meter_levels levels = bus->get_levels();
+	CHECK(std::abs(levels.peak - 0.25f) < 1.0e-6f);
+	CHECK(std::abs(levels.rms - 0.25f) < 1.0e-4f);
+
+	bus->set_metering(false);
+	CHECK(bus->get_levels().peak == 0.0f);
+}
+
+int main()
+{
+	TestReferenceTone();
+	TestTruePeak();
+	TestSilence();
+	TestSubmix();
+	return test_result();
+}
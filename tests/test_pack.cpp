@@ -0,0 +1,98 @@
+#include "test.h"
+#include "pack.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+using namespace std::experimental::audio;
+
+static std::vector<char> ReadFile(const std::filesystem::path& filepath)
+{
+	std::ifstream file(filepath, std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Saved entries are found by name, and the table describes aligned samples identical to the buffers'.
+static void TestRoundTrip()
+{
+	std::filesystem::path filepath = std::filesystem::temp_directory_path() / "stdaudio_test.pak";
+	std::vector<float> stereo(2 * 101);
+	for (size_t i = 0; i < stereo.size(); i++)
+		stereo[i] = static_cast<float>(i) / stereo.size();
+	std::vector<float> mono(37, -0.25f);
+	std::vector<pack_source> entries = {
+		{ "rain", float_buffer(stereo, 2, 44100) },
+		{ "thunder", float_buffer(mono, 1) },
+	};
+	save_pack(filepath, entries);
+
+	CHECK(find_pack_entry(filepath, "rain") == 0);
+	CHECK(find_pack_entry(filepath, "thunder") == 1);
+	CHECK(find_pack_entry(filepath, "thunde") == -1);
+	CHECK(find_pack_entry(filepath, "wind") == -1);
+
+	std::vector<char> file = ReadFile(filepath);
+	pack_header header;
+	memcpy(&header, file.data(), sizeof(header));
+	CHECK(is_valid_pack_header(header));
+	CHECK(header.num_entries == 2);
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		pack_table_entry entry;
+		memcpy(&entry, file.data() + sizeof(header) + i * sizeof(entry), sizeof(entry));
+		memory_buffer_data data = entries[i].sound->get_audio_data();
+		CHECK(is_valid_pack_entry(entry));
+		CHECK(entries[i].name == entry.name);
+		CHECK(entry.format == static_cast<uint32_t>(memory_buffer_format::pcmfloat));
+		CHECK(entry.num_channels == data.description.num_channels);
+		CHECK(entry.frequency == data.description.frequency);
+		CHECK(entry.offset % pack_alignment == 0);
+		CHECK(entry.size == data.data.size);
+		CHECK(entry.offset + entry.size <= file.size());
+		if (entry.offset + entry.size <= file.size())
+			CHECK(memcmp(file.data() + entry.offset, data.data.data, entry.size) == 0);
+	}
+	std::filesystem::remove(filepath);
+}
+
+// Names that don't fit the table and files that aren't packs are refused.
+static void TestRejects()
+{
+	std::filesystem::path filepath = std::filesystem::temp_directory_path() / "stdaudio_test_bad.pak";
+	std::vector<float> mono(16, 0.0f);
+	bool threw = false;
+	try
+	{
+		save_pack(filepath, { { std::string(pack_name_length, 'x'), float_buffer(mono, 1) } });
+	}
+	catch (const std::invalid_argument&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+
+	{
+		std::ofstream file(filepath, std::ios::binary);
+		file << "RIFF plus enough bytes for a header";
+	}
+	threw = false;
+	try
+	{
+		find_pack_entry(filepath, "rain");
+	}
+	catch (const std::runtime_error&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+	std::filesystem::remove(filepath);
+}
+
+int main()
+{
+	TestRoundTrip();
+	TestRejects();
+	return test_result();
+}
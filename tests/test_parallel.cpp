@@ -0,0 +1,128 @@
+#include "test.h"
+#include <chrono>
+
+using namespace std::experimental::audio;
+
+class gain_effect : public effect
+{
+public:
+	explicit gain_effect(float gain) :
+		m_gain(gain)
+	{
+	}
+
+	void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+	{
+		for (size_t i = 0; i < length_samples * num_channels; i++)
+			buffer_out[i] = buffer_in[i] * m_gain;
+	}
+
+private:
+	float m_gain;
+};
+
+// Spins past the mixer's deadline on every block.
+class overrunning_effect : public effect
+{
+public:
+	explicit overrunning_effect(std::chrono::milliseconds duration) :
+		m_duration(duration)
+	{
+	}
+
+	void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+	{
+		auto end = std::chrono::steady_clock::now() + m_duration;
+		while (std::chrono::steady_clock::now() < end)
+		{
+		}
+		std::copy(buffer_in, buffer_in + length_samples * num_channels, buffer_out);
+	}
+
+private:
+	std::chrono::milliseconds m_duration;
+};
+
+static std::vector<float> Ramp(size_t num_frames)
+{
+	std::vector<float> samples(2 * num_frames);
+	for (size_t i = 0; i < samples.size(); i++)
+		samples[i] = static_cast<float>(i % 89) / 89.0f - 0.5f;
+	return samples;
+}
+
+// Parallel effects give the serial output, each a block later.
+static void TestMatchesSerial()
+{
+	std::vector<float> samples = Ramp(256 * 4);
+	std::vector<float> outputs[2];
+	for (int parallel = 0; parallel < 2; parallel++)
+	{
+		device dev(loopback_settings(256));
+		auto bus = dev.create_submix();
+		bus->set_parallel(parallel != 0);
+		bus->add_effect<gain_effect>(0.5f);
+		bus->add_effect<gain_effect>(0.25f);
+		auto voice = dev.play_sound(float_buffer(samples, 2));
+		voice->assign_to_submix(*bus);
+		outputs[parallel] = mix(dev, 256 * 6);
+	}
+
+	for (size_t i = 0; i < 2 * 256 * 4; i++)
+		CHECK(outputs[1][i + 2 * 256 * 2] == outputs[0][i]);
+	for (size_t i = 0; i < 2 * 256 * 2; i++)
+		CHECK(outputs[1][i] == 0.0f);
+}
+
+// A worker that overruns costs silent blocks and is counted, but doesn't hold up the mixer.
+static void TestMissedDeadline()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	bus->set_parallel(true);
+	auto slow = bus->add_effect<overrunning_effect>(std::chrono::milliseconds(30)).lock();
+	std::vector<float> samples(2 * 256 * 8, 0.25f);
+	auto voice = dev.play_sound(float_buffer(samples, 2));
+	voice->assign_to_submix(*bus);
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<float> output = mix(dev, 256 * 3);
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	CHECK(elapsed < std::chrono::milliseconds(30));
+
+	// The first block only queues the job, and the worker is still on it for the two after.
+	for (float sample : output)
+		CHECK(sample == 0.0f);
+	CHECK(slow->get_profile().missed_deadlines == 2);
+
+	bus.reset();
+}
+
+#ifdef STDAUDIO_REALTIME_CHECKS
+// Handing blocks to the workers and collecting them is free of locks and blocking calls.
+static void TestNoBlockingOnMixer()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	bus->set_parallel(true);
+	bus->add_effect<gain_effect>(0.5f);
+	std::vector<float> samples = Ramp(256 * 8);
+	auto voice = dev.play_sound(float_buffer(samples, 2));
+	voice->assign_to_submix(*bus);
+
+	dev.set_realtime_checks(true, 100.0f);
+	mix(dev, 256 * 8);
+	dev.set_realtime_checks(false);
+	CHECK(dev.take_realtime_violations().empty());
+}
+#endif
+
+int main()
+{
+	TestMatchesSerial();
+	TestMissedDeadline();
+#ifdef STDAUDIO_REALTIME_CHECKS
+	TestNoBlockingOnMixer();
+#endif
+	return test_result();
+}
@@ -0,0 +1,122 @@
+#include "test.h"
+#include <chrono>
+
+using namespace std::experimental::audio;
+
+class gain_effect : public effect
+{
+public:
+	void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+	{
+		for (size_t i = 0; i < length_samples * num_channels; i++)
+			buffer_out[i] = buffer_in[i] * 0.5f;
+	}
+};
+
+// Takes at least 2ms over its third block and next to nothing over the others.
+class spike_effect : public effect
+{
+public:
+	void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+	{
+		if (++m_calls == 3)
+		{
+			auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(2);
+			while (std::chrono::steady_clock::now() < end)
+			{
+			}
+		}
+		std::copy(buffer_in, buffer_in + length_samples * num_channels, buffer_out);
+	}
+
+private:
+	int m_calls = 0;
+};
+
+static const profile_node* FindNode(const std::vector<profile_node>& nodes, const submix* mix)
+{
+	for (auto& node : nodes)
+	{
+		if (auto* object = std::get_if<const submix*>(&node.object); object != nullptr && *object == mix)
+			return &node;
+		if (auto* found = FindNode(node.children, mix))
+			return found;
+	}
+	return nullptr;
+}
+
+// Effects count their blocks and worst block, and the submix sums them.
+static void TestCounters()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	auto spike = bus->add_effect<spike_effect>().lock();
+	auto gain = bus->add_effect<gain_effect>().lock();
+	std::vector<float> samples(2 * 256 * 8, 0.25f);
+	auto voice = dev.play_sound(float_buffer(samples, 2));
+	voice->assign_to_submix(*bus);
+	mix(dev, 256 * 4);
+
+	profile_counters spike_counters = spike->get_profile();
+	CHECK(spike_counters.call_count == 4);
+	CHECK(spike_counters.worst_block_time >= std::chrono::milliseconds(2));
+	CHECK(spike_counters.total_time >= spike_counters.worst_block_time);
+	CHECK(gain->get_profile().call_count == 4);
+	CHECK(gain->get_profile().worst_block_time < std::chrono::milliseconds(2));
+
+	device_profile profile = dev.get_profile();
+	CHECK(profile.block_length == 256);
+	CHECK(profile.sample_rate == 48000);
+	const profile_node* node = FindNode(profile.nodes, bus.get());
+	CHECK(node != nullptr);
+	if (node != nullptr)
+	{
+		CHECK(node->children.size() >= 2);
+		CHECK(node->counters.call_count >= 8);
+		CHECK(node->counters.worst_block_time == spike_counters.worst_block_time);
+		CHECK(node->counters.total_time >= spike_counters.total_time + gain->get_profile().total_time);
+		CHECK(node->latency_samples == 0);
+	}
+
+	// The reset lands with the next block, which is then the only one counted.
+	dev.reset_profile();
+	mix(dev, 256);
+	CHECK(spike->get_profile().call_count == 1);
+	CHECK(spike->get_profile().worst_block_time < std::chrono::milliseconds(2));
+}
+
+// Parallel effects each add a block of latency, and a submix adds the slowest path into it.
+static void TestLatency()
+{
+	device dev(loopback_settings(256));
+	auto outer = dev.create_submix();
+	outer->set_parallel(true);
+	outer->add_effect<gain_effect>();
+	auto inner = dev.create_submix();
+	inner->set_parallel(true);
+	inner->add_effect<gain_effect>();
+	inner->add_effect<gain_effect>();
+	inner->assign_to_submix(*outer);
+	auto serial = dev.create_submix();
+	serial->add_effect<gain_effect>();
+	serial->assign_to_submix(*outer);
+
+	device_profile profile = dev.get_profile();
+	const profile_node* outer_node = FindNode(profile.nodes, outer.get());
+	const profile_node* inner_node = FindNode(profile.nodes, inner.get());
+	const profile_node* serial_node = FindNode(profile.nodes, serial.get());
+	CHECK(outer_node != nullptr && inner_node != nullptr && serial_node != nullptr);
+	if (outer_node != nullptr && inner_node != nullptr && serial_node != nullptr)
+	{
+		CHECK(serial_node->latency_samples == 0);
+		CHECK(inner_node->latency_samples == 2 * 256);
+		CHECK(outer_node->latency_samples == 3 * 256);
+	}
+}
+
+int main()
+{
+	TestCounters();
+	TestLatency();
+	return test_result();
+}
@@ -0,0 +1,119 @@
+#include "test.h"
+#include <chrono>
+#include <mutex>
+
+using namespace std::experimental::audio;
+
+// Spins rather than sleeps, so the block overruns without making a blocking call.
+class slow_effect : public effect
+{
+public:
+	void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+	{
+		auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(2);
+		while (std::chrono::steady_clock::now() < end)
+		{
+		}
+		std::copy(buffer_in, buffer_in + length_samples * num_channels, buffer_out);
+	}
+};
+
+static bool HasViolation(const std::vector<realtime_violation>& violations, realtime_violation_type type)
+{
+	for (const realtime_violation& violation : violations)
+	{
+		if (violation.type == type && violation.effect != nullptr)
+			return true;
+	}
+	return false;
+}
+
+// A block that takes longer than its budget is reported against the effect, with how long it took.
+static void TestOverrun()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	bus->add_effect<slow_effect>();
+	dev.set_realtime_checks(true, 0.1f);
+	mix(dev, 256);
+	dev.set_realtime_checks(false);
+
+	std::vector<realtime_violation> violations = dev.take_realtime_violations();
+	CHECK(HasViolation(violations, realtime_violation_type::overrun));
+	for (const realtime_violation& violation : violations)
+	{
+		if (violation.type == realtime_violation_type::overrun)
+			CHECK(violation.duration > violation.budget);
+	}
+	CHECK(dev.take_realtime_violations().empty());
+
+	// Nothing is reported while the checks are off.
+	mix(dev, 256);
+	CHECK(dev.take_realtime_violations().empty());
+}
+
+#ifdef STDAUDIO_REALTIME_CHECKS
+class allocating_effect : public effect
+{
+public:
+	void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+	{
+		std::vector<float> scratch(buffer_in, buffer_in + length_samples * num_channels);
+		std::copy(scratch.begin(), scratch.end(), buffer_out);
+	}
+};
+
+class locking_effect : public effect
+{
+public:
+	void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::copy(buffer_in, buffer_in + length_samples * num_channels, buffer_out);
+	}
+
+private:
+	std::mutex m_mutex;
+};
+
+// Effects that allocate or lock on the mixer thread are reported.
+static void TestAllocationAndLock()
+{
+	device dev(loopback_settings());
+	auto bus = dev.create_submix();
+	bus->add_effect<allocating_effect>();
+	bus->add_effect<locking_effect>();
+	dev.set_realtime_checks(true, 100.0f);
+	mix(dev, 256);
+	dev.set_realtime_checks(false);
+
+	std::vector<realtime_violation> violations = dev.take_realtime_violations();
+	CHECK(HasViolation(violations, realtime_violation_type::allocation));
+	CHECK(HasViolation(violations, realtime_violation_type::deallocation));
+	CHECK(HasViolation(violations, realtime_violation_type::lock));
+}
+
+// The library's own mixing of a plain voice stays clean.
+static void TestCleanMix()
+{
+	device dev(loopback_settings());
+	std::vector<float> samples(2 * 1024, 0.25f);
+	auto sound = dev.play_sound(float_buffer(samples, 2));
+	auto bus = dev.create_submix();
+	sound->assign_to_submix(*bus);
+	dev.set_realtime_checks(true, 100.0f);
+	mix(dev, 1024);
+	dev.set_realtime_checks(false);
+	CHECK(dev.take_realtime_violations().empty());
+}
+#endif
+
+int main()
+{
+	TestOverrun();
+#ifdef STDAUDIO_REALTIME_CHECKS
+	TestAllocationAndLock();
+	TestCleanMix();
+#endif
+	return test_result();
+}
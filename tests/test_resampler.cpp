@@ -0,0 +1,99 @@
+#include "test.h"
+#include "resampler.h"
+#include <cmath>
+
+using namespace std::experimental::audio;
+
+static std::vector<float> tone(size_t num_frames, unsigned int num_channels, double frequency, unsigned int sample_rate)
+{
+	const double pi = 3.14159265358979323846;
+	std::vector<float> samples(num_frames * num_channels);
+	for (size_t i = 0; i < num_frames; i++)
+	{
+		for (unsigned int c = 0; c < num_channels; c++)
+			samples[i * num_channels + c] = static_cast<float>(0.5 * std::sin(2.0 * pi * frequency * (c + 1) * i / sample_rate));
+	}
+	return samples;
+}
+
+// Largest difference over [begin, end), skipping the filter's ramp in and out at the edges.
+static float max_error(const std::vector<float>& a, const std::vector<float>& b, size_t begin, size_t end)
+{
+	float error = 0.0f;
+	for (size_t i = begin; i < end; i++)
+		error = std::max(error, std::abs(a[i] - b[i]));
+	return error;
+}
+
+// A tone resampled down matches the same tone generated at the lower rate, and comes back from a round trip.
+static void TestRoundTrip()
+{
+	std::vector<float> original = tone(48000, 1, 1000.0, 48000);
+	resampler down(48000, 44100);
+	resampler up(44100, 48000);
+
+	std::vector<float> lowered(down.get_output_length(original.size()));
+	down.process(original.data(), original.size(), lowered.data(), 0, lowered.size());
+	CHECK(lowered.size() == 44100);
+	CHECK(max_error(lowered, tone(44100, 1, 1000.0, 44100), 1000, 43100) < 1.0e-4f);
+
+	std::vector<float> restored(up.get_output_length(lowered.size()));
+	up.process(lowered.data(), lowered.size(), restored.data(), 0, restored.size());
+	CHECK(restored.size() == original.size());
+	CHECK(max_error(restored, original, 1000, 47000) < 1.0e-4f);
+}
+
+// Interleaved buffers long enough to be split across threads come out the same as channels done one at a time.
+static void TestInterleavedMatchesPlanar()
+{
+	const size_t num_frames = 44100 * 4;
+	std::vector<float> interleaved = tone(num_frames, 2, 440.0, 44100);
+	resampler up(44100, 48000);
+	std::vector<float> output = up.process_interleaved(interleaved.data(), num_frames, 2);
+
+	const size_t output_frames = up.get_output_length(num_frames);
+	CHECK(output.size() == output_frames * 2);
+	for (unsigned int c = 0; c < 2; c++)
+	{
+		std::vector<float> planar(num_frames);
+		for (size_t i = 0; i < num_frames; i++)
+			planar[i] = interleaved[i * 2 + c];
+		std::vector<float> expected(output_frames);
+		up.process(planar.data(), num_frames, expected.data(), 0, output_frames);
+		for (size_t i = 0; i < output_frames; i++)
+			CHECK(output[i * 2 + c] == expected[i]);
+	}
+}
+
+// A buffer resampled at load plays at the device rate sample for sample.
+static void TestLoadedBufferPlays()
+{
+	const size_t num_frames = 4410;
+	std::vector<float> samples = tone(num_frames, 2, 440.0, 44100);
+	memory_buffer_description description;
+	description.format = memory_buffer_format::pcmfloat;
+	description.num_channels = 2;
+	description.frequency = 44100;
+	load_settings settings;
+	settings.frequency = 48000;
+	auto b = load_from_memory(memory_buffer(reinterpret_cast<const std::byte*>(samples.data()), samples.size() * sizeof(float)), description, settings);
+
+	std::vector<float> expected = resampler(44100, 48000).process_interleaved(samples.data(), num_frames, 2);
+	memory_buffer_data data = b->get_audio_data();
+	CHECK(data.description.frequency == 48000);
+	CHECK(data.data.size == expected.size() * sizeof(float));
+
+	device dev(loopback_settings(256));
+	auto voice = dev.play_sound(b);
+	std::vector<float> output = mix(dev, 256 * 20);
+	for (size_t i = 0; i < output.size(); i++)
+		CHECK(output[i] == (i < expected.size() ? expected[i] : 0.0f));
+}
+
+int main()
+{
+	TestRoundTrip();
+	TestInterleavedMatchesPlanar();
+	TestLoadedBufferPlays();
+	return test_result();
+}
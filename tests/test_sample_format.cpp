@@ -0,0 +1,126 @@
+#include "test.h"
+#include "sample_format.h"
+
+using namespace std::experimental::audio;
+
+static const memory_buffer_format formats[] =
+{
+	memory_buffer_format::pcm8,
+	memory_buffer_format::pcm16,
+	memory_buffer_format::pcm24,
+	memory_buffer_format::pcm32,
+	memory_buffer_format::pcmfloat,
+};
+
+static void WriteSample(std::byte* data, memory_buffer_format format, float value)
+{
+	switch (format)
+	{
+	case memory_buffer_format::pcm8:
+		write_sample<memory_buffer_format::pcm8>(data, value);
+		break;
+	case memory_buffer_format::pcm16:
+		write_sample<memory_buffer_format::pcm16>(data, value);
+		break;
+	case memory_buffer_format::pcm24:
+		write_sample<memory_buffer_format::pcm24>(data, value);
+		break;
+	case memory_buffer_format::pcm32:
+		write_sample<memory_buffer_format::pcm32>(data, value);
+		break;
+	case memory_buffer_format::pcmfloat:
+		write_sample<memory_buffer_format::pcmfloat>(data, value);
+		break;
+	default:
+		break;
+	}
+}
+
+// Input for a format: random bytes for the integer formats, and for float random values in [-1.5, 1.5) led by the
+// clipping and rounding edge cases.
+static std::vector<std::byte> Input(memory_buffer_format format, size_t num_samples)
+{
+	const size_t size = bytes_per_sample(format);
+	std::vector<std::byte> data(num_samples * size);
+	unsigned int seed = 12345;
+	if (format != memory_buffer_format::pcmfloat)
+	{
+		for (auto& b : data)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			b = static_cast<std::byte>(seed >> 24);
+		}
+		return data;
+	}
+
+	const float edges[] = { 0.0f, -1.0f, 1.0f, -2.0f, 2.0f, 0.5f / 128.0f, 1.5f / 128.0f, -0.5f / 32768.0f, 127.5f / 128.0f };
+	for (size_t i = 0; i < num_samples; i++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		float value = i < std::size(edges) ? edges[i] : static_cast<float>(seed >> 8) / static_cast<float>(1u << 24) * 3.0f - 1.5f;
+		memcpy(data.data() + i * size, &value, sizeof(value));
+	}
+	return data;
+}
+
+// Every conversion gives exactly what read_sample and write_sample do one sample at a time, at lengths and
+// offsets that leave the vector loops with a scalar tail.  Converting to the same format copies the samples.
+static void TestMatchesScalar()
+{
+	for (memory_buffer_format input_format : formats)
+	{
+		for (memory_buffer_format output_format : formats)
+		{
+			const size_t input_size = bytes_per_sample(input_format);
+			const size_t output_size = bytes_per_sample(output_format);
+			for (size_t num_samples : { 1, 7, 64, 301, 1000 })
+			{
+				std::vector<std::byte> input = Input(input_format, num_samples + 1);
+				std::vector<std::byte> output((num_samples + 1) * output_size);
+				std::vector<std::byte> expected(output.size());
+				convert_samples(input.data() + input_size, input_format, output.data() + output_size, output_format, num_samples);
+				if (input_format == output_format)
+				{
+					std::copy(input.begin() + input_size, input.end(), expected.begin() + output_size);
+				}
+				else
+				{
+					for (size_t i = 1; i <= num_samples; i++)
+						WriteSample(expected.data() + i * output_size, output_format, read_sample(input.data() + i * input_size, input_format));
+				}
+				CHECK(output == expected);
+			}
+		}
+	}
+}
+
+// Interleaving and deinterleaving are inverses and put each channel's samples in turn.
+static void TestInterleave()
+{
+	for (unsigned int num_channels : { 1u, 2u, 3u, 6u })
+	{
+		const size_t num_frames = 37;
+		std::vector<float> interleaved(num_frames * num_channels);
+		for (size_t i = 0; i < interleaved.size(); i++)
+			interleaved[i] = static_cast<float>(i);
+
+		std::vector<float> planar(interleaved.size());
+		deinterleave(interleaved.data(), planar.data(), num_frames, num_channels);
+		for (size_t frame = 0; frame < num_frames; frame++)
+		{
+			for (unsigned int channel = 0; channel < num_channels; channel++)
+				CHECK(planar[channel * num_frames + frame] == interleaved[frame * num_channels + channel]);
+		}
+
+		std::vector<float> round_trip(interleaved.size());
+		interleave(planar.data(), round_trip.data(), num_frames, num_channels);
+		CHECK(round_trip == interleaved);
+	}
+}
+
+int main()
+{
+	TestMatchesScalar();
+	TestInterleave();
+	return test_result();
+}
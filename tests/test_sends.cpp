@@ -0,0 +1,113 @@
+#include "test.h"
+#include <stdexcept>
+
+using namespace std::experimental::audio;
+
+// Scales its input by a fixed gain.
+class gain_effect : public effect
+{
+public:
+	explicit gain_effect(float gain) :
+		m_gain(gain)
+	{
+	}
+
+	void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+	{
+		for (size_t i = 0; i < length_samples * num_channels; i++)
+			buffer_out[i] = buffer_in[i] * m_gain;
+	}
+
+private:
+	float m_gain;
+};
+
+// A send mixes a scaled copy into the return, which plays it a block after the dry signal.
+static void TestSendLevel()
+{
+	device dev(loopback_settings(256));
+	auto reverb = dev.create_return_submix("reverb");
+
+	std::vector<float> burst(2 * 64, 0.5f);
+	auto voice = dev.play_sound(float_buffer(burst, 2));
+	voice->set_send("reverb", 0.5f);
+	CHECK(voice->get_send(*reverb) == 0.5f);
+
+	std::vector<float> output = mix(dev, 256 * 3);
+	for (size_t i = 0; i < output.size(); i++)
+		CHECK(output[i] == (i < 2 * 64 ? 0.5f : i >= 2 * 256 && i < 2 * 320 ? 0.25f : 0.0f));
+}
+
+// Effects added after the send still come before it, so the return hears them.
+static void TestSendFollowsEffects()
+{
+	device dev(loopback_settings(256));
+	auto reverb = dev.create_return_submix("reverb");
+
+	std::vector<float> burst(2 * 64, 0.5f);
+	auto voice = dev.play_sound(float_buffer(burst, 2), true);
+	voice->set_send(*reverb, 0.5f);
+	voice->add_effect<gain_effect>(2.0f);
+	voice->resume();
+
+	std::vector<float> output = mix(dev, 256 * 3);
+	for (size_t i = 0; i < output.size(); i++)
+		CHECK(output[i] == (i < 2 * 64 ? 1.0f : i >= 2 * 256 && i < 2 * 320 ? 0.5f : 0.0f));
+}
+
+// Returns are found by name, so a second one with the same name is refused.
+static void TestDuplicateReturnName()
+{
+	device dev(loopback_settings(256));
+	auto reverb = dev.create_return_submix("reverb");
+
+	bool threw = false;
+	try
+	{
+		dev.create_return_submix("reverb");
+	}
+	catch (const std::invalid_argument&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+	CHECK(dev.find_return("reverb") == reverb.get());
+}
+
+// Destroying a return takes down the sends to it, and the senders carry on dry.
+static void TestReturnOutlivedBySenders()
+{
+	device dev(loopback_settings(256));
+	auto reverb = dev.create_return_submix("reverb");
+	auto bus = dev.create_submix();
+	bus->set_send(*reverb, 1.0f);
+
+	std::vector<float> samples(2 * 256 * 4, 0.5f);
+	auto voice = dev.play_sound(float_buffer(samples, 2));
+	voice->assign_to_submix(*bus);
+	voice->set_send(*reverb, 0.5f);
+	mix(dev, 256);
+
+	reverb.reset();
+	CHECK(dev.find_return("reverb") == nullptr);
+
+	// A new return in its place, possibly at the same address, starts with no sends.
+	auto echo = dev.create_return_submix("echo");
+	CHECK(voice->get_send(*echo) == 0.0f);
+	CHECK(bus->get_send(*echo) == 0.0f);
+
+	std::vector<float> output = mix(dev, 256 * 2);
+	for (float sample : output)
+		CHECK(sample == 0.5f);
+	voice.reset();
+	bus.reset();
+}
+
+int main()
+{
+	TestSendLevel();
+	TestSendFollowsEffects();
+	TestDuplicateReturnName();
+	TestReturnOutlivedBySenders();
+	return test_result();
+}
@@ -0,0 +1,350 @@
+#include "test.h"
+#include "software_mixer.h"
+#include <cmath>
+#include <thread>
+#include <stdexcept>
+
+using namespace std::experimental::audio;
+
+// A stereo voice at unity gain and centre pan comes out of the software mixer sample for sample.
+static void TestUnityPassThrough()
+{
+	device dev(loopback_settings());
+	std::vector<float> samples(2 * 1000);
+	for (size_t i = 0; i < samples.size(); i++)
+		samples[i] = static_cast<float>(i % 97) / 97.0f - 0.5f;
+	auto voice = dev.play_sound(float_buffer(samples, 2));
+
+	std::vector<float> output = mix(dev, 1024);
+	CHECK(output.size() == 2 * 1024);
+	for (size_t i = 0; i < output.size(); i++)
+		CHECK(output[i] == (i < samples.size() ? samples[i] : 0.0f));
+	CHECK(!voice->is_playing());
+}
+
+// Voice and submix volumes multiply, and a paused voice holds its place.
+static void TestVolumeAndPause()
+{
+	device dev(loopback_settings());
+	std::vector<float> samples(2 * 2048, 0.5f);
+	auto bus = dev.create_submix();
+	bus->set_volume(0.5f);
+	auto voice = dev.play_sound(float_buffer(samples, 2));
+	voice->assign_to_submix(*bus);
+	voice->set_volume(0.5f);
+
+	std::vector<float> output = mix(dev, 256);
+	for (float sample : output)
+		CHECK(sample == 0.125f);
+
+	voice->pause();
+	output = mix(dev, 256);
+	for (float sample : output)
+		CHECK(sample == 0.0f);
+
+	voice->resume();
+	output = mix(dev, 2048);
+	for (size_t i = 0; i < output.size(); i++)
+		CHECK(output[i] == (i < 2 * (2048 - 256) ? 0.125f : 0.0f));
+}
+
+// Tail DSPs see a channel before its fader and head DSPs after it.
+static void TestFaderOrder()
+{
+	struct peak_probe
+	{
+		float peak = 0.0f;
+		static void read(void* userdata, float* in, float* out, size_t length, int num_channels)
+		{
+			auto probe = static_cast<peak_probe*>(userdata);
+			for (size_t i = 0; i < length * num_channels; i++)
+			{
+				probe->peak = std::max(probe->peak, std::abs(in[i]));
+				out[i] = in[i];
+			}
+		}
+	};
+
+	software_mixer mixer(48000, 2, 64);
+	std::vector<float> samples(2 * 64, 0.5f);
+	memory_buffer_data data{ memory_buffer(reinterpret_cast<const std::byte*>(samples.data()), samples.size() * sizeof(float)), { memory_buffer_format::pcmfloat, 2, 48000 } };
+	software_mixer::channel* c = mixer.play(data, nullptr, false);
+	c->set_volume(0.25f);
+
+	peak_probe tail;
+	peak_probe head;
+	software_mixer::dsp* tail_dsp = mixer.create_dsp({ &peak_probe::read, nullptr, &tail });
+	software_mixer::dsp* head_dsp = mixer.create_dsp({ &peak_probe::read, nullptr, &head });
+	c->add_dsp(tail_dsp, dsp_position::tail);
+	c->add_dsp(head_dsp, dsp_position::head);
+
+	std::vector<float> output(2 * 64);
+	mixer.render(output.data(), 64);
+	CHECK(tail.peak == 0.5f);
+	CHECK(head.peak == 0.125f);
+	CHECK(output[0] == 0.125f);
+
+	mixer.release(c);
+	mixer.release(tail_dsp);
+	mixer.release(head_dsp);
+}
+
+// Submixes nested deeper than the mixer's first scratch allocation still mix exactly.
+static void TestDeepNesting()
+{
+	device dev(loopback_settings());
+	std::vector<std::unique_ptr<submix>> buses;
+	buses.push_back(dev.create_submix());
+	for (int i = 0; i < 12; i++)
+	{
+		buses.push_back(dev.create_submix());
+		buses.back()->assign_to_submix(*buses[buses.size() - 2]);
+	}
+	std::vector<float> samples(2 * 256, 0.25f);
+	auto voice = dev.play_sound(float_buffer(samples, 2));
+	voice->assign_to_submix(*buses.back());
+
+	std::vector<float> output = mix(dev, 256);
+	for (float sample : output)
+		CHECK(sample == 0.25f);
+}
+
+// Voices, effects and submixes come and go on this thread while the mixer thread renders.
+static void TestChurnWhileMixing()
+{
+	class gain_effect : public effect
+	{
+	public:
+		void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+		{
+			for (size_t i = 0; i < length_samples * num_channels; i++)
+				buffer_out[i] = buffer_in[i] * 0.5f;
+		}
+	};
+
+	device_settings settings = loopback_settings(64);
+	settings.output = device_output::loopback;
+	device dev(settings);
+	std::vector<float> samples(2 * 4800, 0.1f);
+	auto sound = float_buffer(samples, 2);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+	while (std::chrono::steady_clock::now() < deadline)
+	{
+		auto bus = dev.create_submix();
+		bus->add_effect<gain_effect>();
+		std::vector<std::unique_ptr<voice>> voices;
+		for (int i = 0; i < 8; i++)
+		{
+			voices.push_back(dev.play_sound(sound));
+			voices.back()->add_effect<gain_effect>();
+			voices.back()->assign_to_submix(*bus);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		voices.clear();
+		bus.reset();
+	}
+	CHECK(dev.get_output_stats().blocks_mixed > 0);
+}
+
+// A synth plays on one voice at a time, and is free again once that voice is gone.
+static void TestSynthOneVoice()
+{
+	class ramp_synth : public synth
+	{
+	public:
+		ramp_synth() :
+			synth(2, 48000)
+		{
+		}
+
+		void render(float* output, size_t num_frames) override
+		{
+			for (size_t i = 0; i < num_frames; i++)
+			{
+				output[2 * i] = static_cast<float>(m_frame % 64) / 64.0f;
+				output[2 * i + 1] = -output[2 * i];
+				m_frame++;
+			}
+		}
+
+	private:
+		size_t m_frame = 0;
+	};
+
+	device dev(loopback_settings());
+	auto ramp = std::make_shared<ramp_synth>();
+	auto voice = dev.play_sound(ramp);
+
+	bool threw = false;
+	try
+	{
+		dev.play_sound(ramp);
+	}
+	catch (const std::runtime_error&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+
+	std::vector<float> output = mix(dev, 256);
+	for (size_t i = 0; i < 256; i++)
+	{
+		CHECK(output[2 * i] == static_cast<float>(i % 64) / 64.0f);
+		CHECK(output[2 * i + 1] == -output[2 * i]);
+	}
+
+	// Stopped isn't enough, the voice has to be gone.
+	voice->stop();
+	threw = false;
+	try
+	{
+		dev.play_sound(ramp);
+	}
+	catch (const std::runtime_error&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+
+	voice.reset();
+	voice = dev.play_sound(ramp);
+	CHECK(voice != nullptr);
+}
+
+// Fails the allocations it is told to, as an exhausted voice pool would.
+class failing_resource : public std::pmr::memory_resource
+{
+public:
+	bool fail = false;
+
+private:
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		if (fail)
+			throw std::bad_alloc();
+		return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override
+	{
+		std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+class constant_synth : public synth
+{
+public:
+	constant_synth() :
+		synth(2, 48000)
+	{
+	}
+
+	void render(float* output, size_t num_frames) override
+	{
+		std::fill(output, output + 2 * num_frames, 0.25f);
+	}
+};
+
+// A play that fails leaves the synth free and nothing playing, and of two devices racing for a synth only one wins.
+static void TestSynthClaim()
+{
+	failing_resource voices;
+	device_settings settings = loopback_settings();
+	settings.memory.voices = &voices;
+	device dev(settings);
+	auto constant = std::make_shared<constant_synth>();
+
+	voices.fail = true;
+	bool threw = false;
+	try
+	{
+		dev.play_sound(constant);
+	}
+	catch (const std::bad_alloc&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+	voices.fail = false;
+
+	auto voice = dev.play_sound(constant);
+	std::vector<float> output = mix(dev, 256);
+	for (float sample : output)
+		CHECK(sample == 0.25f);
+	voice.reset();
+
+	device other(loopback_settings());
+	for (int i = 0; i < 50; i++)
+	{
+		std::unique_ptr<std::experimental::audio::voice> voices_played[2];
+		auto race = [&constant](device& d, std::unique_ptr<std::experimental::audio::voice>& played)
+		{
+			try
+			{
+				played = d.play_sound(constant);
+			}
+			catch (const std::runtime_error&)
+			{
+			}
+		};
+		std::thread first(race, std::ref(dev), std::ref(voices_played[0]));
+		std::thread second(race, std::ref(other), std::ref(voices_played[1]));
+		first.join();
+		second.join();
+		CHECK((voices_played[0] != nullptr) != (voices_played[1] != nullptr));
+	}
+}
+
+// Off the mixer's rate, channels are resampled by linear interpolation.
+static void TestPitchInterpolates()
+{
+	device dev(loopback_settings());
+	std::vector<float> samples(2 * 1000);
+	for (size_t i = 0; i < samples.size(); i++)
+		samples[i] = static_cast<float>(i / 2) / 1000.0f;
+	auto voice = dev.play_sound(float_buffer(samples, 2));
+	voice->set_pitch(0.5f);
+
+	std::vector<float> output = mix(dev, 512);
+	for (size_t f = 0; f < 512; f++)
+	{
+		CHECK(std::abs(output[2 * f] - static_cast<float>(f) / 2000.0f) < 1.0e-6f);
+		CHECK(output[2 * f + 1] == output[2 * f]);
+	}
+}
+
+// The software backend has no speakers, which is its default output.
+static void TestNoSpeakers()
+{
+	device_settings settings;
+	settings.backend = device_backend::software;
+	bool threw = false;
+	try
+	{
+		device dev(settings);
+	}
+	catch (const std::runtime_error&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+}
+
+int main()
+{
+	TestUnityPassThrough();
+	TestVolumeAndPause();
+	TestFaderOrder();
+	TestDeepNesting();
+	TestChurnWhileMixing();
+	TestPitchInterpolates();
+	TestNoSpeakers();
+	TestSynthOneVoice();
+	TestSynthClaim();
+	return test_result();
+}
@@ -0,0 +1,125 @@
+#include "test.h"
+
+using namespace std::experimental::audio;
+
+// Delays its input by delay_samples frames, which is also its tail, and counts how often it runs.
+class delay_effect : public effect
+{
+public:
+	explicit delay_effect(size_t delay_samples) :
+		m_delay(delay_samples),
+		m_history(2 * delay_samples)
+	{
+	}
+
+	void process(float* buffer_in, float* buffer_out, size_t length_samples, int num_channels) override
+	{
+		m_calls++;
+		for (size_t f = 0; f < length_samples; f++)
+		{
+			for (int c = 0; c < 2; c++)
+			{
+				float& slot = m_history[m_position * 2 + c];
+				buffer_out[f * num_channels + c] = slot;
+				slot = buffer_in[f * num_channels + c];
+			}
+			m_position = (m_position + 1) % m_delay;
+		}
+	}
+
+	size_t tail_length_samples() const override
+	{
+		return m_delay;
+	}
+
+	int m_calls = 0;
+
+private:
+	size_t m_delay;
+	size_t m_position = 0;
+	std::vector<float> m_history;
+};
+
+// A burst rings out through the delay's tail, after which the effect stops running and its output is silent.
+static void TestTailRunsOut()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	auto delay = bus->add_effect<delay_effect>(300).lock();
+
+	std::vector<float> burst(2 * 64, 0.5f);
+	auto voice = dev.play_sound(float_buffer(burst, 2));
+	voice->assign_to_submix(*bus);
+
+	std::vector<float> output = mix(dev, 256 * 8);
+	for (size_t i = 0; i < output.size(); i++)
+		CHECK(output[i] == (i >= 2 * 300 && i < 2 * 364 ? 0.5f : 0.0f));
+
+	// The burst's block, then 300 samples of tail spread over the next two.
+	CHECK(delay->get_effect<delay_effect>()->m_calls == 3);
+}
+
+// Input below the silence threshold counts as silence even though the voice feeding it is active.
+static void TestQuietInputBypasses()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	auto delay = bus->add_effect<delay_effect>(300).lock();
+
+	std::vector<float> hum(2 * 256 * 8, 1.0e-7f);
+	auto voice = dev.play_sound(float_buffer(hum, 2));
+	voice->assign_to_submix(*bus);
+
+	std::vector<float> output = mix(dev, 256 * 4);
+	for (float sample : output)
+		CHECK(sample == 0.0f);
+	CHECK(delay->get_effect<delay_effect>()->m_calls == 0);
+}
+
+// Sound arriving after the effect went idle wakes it again.
+static void TestWakesAfterBypass()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	auto delay = bus->add_effect<delay_effect>(100).lock();
+
+	mix(dev, 256 * 2);
+	CHECK(delay->get_effect<delay_effect>()->m_calls == 0);
+
+	std::vector<float> burst(2 * 16, 0.25f);
+	auto voice = dev.play_sound(float_buffer(burst, 2));
+	voice->assign_to_submix(*bus);
+	std::vector<float> output = mix(dev, 256 * 2);
+	for (size_t i = 0; i < output.size(); i++)
+		CHECK(output[i] == (i >= 2 * 100 && i < 2 * 116 ? 0.25f : 0.0f));
+
+	// The tail counts from the end of the last block with sound in it.
+	CHECK(delay->get_effect<delay_effect>()->m_calls == 2);
+}
+
+// Parallel effects run a block behind on the worker pool, and the block where the tail ends is still played out.
+static void TestParallelTailFlushes()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	bus->set_parallel(true);
+	auto delay = bus->add_effect<delay_effect>(200).lock();
+
+	std::vector<float> burst(2 * 64, 0.5f);
+	auto voice = dev.play_sound(float_buffer(burst, 2));
+	voice->assign_to_submix(*bus);
+
+	std::vector<float> output = mix(dev, 256 * 6);
+	for (size_t i = 0; i < output.size(); i++)
+		CHECK(output[i] == (i >= 2 * 456 && i < 2 * 520 ? 0.5f : 0.0f));
+	CHECK(delay->get_effect<delay_effect>()->m_calls == 2);
+}
+
+int main()
+{
+	TestTailRunsOut();
+	TestQuietInputBypasses();
+	TestWakesAfterBypass();
+	TestParallelTailFlushes();
+	return test_result();
+}
@@ -0,0 +1,117 @@
+#include "test.h"
+
+using namespace std::experimental::audio;
+
+// Over the limit the oldest voice is muted, and it comes back at the next update after another finishes.
+static void TestStolenVoiceReturns()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	bus->set_voice_limit(2);
+
+	std::vector<float> held(2 * 256 * 8, 0.25f);
+	std::vector<float> short_burst(2 * 256, 0.25f);
+	auto first = dev.play_sound(float_buffer(held, 2), true);
+	first->assign_to_submix(*bus);
+	auto second = dev.play_sound(float_buffer(short_burst, 2), true);
+	second->assign_to_submix(*bus);
+	auto third = dev.play_sound(float_buffer(held, 2), true);
+	third->assign_to_submix(*bus);
+	CHECK(first->is_virtual());
+	CHECK(!second->is_virtual());
+	CHECK(!third->is_virtual());
+	first->resume();
+	second->resume();
+	third->resume();
+
+	std::vector<float> output = mix(dev, 256);
+	for (float sample : output)
+		CHECK(sample == 0.5f);
+
+	// The short voice has finished, but nothing notices until the next update.
+	output = mix(dev, 256);
+	for (float sample : output)
+		CHECK(sample == 0.25f);
+	CHECK(!second->is_playing());
+	CHECK(first->is_virtual());
+
+	dev.update();
+	CHECK(!first->is_virtual());
+	output = mix(dev, 256);
+	for (float sample : output)
+		CHECK(sample == 0.5f);
+}
+
+// In stop mode the voice over the limit is stopped for good.
+static void TestStopMode()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	bus->set_voice_limit(1, voice_steal_policy::oldest, voice_steal_mode::stop);
+
+	std::vector<float> held(2 * 256 * 4, 0.25f);
+	auto first = dev.play_sound(float_buffer(held, 2), true);
+	first->assign_to_submix(*bus);
+	auto second = dev.play_sound(float_buffer(held, 2), true);
+	second->assign_to_submix(*bus);
+	second->resume();
+	CHECK(!first->is_playing());
+
+	std::vector<float> output = mix(dev, 256);
+	for (float sample : output)
+		CHECK(sample == 0.25f);
+}
+
+// A voice stolen by a submix that goes away is heard again.
+static void TestDestroyedSubmixUnmutes()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	bus->set_voice_limit(1);
+
+	std::vector<float> held(2 * 256 * 4, 0.25f);
+	auto first = dev.play_sound(float_buffer(held, 2), true);
+	first->assign_to_submix(*bus);
+	auto second = dev.play_sound(float_buffer(held, 2), true);
+	second->assign_to_submix(*bus);
+	CHECK(first->is_virtual());
+
+	bus.reset();
+	CHECK(!first->is_virtual());
+	first->resume();
+	second->resume();
+	dev.update();
+
+	std::vector<float> output = mix(dev, 256);
+	for (float sample : output)
+		CHECK(sample == 0.5f);
+}
+
+// Only the voice limit virtualizes: a voice faded to silence is still a real voice that counts against it.
+static void TestSilentVoiceStaysReal()
+{
+	device dev(loopback_settings(256));
+	auto bus = dev.create_submix();
+	bus->set_voice_limit(1);
+
+	std::vector<float> held(2 * 256 * 4, 0.25f);
+	auto first = dev.play_sound(float_buffer(held, 2));
+	first->assign_to_submix(*bus);
+	first->set_volume(0.0f);
+	mix(dev, 256);
+	CHECK(!first->is_virtual());
+
+	auto second = dev.play_sound(float_buffer(held, 2));
+	second->assign_to_submix(*bus);
+	CHECK(first->is_virtual());
+	CHECK(!second->is_virtual());
+}
+
+int main()
+{
+	TestStolenVoiceReturns();
+	TestStopMode();
+	TestDestroyedSubmixUnmutes();
+	TestSilentVoiceStaysReal();
+	return test_result();
+}
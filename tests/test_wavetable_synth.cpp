@@ -0,0 +1,172 @@
+#include "test.h"
+#include "wavetable_synth.h"
+#include <cmath>
+#include <stdexcept>
+
+using namespace std::experimental::audio;
+
+static float Peak(const std::vector<float>& samples, size_t begin, size_t end)
+{
+	float peak = 0.0f;
+	for (size_t i = begin; i < end; i++)
+		peak = std::max(peak, std::abs(samples[i]));
+	return peak;
+}
+
+// Magnitude of one frequency in samples, by Goertzel's algorithm, scaled so a full scale sine reads 1.
+static double Magnitude(const std::vector<float>& samples, double frequency)
+{
+	const double pi = 3.14159265358979323846;
+	const double coefficient = 2.0 * std::cos(2.0 * pi * frequency / 48000.0);
+	double s1 = 0.0;
+	double s2 = 0.0;
+	for (float sample : samples)
+	{
+		double s0 = sample + coefficient * s1 - s2;
+		s2 = s1;
+		s1 = s0;
+	}
+	return std::sqrt(s1 * s1 + s2 * s2 - coefficient * s1 * s2) * 2.0 / samples.size();
+}
+
+// A note rises through attack and decay to the sustain level at its pitch, and dies away after note_off.
+static void TestEnvelope()
+{
+	envelope_settings envelope;
+	envelope.attack_seconds = 0.01f;
+	envelope.decay_seconds = 0.01f;
+	envelope.sustain_level = 0.5f;
+	envelope.release_seconds = 0.01f;
+	wavetable_synth synth(wavetable_shape::sine, envelope);
+	CHECK(synth.get_num_channels() == 1);
+
+	CHECK(synth.note_on(69));
+	std::vector<float> output(4800);
+	synth.render(output.data(), output.size());
+	CHECK(synth.get_active_notes() == 1);
+	CHECK(Peak(output, 0, 100) < 0.25f);
+	CHECK(Peak(output, 400, 560) > 0.95f);
+	CHECK(std::abs(Peak(output, 1000, 4800) - 0.5f) < 0.01f);
+
+	// 440Hz over the sustained stretch.
+	int crossings = 0;
+	for (size_t i = 1000; i < 4800; i++)
+		crossings += output[i - 1] < 0.0f && output[i] >= 0.0f;
+	CHECK(std::abs(crossings - 440.0 * 3800 / 48000) <= 1.0);
+
+	// The release takes the 0.5 sustain level to silence in half the release time.
+	CHECK(synth.note_off(69));
+	synth.render(output.data(), 480);
+	CHECK(Peak(output, 0, 100) > 0.3f);
+	CHECK(Peak(output, 240, 480) == 0.0f);
+	CHECK(synth.get_active_notes() == 0);
+}
+
+// Velocity scales the level, holding a note again retriggers it, and past max_notes the quietest note is taken over.
+static void TestNotes()
+{
+	envelope_settings envelope;
+	envelope.sustain_level = 1.0f;
+	wavetable_synth synth(wavetable_shape::sine, envelope, 2);
+	std::vector<float> output(4800);
+
+	synth.note_on(60, 0.25f);
+	synth.note_on(60, 0.25f);
+	synth.render(output.data(), output.size());
+	CHECK(synth.get_active_notes() == 1);
+	CHECK(std::abs(Peak(output, 2400, 4800) - 0.25f) < 0.01f);
+
+	synth.note_on(64, 0.5f);
+	synth.note_on(67, 0.5f);
+	synth.render(output.data(), output.size());
+	CHECK(synth.get_active_notes() == 2);
+
+	// The default 0.2s release takes two renders, and then the synth is silent.
+	synth.all_notes_off();
+	synth.render(output.data(), output.size());
+	synth.render(output.data(), output.size());
+	CHECK(synth.get_active_notes() == 0);
+	synth.render(output.data(), output.size());
+	CHECK(Peak(output, 0, output.size()) == 0.0f);
+}
+
+// Near Nyquist a saw keeps only the harmonics that fit, so nothing folds back below it.
+static void TestNoAliasing()
+{
+	envelope_settings envelope;
+	envelope.sustain_level = 1.0f;
+	wavetable_synth synth(wavetable_shape::saw, envelope);
+	synth.note_on(127);
+	std::vector<float> output(48000);
+	synth.render(output.data(), 2400);
+	synth.render(output.data(), output.size());
+
+	const double fundamental = 440.0 * std::pow(2.0, (127 - 69) / 12.0);
+	CHECK(Magnitude(output, fundamental) > 0.5);
+	CHECK(Magnitude(output, 48000.0 - 2.0 * fundamental) < 1.0e-3);
+	CHECK(Magnitude(output, 3.0 * fundamental - 48000.0) < 1.0e-3);
+}
+
+// The event queue refuses events once full, until a render drains it.
+static void TestEventQueue()
+{
+	wavetable_synth synth(wavetable_shape::square);
+	size_t accepted = 0;
+	while (synth.note_on(60) && accepted < 1000)
+		accepted++;
+	CHECK(accepted == 256);
+
+	std::vector<float> output(64);
+	synth.render(output.data(), output.size());
+	CHECK(synth.note_off(60));
+}
+
+static void TestInvalidSettings()
+{
+	envelope_settings envelope;
+	envelope.sustain_level = 1.5f;
+	bool threw = false;
+	try
+	{
+		wavetable_synth synth(wavetable_shape::sine, envelope);
+	}
+	catch (const std::invalid_argument&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+
+	threw = false;
+	try
+	{
+		wavetable_synth synth(std::vector<float>{ 0.0f, 0.0f });
+	}
+	catch (const std::invalid_argument&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+}
+
+// The synth plays through a voice like any other source.
+static void TestVoice()
+{
+	device dev(loopback_settings(256));
+	auto synth = std::make_shared<wavetable_synth>(wavetable_shape::sine);
+	synth->note_on(69);
+	auto voice = dev.play_sound(synth);
+	std::vector<float> output = mix(dev, 256 * 8);
+	CHECK(output.size() == 2 * 256 * 8);
+	CHECK(Peak(output, 2 * 256 * 4, output.size()) > 0.3f);
+}
+
+int main()
+{
+	TestEnvelope();
+	TestNotes();
+	TestNoAliasing();
+	TestEventQueue();
+	TestInvalidSettings();
+	TestVoice();
+	return test_result();
+}